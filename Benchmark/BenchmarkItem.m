@@ -100,4 +100,73 @@ static id values[ATTRIBUTES];
           1000.0 * [[NSDate date] timeIntervalSinceDate: startDate]);
 }
 
+- (COMutableItem *)makeItem
+{
+    COMutableItem *item = [[COMutableItem alloc] init];
+
+    for (NSUInteger i = 0; i < ATTRIBUTES; i++)
+    {
+        [item setValue: values[i]
+          forAttribute: attributes[i]
+                  type: types[i]];
+    }
+    return item;
+}
+
+- (void)testCopy
+{
+    NSDate *startDate = [NSDate date];
+    COMutableItem *item = [self makeItem];
+    NSMutableArray *copies = [NSMutableArray arrayWithCapacity: ITERATIONS / 10];
+
+    // The copies share the item shape, so only the values are allocated
+    for (NSUInteger i = 0; i < ITERATIONS / 10; i++)
+    {
+        [copies addObject: [item copy]];
+    }
+    UKIntsEqual(ITERATIONS / 10, copies.count);
+
+    NSLog(@"copying %d COMutableItem with %d attributes took %lf ms",
+          ITERATIONS / 10,
+          ATTRIBUTES,
+          1000.0 * [[NSDate date] timeIntervalSinceDate: startDate]);
+}
+
+- (void)testEquality
+{
+    COItem *item = [self makeItem];
+    COItem *otherItem = [item mutableCopy];
+    NSDate *startDate = [NSDate date];
+
+    BOOL ok = YES;
+    for (NSUInteger i = 0; i < ITERATIONS; i++)
+    {
+        ok = ok && [item isEqual: otherItem];
+    }
+    UKTrue(ok);
+
+    NSLog(@"comparing %d COItem with %d attributes took %lf ms",
+          ITERATIONS,
+          ATTRIBUTES,
+          1000.0 * [[NSDate date] timeIntervalSinceDate: startDate]);
+}
+
+- (void)testDataValue
+{
+    COItem *item = [[self makeItem] copy];
+    NSDate *startDate = [NSDate date];
+
+    NSUInteger length = 0;
+    for (NSUInteger i = 0; i < ITERATIONS / 10; i++)
+    {
+        length += item.dataValue.length;
+    }
+    UKTrue(length > 0);
+
+    NSLog(@"serializing %d COItem with %d attributes took %lf ms",
+          ITERATIONS / 10,
+          ATTRIBUTES,
+          1000.0 * [[NSDate date] timeIntervalSinceDate: startDate]);
+}
+
 @end
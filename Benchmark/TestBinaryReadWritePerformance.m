@@ -216,4 +216,99 @@ static volatile char dest[2048];
           1000.0 * [[NSDate date] timeIntervalSinceDate: startDate]);
 }
 
+/** 
+ * Integers with the usual magnitudes, from COType values to Java timestamps 
+ * (milliseconds).
+ */
+static const int64_t roundTripIntegers[] = {
+    0, 1, -1, 5, 16, 127, -128, 200, -200, 1000, -1000, 40000, -40000,
+    65536, -65536, 2000000, -2000000, INT32_MAX, INT32_MIN,
+    1476576000000LL, -1476576000000LL, INT64_MAX, INT64_MIN
+};
+
+#define ROUND_TRIP_INTEGER_COUNT (sizeof(roundTripIntegers) / sizeof(int64_t))
+
+typedef void (*store_integer_t)(co_buffer_t *, int64_t);
+
+- (void)checkIntegerRoundTripWithFormatVersion: (uint8_t)aVersion
+                                  storeInteger: (store_integer_t)storeInteger
+                                   description: (NSString *)aDescription
+{
+    NSMutableArray *expected = [NSMutableArray arrayWithObject: beginArray];
+
+    for (size_t i = 0; i < ROUND_TRIP_INTEGER_COUNT; i++)
+    {
+        [expected addObject: @(roundTripIntegers[i])];
+    }
+    [expected addObject: endArray];
+
+    NSDate *startDate = [NSDate date];
+    size_t length = 0;
+
+    for (int64_t i = 0; i < WRITE_ITERATIONS; i++)
+    {
+        co_buffer_t buf;
+        co_buffer_init_with_format_version(&buf, aVersion);
+        co_buffer_begin_array(&buf);
+        for (size_t j = 0; j < ROUND_TRIP_INTEGER_COUNT; j++)
+        {
+            storeInteger(&buf, roundTripIntegers[j]);
+        }
+        co_buffer_end_array(&buf);
+
+        length = co_buffer_get_length(&buf);
+        memcpy((void *)dest, co_buffer_get_data(&buf), length);
+
+        co_buffer_free(&buf);
+    }
+
+    const NSTimeInterval writeTime = [[NSDate date] timeIntervalSinceDate: startDate];
+
+    co_reader_callback_t cb = {
+        test_read_int64,
+        test_read_double,
+        test_read_string,
+        test_read_uuid,
+        test_read_bytes,
+        test_read_begin_object,
+        test_read_end_object,
+        test_read_begin_array,
+        test_read_end_array,
+        test_read_null
+    };
+
+    startDate = [NSDate date];
+
+    for (int64_t i = 0; i < READ_ITERATIONS; i++)
+    {
+        [readObjects removeAllObjects];
+        co_reader_read((const unsigned char *)dest, length, (__bridge void *)(self), cb);
+
+        if (i == 0)
+        {
+            UKObjectsEqual(expected, readObjects);
+        }
+    }
+
+    const NSTimeInterval readTime = [[NSDate date] timeIntervalSinceDate: startDate];
+
+    NSLog(@"%@ integers: %zu bytes, writing %lld iterations took %lf ms, "
+          "reading %lld iterations took %lf ms",
+          aDescription, length, WRITE_ITERATIONS, 1000.0 * writeTime,
+          READ_ITERATIONS, 1000.0 * readTime);
+}
+
+- (void)testIntegerRoundTripPerf
+{
+    [self checkIntegerRoundTripWithFormatVersion: CO_BUFFER_FORMAT_VERSION_FIXED_INTEGERS
+                                    storeInteger: co_buffer_store_integer
+                                     description: @"fixed-width"];
+    [self checkIntegerRoundTripWithFormatVersion: CO_BUFFER_FORMAT_VERSION_VARINT_INTEGERS
+                                    storeInteger: co_buffer_store_varint_integer
+                                     description: @"varint and zigzag"];
+    [self checkIntegerRoundTripWithFormatVersion: CO_BUFFER_FORMAT_VERSION_VARINT_INTEGERS
+                                    storeInteger: co_buffer_store_integer
+                                     description: @"shortest (fixed-width or varint)"];
+}
+
 @end
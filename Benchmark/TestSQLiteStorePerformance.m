@@ -6,6 +6,8 @@
  */
 
 #import "TestCommon.h"
+#import "COSQLiteStorePersistentRootBackingStore.h"
+#import "COSQLiteStorePersistentRootBackingStoreBinaryFormats.h"
 
 @interface TestSQLiteStorePerformance : SQLiteStoreTestCase <UKTest>
 {
@@ -30,6 +32,14 @@ static const int NUM_PERSISTENT_ROOT_COPIES = 200;
 
 static const int LOTS_OF_EMBEDDED_ITEMS = 10000;
 
+static const int COMPRESSION_ITERATIONS = 20;
+
+static const int NUM_LOADS_PER_READER_THREAD = 200;
+static const int MAX_READER_THREADS = 8;
+
+static const int NUM_SMALL_COMMITS = 400;
+static const int MAX_COMMITTING_THREADS = 8;
+
 static ETUUID *rootUUID;
 static ETUUID *childUUIDs[NUM_CHILDREN];
 
@@ -287,6 +297,72 @@ static int itemChangedAtCommit(int i)
 
 }
 
+- (void)testReloadFullStatesWithCompression
+{
+    store.commitCompression = COSQLiteStoreCompressionZlib;
+    [self testReloadFullStates];
+}
+
+- (void)logCompressionOfCommitData: (NSData *)commitData
+                        dictionary: (NSData *)dictionary
+                       description: (NSString *)description
+{
+    NSData *compressed = nil;
+    NSDate *startDate = [NSDate date];
+
+    for (int i = 0; i < COMPRESSION_ITERATIONS; i++)
+    {
+        compressed = CompressedCommitData(commitData, dictionary);
+    }
+
+    const NSTimeInterval compressionTime = [[NSDate date] timeIntervalSinceDate: startDate];
+    startDate = [NSDate date];
+
+    for (int i = 0; i < COMPRESSION_ITERATIONS; i++)
+    {
+        UKObjectsEqual(commitData, UncompressedCommitData(compressed, dictionary));
+    }
+
+    const NSTimeInterval decompressionTime = [[NSDate date] timeIntervalSinceDate: startDate];
+    const double megabytes = COMPRESSION_ITERATIONS * commitData.length / (1024.0 * 1024.0);
+
+    NSLog(@"compressing %@ (%d bytes) to %d bytes (ratio %.2f), compression: %.1lf MB/s, decompression: %.1lf MB/s",
+          description,
+          (int)commitData.length,
+          (int)compressed.length,
+          (double)commitData.length / compressed.length,
+          megabytes / compressionTime,
+          megabytes / decompressionTime);
+}
+
+- (void)testCommitCompression
+{
+    COItemGraph *it = [self makeItemTreeWithChildCount: LOTS_OF_EMBEDDED_ITEMS];
+    NSData *snapshot = contentsBLOBWithItemTree(it);
+
+    NSMutableDictionary *dataForUUID = [NSMutableDictionary dictionary];
+    ParseCombinedCommitDataInToUUIDToItemDataDictionary(dataForUUID, snapshot, NO, nil);
+    NSData *dictionary = CompressionDictionaryWithItemData(dataForUUID.allValues, 32 * 1024);
+
+    // A typical delta commit touching a single item
+    COItem *item = [it itemForUUID: it.itemUUIDs.firstObject];
+    NSData *delta = contentsBLOBWithItemTree([[COItemGraph alloc] initWithItems: @[item]
+                                                                   rootItemUUID: it.rootItemUUID]);
+
+    [self logCompressionOfCommitData: snapshot
+                          dictionary: nil
+                         description: [NSString stringWithFormat: @"a %d-item snapshot", LOTS_OF_EMBEDDED_ITEMS]];
+    [self logCompressionOfCommitData: snapshot
+                          dictionary: dictionary
+                         description: [NSString stringWithFormat: @"a %d-item snapshot with a dictionary", LOTS_OF_EMBEDDED_ITEMS]];
+    [self logCompressionOfCommitData: delta
+                          dictionary: nil
+                         description: @"a 1-item delta"];
+    [self logCompressionOfCommitData: delta
+                          dictionary: dictionary
+                         description: @"a 1-item delta with a dictionary"];
+}
+
 - (void)testFTS
 {
     ETUUID *prootUUID = [self makeDemoPersistentRoot];
@@ -332,6 +408,38 @@ static int itemChangedAtCommit(int i)
           1000.0 * [[NSDate date] timeIntervalSinceDate: startDate]);
 }
 
+- (void)testLoadLotsOfPersistentRootInfos
+{
+    COItemGraph *it = [self makeItemTreeWithChildCount: 1];
+    COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+
+    for (int i = 0; i < NUM_PERSISTENT_ROOTS; i++)
+    {
+        [txn createPersistentRootWithInitialItemGraph: it
+                                                 UUID: [ETUUID UUID]
+                                           branchUUID: [ETUUID UUID]
+                                     revisionMetadata: nil];
+    }
+    UKTrue([store commitStoreTransaction: txn]);
+
+    NSDate *startDate = [NSDate date];
+
+    for (ETUUID *uuid in store.persistentRootUUIDs)
+    {
+        [store persistentRootInfoForUUID: uuid];
+    }
+
+    NSLog(@"loading %d persistent root infos one by one took %lf ms",
+          NUM_PERSISTENT_ROOTS, 1000.0 * [[NSDate date] timeIntervalSinceDate: startDate]);
+
+    startDate = [NSDate date];
+
+    UKIntsEqual(NUM_PERSISTENT_ROOTS, store.persistentRootInfos.count);
+
+    NSLog(@"loading %d persistent root infos in bulk took %lf ms",
+          NUM_PERSISTENT_ROOTS, 1000.0 * [[NSDate date] timeIntervalSinceDate: startDate]);
+}
+
 - (void)testLotsOfPersistentRootCopies
 {
     NSDate *startDate = [NSDate date];
@@ -393,4 +501,196 @@ static int itemChangedAtCommit(int i)
           1000.0 * [[NSDate date] timeIntervalSinceDate: startDate]);
 }
 
+/**
+ * Commits a revision touching one item to the given persistent root, and 
+ * returns the persistent root transaction ID once committed.
+ */
+- (int64_t)commitRevisionToPersistentRoot: (COPersistentRootInfo *)proot
+                            transactionID: (int64_t)transactionID
+                               commitIndex: (int)commit
+                       parentRevisionUUID: (ETUUID **)parentRevisionUUID
+{
+    COMutableItem *item = [[self initialChildItem: commit % NUM_CHILDREN] mutableCopy];
+    [item setValue: [NSString stringWithFormat: @"concurrent commit %d", commit]
+      forAttribute: @"name"];
+
+    COItemGraph *deltaGraph = [[COItemGraph alloc] initWithItems: @[item]
+                                                    rootItemUUID: rootUUID];
+    ETUUID *revisionUUID = [ETUUID UUID];
+    COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+
+    [txn writeRevisionWithModifiedItems: deltaGraph
+                           revisionUUID: revisionUUID
+                               metadata: nil
+                       parentRevisionID: *parentRevisionUUID
+                  mergeParentRevisionID: nil
+                     persistentRootUUID: proot.UUID
+                             branchUUID: proot.currentBranchUUID];
+    [txn setCurrentRevision: revisionUUID
+               headRevision: revisionUUID
+                  forBranch: proot.currentBranchUUID
+           ofPersistentRoot: proot.UUID];
+
+    const int64_t newTransactionID = [txn setOldTransactionID: transactionID
+                                            forPersistentRoot: proot.UUID];
+
+    UKTrue([store commitStoreTransaction: txn]);
+
+    *parentRevisionUUID = revisionUUID;
+    return newTransactionID;
+}
+
+/**
+ * Measures how random revision loads scale with the number of reader threads, 
+ * while another thread keeps committing to a second persistent root.
+ */
+- (void)testConcurrentRevisionLoadsDuringCommits
+{
+    ETUUID *prootUUID = [self makeDemoPersistentRoot];
+    NSArray *loadedRevisionUUIDs = [revisionUUIDs copy];
+
+    COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+    COPersistentRootInfo *writtenProot = [txn createPersistentRootWithInitialItemGraph: [self makeInitialItemTree]
+                                                                                  UUID: [ETUUID UUID]
+                                                                            branchUUID: [ETUUID UUID]
+                                                                      revisionMetadata: nil];
+    UKTrue([store commitStoreTransaction: txn]);
+
+    __block int64_t transactionID = writtenProot.transactionID;
+    __block ETUUID *parentRevisionUUID = writtenProot.currentRevisionUUID;
+    __block int numberOfCommits = 0;
+
+    // Don't measure the item graph cache
+    store.maxItemGraphCacheSize = 0;
+
+    for (int numberOfThreads = 1; numberOfThreads <= MAX_READER_THREADS; numberOfThreads *= 2)
+    {
+        store.maxNumberOfReaders = numberOfThreads;
+
+        dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+        dispatch_group_t readers = dispatch_group_create();
+        dispatch_semaphore_t committerDone = dispatch_semaphore_create(0);
+        __block volatile BOOL readersDone = NO;
+        const int commitsBefore = numberOfCommits;
+
+        dispatch_async(queue, ^()
+        {
+            while (!readersDone)
+            {
+                @autoreleasepool
+                {
+                    transactionID = [self commitRevisionToPersistentRoot: writtenProot
+                                                           transactionID: transactionID
+                                                             commitIndex: numberOfCommits
+                                                      parentRevisionUUID: &parentRevisionUUID];
+                    numberOfCommits++;
+                }
+            }
+            dispatch_semaphore_signal(committerDone);
+        });
+
+        NSDate *startDate = [NSDate date];
+
+        for (int thread = 0; thread < numberOfThreads; thread++)
+        {
+            dispatch_group_async(readers, queue, ^()
+            {
+                unsigned int seed = thread + 1;
+
+                for (int i = 0; i < NUM_LOADS_PER_READER_THREAD; i++)
+                {
+                    @autoreleasepool
+                    {
+                        ETUUID *revisionUUID = loadedRevisionUUIDs[rand_r(&seed) % loadedRevisionUUIDs.count];
+                        COItemGraph *tree = [store itemGraphForRevisionUUID: revisionUUID
+                                                             persistentRoot: prootUUID];
+                        assert(tree.itemUUIDs.count == NUM_CHILDREN + 1);
+                    }
+                }
+            });
+        }
+        dispatch_group_wait(readers, DISPATCH_TIME_FOREVER);
+
+        const NSTimeInterval duration = [[NSDate date] timeIntervalSinceDate: startDate];
+
+        readersDone = YES;
+        dispatch_semaphore_wait(committerDone, DISPATCH_TIME_FOREVER);
+
+        NSLog(@"%d reader threads loaded %d random full snapshots of a %d-item persistent root "
+               "in %lf ms (%lf loads/s), while %d commits were made concurrently",
+              numberOfThreads,
+              numberOfThreads * NUM_LOADS_PER_READER_THREAD,
+              NUM_CHILDREN,
+              1000.0 * duration,
+              numberOfThreads * NUM_LOADS_PER_READER_THREAD / duration,
+              numberOfCommits - commitsBefore);
+    }
+}
+
+- (COStoreTransaction *)smallCommitTransaction
+{
+    COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+    [txn createPersistentRootWithInitialItemGraph: [self makeItemTreeWithChildCount: 1]
+                                             UUID: [ETUUID UUID]
+                                       branchUUID: [ETUUID UUID]
+                                 revisionMetadata: nil];
+    return txn;
+}
+
+/**
+ * Compares committing many small transactions one after the other, with 
+ * committing them from multiple threads with group commit.
+ */
+- (void)testGroupCommitThroughput
+{
+    NSDate *startDate = [NSDate date];
+
+    for (int i = 0; i < NUM_SMALL_COMMITS; i++)
+    {
+        @autoreleasepool
+        {
+            UKTrue([store commitStoreTransaction: [self smallCommitTransaction]]);
+        }
+    }
+
+    NSLog(@"making %d small commits serially took %lf ms",
+          NUM_SMALL_COMMITS, 1000.0 * [[NSDate date] timeIntervalSinceDate: startDate]);
+
+    store.groupsCommits = YES;
+
+    for (int numberOfThreads = 1; numberOfThreads <= MAX_COMMITTING_THREADS; numberOfThreads *= 2)
+    {
+        dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+        dispatch_group_t group = dispatch_group_create();
+
+        startDate = [NSDate date];
+
+        for (int thread = 0; thread < numberOfThreads; thread++)
+        {
+            dispatch_group_async(group, queue, ^()
+            {
+                for (int i = 0; i < NUM_SMALL_COMMITS / numberOfThreads; i++)
+                {
+                    @autoreleasepool
+                    {
+                        BOOL ok = [store commitStoreTransaction: [self smallCommitTransaction]];
+                        assert(ok);
+                    }
+                }
+            });
+        }
+
+        // The commit notifications are posted on the main thread
+        while (dispatch_group_wait(group, DISPATCH_TIME_NOW) != 0)
+        {
+            [[NSRunLoop currentRunLoop] runUntilDate: [NSDate dateWithTimeIntervalSinceNow: 0.001]];
+        }
+
+        NSLog(@"making %d small commits from %d threads with group commit took %lf ms",
+              NUM_SMALL_COMMITS, numberOfThreads, 1000.0 * [[NSDate date] timeIntervalSinceDate: startDate]);
+    }
+
+    store.groupsCommits = NO;
+}
+
 @end
@@ -998,8 +998,7 @@ NSString *const kCOBranchLabel = @"COBranchLabel";
 
     for (CORevisionInfo *revInfo in revInfos)
     {
-        [revs addObject: [self.editingContext revisionForRevisionUUID: revInfo.revisionUUID
-                                                   persistentRootUUID: revInfo.persistentRootUUID]];
+        [revs addObject: [self.editingContext revisionForRevisionInfo: revInfo]];
     }
     return revs;
 }
@@ -8,7 +8,7 @@
 #import <CoreObject/COEditingContext.h>
 #import <CoreObject/CORevision.h>
 
-@class COCrossPersistentRootDeadRelationshipCache, COPath, COUndoTrack;
+@class COCrossPersistentRootDeadRelationshipCache, COPath, COUndoTrack, CORevisionInfo, CORevisionGraph;
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -71,6 +71,16 @@ restrictedToPersistentRoots: (nullable NSArray *)persistentRoots
 - (void)updateCrossPersistentRootReferencesToPersistentRoot: (COPersistentRoot *)aPersistentRoot
                                                      branch: (nullable COBranch *)aBranch
                                                     isFault: (BOOL)faulting;
+/**
+ * Loads the persistent roots whose current revisions reference the given one 
+ * (see -[COSQLiteStore persistentRootUUIDsReferencingPersistentRoot:]), and 
+ * unfaults their object graphs, so the incoming relationships of the given 
+ * persistent root are complete.
+ *
+ * The store is only queried the first time for a given persistent root, 
+ * until a persistent root is unloaded or a store change is received.
+ */
+- (void)loadPersistentRootsReferencingPersistentRoot: (COPersistentRoot *)aPersistentRoot;
 
 
 /** @taskunit Accessing Store Revisions and Branches */
@@ -78,6 +88,15 @@ restrictedToPersistentRoots: (nullable NSArray *)persistentRoots
 
 - (nullable CORevision *)revisionForRevisionUUID: (ETUUID *)aRevid
                               persistentRootUUID: (ETUUID *)aPersistentRoot;
+/**
+ * See -[CORevisionCache revisionForRevisionInfo:].
+ */
+- (nullable CORevision *)revisionForRevisionInfo: (CORevisionInfo *)aRevInfo;
+/**
+ * See -[CORevisionCache revisionGraphForRevisionUUID:persistentRootUUID:].
+ */
+- (nullable CORevisionGraph *)revisionGraphForRevisionUUID: (ETUUID *)aRevid
+                                        persistentRootUUID: (ETUUID *)aPersistentRoot;
 - (nullable COBranch *)branchForUUID: (ETUUID *)aBranch;
 
 
@@ -11,7 +11,7 @@
 
 @class COSQLiteStore, COEditingContext, COPersistentRoot, COBranch, COObjectGraphContext, COObject;
 @class COUndoTrackStore, COUndoTrack, COCommandGroup;
-@class COCrossPersistentRootDeadRelationshipCache, CORevisionCache;
+@class COCrossPersistentRootDeadRelationshipCache, CORevisionCache, COPersistentRootEvictionPolicy;
 @class COError;
 
 #ifndef NS_ENUM
@@ -160,6 +160,7 @@ typedef NS_ENUM(NSUInteger, COEditingContextUnloadingBehavior)
     /** Loaded (or inserted) persistent roots by UUID */
     NSMutableDictionary *_loadedPersistentRoots;
     COEditingContextUnloadingBehavior _unloadingBehavior;
+    COPersistentRootEvictionPolicy *_evictionPolicy;
     /** Set of persistent roots pending deletion */
     NSMutableSet *_persistentRootsPendingDeletion;
     /** Set of persistent roots pending undeletion */
@@ -175,6 +176,8 @@ typedef NS_ENUM(NSUInteger, COEditingContextUnloadingBehavior)
     COObjectGraphContext *_internalTransientObjectGraphContext;
     NSMutableDictionary *_lastTransactionIDForPersistentRootUUID;
     BOOL _hasLoadedPersistentRootUUIDs;
+    /** Persistent roots whose referrers have been loaded based on the store index */
+    NSMutableSet *_persistentRootUUIDsWithLoadedReferrers;
 }
 
 
@@ -348,6 +351,16 @@ typedef NS_ENUM(NSUInteger, COEditingContextUnloadingBehavior)
  * By default, returns COEditingContextUnloadingOnDeletion.
  */
 @property (nonatomic, readwrite, assign) COEditingContextUnloadingBehavior unloadingBehavior;
+/**
+ * The policy to unload persistent roots when the loaded ones exceed a memory 
+ * budget.
+ *
+ * By default, the policy has no memory budget and never unloads persistent 
+ * roots. The eviction policy is independent from -unloadingBehavior.
+ *
+ * See COPersistentRootEvictionPolicy.
+ */
+@property (nonatomic, readonly, strong) COPersistentRootEvictionPolicy *evictionPolicy;
 
 
 /** @taskunit Pending Changes */
@@ -22,6 +22,7 @@
 #import "COEditingContext+Private.h"
 #import "COCrossPersistentRootDeadRelationshipCache.h"
 #import "CORevisionCache.h"
+#import "COPersistentRootEvictionPolicy.h"
 #import "COStoreTransaction.h"
 #import "CODistributedNotificationCenter.h"
 
@@ -29,7 +30,7 @@
 
 @synthesize store = _store, modelDescriptionRepository = _modelDescriptionRepository;
 @synthesize migrationDriverClass = _migrationDriverClass;
-@synthesize unloadingBehavior = _unloadingBehavior;
+@synthesize unloadingBehavior = _unloadingBehavior, evictionPolicy = _evictionPolicy;
 @synthesize persistentRootsPendingDeletion = _persistentRootsPendingDeletion;
 @synthesize persistentRootsPendingUndeletion = _persistentRootsPendingUndeletion;
 @synthesize deadRelationshipCache = _deadRelationshipCache;
@@ -62,6 +63,7 @@
     _migrationDriverClass = aDriverClass;
     _loadedPersistentRoots = [NSMutableDictionary new];
     _unloadingBehavior = COEditingContextUnloadingBehaviorOnDeletion;
+    _evictionPolicy = [[COPersistentRootEvictionPolicy alloc] initWithEditingContext: self];
     _persistentRootsPendingDeletion = [NSMutableSet new];
     _persistentRootsPendingUndeletion = [NSMutableSet new];
     _deadRelationshipCache = [COCrossPersistentRootDeadRelationshipCache new];
@@ -72,7 +74,9 @@
         initWithModelDescriptionRepository: aRepo
                       migrationDriverClass: aDriverClass];
     _lastTransactionIDForPersistentRootUUID = [NSMutableDictionary new];
+    _persistentRootUUIDsWithLoadedReferrers = [NSMutableSet new];
     CORegisterCoreObjectMetamodel(_modelDescriptionRepository);
+    [self registerIndexedProperties];
 
     [[NSNotificationCenter defaultCenter] addObserver: self
                                              selector: @selector(storePersistentRootsDidChange:)
@@ -88,6 +92,40 @@
     return self;
 }
 
+/**
+ * Registers the persistent attributes marked as indexed in the metamodel with 
+ * the store.
+ *
+ * Inherited properties are registered for each subentity, since the store 
+ * indexes items based on their entity name.
+ *
+ * The entities registered in the store, but without indexed properties in the 
+ * metamodel, are unregistered. Entities unknown to the metamodel are left 
+ * untouched, since other applications can share the store.
+ */
+- (void)registerIndexedProperties
+{
+    NSSet *registeredEntityNames = [_store indexedEntityNames];
+
+    for (ETEntityDescription *entity in _modelDescriptionRepository.entityDescriptions)
+    {
+        NSMutableSet *propertyNames = [NSMutableSet new];
+
+        for (ETPropertyDescription *propertyDesc in entity.allPersistentPropertyDescriptions)
+        {
+            if (propertyDesc.indexedInStore && !propertyDesc.isRelationship)
+            {
+                [propertyNames addObject: propertyDesc.name];
+            }
+        }
+
+        if (propertyNames.isEmpty && ![registeredEntityNames containsObject: entity.name])
+            continue;
+
+        [_store setIndexedPropertyNames: propertyNames forEntityName: entity.name];
+    }
+}
+
 - (instancetype)initWithStore: (COSQLiteStore *)store
    modelDescriptionRepository: (ETModelDescriptionRepository *)aRepo
 {
@@ -169,14 +207,26 @@
 
 #pragma mark Accessing All Persistent Roots -
 
+/**
+ * Loads the persistent roots not yet loaded, from infos fetched in bulk 
+ * (rather than one by one with -persistentRootForUUID:).
+ */
+- (void)loadPersistentRootsWithInfos: (NSArray *)infos
+{
+    for (COPersistentRootInfo *info in infos)
+    {
+        if (_loadedPersistentRoots[info.UUID] != nil)
+            continue;
+
+        [self makePersistentRootWithInfo: info objectGraphContext: nil];
+    }
+}
+
 - (void)loadAllPersistentRootsIfNeeded
 {
     if (!_hasLoadedPersistentRootUUIDs)
     {
-        for (ETUUID *uuid in _store.persistentRootUUIDs)
-        {
-            [self persistentRootForUUID: uuid];
-        }
+        [self loadPersistentRootsWithInfos: _store.persistentRootInfos];
 
         _hasLoadedPersistentRootUUIDs = YES;
     }
@@ -198,10 +248,7 @@
     [self loadAllPersistentRootsIfNeeded];
 
     /* Force deleted persistent roots to be reloaded (see -unloadPersistentRoot:) */
-    for (ETUUID *persistentRootUUID in _store.deletedPersistentRootUUIDs)
-    {
-        [self persistentRootForUUID: persistentRootUUID];
-    }
+    [self loadPersistentRootsWithInfos: _store.deletedPersistentRootInfos];
 
     return [NSSet setWithArray:
         [_loadedPersistentRoots.allValues filteredCollectionWithBlock: ^(COPersistentRoot *obj)
@@ -229,7 +276,10 @@
     COPersistentRoot *persistentRoot = _loadedPersistentRoots[persistentRootUUID];
 
     if (persistentRoot != nil)
+    {
+        [_evictionPolicy didAccessPersistentRoot: persistentRoot];
         return persistentRoot;
+    }
 
     COPersistentRootInfo *info = [_store persistentRootInfoForUUID: persistentRootUUID];
     BOOL persistentRootFound = (info != nil);
@@ -247,6 +297,60 @@
     return _loadedPersistentRoots[aUUID];
 }
 
+- (void)loadPersistentRootsReferencingPersistentRoot: (COPersistentRoot *)aPersistentRoot
+{
+    NSParameterAssert(aPersistentRoot != nil);
+
+    if (aPersistentRoot.persistentRootUncommitted
+        || [_persistentRootUUIDsWithLoadedReferrers containsObject: aPersistentRoot.UUID])
+    {
+        return;
+    }
+    [_persistentRootUUIDsWithLoadedReferrers addObject: aPersistentRoot.UUID];
+
+    NSArray *referrerUUIDs = [_store persistentRootUUIDsReferencingPersistentRoot: aPersistentRoot.UUID];
+
+    for (COPersistentRoot *referrer in [self persistentRootsForUUIDs: referrerUUIDs])
+    {
+        // Deserializing the referrer makes its references to aPersistentRoot 
+        // live, and populates the incoming relationship caches
+        [referrer objectGraphContext];
+    }
+}
+
+/**
+ * Returns the given persistent roots, loading the missing ones in bulk.
+ */
+- (NSArray *)persistentRootsForUUIDs: (NSArray *)UUIDs
+{
+    NSMutableArray *unloadedUUIDs = [NSMutableArray new];
+
+    for (ETUUID *uuid in UUIDs)
+    {
+        if (_loadedPersistentRoots[uuid] == nil)
+        {
+            [unloadedUUIDs addObject: uuid];
+        }
+    }
+    if (unloadedUUIDs.count > 0)
+    {
+        [self loadPersistentRootsWithInfos: [_store persistentRootInfosForUUIDs: unloadedUUIDs]];
+    }
+
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity: UUIDs.count];
+
+    for (ETUUID *uuid in UUIDs)
+    {
+        COPersistentRoot *persistentRoot = _loadedPersistentRoots[uuid];
+
+        if (persistentRoot != nil)
+        {
+            [result addObject: persistentRoot];
+        }
+    }
+    return result;
+}
+
 - (COPersistentRoot *)makePersistentRootWithInfo: (COPersistentRootInfo *)info
                               objectGraphContext: (COObjectGraphContext *)anObjectGrapContext
 {
@@ -259,6 +363,7 @@
                                                            objectGraphContext: anObjectGrapContext
                                                                 parentContext: self];
     _loadedPersistentRoots[persistentRoot.UUID] = persistentRoot;
+    [_evictionPolicy didLoadPersistentRoot: persistentRoot];
 
     // Lazy loading support:
     // Cause any faulted references to this newly loaded persistet root to be unfaulted
@@ -305,6 +410,7 @@
                                                            objectGraphContext: nil
                                                                 parentContext: self];
     _loadedPersistentRoots[persistentRoot.UUID] = persistentRoot;
+    [_evictionPolicy didLoadPersistentRoot: persistentRoot];
 
     return persistentRoot;
 }
@@ -475,7 +581,7 @@
 
         // TODO: Factor out this object graph context -> COPath conversion.
         COPath *targetPath;
-        if (target == aPersistentRoot.objectGraphContext)
+        if (target == aPersistentRoot.objectGraphContextWithoutUnfaulting)
         {
             targetPath = [COPath pathWithPersistentRoot: target.persistentRoot.UUID];
         }
@@ -520,10 +626,16 @@
         return;
 
     [_loadedPersistentRoots removeObjectForKey: aPersistentRoot.UUID];
+    [_evictionPolicy didUnloadPersistentRoot: aPersistentRoot];
+    // The references from the unloaded persistent root disappear
+    [_persistentRootUUIDsWithLoadedReferrers removeAllObjects];
 
     // For a deleted persistent root, references are fixed in -deletePersistentRoot:
     if (!deleted)
     {
+        // -persistentRoots must reload it
+        _hasLoadedPersistentRootUUIDs = NO;
+
         // Turn faulted references to this persistent root back into faults
         [self updateCrossPersistentRootReferencesToPersistentRoot: aPersistentRoot
                                                            branch: nil
@@ -571,6 +683,12 @@
     if (persistentRoot == nil || persistentRoot.deleted)
         return nil;
 
+    /* Keep the reference dead rather than unfaulting the target (and the 
+       persistent roots it references in turn). The reference is fixed when 
+       the target is unfaulted, see -[COPersistentRoot objectGraphContext]. */
+    if (!shouldLoad && branchUUID == nil && persistentRoot.objectGraphContextWithoutUnfaulting == nil)
+        return nil;
+
     if (branchUUID != nil)
     {
         COBranch *branch = [persistentRoot branchForUUID: branchUUID];
@@ -624,10 +742,12 @@
 
     /* Clear persistent roots pending insertion */
 
-    NSArray *persistentRootsPendingInsertion = self.persistentRootsPendingInsertion.allObjects;
-
-    [_loadedPersistentRoots removeObjectsForKeys:
-                            (id)[[persistentRootsPendingInsertion mappedCollection] UUID]];
+    // Unloaded so the eviction policy stops tracking them. No references to 
+    // fix, since the other persistent roots changes were discarded above.
+    for (COPersistentRoot *persistentRoot in self.persistentRootsPendingInsertion.allObjects)
+    {
+        [self unloadPersistentRoot: persistentRoot isDeleted: YES force: YES];
+    }
     ETAssert([self.persistentRootsPendingInsertion isEmpty]);
 
     /* Clear other pending changes */
@@ -774,6 +894,10 @@ restrictedToPersistentRoots: (NSArray *)persistentRoots
         /* Commit persistent root changes (deleted persistent roots included) */
 
         COStoreTransaction *transaction = [[COStoreTransaction alloc] init];
+        NSArray *changedPersistentRoots = [persistentRoots filteredCollectionWithBlock: ^(COPersistentRoot *obj)
+        {
+            return obj.hasChanges;
+        }];
         [self recordBeginUndoGroupWithMetadata: metadata];
 
         for (COPersistentRoot *persistentRoot in persistentRoots)
@@ -835,6 +959,11 @@ restrictedToPersistentRoots: (NSArray *)persistentRoots
         /* For a commit triggered by undo/redo on a COUndoTrack, the command is nil */
         [self didCommitWithCommand: command persistentRoots: persistentRoots];
 
+        for (COPersistentRoot *persistentRoot in changedPersistentRoots)
+        {
+            [_evictionPolicy didChangePersistentRoot: persistentRoot];
+        }
+
         if (anError != NULL)
         {
             *anError = nil;
@@ -844,6 +973,8 @@ restrictedToPersistentRoots: (NSArray *)persistentRoots
     {
         _inCommit = NO;
     }
+
+    [_evictionPolicy evictPersistentRootsIfNeeded];
     return YES;
 }
 
@@ -902,6 +1033,9 @@ restrictedToPersistentRoots: (NSArray *)persistentRoots
  */
 - (void)storePersistentRootsDidChange: (NSNotification *)notif isDistributed: (BOOL)isDistributed
 {
+    // Other editing contexts can have committed new references
+    [_persistentRootUUIDsWithLoadedReferrers removeAllObjects];
+
     NSDictionary *transactionIDs = notif.userInfo[kCOStorePersistentRootTransactionIDs];
     NSArray *persistentRootUUIDs = [transactionIDs.allKeys
         mappedCollectionWithBlock: ^(id uuidString)
@@ -1022,6 +1156,12 @@ restrictedToPersistentRoots: (NSArray *)persistentRoots
                           object: self
                         userInfo: nil];
     }
+
+    // For our own commits, we evict at the end of the commit
+    if (!_inCommit)
+    {
+        [_evictionPolicy evictPersistentRootsIfNeeded];
+    }
 }
 
 #pragma mark Private Conveniency -
@@ -1033,6 +1173,18 @@ restrictedToPersistentRoots: (NSArray *)persistentRoots
                                 persistentRootUUID: aPersistentRoot];
 }
 
+- (CORevision *)revisionForRevisionInfo: (CORevisionInfo *)aRevInfo
+{
+    return [_revisionCache revisionForRevisionInfo: aRevInfo];
+}
+
+- (CORevisionGraph *)revisionGraphForRevisionUUID: (ETUUID *)aRevid
+                               persistentRootUUID: (ETUUID *)aPersistentRoot
+{
+    return [_revisionCache revisionGraphForRevisionUUID: aRevid
+                                     persistentRootUUID: aPersistentRoot];
+}
+
 - (COBranch *)branchForUUID: (ETUUID *)aBranch
 {
     if (aBranch != nil)
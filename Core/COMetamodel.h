@@ -9,3 +9,26 @@
 #import <EtoileFoundation/EtoileFoundation.h>
 
 void CORegisterCoreObjectMetamodel(ETModelDescriptionRepository *_Nonnull repo);
+
+/**
+ * @group Core
+ * @abstract CoreObject additions to the FM3 metamodel.
+ */
+@interface ETPropertyDescription (CoreObject)
+
+/**
+ * Whether the property values are indexed in the store, to support equality 
+ * and range queries without loading the persistent roots.
+ *
+ * Only persistent attributes whose type is a number, a string or data can be 
+ * indexed.
+ *
+ * When an editing context is created, the indexed properties of its metamodel 
+ * are registered with -[COSQLiteStore setIndexedPropertyNames:forEntityName:]. 
+ * See -[COSQLiteStore searchResultsForProperty:value:].
+ *
+ * By default, returns NO.
+ */
+@property (nonatomic, readwrite, assign, getter=isIndexedInStore) BOOL indexedInStore;
+
+@end
@@ -67,3 +67,20 @@ void CORegisterCoreObjectMetamodel(ETModelDescriptionRepository *repo)
                             repo, warnings];
     }
 }
+
+
+static char indexedInStoreKey;
+
+@implementation ETPropertyDescription (CoreObject)
+
+- (BOOL)isIndexedInStore
+{
+    return [objc_getAssociatedObject(self, &indexedInStoreKey) boolValue];
+}
+
+- (void)setIndexedInStore: (BOOL)indexed
+{
+    objc_setAssociatedObject(self, &indexedInStoreKey, (indexed ? @YES : nil), OBJC_ASSOCIATION_RETAIN_NONATOMIC);
+}
+
+@end
@@ -73,6 +73,13 @@ ETEntityDescription *entityDescriptionForObjectInRepository();
 - (nullable id)serializableValueForStorageKey: (NSString *)key;
 - (void)setValue: (nullable id)value forStorageKey: (NSString *)key;
 - (nullable id)valueForProperty: (NSString *)key shouldLoad: (BOOL)shouldLoad;
+/**
+ * Returns a rough estimate of the memory used by the receiver and its variable 
+ * storage, in bytes.
+ *
+ * Referenced objects are not included, but strings and data in collections are.
+ */
+@property (nonatomic, readonly) NSUInteger estimatedMemoryFootprint;
 
 
 /** @taskunit Mutating Collections */
@@ -481,6 +481,54 @@ static NSNull *cachedNSNull = nil;
     return [self valueForVariableStorageKey: @"tags"];
 }
 
+static NSUInteger COEstimatedMemoryFootprintOfValue(id value)
+{
+    if ([value isKindOfClass: [NSString class]])
+    {
+        return [value length] * sizeof(unichar);
+    }
+    else if ([value isKindOfClass: [NSData class]])
+    {
+        return [value length];
+    }
+    else if ([value isKindOfClass: [NSArray class]] || [value isKindOfClass: [NSSet class]])
+    {
+        NSUInteger size = [value count] * sizeof(id);
+
+        for (id element in value)
+        {
+            size += COEstimatedMemoryFootprintOfValue(element);
+        }
+        return size;
+    }
+    else if ([value isKindOfClass: [NSDictionary class]])
+    {
+        NSUInteger size = [value count] * 2 * sizeof(id);
+
+        for (id element in [value objectEnumerator])
+        {
+            size += COEstimatedMemoryFootprintOfValue(element);
+        }
+        return size;
+    }
+    // Numbers, dates, UUIDs, and references to other objects (counted apart)
+    return 0;
+}
+
+- (NSUInteger)estimatedMemoryFootprint
+{
+    // The instance, plus the variable storage hash table buckets and a 
+    // minimal allocation per value
+    const NSUInteger valueSize = 16;
+    NSUInteger size = class_getInstanceSize(object_getClass(self));
+
+    for (id value in _variableStorage.objectEnumerator)
+    {
+        size += 2 * sizeof(id) + valueSize + COEstimatedMemoryFootprintOfValue(value);
+    }
+    return size;
+}
+
 #pragma mark - Property-Value Coding
 
 - (NSSet *)observableKeyPaths
@@ -895,6 +943,13 @@ static NSNull *cachedNSNull = nil;
     // For the relationship cache API, parent(s) = referringObject(s) and self = target
     if ([self isIncomingRelationship: propDesc])
     {
+        // Cross persistent root references can only point to root objects, 
+        // and their sources can belong to persistent roots not yet loaded
+        if (self.loadingEnabled && shouldLoad && self.isRoot && self.persistentRoot != nil)
+        {
+            [self.editingContext loadPersistentRootsReferencingPersistentRoot: self.persistentRoot];
+        }
+
         if (propDesc.multivalued)
         {
             return [_incomingRelationshipCache referringObjectsForPropertyInTarget: key];
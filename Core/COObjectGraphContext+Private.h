@@ -74,6 +74,12 @@ NS_ASSUME_NONNULL_BEGIN
  * See -loadedObjectForUUID:.
  */
 - (NSArray<__kindof COObject *> *)loadedObjectsForUUIDs: (NSArray<ETUUID *> *)UUIDs;
+/**
+ * Returns a rough estimate of the memory used by the loaded objects, in bytes.
+ *
+ * See -[COObject estimatedMemoryFootprint].
+ */
+@property (nonatomic, readonly) unsigned long long estimatedMemoryFootprint;
 
 
 /** @taskunit Change Tracking and Snapshot */
@@ -811,6 +811,17 @@ NSString *const COObjectGraphContextEndBatchChangeNotification = @"COObjectGraph
     return obj;
 }
 
+- (unsigned long long)estimatedMemoryFootprint
+{
+    unsigned long long size = 0;
+
+    for (COObject *object in _loadedObjects.objectEnumerator)
+    {
+        size += object.estimatedMemoryFootprint;
+    }
+    return size;
+}
+
 - (NSArray *)loadedObjectsForUUIDs: (NSArray *)UUIDs
 {
     NILARG_EXCEPTION_TEST(UUIDs);
@@ -37,7 +37,21 @@ extern NSString *const COPersistentRootName;
                parentContext: (COEditingContext *)aCtxt NS_DESIGNATED_INITIALIZER;
 
 @property (nonatomic, readonly, strong) COPersistentRootInfo *persistentRootInfo;
+/**
+ * Returns the object graph that tracks the current branch, or nil if it is 
+ * still a fault.
+ *
+ * See -objectGraphContext.
+ */
+@property (nonatomic, readonly, nullable) COObjectGraphContext *objectGraphContextWithoutUnfaulting;
 @property (nonatomic, readonly, getter=isPersistentRootUncommitted) BOOL persistentRootUncommitted;
+/**
+ * Returns a rough estimate of the memory used by the loaded object graphs and 
+ * the metadata, in bytes.
+ *
+ * See COPersistentRootEvictionPolicy.
+ */
+@property (nonatomic, readonly) unsigned long long estimatedMemoryFootprint;
 
 
 /** @taskunit Committing Changes */
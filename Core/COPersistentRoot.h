@@ -186,6 +186,10 @@ extern NSString *const COPersistentRootDidChangeNotification;
     NSDictionary *_metadata;
     BOOL _metadataChanged;
     COObjectGraphContext *_objectGraphContext;
+    /**
+     * Whether _objectGraphContext content remains to be loaded from the store.
+     */
+    BOOL _objectGraphContextFault;
 }
 
 
@@ -463,6 +467,10 @@ extern NSString *const COPersistentRootDidChangeNotification;
  * contains some changes, a commit must be done, to start making changes to its 
  * counterpart.
  *
+ * For a persistent root loaded from the store, this object graph context is a 
+ * fault until it is accessed (directly or with -rootObject), so loading 
+ * many persistent roots is cheap.
+ *
  * See also -allObjectGraphContexts and -rootObject (for cross persistent root 
  * references).
  */
@@ -471,7 +479,8 @@ extern NSString *const COPersistentRootDidChangeNotification;
  * This method is only exposed to be used internally by CoreObject.
  *
  * Returns the object graphs for the -branches (if they have been instantiated),
- * plus the object graph that dynamically tracks the -currentBranch (see -objectGraphContext).
+ * plus the object graph that dynamically tracks the -currentBranch (if it has 
+ * been unfaulted, see -objectGraphContext).
  */
 @property (nonatomic, readonly) NSSet<COObjectGraphContext *> *allObjectGraphContexts;
 
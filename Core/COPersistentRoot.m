@@ -19,6 +19,7 @@
 #import "COEditingContext+Undo.h"
 #import "COEditingContext+Private.h"
 #import "COStoreTransaction.h"
+#import "COPersistentRootEvictionPolicy.h"
 
 NSString *const COPersistentRootDidChangeNotification = @"COPersistentRootDidChangeNotification";
 
@@ -32,7 +33,6 @@ NSString *const COPersistentRootName = @"org.etoile.coreobject.name";
 @synthesize editingContext = _editingContext, UUID = _UUID, persistentRootInfo = _persistentRootInfo;
 @synthesize branchesPendingDeletion = _branchesPendingDeletion;
 @synthesize branchesPendingUndeletion = _branchesPendingUndeletion;
-@synthesize objectGraphContext = _objectGraphContext;
 
 #pragma mark Creating a New Persistent Root -
 
@@ -122,8 +122,8 @@ NSString *const COPersistentRootName = @"org.etoile.coreobject.name";
         [_editingContext setLastTransactionID: _persistentRootInfo.transactionID
                         forPersistentRootUUID: _UUID];
         _metadata = _persistentRootInfo.metadata;
-
-        [self reloadCurrentBranchObjectGraph];
+        // Loaded lazily, see -objectGraphContext
+        _objectGraphContextFault = YES;
     }
     else
     {
@@ -229,10 +229,47 @@ NSString *const COPersistentRootName = @"org.etoile.coreobject.name";
 
 - (void)reloadCurrentBranchObjectGraph
 {
+    // The current revision is loaded on unfaulting
+    if (_objectGraphContextFault)
+        return;
+
     [self setCurrentBranchObjectGraphToRevisionUUID: self.currentRevision.UUID
                                  persistentRootUUID: _UUID];
 }
 
+/**
+ * For the interaction with cross persistent root references, see
+ * -setCurrentBranchObjectGraphToRevisionUUID:persistentRootUUID:, whose 
+ * discussion applies to this method unfaulting logic in the same way.
+ */
+- (COObjectGraphContext *)objectGraphContext
+{
+    if (_objectGraphContextFault)
+    {
+        //NSLog(@"%@: unfaulting object graph context", self);
+
+        _objectGraphContextFault = NO;
+        [self reloadCurrentBranchObjectGraph];
+        ETAssert(!_objectGraphContext.hasChanges);
+
+        // Lazy loading support: references to this persistent root remain 
+        // dead while it is a fault (see -[COEditingContext crossPersistentRootReferenceWithPath:shouldLoad:])
+        if ([_editingContext loadedPersistentRootForUUID: _UUID] == self)
+        {
+            [_editingContext updateCrossPersistentRootReferencesToPersistentRoot: self
+                                                                          branch: nil
+                                                                         isFault: self.deleted];
+        }
+        [_editingContext.evictionPolicy didChangePersistentRoot: self];
+    }
+    return _objectGraphContext;
+}
+
+- (COObjectGraphContext *)objectGraphContextWithoutUnfaulting
+{
+    return _objectGraphContextFault ? nil : _objectGraphContext;
+}
+
 #pragma mark Persistent Root Properties -
 
 - (NSDictionary *)metadata
@@ -541,10 +578,26 @@ NSString *const COPersistentRootName = @"org.etoile.coreobject.name";
 
 #pragma mark Convenience -
 
+- (unsigned long long)estimatedMemoryFootprint
+{
+    // The persistent root, branch and revision metadata
+    unsigned long long size = 1024 + 512 * _branchForUUID.count;
+
+    for (COObjectGraphContext *objectGraph in self.allObjectGraphContexts)
+    {
+        size += objectGraph.estimatedMemoryFootprint;
+    }
+    return size;
+}
+
 - (NSSet *)allObjectGraphContexts
 {
     NSMutableSet *objectGraphs = [NSMutableSet setWithCapacity: _branchForUUID.count + 1];
-    [objectGraphs addObject: _objectGraphContext];
+
+    if (!_objectGraphContextFault)
+    {
+        [objectGraphs addObject: _objectGraphContext];
+    }
 
     for (COBranch *branch in _branchForUUID.objectEnumerator)
     {
@@ -560,17 +613,18 @@ NSString *const COPersistentRootName = @"org.etoile.coreobject.name";
 
 - (id)rootObject
 {
-    return _objectGraphContext.rootObject;
+    [_editingContext.evictionPolicy didAccessPersistentRoot: self];
+    return self.objectGraphContext.rootObject;
 }
 
 - (void)setRootObject: (COObject *)aRootObject
 {
-    _objectGraphContext.rootObject = aRootObject;
+    self.objectGraphContext.rootObject = aRootObject;
 }
 
 - (COObject *)loadedObjectForUUID: (ETUUID *)uuid
 {
-    return [_objectGraphContext loadedObjectForUUID: uuid];
+    return [self.objectGraphContext loadedObjectForUUID: uuid];
 }
 
 - (CORevision *)currentRevision
@@ -927,6 +981,7 @@ NSString *const COPersistentRootName = @"org.etoile.coreobject.name";
     _metadata = _persistentRootInfo.metadata;
 
     [self reloadCurrentBranchObjectGraph];
+    [_editingContext.evictionPolicy didChangePersistentRoot: self];
     [self sendChangeNotification];
 }
 
@@ -0,0 +1,213 @@
+/**
+    Copyright (C) 2016 Quentin Mathe
+
+    Date:  October 2016
+    License:  MIT  (see COPYING)
+ */
+
+#import <Foundation/Foundation.h>
+#import <EtoileFoundation/ETUUID.h>
+
+@class COEditingContext, COPersistentRoot;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * Hints to decide which persistent roots should be evicted first, when the
+ * loaded persistent roots exceed the memory budget.
+ *
+ * Persistent roots with a lower priority are evicted first. For the same
+ * priority, the least recently accessed ones are evicted first.
+ */
+typedef NS_ENUM(NSInteger, COPersistentRootEvictionPriority)
+{
+    /**
+     * For persistent roots cheap to reload or rarely accessed (e.g. metadata
+     * or settings).
+     */
+    COPersistentRootEvictionPriorityLow = -1,
+    /**
+     * The default priority.
+     */
+    COPersistentRootEvictionPriorityNormal = 0,
+    /**
+     * For persistent roots expensive to reload or frequently accessed (e.g.
+     * photos or documents).
+     */
+    COPersistentRootEvictionPriorityHigh = 1
+};
+
+/**
+ * @group Core
+ * @abstract An eviction policy unloads persistent roots from an editing
+ * context, to keep the memory used by loaded persistent roots under a budget.
+ *
+ * An instance of this class is owned by each COEditingContext, see
+ * -[COEditingContext evictionPolicy].
+ *
+ * The policy tracks an approximate memory footprint and the last access for
+ * each loaded persistent root. When the total footprint exceeds
+ * -maxMemoryFootprint, the persistent roots are unloaded with
+ * -[COEditingContext unloadPersistentRoot:], from the lowest priority and
+ * least recently accessed to the highest priority and most recently accessed,
+ * until the total footprint fits into the budget.
+ *
+ * Persistent roots with uncommitted changes (including pending deletion and
+ * undeletion) and pinned ones are never evicted. Since evicting a persistent
+ * root turns its inner objects into zombies, you must pin the persistent roots
+ * whose inner objects are retained outside of CoreObject (e.g. by a UI).
+ * Cross persistent root references to evicted persistent roots are turned into
+ * faults, and transparently reloaded on access.
+ *
+ * To prevent inner objects from being discarded in the middle of an editing
+ * context operation, eviction only happens at the end of a commit, after
+ * handling store changes committed in other editing contexts, or when calling
+ * -evictPersistentRootsIfNeeded explicitly.
+ *
+ * By default, -maxMemoryFootprint is zero and persistent roots are never
+ * evicted.
+ */
+@interface COPersistentRootEvictionPolicy : NSObject
+{
+@private
+    COEditingContext __weak *_editingContext;
+    unsigned long long _maxMemoryFootprint;
+    NSMutableSet *_pinnedPersistentRootUUIDs;
+    NSMutableDictionary *_priorityForPersistentRootUUID;
+    /** Loaded persistent root UUID to eviction entry */
+    NSMutableDictionary *_entryForPersistentRootUUID;
+    unsigned long long _currentMemoryFootprint;
+    uint64_t _accessCount;
+    BOOL _evicting;
+    NSUInteger _numberOfEvictionPasses;
+    NSUInteger _numberOfEvictedPersistentRoots;
+    unsigned long long _evictedMemoryFootprint;
+    unsigned long long _peakMemoryFootprint;
+}
+
+
+/** @taskunit Memory Budget */
+
+
+/**
+ * The maximum memory footprint of the loaded persistent roots, in bytes.
+ *
+ * The footprint is a rough estimate, and includes persistent roots which
+ * cannot be evicted (e.g. pinned ones), so the memory budget can be exceeded.
+ *
+ * Setting a zero budget disables eviction.
+ *
+ * By default, returns 0.
+ */
+@property (nonatomic, readwrite, assign) unsigned long long maxMemoryFootprint;
+/**
+ * Returns the estimated memory footprint of the loaded persistent roots, in
+ * bytes.
+ */
+@property (nonatomic, readonly) unsigned long long currentMemoryFootprint;
+/**
+ * Unloads persistent roots until -currentMemoryFootprint fits into
+ * -maxMemoryFootprint, or no more persistent roots can be evicted.
+ *
+ * Returns the number of evicted persistent roots.
+ *
+ * You must not call this method while accessing inner objects that belong to
+ * persistent roots which are not pinned.
+ */
+- (NSUInteger)evictPersistentRootsIfNeeded;
+
+
+/** @taskunit Pinning and Priorities */
+
+
+/**
+ * Prevents the given persistent root from being evicted, until
+ * -unpinPersistentRootUUID: is called.
+ *
+ * The persistent root doesn't need to be loaded, and pinning persists across
+ * unloading and reloading.
+ */
+- (void)pinPersistentRootUUID: (ETUUID *)aUUID;
+/**
+ * Allows the given persistent root to be evicted again.
+ */
+- (void)unpinPersistentRootUUID: (ETUUID *)aUUID;
+/**
+ * Returns whether the given persistent root is pinned.
+ */
+- (BOOL)isPersistentRootUUIDPinned: (ETUUID *)aUUID;
+/**
+ * Returns the pinned persistent root UUIDs.
+ */
+@property (nonatomic, readonly) NSSet<ETUUID *> *pinnedPersistentRootUUIDs;
+/**
+ * Sets a hint to decide when the given persistent root should be evicted,
+ * relative to other persistent roots.
+ *
+ * The persistent root doesn't need to be loaded, and the priority persists
+ * across unloading and reloading.
+ */
+- (void)setPriority: (COPersistentRootEvictionPriority)aPriority
+forPersistentRootUUID: (ETUUID *)aUUID;
+/**
+ * Returns the eviction priority of the given persistent root.
+ *
+ * By default, returns COPersistentRootEvictionPriorityNormal.
+ */
+- (COPersistentRootEvictionPriority)priorityForPersistentRootUUID: (ETUUID *)aUUID;
+
+
+/** @taskunit Statistics */
+
+
+/**
+ * The number of times the memory budget was exceeded, and persistent roots
+ * were considered for eviction.
+ */
+@property (nonatomic, readonly) NSUInteger numberOfEvictionPasses;
+/**
+ * The number of unloaded persistent roots.
+ */
+@property (nonatomic, readonly) NSUInteger numberOfEvictedPersistentRoots;
+/**
+ * The sum of the estimated memory footprints of the unloaded persistent roots.
+ */
+@property (nonatomic, readonly) unsigned long long evictedMemoryFootprint;
+/**
+ * The highest -currentMemoryFootprint observed at the beginning of an eviction
+ * pass, or when a persistent root footprint changes.
+ */
+@property (nonatomic, readonly) unsigned long long peakMemoryFootprint;
+/**
+ * Resets the statistics to zero.
+ */
+- (void)resetStatistics;
+
+
+/** @taskunit Framework Private */
+
+
+- (instancetype)initWithEditingContext: (COEditingContext *)aContext NS_DESIGNATED_INITIALIZER;
+/**
+ * Tells the receiver the given persistent root has been loaded.
+ */
+- (void)didLoadPersistentRoot: (COPersistentRoot *)aPersistentRoot;
+/**
+ * Tells the receiver the given persistent root has been unloaded.
+ */
+- (void)didUnloadPersistentRoot: (COPersistentRoot *)aPersistentRoot;
+/**
+ * Tells the receiver the given persistent root has been accessed, and should
+ * be evicted after the persistent roots accessed before it.
+ */
+- (void)didAccessPersistentRoot: (COPersistentRoot *)aPersistentRoot;
+/**
+ * Tells the receiver the content of the given persistent root has changed
+ * (e.g. unfaulted, committed or reloaded), so its memory footprint must be
+ * estimated again.
+ */
+- (void)didChangePersistentRoot: (COPersistentRoot *)aPersistentRoot;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,263 @@
+/**
+    Copyright (C) 2016 Quentin Mathe
+
+    Date:  October 2016
+    License:  MIT  (see COPYING)
+ */
+
+#import "COPersistentRootEvictionPolicy.h"
+#import "COEditingContext.h"
+#import "COPersistentRoot.h"
+#import "COPersistentRoot+Private.h"
+
+/**
+ * The eviction state of a loaded persistent root.
+ */
+@interface COPersistentRootEvictionEntry : NSObject
+{
+    @public
+    COPersistentRoot __weak *persistentRoot;
+    unsigned long long memoryFootprint;
+    uint64_t lastAccess;
+}
+@end
+
+@implementation COPersistentRootEvictionEntry
+@end
+
+
+@implementation COPersistentRootEvictionPolicy
+
+@synthesize maxMemoryFootprint = _maxMemoryFootprint, currentMemoryFootprint = _currentMemoryFootprint;
+@synthesize numberOfEvictionPasses = _numberOfEvictionPasses;
+@synthesize numberOfEvictedPersistentRoots = _numberOfEvictedPersistentRoots;
+@synthesize evictedMemoryFootprint = _evictedMemoryFootprint, peakMemoryFootprint = _peakMemoryFootprint;
+
+#pragma mark Initialization -
+
+- (instancetype)initWithEditingContext: (COEditingContext *)aContext
+{
+    NILARG_EXCEPTION_TEST(aContext);
+    SUPERINIT;
+    _editingContext = aContext;
+    _pinnedPersistentRootUUIDs = [NSMutableSet new];
+    _priorityForPersistentRootUUID = [NSMutableDictionary new];
+    _entryForPersistentRootUUID = [NSMutableDictionary new];
+    return self;
+}
+
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wnonnull"
+
+- (instancetype)init
+{
+    return [self initWithEditingContext: nil];
+}
+
+#pragma clang diagnostic pop
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat: @"<%@ %p - footprint: %llu/%llu bytes, loaded: %lu, pinned: %lu, "
+                                        "evicted: %lu (%llu bytes) in %lu passes>",
+        NSStringFromClass([self class]), self, _currentMemoryFootprint, _maxMemoryFootprint,
+        (unsigned long)_entryForPersistentRootUUID.count, (unsigned long)_pinnedPersistentRootUUIDs.count,
+        (unsigned long)_numberOfEvictedPersistentRoots, _evictedMemoryFootprint,
+        (unsigned long)_numberOfEvictionPasses];
+}
+
+#pragma mark Memory Budget -
+
+- (BOOL)canEvictPersistentRoot: (COPersistentRoot *)aPersistentRoot
+{
+    if (aPersistentRoot == nil || [_pinnedPersistentRootUUIDs containsObject: aPersistentRoot.UUID])
+        return NO;
+
+    if (aPersistentRoot.persistentRootUncommitted || aPersistentRoot.hasChanges)
+        return NO;
+
+    return ![_editingContext.persistentRootsPendingDeletion containsObject: aPersistentRoot]
+        && ![_editingContext.persistentRootsPendingUndeletion containsObject: aPersistentRoot];
+}
+
+- (NSArray *)evictionCandidates
+{
+    NSMutableArray *candidates = [NSMutableArray new];
+
+    for (COPersistentRootEvictionEntry *entry in _entryForPersistentRootUUID.objectEnumerator)
+    {
+        if ([self canEvictPersistentRoot: entry->persistentRoot])
+        {
+            [candidates addObject: entry];
+        }
+    }
+
+    NSDictionary *priorities = _priorityForPersistentRootUUID;
+
+    [candidates sortUsingComparator: ^(COPersistentRootEvictionEntry *entry1, COPersistentRootEvictionEntry *entry2)
+    {
+        NSInteger priority1 = [priorities[entry1->persistentRoot.UUID] integerValue];
+        NSInteger priority2 = [priorities[entry2->persistentRoot.UUID] integerValue];
+
+        if (priority1 != priority2)
+            return (priority1 < priority2 ? NSOrderedAscending : NSOrderedDescending);
+
+        if (entry1->lastAccess != entry2->lastAccess)
+            return (entry1->lastAccess < entry2->lastAccess ? NSOrderedAscending : NSOrderedDescending);
+
+        return NSOrderedSame;
+    }];
+    return candidates;
+}
+
+- (NSUInteger)evictPersistentRootsIfNeeded
+{
+    if (_maxMemoryFootprint == 0 || _currentMemoryFootprint <= _maxMemoryFootprint || _evicting)
+        return 0;
+
+    COEditingContext *editingContext = _editingContext;
+    ETAssert(editingContext != nil);
+    NSUInteger numberOfEvictedPersistentRoots = 0;
+
+    _numberOfEvictionPasses++;
+    _peakMemoryFootprint = MAX(_peakMemoryFootprint, _currentMemoryFootprint);
+    _evicting = YES;
+
+    @try
+    {
+        for (COPersistentRootEvictionEntry *entry in [self evictionCandidates])
+        {
+            if (_currentMemoryFootprint <= _maxMemoryFootprint)
+                break;
+
+            COPersistentRoot *persistentRoot = entry->persistentRoot;
+            unsigned long long memoryFootprint = entry->memoryFootprint;
+
+            // Will call -didUnloadPersistentRoot:
+            [editingContext unloadPersistentRoot: persistentRoot];
+
+            _evictedMemoryFootprint += memoryFootprint;
+            numberOfEvictedPersistentRoots++;
+        }
+    }
+    @finally
+    {
+        _evicting = NO;
+    }
+
+    _numberOfEvictedPersistentRoots += numberOfEvictedPersistentRoots;
+    return numberOfEvictedPersistentRoots;
+}
+
+#pragma mark Pinning and Priorities -
+
+- (void)pinPersistentRootUUID: (ETUUID *)aUUID
+{
+    NILARG_EXCEPTION_TEST(aUUID);
+    [_pinnedPersistentRootUUIDs addObject: aUUID];
+}
+
+- (void)unpinPersistentRootUUID: (ETUUID *)aUUID
+{
+    NILARG_EXCEPTION_TEST(aUUID);
+    [_pinnedPersistentRootUUIDs removeObject: aUUID];
+}
+
+- (BOOL)isPersistentRootUUIDPinned: (ETUUID *)aUUID
+{
+    return [_pinnedPersistentRootUUIDs containsObject: aUUID];
+}
+
+- (NSSet *)pinnedPersistentRootUUIDs
+{
+    return [_pinnedPersistentRootUUIDs copy];
+}
+
+- (void)setPriority: (COPersistentRootEvictionPriority)aPriority
+forPersistentRootUUID: (ETUUID *)aUUID
+{
+    NILARG_EXCEPTION_TEST(aUUID);
+
+    if (aPriority == COPersistentRootEvictionPriorityNormal)
+    {
+        [_priorityForPersistentRootUUID removeObjectForKey: aUUID];
+    }
+    else
+    {
+        _priorityForPersistentRootUUID[aUUID] = @(aPriority);
+    }
+}
+
+- (COPersistentRootEvictionPriority)priorityForPersistentRootUUID: (ETUUID *)aUUID
+{
+    return [_priorityForPersistentRootUUID[aUUID] integerValue];
+}
+
+#pragma mark Statistics -
+
+- (void)resetStatistics
+{
+    _numberOfEvictionPasses = 0;
+    _numberOfEvictedPersistentRoots = 0;
+    _evictedMemoryFootprint = 0;
+    _peakMemoryFootprint = _currentMemoryFootprint;
+}
+
+#pragma mark Tracking Loaded Persistent Roots -
+
+- (void)updateMemoryFootprintForEntry: (COPersistentRootEvictionEntry *)entry
+{
+    unsigned long long memoryFootprint = entry->persistentRoot.estimatedMemoryFootprint;
+
+    _currentMemoryFootprint = _currentMemoryFootprint - entry->memoryFootprint + memoryFootprint;
+    _peakMemoryFootprint = MAX(_peakMemoryFootprint, _currentMemoryFootprint);
+    entry->memoryFootprint = memoryFootprint;
+}
+
+- (void)didLoadPersistentRoot: (COPersistentRoot *)aPersistentRoot
+{
+    NILARG_EXCEPTION_TEST(aPersistentRoot);
+    ETAssert(_entryForPersistentRootUUID[aPersistentRoot.UUID] == nil);
+    COPersistentRootEvictionEntry *entry = [COPersistentRootEvictionEntry new];
+
+    entry->persistentRoot = aPersistentRoot;
+    entry->lastAccess = ++_accessCount;
+    _entryForPersistentRootUUID[aPersistentRoot.UUID] = entry;
+
+    [self updateMemoryFootprintForEntry: entry];
+}
+
+- (void)didUnloadPersistentRoot: (COPersistentRoot *)aPersistentRoot
+{
+    NILARG_EXCEPTION_TEST(aPersistentRoot);
+    COPersistentRootEvictionEntry *entry = _entryForPersistentRootUUID[aPersistentRoot.UUID];
+
+    if (entry == nil)
+        return;
+
+    _currentMemoryFootprint -= entry->memoryFootprint;
+    [_entryForPersistentRootUUID removeObjectForKey: aPersistentRoot.UUID];
+}
+
+- (void)didAccessPersistentRoot: (COPersistentRoot *)aPersistentRoot
+{
+    COPersistentRootEvictionEntry *entry = _entryForPersistentRootUUID[aPersistentRoot.UUID];
+
+    if (entry == nil)
+        return;
+
+    entry->lastAccess = ++_accessCount;
+}
+
+- (void)didChangePersistentRoot: (COPersistentRoot *)aPersistentRoot
+{
+    COPersistentRootEvictionEntry *entry = _entryForPersistentRootUUID[aPersistentRoot.UUID];
+
+    if (entry == nil)
+        return;
+
+    entry->lastAccess = ++_accessCount;
+    [self updateMemoryFootprintForEntry: entry];
+}
+
+@end
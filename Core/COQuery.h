@@ -0,0 +1,169 @@
+/**
+    Copyright (C) 2016 Quentin Mathe
+
+    Date:  October 2016
+    License:  MIT  (see COPYING)
+ */
+
+#import <Foundation/Foundation.h>
+
+@class COEditingContext, COObject;
+
+NS_ASSUME_NONNULL_BEGIN
+
+/**
+ * @group Search
+ * @abstract A query object to search the inner objects in an editing context,
+ * either in memory or with the store search indexes.
+ *
+ * A query is a tree whose leaves are property, full-text or predicate queries,
+ * and whose nodes combine their subqueries with AND or OR.
+ *
+ * When executed with -enumerateResultsInEditingContext:usingBlock:, the
+ * leaves that can be evaluated with the store indexes are turned into SQL
+ * queries, to narrow the persistent roots to load and search in memory:
+ *
+ * <deflist>
+ * <term>+queryWithProperty:value: and +queryWithProperty:minimumValue:maximumValue:</term>
+ * <desc>use -[COSQLiteStore searchResultsForProperty:minimumValue:maximumValue:],
+ * when the property is indexed for all the entities that declare it (see
+ * -[ETPropertyDescription indexedInStore])</desc>
+ * <term>+queryWithText:</term>
+ * <desc>uses -[COSQLiteStore currentSearchResultsForQuery:]</desc>
+ * <term>+queryWithPredicate:</term>
+ * <desc>uses the store indexes for comparisons between an indexed property
+ * and a constant (including compound predicates)</desc>
+ * </deflist>
+ *
+ * Other leaves are only evaluated in memory. Since the store only knows about
+ * the committed changes, the results are always checked in memory with
+ * -evaluateWithObject:, and the persistent roots with uncommitted changes are
+ * always searched in memory.
+ *
+ * Whether the store indexes are used is decided per execution with a simple
+ * cost model, see -prefersStoreEvaluationInEditingContext:.
+ */
+@interface COQuery : NSObject <NSCopying>
+
+
+/** @taskunit Initialization */
+
+
+/**
+ * Returns a query that matches the inner objects whose property is equal to
+ * the given value.
+ *
+ * The property value is compared in its serialized representation (see
+ * -[COObject storeItem]), e.g. a URL is compared as a string for COBookmark.
+ *
+ * For a multivalued property, matches if any element is equal to the value.
+ *
+ * For a nil property or value, raises an NSInvalidArgumentException.
+ */
++ (COQuery *)queryWithProperty: (NSString *)aProperty
+                         value: (id)aValue;
+/**
+ * Returns a query that matches the inner objects whose property is in the
+ * range [minValue, maxValue].
+ *
+ * A nil bound means the range is unbounded on this side. Values whose type
+ * differs from the bounds never match.
+ *
+ * For a nil property, raises an NSInvalidArgumentException.
+ */
++ (COQuery *)queryWithProperty: (NSString *)aProperty
+                  minimumValue: (nullable id)minValue
+                  maximumValue: (nullable id)maxValue;
+/**
+ * Returns a query that matches the inner objects whose full-text search
+ * content contains the given text (ignoring case).
+ *
+ * In the store, the FTS index on current revisions is searched with the same
+ * words (so FTS query syntax is not supported).
+ *
+ * For a nil text, raises an NSInvalidArgumentException.
+ */
++ (COQuery *)queryWithText: (NSString *)aText;
+/**
+ * Returns a query that matches the inner objects for which the predicate is
+ * evaluated to YES.
+ *
+ * For a nil predicate, raises an NSInvalidArgumentException.
+ */
++ (COQuery *)queryWithPredicate: (NSPredicate *)aPredicate;
+/**
+ * Returns a query that matches the inner objects matched by all the given
+ * queries.
+ *
+ * For a nil or empty array, raises an NSInvalidArgumentException.
+ */
++ (COQuery *)queryMatchingAllOfQueries: (NSArray<COQuery *> *)queries;
+/**
+ * Returns a query that matches the inner objects matched by any of the given
+ * queries.
+ *
+ * For a nil or empty array, raises an NSInvalidArgumentException.
+ */
++ (COQuery *)queryMatchingAnyOfQueries: (NSArray<COQuery *> *)queries;
+
+
+/** @taskunit Evaluation */
+
+
+/**
+ * Returns whether the inner object matches the receiver, by evaluating the
+ * receiver in memory.
+ */
+- (BOOL)evaluateWithObject: (COObject *)anObject;
+/**
+ * Returns the inner objects that match the receiver in the given array.
+ */
+- (NSArray *)filteredArrayUsingQuery: (NSArray<COObject *> *)objects;
+
+
+/** @taskunit Execution */
+
+
+/**
+ * Searches the non-deleted persistent roots in the editing context, and calls
+ * the block with each matching inner object.
+ *
+ * The results are delivered as soon as each persistent root is searched,
+ * without waiting for the other persistent roots to be loaded. Setting stop
+ * to YES in the block ends the search, and prevents loading the persistent
+ * roots that remain to be searched.
+ *
+ * The results are not ordered.
+ */
+- (void)enumerateResultsInEditingContext: (COEditingContext *)aContext
+                              usingBlock: (void (^)(COObject *object, BOOL *stop))aBlock;
+/**
+ * Returns the inner objects that match the receiver in the non-deleted
+ * persistent roots of the editing context.
+ *
+ * See -enumerateResultsInEditingContext:usingBlock:.
+ */
+- (NSArray<COObject *> *)resultsInEditingContext: (COEditingContext *)aContext;
+
+
+/** @taskunit Query Planning */
+
+
+/**
+ * Returns whether the store indexes are used to narrow the persistent roots
+ * to search, when executing the receiver in the given editing context.
+ *
+ * Loading persistent roots is considered much more expensive than searching
+ * loaded ones in memory or querying the store indexes. The cost to search
+ * all the persistent roots in memory is compared to the cost of the index
+ * queries, plus the cost to search the persistent roots estimated to match
+ * (based on a selectivity per query type).
+ *
+ * As a result, when all the persistent roots are already loaded, the store
+ * indexes are usually not used.
+ */
+- (BOOL)prefersStoreEvaluationInEditingContext: (COEditingContext *)aContext;
+
+@end
+
+NS_ASSUME_NONNULL_END
@@ -0,0 +1,942 @@
+/*
+    Copyright (C) 2016 Quentin Mathe
+
+    Date:  October 2016
+    License:  MIT  (see COPYING)
+ */
+
+#import "COQuery.h"
+#import "COEditingContext.h"
+#import "COPersistentRoot.h"
+#import "COPersistentRoot+Private.h"
+#import "COObjectGraphContext.h"
+#import "COObject.h"
+#import "COSerialization.h"
+#import "COMetamodel.h"
+#import "COSQLiteStore.h"
+#import "COSearchResult.h"
+#import "COItem.h"
+
+/* Cost model used by -prefersStoreEvaluationInEditingContext: (the units are
+   arbitrary, only the ratios matter) */
+
+/** Cost to load a persistent root object graph from the store */
+static const double COQueryLoadCost = 100;
+/** Cost to search the inner objects of a loaded persistent root in memory */
+static const double COQueryScanCost = 1;
+/** Cost to run a SQL query against an index */
+static const double COQueryIndexLookupCost = 10;
+
+/**
+ * Compares two values in their serialized representation, the same way than
+ * SQLite for the values stored in the indexes.
+ *
+ * Returns NO if the values cannot be compared (e.g. a number and a string).
+ */
+static BOOL COQueryCompareValues(id value, id otherValue, NSComparisonResult *result)
+{
+    if ([value isKindOfClass: [NSNumber class]] && [otherValue isKindOfClass: [NSNumber class]])
+    {
+        *result = [value compare: otherValue];
+        return YES;
+    }
+    else if ([value isKindOfClass: [NSString class]] && [otherValue isKindOfClass: [NSString class]])
+    {
+        *result = [value compare: otherValue options: NSLiteralSearch];
+        return YES;
+    }
+    else if ([value isKindOfClass: [NSData class]] && [otherValue isKindOfClass: [NSData class]])
+    {
+        const NSUInteger length = MIN([value length], [otherValue length]);
+        const int order = memcmp([value bytes], [otherValue bytes], length);
+
+        if (order != 0)
+        {
+            *result = (order < 0 ? NSOrderedAscending : NSOrderedDescending);
+        }
+        else if ([value length] != [otherValue length])
+        {
+            *result = ([value length] < [otherValue length] ? NSOrderedAscending : NSOrderedDescending);
+        }
+        else
+        {
+            *result = NSOrderedSame;
+        }
+        return YES;
+    }
+    return NO;
+}
+
+static BOOL COQueryValueIsInRange(id value, id minValue, id maxValue)
+{
+    NSComparisonResult result;
+
+    if (minValue != nil)
+    {
+        if (!COQueryCompareValues(value, minValue, &result) || result == NSOrderedAscending)
+            return NO;
+    }
+    if (maxValue != nil)
+    {
+        if (!COQueryCompareValues(value, maxValue, &result) || result == NSOrderedDescending)
+            return NO;
+    }
+    return YES;
+}
+
+/**
+ * Returns the words in the text, split and lowercased the same way than the
+ * FTS simple tokenizer.
+ *
+ * The simple tokenizer only knows ASCII: any non-alphanumeric ASCII character
+ * is a separator, while non-ASCII characters (including punctuation and
+ * spaces) belong to words, and only ASCII letters are lowercased.
+ */
+static NSSet *COQueryWordsInText(NSString *aText)
+{
+    NSMutableSet *words = [NSMutableSet set];
+    NSMutableString *word = [NSMutableString string];
+    const NSUInteger length = aText.length;
+
+    for (NSUInteger i = 0; i <= length; i++)
+    {
+        const unichar c = (i < length ? [aText characterAtIndex: i] : ' ');
+
+        if (c >= 0x80 || isalnum(c))
+        {
+            const unichar lowercaseChar = (c < 0x80 ? tolower(c) : c);
+
+            [word appendString: [NSString stringWithCharacters: &lowercaseChar length: 1]];
+        }
+        else if (word.length > 0)
+        {
+            [words addObject: [word copy]];
+            [word setString: @""];
+        }
+    }
+    return words;
+}
+
+/**
+ * Returns whether the property is declared and indexed in the store for all
+ * the entities that declare it as a persistent attribute.
+ *
+ * If unserializedTypeNames is not nil, the property type must also be among
+ * them (for queries that compare object values rather than serialized ones).
+ */
+static BOOL COQueryIsPropertyIndexedInStore(ETModelDescriptionRepository *repo,
+                                            NSString *aProperty,
+                                            NSSet *unserializedTypeNames)
+{
+    BOOL isDeclared = NO;
+
+    for (ETEntityDescription *entity in repo.entityDescriptions)
+    {
+        ETPropertyDescription *propertyDesc = [entity propertyDescriptionForName: aProperty];
+
+        if (propertyDesc == nil || !propertyDesc.persistent || propertyDesc.isRelationship)
+            continue;
+
+        if (!propertyDesc.indexedInStore)
+            return NO;
+
+        if (unserializedTypeNames != nil && ![unserializedTypeNames containsObject: propertyDesc.type.name])
+            return NO;
+
+        isDeclared = YES;
+    }
+    return isDeclared;
+}
+
+/**
+ * Returns the candidates for the search results, see
+ * -candidatesInEditingContext:.
+ */
+static NSMutableDictionary *COQueryCandidatesForSearchResults(NSArray *searchResults)
+{
+    NSMutableDictionary *candidates = [NSMutableDictionary dictionary];
+
+    for (COSearchResult *result in searchResults)
+    {
+        if (result.innerObjectUUID == nil)
+        {
+            candidates[result.persistentRoot] = [NSNull null];
+            continue;
+        }
+
+        NSMutableSet *innerObjectUUIDs = candidates[result.persistentRoot];
+
+        if ((id)innerObjectUUIDs == [NSNull null])
+            continue;
+
+        if (innerObjectUUIDs == nil)
+        {
+            innerObjectUUIDs = [NSMutableSet set];
+            candidates[result.persistentRoot] = innerObjectUUIDs;
+        }
+        [innerObjectUUIDs addObject: result.innerObjectUUID];
+    }
+    return candidates;
+}
+
+
+@interface COQuery ()
+
+/**
+ * Returns the persistent root UUIDs that can contain matching inner objects,
+ * based on the store indexes, with either the candidate inner object UUIDs as
+ * a set or NSNull (any inner object can match) as value.
+ *
+ * Returns nil when the receiver cannot be evaluated with the store indexes.
+ */
+- (NSDictionary *)candidatesInEditingContext: (COEditingContext *)aContext;
+/**
+ * Returns the estimated fraction of persistent roots returned by
+ * -candidatesInEditingContext:, or 1 when it returns nil.
+ */
+- (double)selectivityInEditingContext: (COEditingContext *)aContext;
+/**
+ * Returns the number of SQL queries run by -candidatesInEditingContext:.
+ */
+- (NSUInteger)numberOfStoreQueriesInEditingContext: (COEditingContext *)aContext;
+
+@end
+
+
+@interface COPropertyQuery : COQuery
+{
+    @public
+    NSString *_property;
+    id _minValue;
+    id _maxValue;
+    /**
+     * For queries compiled from predicates, the types whose object values are
+     * equal to the serialized values.
+     */
+    NSSet *_unserializedTypeNames;
+}
+@end
+
+@interface COTextQuery : COQuery
+{
+    NSString *_text;
+    NSSet *_words;
+}
+
+- (instancetype)initWithText: (NSString *)aText NS_DESIGNATED_INITIALIZER;
+
+@end
+
+@interface COPredicateQuery : COQuery
+{
+    NSPredicate *_predicate;
+    /** The query used to narrow the candidates in the store, or nil */
+    COQuery *_storeQuery;
+}
+
+- (instancetype)initWithPredicate: (NSPredicate *)aPredicate NS_DESIGNATED_INITIALIZER;
+
+@end
+
+@interface COCompoundQuery : COQuery
+{
+    @public
+    NSArray *_subqueries;
+    BOOL _matchesAll;
+}
+@end
+
+
+@implementation COQuery
+
+#pragma mark Initialization -
+
++ (COQuery *)queryWithProperty: (NSString *)aProperty
+                         value: (id)aValue
+{
+    NILARG_EXCEPTION_TEST(aValue);
+    return [self queryWithProperty: aProperty minimumValue: aValue maximumValue: aValue];
+}
+
++ (COQuery *)queryWithProperty: (NSString *)aProperty
+                  minimumValue: (id)minValue
+                  maximumValue: (id)maxValue
+{
+    NILARG_EXCEPTION_TEST(aProperty);
+    COPropertyQuery *query = [COPropertyQuery new];
+
+    query->_property = [aProperty copy];
+    query->_minValue = [minValue copy];
+    query->_maxValue = [maxValue copy];
+    return query;
+}
+
++ (COQuery *)queryWithText: (NSString *)aText
+{
+    return [[COTextQuery alloc] initWithText: aText];
+}
+
++ (COQuery *)queryWithPredicate: (NSPredicate *)aPredicate
+{
+    return [[COPredicateQuery alloc] initWithPredicate: aPredicate];
+}
+
++ (COQuery *)queryWithSubqueries: (NSArray *)queries
+                      matchesAll: (BOOL)matchesAll
+{
+    NILARG_EXCEPTION_TEST(queries);
+    INVALIDARG_EXCEPTION_TEST(queries, queries.count > 0);
+    COCompoundQuery *query = [COCompoundQuery new];
+
+    query->_subqueries = [queries copy];
+    query->_matchesAll = matchesAll;
+    return query;
+}
+
++ (COQuery *)queryMatchingAllOfQueries: (NSArray *)queries
+{
+    return [self queryWithSubqueries: queries matchesAll: YES];
+}
+
++ (COQuery *)queryMatchingAnyOfQueries: (NSArray *)queries
+{
+    return [self queryWithSubqueries: queries matchesAll: NO];
+}
+
+- (id)copyWithZone: (NSZone *)aZone
+{
+    // Immutable
+    return self;
+}
+
+#pragma mark Evaluation -
+
+- (BOOL)evaluateWithObject: (COObject *)anObject
+{
+    [self doesNotRecognizeSelector: _cmd];
+    return NO;
+}
+
+- (NSArray *)filteredArrayUsingQuery: (NSArray *)objects
+{
+    NSMutableArray *results = [NSMutableArray array];
+
+    for (COObject *object in objects)
+    {
+        if ([self evaluateWithObject: object])
+        {
+            [results addObject: object];
+        }
+    }
+    return results;
+}
+
+#pragma mark Query Planning -
+
+- (NSDictionary *)candidatesInEditingContext: (COEditingContext *)aContext
+{
+    return nil;
+}
+
+- (double)selectivityInEditingContext: (COEditingContext *)aContext
+{
+    return 1;
+}
+
+- (NSUInteger)numberOfStoreQueriesInEditingContext: (COEditingContext *)aContext
+{
+    return 0;
+}
+
+- (BOOL)prefersStoreEvaluationInEditingContext: (COEditingContext *)aContext
+{
+    NILARG_EXCEPTION_TEST(aContext);
+    const double selectivity = [self selectivityInEditingContext: aContext];
+
+    if (selectivity >= 1)
+        return NO;
+
+    NSUInteger numberOfLoadedPersistentRoots = 0;
+
+    for (COPersistentRoot *persistentRoot in aContext.loadedPersistentRoots)
+    {
+        if (persistentRoot.objectGraphContextWithoutUnfaulting != nil)
+        {
+            numberOfLoadedPersistentRoots++;
+        }
+    }
+
+    const NSUInteger numberOfPersistentRoots =
+        aContext.store.persistentRootUUIDs.count + aContext.persistentRootsPendingInsertion.count;
+    const NSUInteger numberOfUnloadedPersistentRoots =
+        (numberOfPersistentRoots > numberOfLoadedPersistentRoots
+            ? numberOfPersistentRoots - numberOfLoadedPersistentRoots : 0);
+
+    const double memoryCost = numberOfUnloadedPersistentRoots * COQueryLoadCost
+        + numberOfLoadedPersistentRoots * COQueryScanCost;
+    const double storeCost = [self numberOfStoreQueriesInEditingContext: aContext] * COQueryIndexLookupCost
+        + selectivity * memoryCost;
+
+    return storeCost < memoryCost;
+}
+
+#pragma mark Execution -
+
+/**
+ * Returns the persistent roots to search with their candidate inner object
+ * UUIDs as a set or NSNull (all the inner objects must be searched).
+ */
+- (NSMapTable *)persistentRootsToSearchInEditingContext: (COEditingContext *)aContext
+{
+    NSMapTable *persistentRoots = [NSMapTable strongToStrongObjectsMapTable];
+    NSDictionary *candidates = nil;
+
+    if ([self prefersStoreEvaluationInEditingContext: aContext])
+    {
+        candidates = [self candidatesInEditingContext: aContext];
+    }
+
+    if (candidates == nil)
+    {
+        for (COPersistentRoot *persistentRoot in aContext.persistentRoots)
+        {
+            [persistentRoots setObject: [NSNull null] forKey: persistentRoot];
+        }
+        return persistentRoots;
+    }
+
+    for (ETUUID *persistentRootUUID in candidates)
+    {
+        COPersistentRoot *persistentRoot = [aContext persistentRootForUUID: persistentRootUUID];
+
+        if (persistentRoot == nil || persistentRoot.deleted)
+            continue;
+
+        [persistentRoots setObject: candidates[persistentRootUUID] forKey: persistentRoot];
+    }
+
+    // The store indexes don't know about uncommitted changes
+    for (COPersistentRoot *persistentRoot in aContext.loadedPersistentRoots)
+    {
+        if (persistentRoot.deleted || persistentRoot.objectGraphContextWithoutUnfaulting == nil)
+            continue;
+
+        if (persistentRoot.hasChanges || persistentRoot.persistentRootUncommitted)
+        {
+            [persistentRoots setObject: [NSNull null] forKey: persistentRoot];
+        }
+    }
+    return persistentRoots;
+}
+
+- (void)enumerateResultsInEditingContext: (COEditingContext *)aContext
+                              usingBlock: (void (^)(COObject *object, BOOL *stop))aBlock
+{
+    NILARG_EXCEPTION_TEST(aContext);
+    NILARG_EXCEPTION_TEST(aBlock);
+    NSMapTable *persistentRoots = [self persistentRootsToSearchInEditingContext: aContext];
+    BOOL stop = NO;
+
+    for (COPersistentRoot *persistentRoot in persistentRoots)
+    {
+        id innerObjectUUIDs = [persistentRoots objectForKey: persistentRoot];
+        COObjectGraphContext *objectGraphContext = persistentRoot.objectGraphContext;
+        NSMutableArray *objects = [NSMutableArray array];
+
+        if (innerObjectUUIDs == [NSNull null])
+        {
+            [objects addObjectsFromArray: objectGraphContext.loadedObjects];
+        }
+        else
+        {
+            for (ETUUID *UUID in innerObjectUUIDs)
+            {
+                COObject *object = [objectGraphContext loadedObjectForUUID: UUID];
+
+                if (object != nil)
+                {
+                    [objects addObject: object];
+                }
+            }
+        }
+
+        for (COObject *object in objects)
+        {
+            if (![self evaluateWithObject: object])
+                continue;
+
+            aBlock(object, &stop);
+
+            if (stop)
+                return;
+        }
+    }
+}
+
+- (NSArray *)resultsInEditingContext: (COEditingContext *)aContext
+{
+    NSMutableArray *results = [NSMutableArray array];
+
+    [self enumerateResultsInEditingContext: aContext
+                                usingBlock: ^(COObject *object, BOOL *stop)
+    {
+        [results addObject: object];
+    }];
+    return results;
+}
+
+@end
+
+
+@implementation COPropertyQuery
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat: @"%@ in [%@, %@]", _property, _minValue, _maxValue];
+}
+
+- (BOOL)evaluateWithObject: (COObject *)anObject
+{
+    COItem *item = anObject.storeItem;
+    const COType type = [item typeForAttribute: _property];
+
+    if (type == 0)
+        return NO;
+
+    id value = [item valueForAttribute: _property];
+    id <NSFastEnumeration> values = (COTypeIsMultivalued(type) ? value : @[value]);
+
+    for (id element in values)
+    {
+        if (COQueryValueIsInRange(element, _minValue, _maxValue))
+            return YES;
+    }
+    return NO;
+}
+
+- (BOOL)isIndexedInEditingContext: (COEditingContext *)aContext
+{
+    return COQueryIsPropertyIndexedInStore(aContext.modelDescriptionRepository,
+                                           _property,
+                                           _unserializedTypeNames);
+}
+
+- (NSDictionary *)candidatesInEditingContext: (COEditingContext *)aContext
+{
+    if (![self isIndexedInEditingContext: aContext])
+        return nil;
+
+    NSArray *results = [aContext.store searchResultsForProperty: _property
+                                                   minimumValue: _minValue
+                                                   maximumValue: _maxValue];
+
+    return COQueryCandidatesForSearchResults(results);
+}
+
+- (double)selectivityInEditingContext: (COEditingContext *)aContext
+{
+    if (![self isIndexedInEditingContext: aContext])
+        return 1;
+
+    return (_minValue != nil && [_minValue isEqual: _maxValue] ? 0.05 : 0.25);
+}
+
+- (NSUInteger)numberOfStoreQueriesInEditingContext: (COEditingContext *)aContext
+{
+    return ([self isIndexedInEditingContext: aContext] ? 1 : 0);
+}
+
+@end
+
+
+@implementation COTextQuery
+
+- (instancetype)initWithText: (NSString *)aText
+{
+    NILARG_EXCEPTION_TEST(aText);
+    SUPERINIT;
+    _text = [aText copy];
+    _words = COQueryWordsInText(aText);
+    return self;
+}
+
+- (instancetype)init
+{
+    return [self initWithText: nil];
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat: @"text contains '%@'", _text];
+}
+
+- (BOOL)evaluateWithObject: (COObject *)anObject
+{
+    NSSet *words = COQueryWordsInText(anObject.storeItem.fullTextSearchContent);
+
+    return [_words isSubsetOfSet: words];
+}
+
+- (NSDictionary *)candidatesInEditingContext: (COEditingContext *)aContext
+{
+    if (_words.isEmpty)
+        return nil;
+
+    // Searching for the words rather than the text prevents FTS syntax errors
+    NSString *query = [_words.allObjects componentsJoinedByString: @" "];
+    NSArray *results = [aContext.store currentSearchResultsForQuery: query];
+
+    return COQueryCandidatesForSearchResults(results);
+}
+
+- (double)selectivityInEditingContext: (COEditingContext *)aContext
+{
+    return (_words.isEmpty ? 1 : 0.1);
+}
+
+- (NSUInteger)numberOfStoreQueriesInEditingContext: (COEditingContext *)aContext
+{
+    return (_words.isEmpty ? 0 : 1);
+}
+
+@end
+
+
+@implementation COPredicateQuery
+
+/**
+ * Returns the types of the properties whose object values are stored as is
+ * (without a custom serialization), and can be compared with the indexed
+ * values.
+ */
++ (NSSet *)unserializedTypeNames
+{
+    return S(@"NSString", @"NSNumber", @"NSInteger", @"NSUInteger", @"BOOL",
+             @"CGFloat", @"double", @"float", @"int", @"NSData");
+}
+
++ (BOOL)isIndexableValue: (id)aValue
+{
+    return [aValue isKindOfClass: [NSString class]]
+        || [aValue isKindOfClass: [NSNumber class]]
+        || [aValue isKindOfClass: [NSData class]];
+}
+
+/**
+ * Returns the constant values in the expression, or nil if the expression is
+ * not constant or contains nil or NSNull.
+ *
+ * Nil values cannot be looked up in the store indexes, so the query is then
+ * evaluated in memory.
+ */
++ (NSArray *)constantValuesForExpression: (NSExpression *)anExpression
+{
+    NSArray *values = nil;
+
+    if (anExpression.expressionType == NSConstantValueExpressionType)
+    {
+        id value = anExpression.constantValue;
+
+        if (value == nil)
+            return nil;
+
+        values = ([value isKindOfClass: [NSArray class]] ? value : @[value]);
+    }
+    else if (anExpression.expressionType == NSAggregateExpressionType)
+    {
+        NSMutableArray *collectedValues = [NSMutableArray array];
+
+        for (NSExpression *expression in anExpression.collection)
+        {
+            if (expression.expressionType != NSConstantValueExpressionType
+                || expression.constantValue == nil)
+            {
+                return nil;
+            }
+            [collectedValues addObject: expression.constantValue];
+        }
+        values = collectedValues;
+    }
+
+    if ([values containsObject: [NSNull null]])
+        return nil;
+
+    return values;
+}
+
+/**
+ * Returns a query matching a superset of the objects that match the
+ * comparison, or nil if the comparison cannot be evaluated in the store.
+ */
++ (COQuery *)storeQueryForComparisonPredicate: (NSComparisonPredicate *)aPredicate
+{
+    if (aPredicate.leftExpression.expressionType != NSKeyPathExpressionType
+        || aPredicate.comparisonPredicateModifier != NSDirectPredicateModifier
+        || aPredicate.options != 0)
+    {
+        return nil;
+    }
+
+    NSString *property = aPredicate.leftExpression.keyPath;
+    NSArray *values = [self constantValuesForExpression: aPredicate.rightExpression];
+
+    if ([property rangeOfString: @"."].location != NSNotFound || values.count == 0)
+        return nil;
+
+    for (id value in values)
+    {
+        if (![self isIndexableValue: value])
+            return nil;
+    }
+
+    id minValue = nil;
+    id maxValue = nil;
+
+    switch (aPredicate.predicateOperatorType)
+    {
+        case NSEqualToPredicateOperatorType:
+            minValue = values.firstObject;
+            maxValue = values.firstObject;
+            break;
+        case NSLessThanPredicateOperatorType:
+        case NSLessThanOrEqualToPredicateOperatorType:
+            maxValue = values.firstObject;
+            break;
+        case NSGreaterThanPredicateOperatorType:
+        case NSGreaterThanOrEqualToPredicateOperatorType:
+            minValue = values.firstObject;
+            break;
+        case NSBetweenPredicateOperatorType:
+            if (values.count != 2)
+                return nil;
+            minValue = values[0];
+            maxValue = values[1];
+            break;
+        default:
+            return nil;
+    }
+
+    COPropertyQuery *query = (COPropertyQuery *)[COQuery queryWithProperty: property
+                                                              minimumValue: minValue
+                                                              maximumValue: maxValue];
+    query->_unserializedTypeNames = [self unserializedTypeNames];
+    return query;
+}
+
++ (COQuery *)storeQueryForPredicate: (NSPredicate *)aPredicate
+{
+    if ([aPredicate isKindOfClass: [NSComparisonPredicate class]])
+    {
+        return [self storeQueryForComparisonPredicate: (NSComparisonPredicate *)aPredicate];
+    }
+    else if (![aPredicate isKindOfClass: [NSCompoundPredicate class]])
+    {
+        return nil;
+    }
+
+    NSCompoundPredicate *compoundPredicate = (NSCompoundPredicate *)aPredicate;
+    const NSCompoundPredicateType type = compoundPredicate.compoundPredicateType;
+    NSMutableArray *subqueries = [NSMutableArray array];
+
+    if (type == NSNotPredicateType)
+        return nil;
+
+    for (NSPredicate *subpredicate in compoundPredicate.subpredicates)
+    {
+        COQuery *subquery = [self storeQueryForPredicate: subpredicate];
+
+        if (subquery == nil && type == NSOrPredicateType)
+            return nil;
+
+        if (subquery != nil)
+        {
+            [subqueries addObject: subquery];
+        }
+    }
+
+    if (subqueries.isEmpty)
+        return nil;
+
+    return (type == NSAndPredicateType ? [COQuery queryMatchingAllOfQueries: subqueries]
+                                       : [COQuery queryMatchingAnyOfQueries: subqueries]);
+}
+
+- (instancetype)initWithPredicate: (NSPredicate *)aPredicate
+{
+    NILARG_EXCEPTION_TEST(aPredicate);
+    SUPERINIT;
+    _predicate = aPredicate;
+    _storeQuery = [[self class] storeQueryForPredicate: aPredicate];
+    return self;
+}
+
+- (instancetype)init
+{
+    return [self initWithPredicate: nil];
+}
+
+- (NSString *)description
+{
+    return _predicate.predicateFormat;
+}
+
+- (BOOL)evaluateWithObject: (COObject *)anObject
+{
+    return [_predicate evaluateWithObject: anObject];
+}
+
+- (NSDictionary *)candidatesInEditingContext: (COEditingContext *)aContext
+{
+    return [_storeQuery candidatesInEditingContext: aContext];
+}
+
+- (double)selectivityInEditingContext: (COEditingContext *)aContext
+{
+    return (_storeQuery != nil ? [_storeQuery selectivityInEditingContext: aContext] : 1);
+}
+
+- (NSUInteger)numberOfStoreQueriesInEditingContext: (COEditingContext *)aContext
+{
+    return [_storeQuery numberOfStoreQueriesInEditingContext: aContext];
+}
+
+@end
+
+
+@implementation COCompoundQuery
+
+- (NSString *)description
+{
+    NSArray *descriptions = (id)[[_subqueries mappedCollection] description];
+    NSString *separator = (_matchesAll ? @") AND (" : @") OR (");
+
+    return [NSString stringWithFormat: @"(%@)", [descriptions componentsJoinedByString: separator]];
+}
+
+- (BOOL)evaluateWithObject: (COObject *)anObject
+{
+    for (COQuery *query in _subqueries)
+    {
+        if ([query evaluateWithObject: anObject] != _matchesAll)
+            return !_matchesAll;
+    }
+    return _matchesAll;
+}
+
+/**
+ * Combines the inner object candidates for a persistent root, where NSNull
+ * means any inner object.
+ */
+- (id)innerObjectUUIDsByCombining: (id)innerObjectUUIDs
+                             with: (id)otherInnerObjectUUIDs
+{
+    if (_matchesAll)
+    {
+        if (innerObjectUUIDs == [NSNull null])
+            return otherInnerObjectUUIDs;
+        if (otherInnerObjectUUIDs == [NSNull null])
+            return innerObjectUUIDs;
+
+        NSMutableSet *intersection = [innerObjectUUIDs mutableCopy];
+        [intersection intersectSet: otherInnerObjectUUIDs];
+        return intersection;
+    }
+    else
+    {
+        if (innerObjectUUIDs == [NSNull null] || otherInnerObjectUUIDs == [NSNull null])
+            return [NSNull null];
+
+        return [innerObjectUUIDs setByAddingObjectsFromSet: otherInnerObjectUUIDs];
+    }
+}
+
+- (NSDictionary *)candidatesInEditingContext: (COEditingContext *)aContext
+{
+    NSMutableDictionary *candidates = nil;
+
+    for (COQuery *query in _subqueries)
+    {
+        NSDictionary *subqueryCandidates = [query candidatesInEditingContext: aContext];
+
+        // A subquery that cannot be narrowed matches anything
+        if (subqueryCandidates == nil)
+        {
+            if (_matchesAll)
+                continue;
+
+            return nil;
+        }
+
+        if (candidates == nil)
+        {
+            candidates = [subqueryCandidates mutableCopy];
+            continue;
+        }
+
+        NSMutableDictionary *combinedCandidates = [NSMutableDictionary dictionary];
+        NSSet *persistentRootUUIDs = nil;
+
+        if (_matchesAll)
+        {
+            NSMutableSet *intersection = [NSMutableSet setWithArray: candidates.allKeys];
+            [intersection intersectSet: [NSSet setWithArray: subqueryCandidates.allKeys]];
+            persistentRootUUIDs = intersection;
+        }
+        else
+        {
+            persistentRootUUIDs = [[NSSet setWithArray: candidates.allKeys]
+                setByAddingObjectsFromArray: subqueryCandidates.allKeys];
+        }
+
+        for (ETUUID *persistentRootUUID in persistentRootUUIDs)
+        {
+            id innerObjectUUIDs = candidates[persistentRootUUID];
+            id otherInnerObjectUUIDs = subqueryCandidates[persistentRootUUID];
+            id combinedInnerObjectUUIDs = nil;
+
+            if (innerObjectUUIDs == nil || otherInnerObjectUUIDs == nil)
+            {
+                combinedInnerObjectUUIDs = (innerObjectUUIDs != nil ? innerObjectUUIDs : otherInnerObjectUUIDs);
+            }
+            else
+            {
+                combinedInnerObjectUUIDs = [self innerObjectUUIDsByCombining: innerObjectUUIDs
+                                                                        with: otherInnerObjectUUIDs];
+            }
+
+            if ([combinedInnerObjectUUIDs isKindOfClass: [NSSet class]] && [combinedInnerObjectUUIDs isEmpty])
+                continue;
+
+            combinedCandidates[persistentRootUUID] = combinedInnerObjectUUIDs;
+        }
+        candidates = combinedCandidates;
+    }
+    return candidates;
+}
+
+- (double)selectivityInEditingContext: (COEditingContext *)aContext
+{
+    double selectivity = (_matchesAll ? 1 : 0);
+
+    for (COQuery *query in _subqueries)
+    {
+        const double subquerySelectivity = [query selectivityInEditingContext: aContext];
+
+        selectivity = (_matchesAll ? selectivity * subquerySelectivity
+                                   : MIN(1, selectivity + subquerySelectivity));
+    }
+    return selectivity;
+}
+
+- (NSUInteger)numberOfStoreQueriesInEditingContext: (COEditingContext *)aContext
+{
+    NSUInteger count = 0;
+
+    for (COQuery *query in _subqueries)
+    {
+        count += [query numberOfStoreQueriesInEditingContext: aContext];
+    }
+    return count;
+}
+
+@end
@@ -9,7 +9,7 @@
 #import <EtoileFoundation/EtoileFoundation.h>
 #import <CoreObject/COTrack.h>
 
-@class COEditingContext, CORevisionInfo, CORevisionCache, COCommitDescriptor;
+@class COEditingContext, CORevisionInfo, CORevisionGraph, CORevisionCache, COCommitDescriptor;
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -36,11 +36,18 @@ NS_ASSUME_NONNULL_BEGIN
  * commit can create multiple revisions or even none.
  *
  * Revisions are immutable.
+ *
+ * The history graph properties (parent revisions, branch, persistent root and
+ * date) are read from the revision graph loaded in bulk by the revision cache,
+ * while the metadata is loaded on demand.
  */
 @interface CORevision : NSObject <COTrackNode>
 {
 @private
     CORevisionCache *__weak _cache;
+    CORevisionGraph *_revisionGraph;
+    int64_t _revid;
+    ETUUID *_UUID;
     CORevisionInfo *_revisionInfo;
 }
 
@@ -129,11 +136,23 @@ NS_ASSUME_NONNULL_BEGIN
  * Initializes and returns a new revision object to represent a precise revision 
  * number in the given revision cache.
  *
- * For a nil cache or revision info, raises a NSInvalidArgumentException.
+ * The revid must exist in the revision graph.
+ *
+ * For a nil cache or revision graph, raises a NSInvalidArgumentException.
  */
 - (instancetype)initWithCache: (CORevisionCache *)aCache
-                 revisionInfo: (CORevisionInfo *)aRevInfo NS_DESIGNATED_INITIALIZER;
-
+                revisionGraph: (CORevisionGraph *)aRevisionGraph
+                        revid: (int64_t)aRevid NS_DESIGNATED_INITIALIZER;
+/**
+ * The revision info that holds the metadata.
+ *
+ * Loaded from the store on first access, unless set before.
+ */
+@property (nonatomic, readwrite, strong, nullable) CORevisionInfo *revisionInfo;
+/**
+ * Returns whether -revisionInfo is loaded, without loading it.
+ */
+@property (nonatomic, readonly, getter=isRevisionInfoLoaded) BOOL revisionInfoLoaded;
 
 @end
 
@@ -9,18 +9,24 @@
 #import "COCommitDescriptor.h"
 #import "CORevisionInfo.h"
 #import "CORevisionCache.h"
+#import "CORevisionGraph.h"
+#import "COEditingContext.h"
+#import "COSQLiteStore.h"
 
 @implementation CORevision
 
 - (instancetype)initWithCache: (CORevisionCache *)aCache
-                 revisionInfo: (CORevisionInfo *)aRevInfo
+                revisionGraph: (CORevisionGraph *)aRevisionGraph
+                        revid: (int64_t)aRevid
 {
     NILARG_EXCEPTION_TEST(aCache);
-    NILARG_EXCEPTION_TEST(aRevInfo);
+    NILARG_EXCEPTION_TEST(aRevisionGraph);
+    INVALIDARG_EXCEPTION_TEST(aRevid, [aRevisionGraph containsRevid: aRevid]);
     SUPERINIT;
     _cache = aCache;
-    _revisionInfo = aRevInfo;
-    assert(_revisionInfo.revisionUUID != nil);
+    _revisionGraph = aRevisionGraph;
+    _revid = aRevid;
+    _UUID = [aRevisionGraph revisionUUIDForRevid: aRevid];
     return self;
 }
 
@@ -29,7 +35,7 @@
 
 - (instancetype)init
 {
-    return [self initWithCache: nil revisionInfo: nil];
+    return [self initWithCache: nil revisionGraph: nil revid: -1];
 }
 
 #pragma clang diagnostic pop
@@ -39,12 +45,12 @@
     if (![rhs isKindOfClass: [CORevision class]])
         return NO;
 
-    return [_revisionInfo.revisionUUID isEqual: ((CORevision *)rhs)->_revisionInfo.revisionUUID];
+    return [_UUID isEqual: ((CORevision *)rhs)->_UUID];
 }
 
 - (NSUInteger)hash
 {
-    return _revisionInfo.revisionUUID.hash;
+    return _UUID.hash;
 }
 
 - (NSArray *)propertyNames
@@ -56,7 +62,7 @@
 
 - (ETUUID *)UUID
 {
-    return _revisionInfo.revisionUUID;
+    return _UUID;
 }
 
 - (CORevisionCache *)cache
@@ -70,39 +76,64 @@
     return _cache;
 }
 
-- (CORevision *)parentRevision
+- (CORevisionInfo *)revisionInfo
 {
-    if (_revisionInfo.parentRevisionUUID == nil)
-        return nil;
+    if (_revisionInfo == nil)
+    {
+        COSQLiteStore *store = [self cache].parentEditingContext.store;
 
-    ETUUID *parentRevID = _revisionInfo.parentRevisionUUID;
-    return [[self cache] revisionForRevisionUUID: parentRevID
-                              persistentRootUUID: _revisionInfo.persistentRootUUID];
+        _revisionInfo = [store revisionInfoForRevisionUUID: _UUID
+                                        persistentRootUUID: self.persistentRootUUID];
+    }
+    return _revisionInfo;
 }
 
-- (CORevision *)mergeParentRevision
+- (void)setRevisionInfo: (CORevisionInfo *)aRevInfo
+{
+    NSParameterAssert(aRevInfo == nil || [aRevInfo.revisionUUID isEqual: _UUID]);
+    _revisionInfo = aRevInfo;
+}
+
+- (BOOL)isRevisionInfoLoaded
+{
+    return _revisionInfo != nil;
+}
+
+/**
+ * Returns nil when the revid is -1 or the revision was deleted by a history
+ * compaction.
+ */
+- (CORevision *)revisionForRevid: (int64_t)aRevid
 {
-    if (_revisionInfo.mergeParentRevisionUUID == nil)
+    if (![_revisionGraph containsRevid: aRevid])
         return nil;
 
-    ETUUID *revID = _revisionInfo.mergeParentRevisionUUID;
-    return [[self cache] revisionForRevisionUUID: revID
-                              persistentRootUUID: _revisionInfo.persistentRootUUID];
+    return [[self cache] revisionForRevid: aRevid revisionGraph: _revisionGraph];
+}
+
+- (CORevision *)parentRevision
+{
+    return [self revisionForRevid: [_revisionGraph parentRevidForRevid: _revid]];
+}
+
+- (CORevision *)mergeParentRevision
+{
+    return [self revisionForRevid: [_revisionGraph mergeParentRevidForRevid: _revid]];
 }
 
 - (ETUUID *)persistentRootUUID
 {
-    return _revisionInfo.persistentRootUUID;
+    return [_revisionGraph persistentRootUUIDForRevid: _revid];
 }
 
 - (ETUUID *)branchUUID
 {
-    return _revisionInfo.branchUUID;
+    return [_revisionGraph branchUUIDForRevid: _revid];
 }
 
 - (NSDate *)date
 {
-    return _revisionInfo.date;
+    return [_revisionGraph dateForRevid: _revid];
 }
 
 // TODO: Implement it in the metadata for the new store
@@ -113,7 +144,7 @@
 
 - (NSDictionary *)metadata
 {
-    return _revisionInfo.metadata;
+    return self.revisionInfo.metadata;
 }
 
 - (COCommitDescriptor *)commitDescriptor
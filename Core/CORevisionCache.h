@@ -8,7 +8,7 @@
 #import <Foundation/Foundation.h>
 #import <EtoileFoundation/ETUUID.h>
 
-@class COEditingContext, CORevision;
+@class COEditingContext, CORevision, CORevisionInfo, CORevisionGraph;
 
 NS_ASSUME_NONNULL_BEGIN
 
@@ -17,6 +17,7 @@ NS_ASSUME_NONNULL_BEGIN
 @private
     COEditingContext __weak *_parentContext;
     NSMutableDictionary *_revisionForRevisionID;
+    NSMutableDictionary *_revisionGraphForPersistentRootUUID;
 }
 
 /** @taskunit Framework Private */
@@ -24,8 +25,39 @@ NS_ASSUME_NONNULL_BEGIN
 @property (nonatomic, readonly, weak) COEditingContext *parentEditingContext;
 
 - (instancetype)initWithParentEditingContext: (COEditingContext *)aCtx NS_DESIGNATED_INITIALIZER;
+/**
+ * Returns the revision, or nil if it doesn't exist in the store.
+ *
+ * On a cache miss, the whole revision graph of the persistent root is loaded
+ * (see -[COSQLiteStore revisionGraphForPersistentRootUUID:]), so walking the
+ * history afterwards doesn't access the store. When the revision graph doesn't
+ * contain a requested revision, only the revisions committed since it was 
+ * loaded are read (see -[COSQLiteStore updateRevisionGraph:forPersistentRootUUID:]).
+ */
 - (nullable CORevision *)revisionForRevisionUUID: (ETUUID *)aRevid
                               persistentRootUUID: (ETUUID *)aPersistentRoot;
+/**
+ * Returns the revision graph of the persistent root, updated if it doesn't
+ * contain the given revision, or nil if the persistent root doesn't exist.
+ */
+- (nullable CORevisionGraph *)revisionGraphForRevisionUUID: (ETUUID *)aRevid
+                                        persistentRootUUID: (ETUUID *)aPersistentRoot;
+/**
+ * Returns the revision in the given revision graph.
+ *
+ * The revid must exist in the revision graph.
+ */
+- (CORevision *)revisionForRevid: (int64_t)aRevid
+                   revisionGraph: (CORevisionGraph *)aRevisionGraph;
+/**
+ * Returns the revision described by the revision info, and attaches the
+ * revision info to it if the metadata is not loaded yet.
+ *
+ * This avoids a store access per revision to read the metadata, when the
+ * revision infos were loaded in bulk, e.g. with
+ * -[COSQLiteStore revisionInfosForBranchUUID:options:].
+ */
+- (nullable CORevision *)revisionForRevisionInfo: (CORevisionInfo *)aRevInfo;
 
 @end
 
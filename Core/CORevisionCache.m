@@ -8,6 +8,8 @@
 #import "CORevisionCache.h"
 #import "CORevision.h"
 #import "COEditingContext.h"
+#import "CORevisionGraph.h"
+#import "CORevisionInfo.h"
 
 @implementation CORevisionCache
 
@@ -19,6 +21,7 @@
     SUPERINIT;
     _parentContext = aCtx;
     _revisionForRevisionID = [[NSMutableDictionary alloc] init];
+    _revisionGraphForPersistentRootUUID = [[NSMutableDictionary alloc] init];
     return self;
 }
 
@@ -32,26 +35,90 @@
 
 #pragma clang diagnostic pop
 
+- (CORevisionGraph *)reloadRevisionGraphForPersistentRootUUID: (ETUUID *)aPersistentRoot
+{
+    COSQLiteStore *store = _parentContext.store;
+    ETAssert(store != nil);
+    CORevisionGraph *graph = [store revisionGraphForPersistentRootUUID: aPersistentRoot];
+
+    if (graph == nil)
+    {
+        [_revisionGraphForPersistentRootUUID removeObjectForKey: aPersistentRoot];
+    }
+    else
+    {
+        _revisionGraphForPersistentRootUUID[aPersistentRoot] = graph;
+    }
+    return graph;
+}
+
+- (CORevisionGraph *)revisionGraphForRevisionUUID: (ETUUID *)aRevid
+                               persistentRootUUID: (ETUUID *)aPersistentRoot
+{
+    ETAssert(_parentContext != nil);
+    CORevisionGraph *graph = _revisionGraphForPersistentRootUUID[aPersistentRoot];
+
+    if ([graph revidForRevisionUUID: aRevid] != -1)
+        return graph;
+
+    // The revision was committed since the graph was loaded, so we only read
+    // the new revisions, otherwise each commit would reload the whole history
+    if (graph != nil && [_parentContext.store updateRevisionGraph: graph
+                                             forPersistentRootUUID: aPersistentRoot])
+    {
+        return graph;
+    }
+    // The graph was never loaded, or a history compaction invalidated it
+    return [self reloadRevisionGraphForPersistentRootUUID: aPersistentRoot];
+}
+
 - (CORevision *)revisionForRevisionUUID: (ETUUID *)aRevid
                      persistentRootUUID: (ETUUID *)aPersistentRoot
 {
     ETAssert(_parentContext != nil);
     CORevision *cached = _revisionForRevisionID[aRevid];
 
+    if (cached != nil)
+        return cached;
+
+    CORevisionGraph *graph = [self revisionGraphForRevisionUUID: aRevid
+                                             persistentRootUUID: aPersistentRoot];
+    int64_t revid = [graph revidForRevisionUUID: aRevid];
+
+    if (revid == -1)
+        return nil;
+
+    return [self revisionForRevid: revid revisionGraph: graph];
+}
+
+- (CORevision *)revisionForRevid: (int64_t)aRevid
+                   revisionGraph: (CORevisionGraph *)aRevisionGraph
+{
+    ETUUID *revisionUUID = [aRevisionGraph revisionUUIDForRevid: aRevid];
+    ETAssert(revisionUUID != nil);
+    CORevision *cached = _revisionForRevisionID[revisionUUID];
+
     if (cached == nil)
     {
-        COSQLiteStore *store = _parentContext.store;
-        ETAssert(store != nil);
-        CORevisionInfo *info = [store revisionInfoForRevisionUUID: aRevid
-                                               persistentRootUUID: aPersistentRoot];
+        cached = [[CORevision alloc] initWithCache: self
+                                     revisionGraph: aRevisionGraph
+                                             revid: aRevid];
+        _revisionForRevisionID[revisionUUID] = cached;
+    }
+    return cached;
+}
 
-        if (info == nil)
-            return nil;
+- (CORevision *)revisionForRevisionInfo: (CORevisionInfo *)aRevInfo
+{
+    NILARG_EXCEPTION_TEST(aRevInfo);
+    CORevision *revision = [self revisionForRevisionUUID: aRevInfo.revisionUUID
+                                      persistentRootUUID: aRevInfo.persistentRootUUID];
 
-        cached = [[CORevision alloc] initWithCache: self revisionInfo: info];
-        _revisionForRevisionID[aRevid] = cached;
+    if (revision != nil && !revision.isRevisionInfoLoaded)
+    {
+        revision.revisionInfo = aRevInfo;
     }
-    return cached;
+    return revision;
 }
 
 @end
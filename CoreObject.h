@@ -12,6 +12,8 @@
 #import <CoreObject/COObject.h>
 #import <CoreObject/COObjectGraphContext.h>
 #import <CoreObject/COPersistentRoot.h>
+#import <CoreObject/COPersistentRootEvictionPolicy.h>
+#import <CoreObject/COQuery.h>
 #import <CoreObject/COBranch.h>
 #import <CoreObject/CORevision.h>
 #import <CoreObject/COSerialization.h>
@@ -62,6 +64,7 @@
 /* Store */
 
 #import <CoreObject/CORevisionInfo.h>
+#import <CoreObject/CORevisionGraph.h>
 #import <CoreObject/COBranchInfo.h>
 #import <CoreObject/COHistoryCompaction.h>
 #import <CoreObject/COPersistentRootInfo.h>
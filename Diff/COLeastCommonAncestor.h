@@ -12,9 +12,19 @@
 
 @interface COEditingContext (CommonAncestor)
 
+/**
+ * Returns the common ancestor of the two revisions, following merge parents
+ * too, or nil if they have no common ancestor.
+ *
+ * See -[CORevisionGraph commonAncestorForRevid:andRevid:].
+ */
 - (ETUUID *)commonAncestorForCommit: (ETUUID *)commitA
                           andCommit: (ETUUID *)commitB
                      persistentRoot: (ETUUID *)persistentRoot;
+/**
+ * Returns whether commitA is equal to commitB or to an ancestor on its
+ * parent chain (merge parents are not followed).
+ */
 - (BOOL)       isRevision: (ETUUID *)commitA
 equalToOrParentOfRevision: (ETUUID *)commitB
            persistentRoot: (ETUUID *)persistentRoot;
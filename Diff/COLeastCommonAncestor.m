@@ -7,87 +7,66 @@
 
 #import "COLeastCommonAncestor.h"
 #import "COEditingContext+Private.h"
+#import "CORevisionGraph.h"
 
 @implementation COEditingContext (CommonAncestor)
 
-- (void)addUUIDAndParents: (ETUUID *)aUUID
-           persistentRoot: (ETUUID *)persistentRoot
-                    toSet: (NSMutableSet *)dest
+/**
+ * Returns the revision graph that contains both revisions, or nil if one
+ * revision doesn't exist.
+ */
+- (CORevisionGraph *)revisionGraphForCommit: (ETUUID *)commitA
+                                  andCommit: (ETUUID *)commitB
+                             persistentRoot: (ETUUID *)persistentRoot
 {
-    if ([dest containsObject: aUUID])
-        return;
+    CORevisionGraph *graph = [self revisionGraphForRevisionUUID: commitA
+                                             persistentRootUUID: persistentRoot];
 
-    [dest addObject: aUUID];
-
-    CORevision *revision = [self revisionForRevisionUUID: aUUID persistentRootUUID: persistentRoot];
+    if ([graph revidForRevisionUUID: commitB] == -1)
+    {
+        graph = [self revisionGraphForRevisionUUID: commitB
+                                persistentRootUUID: persistentRoot];
+    }
 
-    if (revision.parentRevision != nil)
-        [self addUUIDAndParents: revision.parentRevision.UUID
-                 persistentRoot: persistentRoot
-                          toSet: dest];
+    if ([graph revidForRevisionUUID: commitA] == -1 || [graph revidForRevisionUUID: commitB] == -1)
+        return nil;
 
-    if (revision.mergeParentRevision != nil)
-        [self addUUIDAndParents: revision.mergeParentRevision.UUID
-                 persistentRoot: persistentRoot
-                          toSet: dest];
+    return graph;
 }
 
 - (ETUUID *)commonAncestorForCommit: (ETUUID *)commitA
                           andCommit: (ETUUID *)commitB
                      persistentRoot: (ETUUID *)persistentRoot
 {
-    NSMutableSet *ancestorsOfA = [NSMutableSet set];
-
-    [self addUUIDAndParents: commitA persistentRoot: persistentRoot toSet: ancestorsOfA];
-
-    // Do a BFS starting at commitB until we hit a commit in ancestorsOfA
-    // TODO: Check whether this makes sense
-
-    NSMutableArray *siblingsArray = [NSMutableArray arrayWithObject: commitB];
-
-    while (siblingsArray.count > 0)
-    {
-        NSMutableArray *nextSiblingsArray = [NSMutableArray new];
-
-        for (ETUUID *sibling in siblingsArray)
-        {
-            if ([ancestorsOfA containsObject: sibling])
-            {
-                return sibling;
-            }
-
-            CORevision *revision = [self revisionForRevisionUUID: sibling
-                                              persistentRootUUID: persistentRoot];
-
-            if (revision.parentRevision != nil)
-                [nextSiblingsArray addObject: revision.parentRevision.UUID];
+    if ([commitA isEqual: commitB])
+        return commitA;
 
-            if (revision.mergeParentRevision != nil)
-                [nextSiblingsArray addObject: revision.mergeParentRevision.UUID];
-        }
-
-        [siblingsArray setArray: nextSiblingsArray];
-    }
+    CORevisionGraph *graph = [self revisionGraphForCommit: commitA
+                                                andCommit: commitB
+                                           persistentRoot: persistentRoot];
+    const int64_t revid = [graph commonAncestorForRevid: [graph revidForRevisionUUID: commitA]
+                                               andRevid: [graph revidForRevisionUUID: commitB]];
 
     // No common ancestor
-    return nil;
+    if (revid == -1)
+        return nil;
+
+    return [graph revisionUUIDForRevid: revid];
 }
 
 - (BOOL)       isRevision: (ETUUID *)commitA
 equalToOrParentOfRevision: (ETUUID *)commitB
            persistentRoot: (ETUUID *)persistentRoot
 {
-    ETUUID *rev = commitB;
-    while (rev != nil)
-    {
-        if ([rev isEqual: commitA])
-        {
-            return YES;
-        }
-        rev = [self revisionForRevisionUUID: rev
-                         persistentRootUUID: persistentRoot].parentRevision.UUID;
-    }
-    return NO;
+    if ([commitA isEqual: commitB])
+        return YES;
+
+    CORevisionGraph *graph = [self revisionGraphForCommit: commitA
+                                                andCommit: commitB
+                                           persistentRoot: persistentRoot];
+
+    return [graph isRevid: [graph revidForRevisionUUID: commitA]
+   equalToOrParentOfRevid: [graph revidForRevisionUUID: commitB]];
 }
 
 - (NSArray *)revisionUUIDsFromRevisionUUIDExclusive: (ETUUID *)start
@@ -6,6 +6,7 @@
  */
 
 #import "COBookmark.h"
+#import "COMetamodel.h"
 
 @implementation COBookmark
 
@@ -27,6 +28,9 @@
     ETPropertyDescription *favIconData =
         [ETPropertyDescription descriptionWithName: @"favIconData" typeName: @"NSData"];
 
+    // For finding bookmarks by URL, without loading every bookmark library
+    URL.indexedInStore = YES;
+
     NSArray *persistentProperties = @[URL, lastVisitedDate, favIconData];
 
     [[persistentProperties mappedCollection] setPersistent: YES];
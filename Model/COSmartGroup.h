@@ -9,12 +9,14 @@
 #import <EtoileFoundation/EtoileFoundation.h>
 #import <CoreObject/COCollection.h>
 
+@class COQuery;
+
 typedef NSArray *(^COContentBlock)(void);
 
 /**
  * @group Search
- * @abstract A custom group class whose content is provided by a predicate or
- * code block.
+ * @abstract A custom group class whose content is provided by a query, a
+ * predicate or code block.
  *
  * COSmartGroup is an immutable, ordered, weak (an object can be in any number 
  * of collections) collection class.
@@ -26,6 +28,7 @@ typedef NSArray *(^COContentBlock)(void);
 @private
     id <ETCollection> targetCollection;
     NSPredicate *predicate;
+    COQuery *query;
     COContentBlock contentBlock;
     NSArray *content;
 }
@@ -61,12 +64,27 @@ typedef NSArray *(^COContentBlock)(void);
  * See -targetCollection and -contentBlock.
  */
 @property (nonatomic, readwrite, strong) NSPredicate *predicate;
+/**
+ * The query used to compute the smart group content.
+ *
+ * If a content block is provided, the query is ignored. If a query is set, the 
+ * predicate is ignored.
+ *
+ * If a target collection is provided, the target collection is filtered as an 
+ * array using the query in memory. Otherwise the query is executed in the 
+ * editing context, which lets the store indexes narrow the persistent roots 
+ * to load (see -[COQuery resultsInEditingContext:]).
+ *
+ * See -targetCollection and -contentBlock.
+ */
+@property (nonatomic, readwrite, strong) COQuery *query;
 /**
  * The content block used to compute the smart group content.
  *
- * If a content block is set, both the target collection and predicate are ignored.
+ * If a content block is set, the target collection, query and predicate are 
+ * ignored.
  *
- * See -targetCollection and -predicate.
+ * See -targetCollection, -query and -predicate.
  */
 @property (nonatomic, readwrite, copy) COContentBlock contentBlock;
 
@@ -6,10 +6,11 @@
  */
 
 #import "COSmartGroup.h"
+#import "COQuery.h"
 
 @implementation COSmartGroup
 
-@synthesize targetCollection, predicate, contentBlock;
+@synthesize targetCollection, predicate, query, contentBlock;
 
 + (void)initialize
 {
@@ -80,6 +81,12 @@
     [self refresh];
 }
 
+- (void)setQuery: (COQuery *)aQuery
+{
+    query = aQuery;
+    [self refresh];
+}
+
 - (BOOL)isOrdered
 {
     return YES;
@@ -109,6 +116,15 @@
     {
         result = contentBlock();
     }
+    else if (query != nil && targetCollection != nil)
+    {
+        result = [query filteredArrayUsingQuery: [targetCollection contentArray]];
+    }
+    else if (query != nil)
+    {
+        // For a transient smart group, there is nothing to search
+        result = (self.editingContext != nil ? [query resultsInEditingContext: self.editingContext] : @[]);
+    }
     else if (targetCollection != nil && predicate != nil)
     {
         result = [[targetCollection contentArray] filteredArrayUsingPredicate: predicate];
@@ -242,11 +242,12 @@ static COType importTypeFromPlist(id typeValuePair)
 
 - (id)JSONPlist
 {
-    NSMutableDictionary *plistValues = [NSMutableDictionary dictionaryWithCapacity: values.count];
+    NSArray *attributeNames = self.attributeNames;
+    NSMutableDictionary *plistValues = [NSMutableDictionary dictionaryWithCapacity: attributeNames.count];
 
-    for (NSString *key in values)
+    for (NSString *key in attributeNames)
     {
-        id plistValue = plistValueForValue(values[key], [types[key] intValue]);
+        id plistValue = plistValueForValue([self valueForAttribute: key], [self typeForAttribute: key]);
         plistValues[key] = plistValue;
     }
 
@@ -8,7 +8,7 @@
 #import <Foundation/Foundation.h>
 #import <CoreObject/COType.h>
 
-@class ETUUID;
+@class ETUUID, COItemShape;
 
 extern NSString *const kCOItemEntityNameProperty;
 extern NSString *const kCOItemPackageVersionProperty;
@@ -35,14 +35,21 @@ extern NSString *const kCOItemIsSharedProperty;
  * COItem(Binary) and COItem(JSON), and COItem also defines the abstract storage 
  * model (independent of a particular serialization format like binary or JSON) 
  * that CoreObject uses. 
+ *
+ * The attribute names and types are stored in a shape shared by all the items 
+ * that have the same attributes, and the item itself only stores the values 
+ * (see COItemShape). So -attributeNames returns the attributes sorted with 
+ * -compare:.
  */
 @interface COItem : NSObject <NSCopying, NSMutableCopying>
 {
 @package
     ETUUID *uuid;
 @protected
-    NSMutableDictionary *types;
-    NSMutableDictionary *values;
+    /** The attribute names and types, shared with the items of the same shape */
+    COItemShape *_shape;
+    /** The values, ordered like the shape attributes */
+    __strong id *_values;
 }
 
 
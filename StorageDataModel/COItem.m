@@ -6,6 +6,7 @@
  */
 
 #import "COItem.h"
+#import "COItemShape.h"
 #import <EtoileFoundation/Macros.h>
 #import <EtoileFoundation/ETUUID.h>
 #import "COPath.h"
@@ -16,41 +17,55 @@ NSString *const kCOItemPackageVersionProperty = @"org.etoile-project.coreobject.
 NSString *const kCOItemPackageNameProperty = @"org.etoile-project.coreobject.packagename";
 NSString *const kCOItemIsSharedProperty = @"isShared";
 
-static NSDictionary *copyValueDictionary(NSDictionary *input, BOOL mutable)
+static id copyValue(id value, BOOL mutable)
 {
-    NSMutableDictionary *result = [[NSMutableDictionary alloc] init];
-
-    for (NSString *key in input)
+    if ([value isKindOfClass: [NSCountedSet class]])
     {
-        id obj = input[key];
-
-        if ([obj isKindOfClass: [NSCountedSet class]])
-        {
-            // FIXME: Always mutable
-            result[key] = obj;
-        }
-        else if ([obj isKindOfClass: [NSSet class]])
-        {
-            result[key] = [(mutable ? [NSMutableSet class] : [NSSet class]) setWithSet: obj];
-        }
-        else if ([obj isKindOfClass: [NSArray class]])
-        {
-            result[key] = [(mutable ? [NSMutableArray class] : [NSArray class]) arrayWithArray: obj];
-        }
-        else
-        {
-            result[key] = obj;
-        }
+        // FIXME: Always mutable
+        return value;
+    }
+    else if ([value isKindOfClass: [NSSet class]])
+    {
+        return [(mutable ? [NSMutableSet class] : [NSSet class]) setWithSet: value];
+    }
+    else if ([value isKindOfClass: [NSArray class]])
+    {
+        return [(mutable ? [NSMutableArray class] : [NSArray class]) arrayWithArray: value];
     }
+    return value;
+}
+
+static inline __strong id *allocValues(NSUInteger count)
+{
+    return (__strong id *)calloc(MAX(count, 1), sizeof(id));
+}
+
+/**
+ * Releases the values, and frees the array allocated for the given shape.
+ */
+static inline void freeValues(__strong id *values, COItemShape *shape)
+{
+    if (values == NULL)
+        return;
 
-    if (!mutable)
+    for (NSUInteger i = 0; i < shape->_count; i++)
     {
-        NSDictionary *immutable = [[NSDictionary alloc] initWithDictionary: result];
-        return immutable;
+        values[i] = nil;
     }
-    return result;
+    free((void *)values);
 }
 
+@interface COItem ()
+
+- (void)loadAttributesIfNeeded;
+- (void)setTypesForAttributes: (NSDictionary *)typesForAttributes
+          valuesForAttributes: (NSDictionary *)valuesForAttributes
+                  mutableCopy: (BOOL)mutable;
+- (void)setAttributesFromItem: (COItem *)anItem mutableCopy: (BOOL)mutable;
+
+@end
+
+
 @implementation COItem
 
 #pragma mark Initialization -
@@ -65,15 +80,9 @@ static NSDictionary *copyValueDictionary(NSDictionary *input, BOOL mutable)
 
     SUPERINIT;
     uuid = aUUID;
-    // FIXME: These casts are not truly elegant
-    types = (NSMutableDictionary *)[[NSDictionary alloc] initWithDictionary: typesForAttributes];
-    values = (NSMutableDictionary *)copyValueDictionary(valuesForAttributes, NO);
-
-    for (NSString *key in values)
-    {
-        ETAssert(COTypeValidateObject([types[key] intValue], values[key]));
-    }
-
+    [self setTypesForAttributes: typesForAttributes
+            valuesForAttributes: valuesForAttributes
+                    mutableCopy: NO];
     return self;
 }
 
@@ -90,6 +99,11 @@ static NSDictionary *copyValueDictionary(NSDictionary *input, BOOL mutable)
                   valuesForAttributes: valuesForAttributes];
 }
 
+- (void)dealloc
+{
+    freeValues(_values, _shape);
+}
+
 - (NSString *)description
 {
     NSMutableString *result = [NSMutableString string];
@@ -109,6 +123,73 @@ static NSDictionary *copyValueDictionary(NSDictionary *input, BOOL mutable)
     return result;
 }
 
+#pragma mark Shape and Value Storage -
+
+- (void)setTypesForAttributes: (NSDictionary *)typesForAttributes
+          valuesForAttributes: (NSDictionary *)valuesForAttributes
+                  mutableCopy: (BOOL)mutable
+{
+    for (NSString *key in valuesForAttributes)
+    {
+        ETAssert(COTypeValidateObject([typesForAttributes[key] intValue], valuesForAttributes[key]));
+    }
+
+    COItemShape *shape = [COItemShape shapeWithTypesForAttributes: typesForAttributes];
+    __strong id *values = allocValues(shape->_count);
+
+    for (NSUInteger i = 0; i < shape->_count; i++)
+    {
+        values[i] = copyValue(valuesForAttributes[shape->_names[i]], mutable);
+    }
+
+    freeValues(_values, _shape);
+    _shape = shape;
+    _values = values;
+}
+
+- (void)setTypesForAttributes: (NSDictionary *)typesForAttributes
+          valuesForAttributes: (NSDictionary *)valuesForAttributes
+{
+    COItemShape *shape = [COItemShape shapeWithTypesForAttributes: typesForAttributes];
+    __strong id *values = allocValues(shape->_count);
+
+    for (NSUInteger i = 0; i < shape->_count; i++)
+    {
+        values[i] = valuesForAttributes[shape->_names[i]];
+    }
+
+    freeValues(_values, _shape);
+    _shape = shape;
+    _values = values;
+}
+
+/**
+ * Shares the shape of the given item, and copies its values (collections are
+ * copied, see copyValue()).
+ */
+- (void)setAttributesFromItem: (COItem *)anItem mutableCopy: (BOOL)mutable
+{
+    [anItem loadAttributesIfNeeded];
+
+    COItemShape *shape = anItem->_shape;
+    __strong id *values = allocValues(shape->_count);
+
+    for (NSUInteger i = 0; i < shape->_count; i++)
+    {
+        values[i] = copyValue(anItem->_values[i], mutable);
+    }
+
+    freeValues(_values, _shape);
+    _shape = shape;
+    _values = values;
+}
+
+- (COItemShape *)shape
+{
+    [self loadAttributesIfNeeded];
+    return _shape;
+}
+
 #pragma mark Equality -
 
 - (BOOL)isEqual: (id)object
@@ -124,19 +205,42 @@ static NSDictionary *copyValueDictionary(NSDictionary *input, BOOL mutable)
     COItem *otherItem = (COItem *)object;
 
     if (![otherItem->uuid isEqual: uuid]) return NO;
-    if (![otherItem->types isEqual: types]) return NO;
-    if (![otherItem->values isEqual: values]) return NO;
+
+    [self loadAttributesIfNeeded];
+    [otherItem loadAttributesIfNeeded];
+
+    /* Shapes are interned, so comparing the shapes compares the attribute 
+       names and types */
+    if (otherItem->_shape != _shape) return NO;
+
+    for (NSUInteger i = 0; i < _shape->_count; i++)
+    {
+        id value = _values[i];
+        id otherValue = otherItem->_values[i];
+
+        if (value != otherValue && ![value isEqual: otherValue]) return NO;
+    }
     return YES;
 }
 
 - (NSUInteger)hash
 {
-    return uuid.hash ^ types.hash ^ values.hash ^ 9014972660509684524LL;
+    [self loadAttributesIfNeeded];
+    return uuid.hash ^ _shape.hash ^ 9014972660509684524LL;
 }
 
 #pragma mark Accessing Attributes -
 
 
+/**
+ * For subclasses that don't populate the shape and values on initialization 
+ * (see COLazyItem), must ensure all the attributes are loaded, usually with
+ * -setTypesForAttributes:valuesForAttributes:.
+ */
+- (void)loadAttributesIfNeeded
+{
+}
+
 - (ETUUID *)UUID
 {
     return uuid;
@@ -144,17 +248,19 @@ static NSDictionary *copyValueDictionary(NSDictionary *input, BOOL mutable)
 
 - (NSArray *)attributeNames
 {
-    return types.allKeys;
+    return _shape.attributeNames;
 }
 
 - (COType)typeForAttribute: (NSString *)anAttribute
 {
-    return [types[anAttribute] intValue];
+    const NSUInteger i = COItemShapeIndexOfAttribute(_shape, anAttribute);
+    return (i != NSNotFound ? _shape->_types[i] : 0);
 }
 
 - (id)valueForAttribute: (NSString *)anAttribute
 {
-    return values[anAttribute];
+    const NSUInteger i = COItemShapeIndexOfAttribute(_shape, anAttribute);
+    return (i != NSNotFound ? _values[i] : nil);
 }
 
 #pragma mark Convenience -
@@ -162,12 +268,12 @@ static NSDictionary *copyValueDictionary(NSDictionary *input, BOOL mutable)
 
 - (NSString *)entityName
 {
-    return values[kCOItemEntityNameProperty];
+    return [self valueForAttribute: kCOItemEntityNameProperty];
 }
 
 - (int64_t)packageVersion
 {
-    NSNumber *version = values[kCOItemPackageVersionProperty];
+    NSNumber *version = [self valueForAttribute: kCOItemPackageVersionProperty];
     if (version != nil)
     {
         return version.longLongValue;
@@ -177,7 +283,7 @@ static NSDictionary *copyValueDictionary(NSDictionary *input, BOOL mutable)
 
 - (NSString *)packageName
 {
-    return values[kCOItemPackageNameProperty];
+    return [self valueForAttribute: kCOItemPackageNameProperty];
 }
 
 - (NSArray *)allObjectsForAttribute: (NSString *)attribute
@@ -335,9 +441,9 @@ static NSDictionary *copyValueDictionary(NSDictionary *input, BOOL mutable)
 
 - (id)mutableCopyWithZone: (NSZone *)zone
 {
-    return [[COMutableItem alloc] initWithUUID: uuid
-                            typesForAttributes: types
-                           valuesForAttributes: values];
+    COMutableItem *aCopy = [[COMutableItem alloc] initWithUUID: uuid];
+    [aCopy setAttributesFromItem: self mutableCopy: YES];
+    return aCopy;
 }
 
 - (id)mutableCopyWithNameMapping: (NSDictionary *)aMapping
@@ -417,14 +523,9 @@ static NSDictionary *copyValueDictionary(NSDictionary *input, BOOL mutable)
     NILARG_EXCEPTION_TEST(valuesForAttributes);
 
     uuid = aUUID;
-    types = [[NSMutableDictionary alloc] initWithDictionary: typesForAttributes];
-    values = (NSMutableDictionary *)copyValueDictionary(valuesForAttributes, YES);
-
-    for (NSString *key in values)
-    {
-        ETAssert(COTypeValidateObject([types[key] intValue], values[key]));
-    }
-
+    [self setTypesForAttributes: typesForAttributes
+            valuesForAttributes: valuesForAttributes
+                    mutableCopy: YES];
     return self;
 }
 
@@ -467,14 +568,55 @@ static NSDictionary *copyValueDictionary(NSDictionary *input, BOOL mutable)
 
     ETAssert(COTypeValidateObject(aType, aValue));
 
-    ((NSMutableDictionary *)types)[anAttribute] = @(aType);
-    ((NSMutableDictionary *)values)[anAttribute] = aValue;
+    const NSUInteger i = COItemShapeIndexOfAttribute(_shape, anAttribute);
+
+    if (i != NSNotFound && _shape->_types[i] == aType)
+    {
+        _values[i] = aValue;
+        return;
+    }
+
+    COItemShape *shape = [_shape shapeBySettingType: aType forAttribute: anAttribute];
+
+    if (i != NSNotFound)
+    {
+        /* Same attributes, so the value order is unchanged */
+        _shape = shape;
+        _values[i] = aValue;
+        return;
+    }
+
+    /* Insert the value at the attribute position in the new shape */
+    const NSUInteger count = _shape->_count;
+    const NSUInteger insertionIndex = COItemShapeIndexOfAttribute(shape, anAttribute);
+
+    ETAssert(shape->_count == count + 1);
+    _values = (__strong id *)realloc((void *)_values, (count + 1) * sizeof(id));
+    memmove((void *)(_values + insertionIndex + 1),
+            (void *)(_values + insertionIndex),
+            (count - insertionIndex) * sizeof(id));
+    memset((void *)(_values + insertionIndex), 0, sizeof(id));
+
+    _shape = shape;
+    _values[insertionIndex] = aValue;
 }
 
 - (void)removeValueForAttribute: (NSString *)anAttribute
 {
-    [(NSMutableDictionary *)types removeObjectForKey: anAttribute];
-    [(NSMutableDictionary *)values removeObjectForKey: anAttribute];
+    const NSUInteger i = COItemShapeIndexOfAttribute(_shape, anAttribute);
+
+    if (i == NSNotFound)
+        return;
+
+    const NSUInteger count = _shape->_count;
+
+    _values[i] = nil;
+    memmove((void *)(_values + i),
+            (void *)(_values + i + 1),
+            (count - i - 1) * sizeof(id));
+    memset((void *)(_values + count - 1), 0, sizeof(id));
+
+    _shape = [_shape shapeByRemovingAttribute: anAttribute];
 }
 
 #pragma mark Convenience -
@@ -513,9 +655,11 @@ static NSDictionary *copyValueDictionary(NSDictionary *input, BOOL mutable)
 
 - (id)copyWithZone: (NSZone *)zone
 {
-    return [[COItem alloc] initWithUUID: uuid
-                     typesForAttributes: types
-                    valuesForAttributes: values];
+    COItem *aCopy = [[COItem alloc] initWithUUID: uuid
+                              typesForAttributes: @{}
+                             valuesForAttributes: @{}];
+    [aCopy setAttributesFromItem: self mutableCopy: NO];
+    return aCopy;
 }
 
 @end
@@ -259,9 +259,12 @@ NSData *COItemGraphToBinaryData(id <COItemGraph> aGraph)
 {
     // format:
     // 'CoreObjectBinaryItemGraph' (ASCII)
-    // 1 (version number - uint32, little endian)
+    // 2 (version number - uint32, little endian)
     // 16-byte UUID of root item
     // [ item data block, same format as used for COSQLiteStore ]
+    //
+    // Version 1 is identical, except that the item data block uses the
+    // length-prefixed format without a directory.
 
     if (aGraph == nil)
     {
@@ -271,7 +274,7 @@ NSData *COItemGraphToBinaryData(id <COItemGraph> aGraph)
     NSMutableData *result = [NSMutableData data];
     [result appendData: [BinaryHeaderString dataUsingEncoding: NSUTF8StringEncoding]];
 
-    const uint32_t version = NSSwapHostIntToLittle(1);
+    const uint32_t version = NSSwapHostIntToLittle(2);
     [result appendBytes: &version length: sizeof(version)];
     [result appendData: [aGraph.rootItemUUID dataValue]];
     [result appendData: contentsBLOBWithItemTree(aGraph)];
@@ -305,9 +308,9 @@ COItemGraph *COItemGraphFromBinaryData(NSData *binarydata)
     uint32_t version;
     [versionData getBytes: &version length: versionLen];
     version = NSSwapLittleIntToHost(version);
-    if (version != 1)
+    if (version != 1 && version != 2)
     {
-        [NSException raise: NSInvalidArgumentException format: @"Expected version 1"];
+        [NSException raise: NSInvalidArgumentException format: @"Expected version 1 or 2"];
     }
 
     // Get root item UUID
@@ -0,0 +1,148 @@
+/**
+    Copyright (C) 2016 Quentin Mathe
+
+    Date:  October 2016
+    License:  MIT  (see COPYING)
+ */
+
+#import <Foundation/Foundation.h>
+#import <CoreObject/COType.h>
+#import <CoreObject/COItem.h>
+
+/**
+ * @group Storage Data Model
+ * @abstract The attribute names and types shared by the items that have the
+ * same attributes (usually the items of a given entity).
+ *
+ * Shapes are interned, so two items have the same attribute names and types
+ * if and only if they point to the same shape. Each COItem just holds its
+ * shape, and its values in a flat array ordered like the shape attributes.
+ *
+ * The attribute names are sorted with -compare:, which is the order in which
+ * -[COItem dataValue] serializes the attributes. The serialized name and type
+ * tokens are computed once per shape, so the serialization only encodes the
+ * values.
+ *
+ * A shape is immutable. When an attribute is added, removed or changes its
+ * type, a COMutableItem moves to another shape, and the transitions are cached
+ * in the source shape.
+ *
+ * The interning table and the transition caches don't retain the shapes, so
+ * the shapes that no item uses anymore are released (e.g. the shapes of
+ * CODictionary items, whose attributes are the dictionary keys).
+ *
+ * Shapes can be shared between threads.
+ */
+@interface COItemShape : NSObject
+{
+@public
+    /** Number of attributes */
+    NSUInteger _count;
+    /** Attribute names, retained by _attributeNames */
+    __unsafe_unretained NSString **_names;
+    /** Attribute types */
+    COType *_types;
+    /** Offsets in _attributeTokens for each attribute, plus the end offset */
+    size_t *_tokenOffsets;
+    /** Serialized name and type tokens, concatenated in attribute order */
+    NSData *_attributeTokens;
+@private
+    NSArray *_attributeNames;
+    NSDictionary *_indexForAttribute;
+    NSUInteger _hash;
+    NSMapTable *_shapeForSetAttribute;
+    NSMapTable *_shapeForRemovedAttribute;
+}
+
+
+/** @taskunit Initialization */
+
+
+/**
+ * Returns the interned shape without attributes.
+ */
++ (COItemShape *)emptyShape;
+/**
+ * Returns the interned shape for the given attribute names and types.
+ *
+ * The dictionary values must be COType NSNumbers.
+ */
++ (COItemShape *)shapeWithTypesForAttributes: (NSDictionary *)typesForAttributes;
+
+
+/** @taskunit Accessing Attributes */
+
+
+/**
+ * The attribute names, sorted with -compare:.
+ */
+@property (nonatomic, readonly) NSArray *attributeNames;
+/**
+ * Returns the index of the attribute, or NSNotFound if the shape doesn't
+ * contain it.
+ *
+ * See also COItemShapeIndexOfAttribute().
+ */
+- (NSUInteger)indexOfAttribute: (NSString *)anAttribute;
+/**
+ * Returns the attribute types keyed by attribute name.
+ */
+- (NSMutableDictionary *)typesForAttributes;
+
+
+/** @taskunit Transitions */
+
+
+/**
+ * Returns the shape including the attribute with the given type.
+ *
+ * If the attribute exists with another type, the returned shape has the same
+ * attribute order as the receiver.
+ */
+- (COItemShape *)shapeBySettingType: (COType)aType forAttribute: (NSString *)anAttribute;
+/**
+ * Returns the shape without the attribute.
+ *
+ * If the receiver doesn't contain the attribute, returns the receiver.
+ */
+- (COItemShape *)shapeByRemovingAttribute: (NSString *)anAttribute;
+
+@end
+
+/**
+ * Returns the index of the attribute, or NSNotFound if the shape doesn't
+ * contain it.
+ *
+ * Attribute names are usually constant strings, so for small shapes, the
+ * attribute is first compared by pointer, before falling back on
+ * -indexOfAttribute:.
+ */
+static inline NSUInteger COItemShapeIndexOfAttribute(COItemShape *shape, NSString *anAttribute)
+{
+    const NSUInteger count = shape->_count;
+    __unsafe_unretained NSString **names = shape->_names;
+
+    for (NSUInteger i = 0; i < count && i < 16; i++)
+    {
+        if (names[i] == anAttribute)
+            return i;
+    }
+    return [shape indexOfAttribute: anAttribute];
+}
+
+
+@interface COItem (COItemShape)
+
+/**
+ * The item shape, once the attributes are loaded.
+ */
+@property (nonatomic, readonly) COItemShape *shape;
+/**
+ * Replaces the attributes without validating or copying the values.
+ *
+ * For the initializers that decode the attributes (see COItem(Binary)).
+ */
+- (void)setTypesForAttributes: (NSDictionary *)typesForAttributes
+          valuesForAttributes: (NSDictionary *)valuesForAttributes;
+
+@end
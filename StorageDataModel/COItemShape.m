@@ -0,0 +1,260 @@
+/*
+    Copyright (C) 2016 Quentin Mathe
+
+    Date:  October 2016
+    License:  MIT  (see COPYING)
+ */
+
+#import "COItemShape.h"
+#import "COBinaryWriter.h"
+#import <EtoileFoundation/Macros.h>
+
+@implementation COItemShape
+
+/** Interned shapes, not retained */
+static NSHashTable *internedShapes;
+static COItemShape *emptyShape;
+
++ (void)initialize
+{
+    if (self != [COItemShape class])
+        return;
+
+    internedShapes = [NSHashTable weakObjectsHashTable];
+    emptyShape = [self internedShape: [[self alloc] initWithAttributeNames: @[] types: NULL]];
+}
+
+#pragma mark Initialization -
+
+/**
+ * The attribute names must be sorted with -compare:.
+ *
+ * The lookup tables are built when the shape is interned, see -prepareLookup.
+ */
+- (instancetype)initWithAttributeNames: (NSArray *)sortedNames types: (const COType *)types
+{
+    SUPERINIT;
+    _attributeNames = sortedNames;
+    _count = sortedNames.count;
+    _types = malloc(MAX(_count, 1) * sizeof(COType));
+    if (_count > 0)
+    {
+        memcpy(_types, types, _count * sizeof(COType));
+    }
+
+    NSUInteger hash = _count;
+
+    for (NSUInteger i = 0; i < _count; i++)
+    {
+        hash = hash * 31 + [_attributeNames[i] hash];
+        hash = hash * 31 + _types[i];
+    }
+    _hash = hash;
+    return self;
+}
+
+- (instancetype)init
+{
+    return [self initWithAttributeNames: nil types: NULL];
+}
+
+- (void)dealloc
+{
+    free(_names);
+    free(_types);
+    free(_tokenOffsets);
+}
+
+- (void)prepareLookup
+{
+    NSMutableDictionary *indexForAttribute = [[NSMutableDictionary alloc] initWithCapacity: _count];
+
+    _names = malloc(MAX(_count, 1) * sizeof(NSString *));
+    _tokenOffsets = malloc((_count + 1) * sizeof(size_t));
+
+    co_buffer_t buf;
+    co_buffer_init(&buf);
+
+    for (NSUInteger i = 0; i < _count; i++)
+    {
+        NSString *name = _attributeNames[i];
+
+        _names[i] = name;
+        indexForAttribute[name] = @(i);
+
+        _tokenOffsets[i] = co_buffer_get_length(&buf);
+        co_buffer_store_string(&buf, name);
+        co_buffer_store_integer(&buf, _types[i]);
+    }
+    _tokenOffsets[_count] = co_buffer_get_length(&buf);
+
+    _indexForAttribute = [[NSDictionary alloc] initWithDictionary: indexForAttribute];
+    _attributeTokens = [[NSData alloc] initWithBytes: co_buffer_get_data(&buf)
+                                              length: co_buffer_get_length(&buf)];
+    co_buffer_free(&buf);
+
+    _shapeForSetAttribute = [NSMapTable strongToWeakObjectsMapTable];
+    _shapeForRemovedAttribute = [NSMapTable strongToWeakObjectsMapTable];
+}
+
++ (COItemShape *)internedShape: (COItemShape *)aShape
+{
+    @synchronized(internedShapes)
+    {
+        COItemShape *shape = [internedShapes member: aShape];
+
+        if (shape == nil)
+        {
+            [aShape prepareLookup];
+            [internedShapes addObject: aShape];
+            shape = aShape;
+        }
+        return shape;
+    }
+}
+
++ (COItemShape *)emptyShape
+{
+    return emptyShape;
+}
+
++ (COItemShape *)shapeWithTypesForAttributes: (NSDictionary *)typesForAttributes
+{
+    NILARG_EXCEPTION_TEST(typesForAttributes);
+
+    const NSUInteger count = typesForAttributes.count;
+
+    if (count == 0)
+        return emptyShape;
+
+    NSArray *names = [typesForAttributes.allKeys sortedArrayUsingSelector: @selector(compare:)];
+    COType *types = malloc(count * sizeof(COType));
+
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        types[i] = [typesForAttributes[names[i]] intValue];
+    }
+
+    COItemShape *shape = [[self alloc] initWithAttributeNames: names types: types];
+
+    free(types);
+    return [self internedShape: shape];
+}
+
+#pragma mark Equality -
+
+- (BOOL)isEqual: (id)object
+{
+    if (object == self)
+        return YES;
+
+    if (![object isKindOfClass: [COItemShape class]])
+        return NO;
+
+    COItemShape *otherShape = object;
+
+    if (otherShape->_hash != _hash || otherShape->_count != _count)
+        return NO;
+
+    if (_count > 0 && memcmp(otherShape->_types, _types, _count * sizeof(COType)) != 0)
+        return NO;
+
+    return [otherShape->_attributeNames isEqualToArray: _attributeNames];
+}
+
+- (NSUInteger)hash
+{
+    return _hash;
+}
+
+- (NSString *)description
+{
+    NSMutableString *result = [NSMutableString stringWithFormat: @"<%@ %p", [self class], self];
+
+    for (NSUInteger i = 0; i < _count; i++)
+    {
+        [result appendFormat: @" %@ <%@>", _attributeNames[i], COTypeDescription(_types[i])];
+    }
+    [result appendString: @">"];
+    return result;
+}
+
+#pragma mark Accessing Attributes -
+
+- (NSArray *)attributeNames
+{
+    return _attributeNames;
+}
+
+- (NSUInteger)indexOfAttribute: (NSString *)anAttribute
+{
+    NSNumber *index = _indexForAttribute[anAttribute];
+    return (index != nil ? index.unsignedIntegerValue : NSNotFound);
+}
+
+- (NSMutableDictionary *)typesForAttributes
+{
+    NSMutableDictionary *types = [[NSMutableDictionary alloc] initWithCapacity: _count + 1];
+
+    for (NSUInteger i = 0; i < _count; i++)
+    {
+        types[_attributeNames[i]] = @(_types[i]);
+    }
+    return types;
+}
+
+#pragma mark Transitions -
+
+- (COItemShape *)shapeBySettingType: (COType)aType forAttribute: (NSString *)anAttribute
+{
+    NILARG_EXCEPTION_TEST(anAttribute);
+    COItemShape *shape = nil;
+
+    @synchronized(self)
+    {
+        shape = [_shapeForSetAttribute objectForKey: anAttribute];
+    }
+
+    if (shape != nil && shape->_types[COItemShapeIndexOfAttribute(shape, anAttribute)] == aType)
+        return shape;
+
+    NSMutableDictionary *types = [self typesForAttributes];
+
+    types[anAttribute] = @(aType);
+    shape = [COItemShape shapeWithTypesForAttributes: types];
+
+    @synchronized(self)
+    {
+        [_shapeForSetAttribute setObject: shape forKey: [anAttribute copy]];
+    }
+    return shape;
+}
+
+- (COItemShape *)shapeByRemovingAttribute: (NSString *)anAttribute
+{
+    if (COItemShapeIndexOfAttribute(self, anAttribute) == NSNotFound)
+        return self;
+
+    COItemShape *shape = nil;
+
+    @synchronized(self)
+    {
+        shape = [_shapeForRemovedAttribute objectForKey: anAttribute];
+    }
+
+    if (shape != nil)
+        return shape;
+
+    NSMutableDictionary *types = [self typesForAttributes];
+
+    [types removeObjectForKey: anAttribute];
+    shape = [COItemShape shapeWithTypesForAttributes: types];
+
+    @synchronized(self)
+    {
+        [_shapeForRemovedAttribute setObject: shape forKey: [anAttribute copy]];
+    }
+    return shape;
+}
+
+@end
@@ -23,13 +23,52 @@ typedef struct
     void (*co_read_null)(void *);
 } co_reader_callback_t;
 
+/**
+ * Reads the tokens, and calls the callback matching each token.
+ *
+ * All the integer tokens (fixed-width, varint and zigzag) are passed to 
+ * co_read_int64, so any format version up to CO_BUFFER_FORMAT_VERSION_LATEST 
+ * can be read.
+ */
 void co_reader_read(const unsigned char *bytes,
                     size_t length,
                     void *context,
                     co_reader_callback_t callbacks);
+/**
+ * Same as co_reader_read(), but resolves the string references ('r' tokens) 
+ * with the given string table, and passes the shared string instances to the 
+ * co_read_string callback.
+ *
+ * For a string reference without string table, raises an NSGenericException.
+ */
+void co_reader_read_with_string_table(const unsigned char *bytes,
+                                      size_t length,
+                                      void *context,
+                                      co_reader_callback_t callbacks,
+                                      NSArray *stringTable);
 
 /**
  * given a pointer to the start of a token, returns the length of that token
  * in bytes.
  */
 size_t co_reader_length_of_token(const unsigned char *bytes);
+/**
+ * given a pointer to the start of a string token ('s' or 'S'), returns the 
+ * string.
+ */
+NSString *co_reader_read_string_token(const unsigned char *bytes);
+/**
+ * Same as co_reader_read_string_token(), but also accepts a string reference
+ * ('r'), resolved with the given string table.
+ */
+NSString *co_reader_read_string_token_with_string_table(const unsigned char *bytes,
+                                                        NSArray *stringTable);
+/**
+ * given a pointer to the start of an integer token (fixed-width, varint or 
+ * zigzag), returns the integer.
+ */
+int64_t co_reader_read_integer_token(const unsigned char *bytes);
+/**
+ * Reads an unsigned LEB128 varint, and returns its length in bytes in length.
+ */
+uint64_t co_reader_read_varint(const unsigned char *bytes, size_t *length);
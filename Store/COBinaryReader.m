@@ -34,6 +34,41 @@ static inline uint64_t readUint64(const unsigned char *bytes)
     return NSSwapBigLongLongToHost(unswapped);
 }
 
+uint64_t co_reader_read_varint(const unsigned char *bytes, size_t *length)
+{
+    uint64_t value = 0;
+    size_t i = 0;
+
+    do
+    {
+        if (i == 10)
+        {
+            [NSException raise: NSGenericException
+                        format: @"varint longer than 10 bytes"];
+        }
+        value |= (uint64_t)(bytes[i] & 0x7F) << (7 * i);
+    } while (bytes[i++] & 0x80);
+
+    *length = i;
+    return value;
+}
+
+static inline int64_t zigzagDecode(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline NSString *stringForReference(NSArray *stringTable, uint64_t index)
+{
+    if (stringTable == nil || index >= stringTable.count)
+    {
+        [NSException raise: NSGenericException
+                    format: @"string reference %llu without matching string table entry",
+                            (unsigned long long)index];
+    }
+    return stringTable[(NSUInteger)index];
+}
+
 size_t co_reader_length_of_token(const unsigned char *bytes)
 {
     const char type = bytes[0];
@@ -59,6 +94,14 @@ size_t co_reader_length_of_token(const unsigned char *bytes)
             return 5 + readUint32(&bytes[1]);
         case '#':
             return 17;
+        case 'r':
+        case 'v':
+        case 'z':
+        {
+            size_t length;
+            co_reader_read_varint(bytes + 1, &length);
+            return 1 + length;
+        }
         case '{':
         case '}':
         case '[':
@@ -72,10 +115,77 @@ size_t co_reader_length_of_token(const unsigned char *bytes)
     return 0;
 }
 
+NSString *co_reader_read_string_token(const unsigned char *bytes)
+{
+    return co_reader_read_string_token_with_string_table(bytes, nil);
+}
+
+NSString *co_reader_read_string_token_with_string_table(const unsigned char *bytes,
+                                                        NSArray *stringTable)
+{
+    const char type = bytes[0];
+
+    switch (type)
+    {
+        case 'r':
+        {
+            size_t length;
+            return stringForReference(stringTable, co_reader_read_varint(bytes + 1, &length));
+        }
+        case 's':
+            return [[NSString alloc] initWithBytes: bytes + 2
+                                            length: readUint8(&bytes[1])
+                                          encoding: NSUTF8StringEncoding];
+        case 'S':
+            return [[NSString alloc] initWithBytes: bytes + 5
+                                            length: readUint32(&bytes[1])
+                                          encoding: NSUTF8StringEncoding];
+        default:
+            [NSException raise: NSGenericException
+                        format: @"expected a string, got type '%c'", type];
+    }
+    return nil;
+}
+
+int64_t co_reader_read_integer_token(const unsigned char *bytes)
+{
+    const char type = bytes[0];
+    size_t length;
+
+    switch (type)
+    {
+        case 'B':
+            return (int8_t)readUint8(&bytes[1]);
+        case 'i':
+            return (int16_t)readUint16(&bytes[1]);
+        case 'I':
+            return (int32_t)readUint32(&bytes[1]);
+        case 'L':
+            return (int64_t)readUint64(&bytes[1]);
+        case 'v':
+            return (int64_t)co_reader_read_varint(bytes + 1, &length);
+        case 'z':
+            return zigzagDecode(co_reader_read_varint(bytes + 1, &length));
+        default:
+            [NSException raise: NSGenericException
+                        format: @"expected an integer, got type '%c'", type];
+    }
+    return 0;
+}
+
 void co_reader_read(const unsigned char *bytes,
                     size_t length,
                     void *context,
                     co_reader_callback_t callbacks)
+{
+    co_reader_read_with_string_table(bytes, length, context, callbacks, nil);
+}
+
+void co_reader_read_with_string_table(const unsigned char *bytes,
+                                      size_t length,
+                                      void *context,
+                                      co_reader_callback_t callbacks,
+                                      NSArray *stringTable)
 {
     size_t pos = 0;
 
@@ -102,6 +212,22 @@ void co_reader_read(const unsigned char *bytes,
                 callbacks.co_read_int64(context, (int64_t)readUint64(bytes + pos));
                 pos += 8;
                 break;
+            case 'v':
+            {
+                size_t varintLen;
+                const uint64_t value = co_reader_read_varint(bytes + pos, &varintLen);
+                callbacks.co_read_int64(context, (int64_t)value);
+                pos += varintLen;
+                break;
+            }
+            case 'z':
+            {
+                size_t varintLen;
+                const uint64_t value = co_reader_read_varint(bytes + pos, &varintLen);
+                callbacks.co_read_int64(context, zigzagDecode(value));
+                pos += varintLen;
+                break;
+            }
             case 'F':
             {
                 NSSwappedDouble swapped;
@@ -135,6 +261,14 @@ void co_reader_read(const unsigned char *bytes,
                 pos += dataLen;
                 break;
             }
+            case 'r':
+            {
+                size_t varintLen;
+                const uint64_t index = co_reader_read_varint(bytes + pos, &varintLen);
+                callbacks.co_read_string(context, stringForReference(stringTable, index));
+                pos += varintLen;
+                break;
+            }
             case 'd':
             {
                 const uint8_t dataLen = readUint8(&bytes[pos]);
@@ -8,11 +8,27 @@
 #import <Foundation/Foundation.h>
 #import <EtoileFoundation/ETUUID.h>
 
+/**
+ * Integers are written as fixed-width big-endian tokens ('B', 'i', 'I' and 
+ * 'L'). Readable by all co_reader_read() versions.
+ */
+#define CO_BUFFER_FORMAT_VERSION_FIXED_INTEGERS 1
+/**
+ * Integers are written as LEB128 varint ('v') or zigzag ('z') tokens, when 
+ * they are shorter than the fixed-width ones.
+ */
+#define CO_BUFFER_FORMAT_VERSION_VARINT_INTEGERS 2
+/**
+ * The most recent format version that co_reader_read() supports.
+ */
+#define CO_BUFFER_FORMAT_VERSION_LATEST CO_BUFFER_FORMAT_VERSION_VARINT_INTEGERS
+
 typedef struct
 {
     unsigned char *data;
     size_t length;
     size_t allocated_length;
+    uint8_t format_version;
 } co_buffer_t;
 
 static inline
@@ -21,15 +37,53 @@ co_buffer_store_null(co_buffer_t *dest);
 
 #define CO_BUFFER_INITIAL_LENGTH 4096
 
+/**
+ * Initializes the buffer to write the tokens of the given format version.
+ *
+ * The writer must not use a version more recent than the one the reader 
+ * supports, see CO_BUFFER_FORMAT_VERSION_LATEST. The format version is not 
+ * recorded in the buffer, but implied by the enclosing format (e.g. the 
+ * version 3 commit data implies CO_BUFFER_FORMAT_VERSION_VARINT_INTEGERS).
+ */
 static inline
 void
-co_buffer_init(co_buffer_t *dest)
+co_buffer_init_with_format_version(co_buffer_t *dest, uint8_t version)
 {
     dest->allocated_length = CO_BUFFER_INITIAL_LENGTH;
     dest->data = malloc(CO_BUFFER_INITIAL_LENGTH);
     dest->length = 0;
+    dest->format_version = version;
+}
+
+/**
+ * Initializes the buffer to write fixed-width integers, so older readers can 
+ * read the data.
+ */
+static inline
+void
+co_buffer_init(co_buffer_t *dest)
+{
+    co_buffer_init_with_format_version(dest, CO_BUFFER_FORMAT_VERSION_FIXED_INTEGERS);
 }
 
+/**
+ * Initializes the buffer like co_buffer_init_with_format_version(), but 
+ * reuses the memory of a buffer returned to the current thread arena if 
+ * possible.
+ *
+ * The buffer must be released with co_buffer_return_to_arena() on the same 
+ * thread, rather than co_buffer_free().
+ */
+void co_buffer_init_from_arena(co_buffer_t *dest, uint8_t version);
+/**
+ * Keeps the buffer memory in the current thread arena, to be reused by the 
+ * next co_buffer_init_from_arena() call, or frees it if the arena is full or 
+ * the buffer is larger than 256 KB.
+ *
+ * The arena memory is freed when the thread exits.
+ */
+void co_buffer_return_to_arena(co_buffer_t *dest);
+
 static inline
 void
 co_buffer_clear(co_buffer_t *dest)
@@ -62,10 +116,11 @@ static inline
 void
 co_buffer_ensure_available(co_buffer_t *dest, size_t len)
 {
-    const size_t currlength = dest->length;
-    if (currlength + len > dest->allocated_length)
+    const size_t requiredLength = dest->length + len;
+    if (requiredLength > dest->allocated_length)
     {
-        dest->allocated_length = currlength + len + CO_BUFFER_INITIAL_LENGTH;
+        // Grow geometrically, so writing n bytes takes O(log n) reallocations
+        dest->allocated_length = MAX(2 * dest->allocated_length, requiredLength);
         dest->data = realloc(dest->data, dest->allocated_length);
     }
 }
@@ -116,9 +171,92 @@ co_buffer_store_uint64(co_buffer_t *dest, uint64_t value)
     WRITE(swapped);
 }
 
+/**
+ * Writes an unsigned LEB128 varint (7 bits per byte, the high bit is set 
+ * except in the last byte), without a type byte.
+ */
+static inline
+void
+co_buffer_store_varint(co_buffer_t *dest, uint64_t value)
+{
+    unsigned char bytes[10];
+    size_t length = 0;
+
+    while (value >= 0x80)
+    {
+        bytes[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    bytes[length++] = (unsigned char)value;
+
+    co_buffer_write(dest, bytes, length);
+}
+
+/**
+ * Writes a reference to a string in the string table of the commit data that 
+ * contains the item (see COItemStringTable).
+ */
 static inline
 void
-co_buffer_store_integer(co_buffer_t *dest, int64_t value)
+co_buffer_store_string_reference(co_buffer_t *dest, uint64_t index)
+{
+    WRTITE_TYPE("r");
+    co_buffer_store_varint(dest, index);
+}
+
+/**
+ * Returns the length of the unsigned LEB128 varint in bytes.
+ */
+static inline
+size_t
+co_varint_length(uint64_t value)
+{
+    size_t length = 1;
+
+    while (value >= 0x80)
+    {
+        value >>= 7;
+        length++;
+    }
+    return length;
+}
+
+/**
+ * Maps signed integers to unsigned ones, so the small negative integers 
+ * become small varints (0 => 0, -1 => 1, 1 => 2, -2 => 3 etc.).
+ */
+static inline
+uint64_t
+co_zigzag_encode(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+/**
+ * Returns the length of the fixed-width token for the integer, including its 
+ * type byte.
+ */
+static inline
+size_t
+co_fixed_integer_token_length(int64_t value)
+{
+    if (value <= INT8_MAX && value >= INT8_MIN)
+        return 2;
+    else if (value <= INT16_MAX && value >= INT16_MIN)
+        return 3;
+    else if (value <= INT32_MAX && value >= INT32_MIN)
+        return 5;
+    else
+        return 9;
+}
+
+/**
+ * Writes the integer as a 'B', 'i', 'I' or 'L' token, whatever the buffer 
+ * format version is.
+ */
+static inline
+void
+co_buffer_store_fixed_integer(co_buffer_t *dest, int64_t value)
 {
     if (value <= INT8_MAX && value >= INT8_MIN)
     {
@@ -142,6 +280,51 @@ co_buffer_store_integer(co_buffer_t *dest, int64_t value)
     }
 }
 
+/**
+ * Writes the integer as a 'v' (LEB128 varint) token if positive, or a 'z' 
+ * (zigzag varint) token if negative, whatever the buffer format version is.
+ */
+static inline
+void
+co_buffer_store_varint_integer(co_buffer_t *dest, int64_t value)
+{
+    if (value >= 0)
+    {
+        WRTITE_TYPE("v");
+        co_buffer_store_varint(dest, (uint64_t)value);
+    }
+    else
+    {
+        WRTITE_TYPE("z");
+        co_buffer_store_varint(dest, co_zigzag_encode(value));
+    }
+}
+
+/**
+ * Writes the shortest integer token that the buffer format version supports.
+ *
+ * With CO_BUFFER_FORMAT_VERSION_VARINT_INTEGERS, when the varint token has 
+ * the same length as the fixed-width one (e.g. for COType values and other 
+ * integers between -128 and 127), the fixed-width one is written, since it is 
+ * faster to read.
+ */
+static inline
+void
+co_buffer_store_integer(co_buffer_t *dest, int64_t value)
+{
+    if (dest->format_version >= CO_BUFFER_FORMAT_VERSION_VARINT_INTEGERS)
+    {
+        const uint64_t varint = (value >= 0 ? (uint64_t)value : co_zigzag_encode(value));
+
+        if (1 + co_varint_length(varint) < co_fixed_integer_token_length(value))
+        {
+            co_buffer_store_varint_integer(dest, value);
+            return;
+        }
+    }
+    co_buffer_store_fixed_integer(dest, value);
+}
+
 static inline
 void
 co_buffer_store_double(co_buffer_t *dest, double value)
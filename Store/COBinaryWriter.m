@@ -0,0 +1,92 @@
+/*
+    Copyright (C) 2016 Quentin Mathe
+
+    Date:  October 2016
+    License:  MIT  (see COPYING)
+ */
+
+#import "COBinaryWriter.h"
+#include <pthread.h>
+
+/**
+ * The number of buffers kept per thread, enough for the nested buffers used 
+ * to serialize items (e.g. the commit data buffer, and the temporary buffer 
+ * to sort set values).
+ */
+#define CO_BUFFER_ARENA_CAPACITY 4
+/**
+ * Larger buffers are freed rather than kept, so a thread doesn't retain the 
+ * memory used to write a large commit. Most item and commit data fit, and with 
+ * the arena capacity, a thread retains at most 1 MB.
+ */
+#define CO_BUFFER_ARENA_MAX_LENGTH (256 * 1024)
+
+typedef struct
+{
+    co_buffer_t buffers[CO_BUFFER_ARENA_CAPACITY];
+    size_t count;
+} co_buffer_arena_t;
+
+static pthread_key_t arenaKey;
+static pthread_once_t arenaKeyOnce = PTHREAD_ONCE_INIT;
+
+static void freeArena(void *value)
+{
+    co_buffer_arena_t *arena = value;
+
+    for (size_t i = 0; i < arena->count; i++)
+    {
+        co_buffer_free(&arena->buffers[i]);
+    }
+    free(arena);
+}
+
+static void createArenaKey(void)
+{
+    pthread_key_create(&arenaKey, freeArena);
+}
+
+static co_buffer_arena_t *currentArena(void)
+{
+    pthread_once(&arenaKeyOnce, createArenaKey);
+
+    co_buffer_arena_t *arena = pthread_getspecific(arenaKey);
+
+    if (arena == NULL)
+    {
+        arena = calloc(1, sizeof(co_buffer_arena_t));
+        pthread_setspecific(arenaKey, arena);
+    }
+    return arena;
+}
+
+void co_buffer_init_from_arena(co_buffer_t *dest, uint8_t version)
+{
+    co_buffer_arena_t *arena = currentArena();
+
+    if (arena->count == 0)
+    {
+        co_buffer_init_with_format_version(dest, version);
+        return;
+    }
+
+    arena->count--;
+    *dest = arena->buffers[arena->count];
+    dest->length = 0;
+    dest->format_version = version;
+}
+
+void co_buffer_return_to_arena(co_buffer_t *dest)
+{
+    co_buffer_arena_t *arena = currentArena();
+
+    if (arena->count == CO_BUFFER_ARENA_CAPACITY
+        || dest->allocated_length > CO_BUFFER_ARENA_MAX_LENGTH)
+    {
+        co_buffer_free(dest);
+        return;
+    }
+
+    arena->buffers[arena->count] = *dest;
+    arena->count++;
+}
@@ -21,6 +21,9 @@
 - (COSQLiteStorePersistentRootBackingStore *)backingStoreForUUID: (ETUUID *)aUUID
                                                            error: (NSError **)error;
 - (BOOL)finalizeGarbageAttachments;
+- (void)applySearchIndexJournal;
+- (void)deleteCurrentReferencesForPersistentRoot: (ETUUID *)aPersistentRoot;
+- (void)invalidateReaderCaches;
 - (void)postCommitNotificationsWithTransactionIDForPersistentRootUUID: (NSDictionary *)txnIDForPersistentRoot
                                               insertedPersistentRoots: (NSArray *)insertedUUIDs
                                                deletedPersistentRoots: (NSArray *)deletedUUIDs
@@ -47,6 +50,9 @@
 
     dispatch_sync(queue_, ^()
     {
+        // The revision indexes must be complete to find garbage attachments
+        [self applySearchIndexJournal];
+
         [db_ beginTransaction];
 
         NSMutableSet *collectablePersistentRootUUIDs = [NSMutableSet new];
@@ -75,6 +81,7 @@
                 [db_ executeUpdate: @"DELETE FROM branches WHERE proot = ?", persistentRootData];
                 [db_ executeUpdate: @"DELETE FROM persistentroots WHERE uuid = ?",
                                     persistentRootData];
+                [self deleteCurrentReferencesForPersistentRoot: persistentRoot];
 
                 [finalizedPersistentRootUUIDs addObject: persistentRoot];
             }
@@ -219,11 +226,22 @@
             {
                 // TODO: We should probably change attachment_refs to store
                 // revid as INTEGER rather than BLOB (same for proot_refs)
+                NSData *revisionUUIDData = [backing revisionUUIDForRevid: i].dataValue;
+
                 [db_ executeUpdate: @"DELETE FROM attachment_refs WHERE root_id = ? AND revid = ?",
                                     backingUUID.dataValue,
-                                    [backing revisionUUIDForRevid: i].dataValue];
-
-                // FIXME: FTS, proot_refs
+                                    revisionUUIDData];
+                [db_ executeUpdate: @"DELETE FROM proot_refs WHERE root_id = ? AND revid = ?",
+                                    backingUUID.dataValue,
+                                    revisionUUIDData];
+                [db_ executeUpdate: @"DELETE FROM property_values WHERE backingstore = ? AND revid = ?",
+                                    backingUUID.dataValue,
+                                    revisionUUIDData];
+                // The fts documents can't be deleted (fts is contentless), but
+                // they are not returned anymore once their docid is unmapped
+                [db_ executeUpdate: @"DELETE FROM fts_docid_to_revisionid WHERE backingstore = ? AND revid = ?",
+                                    backingUUID.dataValue,
+                                    revisionUUIDData];
             }];
 
             // Delete the actual revisions
@@ -231,6 +249,8 @@
             assert([backing deleteRevids: deletedRevisions]);
         }
 
+        // Deleted revids can be reused by the next commits
+        [self invalidateReaderCaches];
         assert([db_ commit]);
 
         [self finalizeGarbageAttachments];
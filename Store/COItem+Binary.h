@@ -7,11 +7,133 @@
 
 #import <Foundation/Foundation.h>
 #import "COItem.h"
+#import "COBinaryWriter.h"
+
+@class COItemShape;
+
+/**
+ * The strings shared by the items written in the same commit data (see 
+ * CombinedCommitDataWithItems()).
+ *
+ * The attribute names, and the entity and package names, are written once in 
+ * the string table, and the item data reference them by index with a small 
+ * varint ('r' token).
+ */
+@interface COItemStringTable : NSObject
+{
+    NSMutableArray *_strings;
+    NSMutableDictionary *_indexForString;
+    /** COItemShape => NSData (uint64_t index array for the shape attributes) */
+    NSMapTable *_attributeIndexesForShape;
+}
+
+/**
+ * The strings in index order.
+ */
+@property (nonatomic, readonly) NSArray *strings;
+
+/**
+ * Returns the index of the string, adding it to the table if needed.
+ */
+- (uint64_t)indexForString: (NSString *)aString;
+/**
+ * Returns the indexes of the shape attribute names, in the shape order.
+ */
+- (const uint64_t *)attributeIndexesForShape: (COItemShape *)aShape;
+
+@end
+
 
 @interface COItem (Binary)
 
+/**
+ * Returns the item data, which can be read back with -initWithData: or 
+ * -[COLazyItem initWithUUID:data:].
+ *
+ * The returned data is self-contained, and contains no string references. 
+ * The integers are written as fixed-width tokens 
+ * (CO_BUFFER_FORMAT_VERSION_FIXED_INTEGERS), so older readers can read it.
+ */
 @property (nonatomic, readonly) NSData *dataValue;
 
+/**
+ * Returns the item data where the attribute names, and the entity and package 
+ * names, reference strings in the given table.
+ *
+ * The result can only be read along with the table strings (see 
+ * CombinedCommitDataWithItems()). Since the readers that support string 
+ * tables support varint integers too, the integers are written with 
+ * CO_BUFFER_FORMAT_VERSION_VARINT_INTEGERS.
+ */
+- (NSData *)dataValueWithStringTable: (COItemStringTable *)aTable;
+/**
+ * Appends the same item data as -dataValueWithStringTable: to the buffer, 
+ * without allocating an intermediate NSData.
+ *
+ * The integers are written with the buffer format version, which should be 
+ * CO_BUFFER_FORMAT_VERSION_VARINT_INTEGERS or older.
+ */
+- (void)appendDataValueWithStringTable: (COItemStringTable *)aTable
+                              toBuffer: (co_buffer_t *)aBuffer;
+
+/**
+ * Initializes the item from the item data.
+ *
+ * If the data was parsed from commit data with a string table (see 
+ * StringTableForItemData()), the string references are resolved with it.
+ */
 - (instancetype)initWithData: (NSData *)aData;
 
 @end
+
+
+/**
+ * An immutable item decoded lazily from its binary representation (see 
+ * -[COItem dataValue]).
+ *
+ * On initialization, the item just retains the serialized data (usually a 
+ * slice of a commit blob, so nothing is copied). The first time the attributes 
+ * are accessed, the token stream is scanned to build an attribute name index, 
+ * then each attribute is decoded the first time -typeForAttribute: or 
+ * -valueForAttribute: is called for it.
+ *
+ * Comparing, hashing or copying the item decodes all the attributes. Once 
+ * all the attributes are decoded, the serialized data is released, so the 
+ * item doesn't keep the commit blob alive anymore.
+ *
+ * When the data references strings in the string table of its commit data, 
+ * -dataValue returns a copy where the references are replaced with the 
+ * strings.
+ *
+ * Like other COItem instances, a lazy item can be accessed from several 
+ * threads concurrently. The decoding is serialized with a lock, and once all 
+ * the attributes are loaded, the accessors don't take the lock anymore.
+ */
+@interface COLazyItem : COItem
+{
+    NSData *_data;
+    /** The string table of the commit data containing _data, or nil */
+    NSArray *_stringTable;
+    /** Attribute names in the serialization order */
+    NSMutableArray *_attributeNames;
+    /** NSRange array, locating the type and value tokens for each attribute */
+    NSMutableData *_attributeRanges;
+    /** Attributes decoded individually, until all the attributes are loaded */
+    NSMutableDictionary *_decodedTypes;
+    NSMutableDictionary *_decodedValues;
+    /** Set once the shape and values are loaded, see -isLoaded */
+    BOOL _loaded;
+}
+
+/**
+ * aData must have been produced by -[COItem dataValue] for an item whose UUID
+ * is aUUID, or parsed from commit data (see StringTableForItemData()).
+ */
+- (instancetype)initWithUUID: (ETUUID *)aUUID data: (NSData *)aData;
+
+/**
+ * Returns the attribute names, without decoding the attribute values.
+ */
+@property (nonatomic, readonly) NSArray *attributeNames;
+
+@end
@@ -6,6 +6,8 @@
  */
 
 #import "COItem+Binary.h"
+#import "COItemShape.h"
+#import "COSQLiteStorePersistentRootBackingStoreBinaryFormats.h"
 #import "COBinaryWriter.h"
 #import "COBinaryReader.h"
 #import "COPath.h"
@@ -38,17 +40,79 @@ typedef NS_ENUM(unsigned int, reader_state)
 
 @implementation COReaderState
 
-- (instancetype)init
+- (instancetype)initWithTypes: (NSMutableDictionary *)aTypeDict
+                        values: (NSMutableDictionary *)aValueDict
 {
     SUPERINIT;
-    values = [[NSMutableDictionary alloc] init];
-    types = [[NSMutableDictionary alloc] init];
+    values = aValueDict;
+    types = aTypeDict;
     state = co_reader_expect_object_uuid;
     return self;
 }
 
+- (instancetype)init
+{
+    return [self initWithTypes: [[NSMutableDictionary alloc] init]
+                        values: [[NSMutableDictionary alloc] init]];
+}
+
 @end
 
+@implementation COItemStringTable
+
+- (instancetype)init
+{
+    SUPERINIT;
+    _strings = [[NSMutableArray alloc] init];
+    _indexForString = [[NSMutableDictionary alloc] init];
+    _attributeIndexesForShape = [NSMapTable strongToStrongObjectsMapTable];
+    return self;
+}
+
+- (NSArray *)strings
+{
+    return _strings;
+}
+
+- (uint64_t)indexForString: (NSString *)aString
+{
+    NILARG_EXCEPTION_TEST(aString);
+    NSNumber *index = _indexForString[aString];
+
+    if (index == nil)
+    {
+        NSString *string = [aString copy];
+
+        index = @(_strings.count);
+        [_strings addObject: string];
+        _indexForString[string] = index;
+    }
+    return index.unsignedLongLongValue;
+}
+
+- (const uint64_t *)attributeIndexesForShape: (COItemShape *)aShape
+{
+    NSData *indexData = [_attributeIndexesForShape objectForKey: aShape];
+
+    if (indexData == nil)
+    {
+        NSMutableData *mutableIndexData =
+            [NSMutableData dataWithLength: MAX(aShape->_count, 1) * sizeof(uint64_t)];
+        uint64_t *indexes = mutableIndexData.mutableBytes;
+
+        for (NSUInteger i = 0; i < aShape->_count; i++)
+        {
+            indexes[i] = [self indexForString: aShape->_names[i]];
+        }
+        [_attributeIndexesForShape setObject: mutableIndexData forKey: aShape];
+        indexData = mutableIndexData;
+    }
+    return indexData.bytes;
+}
+
+@end
+
+
 @implementation COItem (Binary)
 
 static NSNull *NSNullCached;
@@ -225,38 +289,200 @@ static inline void writeValue(co_buffer_t *dest, id aValue, COType aType, co_buf
 {
     /** Parts of the serialization process need temporary storage */
     co_buffer_t temp;
-    co_buffer_init(&temp);
+    co_buffer_init_from_arena(&temp, CO_BUFFER_FORMAT_VERSION_FIXED_INTEGERS);
 
     co_buffer_t buf;
-    co_buffer_init(&buf);
+    co_buffer_init_from_arena(&buf, CO_BUFFER_FORMAT_VERSION_FIXED_INTEGERS);
     co_buffer_store_uuid(&buf, self.UUID);
     co_buffer_begin_object(&buf);
 
-    // TODO: For safety we should probaly serialize the attribute names to UTF-8 and compare
-    // them there. Although, I believe compare: should be the same as comparing Unicode character numbers
-    // which is the same as comparing UTF-8 byte sequences (mentiomed in the RFC.)
-    NSArray *propsSorted = [self.attributeNames sortedArrayUsingSelector: @selector(compare:)];
+    // The shape attributes are sorted with -compare:, which should be the same
+    // as comparing the UTF-8 byte sequences (mentioned in the RFC 3629), and the
+    // shape caches the serialized name and type tokens.
+    // TODO: For safety we should probaly sort the serialized attribute names.
+    COItemShape *shape = self.shape;
+    const unsigned char *tokens = shape->_attributeTokens.bytes;
 
-    for (NSString *prop in propsSorted)
+    for (NSUInteger i = 0; i < shape->_count; i++)
     {
-        COType type = [self typeForAttribute: prop];
-        id val = [self valueForAttribute: prop];
+        const size_t offset = shape->_tokenOffsets[i];
 
-        co_buffer_store_string(&buf, prop);
-        co_buffer_store_integer(&buf, type);
-        writeValue(&buf, val, type, &temp);
+        co_buffer_write(&buf, tokens + offset, shape->_tokenOffsets[i + 1] - offset);
+        writeValue(&buf, _values[i], shape->_types[i], &temp);
     }
 
-    co_buffer_free(&temp);
+    co_buffer_return_to_arena(&temp);
 
     co_buffer_end_object(&buf);
 
     NSData *result = [NSData dataWithBytes: co_buffer_get_data(&buf)
                                     length: co_buffer_get_length(&buf)];
-    co_buffer_free(&buf);
+    co_buffer_return_to_arena(&buf);
+    return result;
+}
+
+/**
+ * Returns whether the string values of the attribute are written in the string
+ * table, because most items repeat them.
+ */
+static inline BOOL isStringTableValueAttribute(NSString *anAttribute)
+{
+    return [anAttribute isEqualToString: kCOItemEntityNameProperty]
+        || [anAttribute isEqualToString: kCOItemPackageNameProperty];
+}
+
+static inline void writeStringOrReference(co_buffer_t *dest, NSString *aString, COItemStringTable *aTable)
+{
+    if (aTable != nil)
+    {
+        co_buffer_store_string_reference(dest, [aTable indexForString: aString]);
+    }
+    else
+    {
+        co_buffer_store_string(dest, aString);
+    }
+}
+
+- (NSData *)dataValueWithStringTable: (COItemStringTable *)aTable
+{
+    NILARG_EXCEPTION_TEST(aTable);
+
+    // Readers that support string tables support varint integers too
+    co_buffer_t buf;
+    co_buffer_init_from_arena(&buf, CO_BUFFER_FORMAT_VERSION_VARINT_INTEGERS);
+
+    [self appendDataValueWithStringTable: aTable toBuffer: &buf];
+
+    NSData *result = [NSData dataWithBytes: co_buffer_get_data(&buf)
+                                    length: co_buffer_get_length(&buf)];
+    co_buffer_return_to_arena(&buf);
     return result;
 }
 
+- (void)appendDataValueWithStringTable: (COItemStringTable *)aTable toBuffer: (co_buffer_t *)aBuffer
+{
+    NILARG_EXCEPTION_TEST(aTable);
+    NSParameterAssert(aBuffer != NULL);
+
+    co_buffer_t temp;
+    co_buffer_init_from_arena(&temp, aBuffer->format_version);
+
+    co_buffer_store_uuid(aBuffer, self.UUID);
+    co_buffer_begin_object(aBuffer);
+
+    COItemShape *shape = self.shape;
+    const uint64_t *indexes = [aTable attributeIndexesForShape: shape];
+    const NSUInteger entityNameIndex = COItemShapeIndexOfAttribute(shape, kCOItemEntityNameProperty);
+    const NSUInteger packageNameIndex = COItemShapeIndexOfAttribute(shape, kCOItemPackageNameProperty);
+
+    for (NSUInteger i = 0; i < shape->_count; i++)
+    {
+        const COType type = shape->_types[i];
+        id value = _values[i];
+
+        co_buffer_store_string_reference(aBuffer, indexes[i]);
+        co_buffer_store_integer(aBuffer, type);
+
+        if ((i == entityNameIndex || i == packageNameIndex)
+            && [value isKindOfClass: [NSString class]])
+        {
+            co_buffer_store_string_reference(aBuffer, [aTable indexForString: value]);
+        }
+        else
+        {
+            writeValue(aBuffer, value, type, &temp);
+        }
+    }
+
+    co_buffer_return_to_arena(&temp);
+
+    co_buffer_end_object(aBuffer);
+}
+
+/**
+ * Copies the token to dest, and returns its length.
+ *
+ * The varint integers are written as fixed-width ones, if the dest format 
+ * version doesn't support them.
+ */
+static inline size_t copyToken(co_buffer_t *dest, const unsigned char *bytes)
+{
+    const size_t length = co_reader_length_of_token(bytes);
+
+    if ((bytes[0] == 'v' || bytes[0] == 'z')
+        && dest->format_version < CO_BUFFER_FORMAT_VERSION_VARINT_INTEGERS)
+    {
+        co_buffer_store_fixed_integer(dest, co_reader_read_integer_token(bytes));
+    }
+    else
+    {
+        co_buffer_write(dest, bytes, length);
+    }
+    return length;
+}
+
+/**
+ * Copies the item data to dest, resolving its string references with 
+ * sourceTable.
+ *
+ * The attribute names, and the entity and package names, are written as 
+ * references to destTable, or as strings when destTable is nil. The other 
+ * tokens are copied as is, except the varint integers that the dest format 
+ * version doesn't support (see copyToken()).
+ */
+static void copyItemData(co_buffer_t *dest,
+                         NSData *itemData,
+                         NSArray *sourceTable,
+                         COItemStringTable *destTable)
+{
+    const unsigned char *bytes = itemData.bytes;
+    const size_t length = itemData.length;
+    size_t pos = co_reader_length_of_token(bytes);
+
+    ETAssert(bytes[pos] == '{');
+    pos++;
+    co_buffer_write(dest, bytes, pos);
+
+    while (pos < length && bytes[pos] != '}')
+    {
+        NSString *name = co_reader_read_string_token_with_string_table(bytes + pos, sourceTable);
+        pos += co_reader_length_of_token(bytes + pos);
+        writeStringOrReference(dest, name, destTable);
+
+        // Type
+        pos += copyToken(dest, bytes + pos);
+
+        // Value
+        if (bytes[pos] == '[')
+        {
+            co_buffer_begin_array(dest);
+            pos++;
+            while (bytes[pos] != ']')
+            {
+                pos += copyToken(dest, bytes + pos);
+            }
+            co_buffer_end_array(dest);
+            pos++;
+        }
+        else if (bytes[pos] == 'r'
+                 || (destTable != nil
+                     && (bytes[pos] == 's' || bytes[pos] == 'S')
+                     && isStringTableValueAttribute(name)))
+        {
+            NSString *value = co_reader_read_string_token_with_string_table(bytes + pos, sourceTable);
+            pos += co_reader_length_of_token(bytes + pos);
+            writeStringOrReference(dest, value, destTable);
+        }
+        else
+        {
+            pos += copyToken(dest, bytes + pos);
+        }
+    }
+    ETAssert(pos < length);
+
+    co_buffer_end_object(dest);
+}
+
 // Read
 
 static void co_read_object_value(COReaderState *state, id obj)
@@ -428,13 +654,11 @@ static void co_read_null(void *ctx)
     }
 }
 
-/* Initializers in categories cannot be marked with NS_DESIGNATED_INITIALIZER */
-#pragma clang diagnostic ignored "-Wobjc-designated-initializers"
-
-- (instancetype)initWithData: (NSData *)aData
+static void readItemTokens(const unsigned char *bytes,
+                           size_t length,
+                           NSArray *stringTable,
+                           COReaderState *state)
 {
-    COReaderState *state = [[COReaderState alloc] init];
-
     co_reader_callback_t cb = {
         co_read_int64,
         co_read_double,
@@ -447,18 +671,281 @@ static void co_read_null(void *ctx)
         co_read_end_array,
         co_read_null
     };
-    co_reader_read(aData.bytes,
-                   aData.length,
-                   (__bridge void *)state,
-                   cb);
+    co_reader_read_with_string_table(bytes,
+                                     length,
+                                     (__bridge void *)state,
+                                     cb,
+                                     stringTable);
+}
+
+/* Initializers in categories cannot be marked with NS_DESIGNATED_INITIALIZER */
+#pragma clang diagnostic ignored "-Wobjc-designated-initializers"
+
+- (instancetype)initWithData: (NSData *)aData
+{
+    COReaderState *state = [[COReaderState alloc] init];
+
+    readItemTokens(aData.bytes, aData.length, StringTableForItemData(aData), state);
 
     SUPERINIT;
     uuid = state->uuid;
-    types = state->types;
-    values = state->values;
-
+    [self setTypesForAttributes: state->types
+            valuesForAttributes: state->values];
     return self;
 }
 
 @end
 
+
+@implementation COLazyItem
+
+- (instancetype)initWithUUID: (ETUUID *)aUUID data: (NSData *)aData
+{
+    NILARG_EXCEPTION_TEST(aUUID);
+    NILARG_EXCEPTION_TEST(aData);
+    NSParameterAssert(aData.length >= 17 && ((const unsigned char *)aData.bytes)[0] == '#');
+
+    /* The item starts with the empty shape, until the attributes are loaded */
+    self = [super initWithUUID: aUUID typesForAttributes: @{} valuesForAttributes: @{}];
+    if (self == nil)
+        return nil;
+
+    _data = aData;
+    _stringTable = StringTableForItemData(aData);
+    return self;
+}
+
+/**
+ * Returns whether the shape and values are loaded.
+ *
+ * Once it returns YES, the shape and values can be read without the lock, 
+ * since they are published before the flag (see -loadAttributesIfNeeded).
+ */
+- (BOOL)isLoaded
+{
+    return __atomic_load_n(&_loaded, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Scans the token stream without decoding the values.
+ *
+ * format: UUID token, '{', then for each attribute: name, type and value
+ * tokens (an array value is '[', primitive value tokens, ']'), and '}'.
+ *
+ * Must be called with the lock held.
+ */
+- (void)buildAttributeIndex
+{
+    const unsigned char *bytes = _data.bytes;
+    const size_t length = _data.length;
+    size_t pos = co_reader_length_of_token(bytes);
+
+    _attributeNames = [[NSMutableArray alloc] init];
+    _attributeRanges = [[NSMutableData alloc] init];
+
+    ETAssert(bytes[pos] == '{');
+    pos++;
+
+    while (pos < length && bytes[pos] != '}')
+    {
+        NSString *name = co_reader_read_string_token_with_string_table(bytes + pos, _stringTable);
+        pos += co_reader_length_of_token(bytes + pos);
+
+        const size_t start = pos;
+
+        // Type
+        pos += co_reader_length_of_token(bytes + pos);
+
+        // Value
+        if (bytes[pos] == '[')
+        {
+            pos++;
+            while (bytes[pos] != ']')
+            {
+                pos += co_reader_length_of_token(bytes + pos);
+            }
+            pos++;
+        }
+        else
+        {
+            pos += co_reader_length_of_token(bytes + pos);
+        }
+
+        const NSRange range = NSMakeRange(start, pos - start);
+
+        [_attributeNames addObject: name];
+        [_attributeRanges appendBytes: &range length: sizeof(NSRange)];
+    }
+    ETAssert(pos < length);
+}
+
+- (NSArray *)attributeNames
+{
+    if (self.isLoaded)
+        return [super attributeNames];
+
+    @synchronized(self)
+    {
+        if (_loaded)
+            return [super attributeNames];
+
+        if (_attributeNames == nil)
+        {
+            [self buildAttributeIndex];
+        }
+        return [_attributeNames copy];
+    }
+}
+
+/**
+ * Must be called with the lock held.
+ */
+- (void)decodeAttribute: (NSString *)anAttribute
+{
+    if (_attributeNames == nil)
+    {
+        [self buildAttributeIndex];
+    }
+
+    const NSUInteger i = [_attributeNames indexOfObject: anAttribute];
+
+    if (i == NSNotFound)
+        return;
+
+    if (_decodedTypes == nil)
+    {
+        _decodedTypes = [[NSMutableDictionary alloc] init];
+        _decodedValues = [[NSMutableDictionary alloc] init];
+    }
+
+    const NSRange range = ((const NSRange *)_attributeRanges.bytes)[i];
+    COReaderState *state = [[COReaderState alloc] initWithTypes: _decodedTypes
+                                                         values: _decodedValues];
+    state->currentProperty = _attributeNames[i];
+    state->state = co_reader_expect_type;
+
+    readItemTokens((const unsigned char *)_data.bytes + range.location,
+                   range.length,
+                   _stringTable,
+                   state);
+}
+
+- (void)loadAttributesIfNeeded
+{
+    if (self.isLoaded)
+        return;
+
+    @synchronized(self)
+    {
+        if (_loaded)
+            return;
+
+        COReaderState *state = [[COReaderState alloc] init];
+
+        readItemTokens(_data.bytes, _data.length, _stringTable, state);
+
+        [self setTypesForAttributes: state->types
+                valuesForAttributes: state->values];
+
+        // The item is serialized from its values from now on
+        _data = nil;
+        _stringTable = nil;
+        _attributeNames = nil;
+        _attributeRanges = nil;
+        _decodedTypes = nil;
+        _decodedValues = nil;
+
+        __atomic_store_n(&_loaded, YES, __ATOMIC_RELEASE);
+    }
+}
+
+- (COType)typeForAttribute: (NSString *)anAttribute
+{
+    if (self.isLoaded)
+        return [super typeForAttribute: anAttribute];
+
+    @synchronized(self)
+    {
+        if (_loaded)
+            return [super typeForAttribute: anAttribute];
+
+        if (_decodedTypes[anAttribute] == nil)
+        {
+            [self decodeAttribute: anAttribute];
+        }
+        return [_decodedTypes[anAttribute] intValue];
+    }
+}
+
+- (id)valueForAttribute: (NSString *)anAttribute
+{
+    if (self.isLoaded)
+        return [super valueForAttribute: anAttribute];
+
+    @synchronized(self)
+    {
+        if (_loaded)
+            return [super valueForAttribute: anAttribute];
+
+        id value = _decodedValues[anAttribute];
+
+        if (value == nil)
+        {
+            [self decodeAttribute: anAttribute];
+            value = _decodedValues[anAttribute];
+        }
+        return value;
+    }
+}
+
+- (NSData *)dataValue
+{
+    NSData *data = nil;
+    NSArray *stringTable = nil;
+
+    @synchronized(self)
+    {
+        data = _data;
+        stringTable = _stringTable;
+    }
+
+    if (data == nil)
+        return [super dataValue];
+
+    if (stringTable == nil)
+        return data;
+
+    co_buffer_t buf;
+    co_buffer_init_from_arena(&buf, CO_BUFFER_FORMAT_VERSION_FIXED_INTEGERS);
+    copyItemData(&buf, data, stringTable, nil);
+
+    NSData *result = [NSData dataWithBytes: co_buffer_get_data(&buf)
+                                    length: co_buffer_get_length(&buf)];
+    co_buffer_return_to_arena(&buf);
+    return result;
+}
+
+- (void)appendDataValueWithStringTable: (COItemStringTable *)aTable toBuffer: (co_buffer_t *)aBuffer
+{
+    NILARG_EXCEPTION_TEST(aTable);
+    NSParameterAssert(aBuffer != NULL);
+
+    NSData *data = nil;
+    NSArray *stringTable = nil;
+
+    @synchronized(self)
+    {
+        data = _data;
+        stringTable = _stringTable;
+    }
+
+    if (data == nil)
+    {
+        [super appendDataValueWithStringTable: aTable toBuffer: aBuffer];
+        return;
+    }
+
+    copyItemData(aBuffer, data, stringTable, aTable);
+}
+
+@end
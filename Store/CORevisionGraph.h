@@ -0,0 +1,176 @@
+/**
+    Copyright (C) 2016 Quentin Mathe
+
+    Date:  October 2016
+    License:  MIT  (see COPYING)
+ */
+
+#import <Foundation/Foundation.h>
+#import <EtoileFoundation/ETUUID.h>
+
+/**
+ * @group Store
+ * @abstract The revision DAG of a backing store, loaded in a single query.
+ *
+ * The revisions are identified by their revid (their row number in the
+ * backing store), and their parent, merge parent, branch, persistent root and
+ * timestamp are kept in arrays indexed by revid, so walking the history
+ * doesn't involve any store access or object allocation.
+ *
+ * The metadata is not loaded, see -[COSQLiteStore
+ * revisionInfoForRevisionUUID:persistentRootUUID:].
+ *
+ * The ancestry index persisted in the backing store is loaded too, so
+ * ancestor and common ancestor queries don't walk the whole history. For each
+ * revision, it records the depth along the parent chain, a skip pointer to a
+ * parent chain ancestor (spaced so any ancestor can be reached in O(log n)
+ * steps) and the depth of the last merge on the parent chain.
+ *
+ * A revision graph is a snapshot, and doesn't include the revisions committed
+ * afterwards, until -[COSQLiteStore updateRevisionGraph:forPersistentRootUUID:]
+ * appends them. Existing revisions are never changed, but the graph must not 
+ * be shared between threads while it is updated.
+ */
+@interface CORevisionGraph : NSObject
+{
+@private
+    int64_t _count;
+    NSMutableArray *_revisionUUIDs; // ETUUID or NSNull, indexed by revid
+    NSMutableData *_parentRevids; // int64_t, -1 for none
+    NSMutableData *_mergeParentRevids; // int64_t, -1 for none
+    NSMutableData *_branchIndexes; // uint32_t, index in _branchUUIDs
+    NSMutableData *_persistentRootIndexes; // uint32_t, index in _persistentRootUUIDs
+    NSMutableData *_timestamps; // int64_t, Java timestamp (milliseconds)
+    NSMutableArray *_branchUUIDs;
+    NSMutableArray *_persistentRootUUIDs;
+    NSMutableDictionary *_revidForRevisionUUID; // ETUUID => NSNumber
+    NSMutableData *_depths; // int64_t, 0 for a revision without parent
+    NSMutableData *_skipRevids; // int64_t, -1 for none
+    NSMutableData *_mergeDepths; // int64_t, -1 for no merge on the parent chain
+    BOOL _hasAncestryIndex;
+}
+
+
+/** @taskunit Revision Access */
+
+
+/**
+ * The revid upper bound (the last revid plus one).
+ *
+ * Because revisions can be deleted by history compaction, some revids below
+ * this count can be missing, see -containsRevid:.
+ */
+@property (nonatomic, readonly) int64_t count;
+/**
+ * Returns whether a revision exists for the revid.
+ */
+- (BOOL)containsRevid: (int64_t)aRevid;
+/**
+ * Returns the revid of the revision, or -1 if the receiver doesn't contain it.
+ */
+- (int64_t)revidForRevisionUUID: (ETUUID *)aRevisionUUID;
+/**
+ * Returns the revision UUID, or nil if the receiver doesn't contain the revid.
+ */
+- (ETUUID *)revisionUUIDForRevid: (int64_t)aRevid;
+/**
+ * Returns the parent revid, or -1 for the first revision.
+ */
+- (int64_t)parentRevidForRevid: (int64_t)aRevid;
+/**
+ * Returns the merge parent revid, or -1 if the revision is not a merge.
+ */
+- (int64_t)mergeParentRevidForRevid: (int64_t)aRevid;
+/**
+ * Returns the UUID of the branch where the revision was committed.
+ */
+- (ETUUID *)branchUUIDForRevid: (int64_t)aRevid;
+/**
+ * Returns the UUID of the persistent root where the revision was committed
+ * (e.g. for cheap copies, the revisions of the parent persistent root).
+ */
+- (ETUUID *)persistentRootUUIDForRevid: (int64_t)aRevid;
+/**
+ * Returns the commit date.
+ */
+- (NSDate *)dateForRevid: (int64_t)aRevid;
+
+
+/** @taskunit Ancestry */
+
+
+/**
+ * Returns the number of parents between the revision and the first revision,
+ * following the parent (not the merge parent).
+ *
+ * When the ancestry index is not available, walks the parents, and returns -1
+ * if a history compaction deleted some of them.
+ */
+- (int64_t)depthForRevid: (int64_t)aRevid;
+/**
+ * Returns the ancestor at the given depth on the parent chain of the
+ * revision, or -1 if the depth is greater than the revision one or the
+ * ancestor was deleted by a history compaction.
+ *
+ * Takes O(log n) steps when the ancestry index is available.
+ */
+- (int64_t)ancestorRevidForRevid: (int64_t)aRevid atDepth: (int64_t)aDepth;
+/**
+ * Returns whether the first revision is equal to the second one or to an
+ * ancestor on its parent chain (merge parents are not followed).
+ *
+ * Takes O(log n) steps when the ancestry index is available.
+ */
+- (BOOL)isRevid: (int64_t)aRevid equalToOrParentOfRevid: (int64_t)anotherRevid;
+/**
+ * Returns the common ancestor of the two revisions, following both parents
+ * and merge parents, or -1 if the revisions have no common ancestor.
+ *
+ * When multiple common ancestors are not ancestors of each other (e.g. after
+ * criss-cross merges), returns the most recent one.
+ *
+ * When no merges happened on the parent chains since the common ancestor,
+ * takes O(log^2 n) steps with the ancestry index. Otherwise the walk only
+ * visits the revisions more recent than the common ancestor.
+ */
+- (int64_t)commonAncestorForRevid: (int64_t)aRevid andRevid: (int64_t)anotherRevid;
+
+
+/** @taskunit Framework Private */
+
+
+/**
+ * Adds a revision while building the receiver (the revids must be added in
+ * increasing order).
+ *
+ * For a nil parent or merge parent revid, pass -1.
+ *
+ * The depth, skip revid and merge depth come from the ancestry index. If the
+ * index is not available for the revision, pass -1 as the depth, and the
+ * ancestry queries walk the parents instead.
+ */
+- (void)addRevid: (int64_t)aRevid
+    revisionUUID: (ETUUID *)aRevisionUUID
+     parentRevid: (int64_t)aParentRevid
+mergeParentRevid: (int64_t)aMergeParentRevid
+      branchUUID: (ETUUID *)aBranchUUID
+persistentRootUUID: (ETUUID *)aPersistentRootUUID
+       timestamp: (int64_t)aTimestamp
+           depth: (int64_t)aDepth
+       skipRevid: (int64_t)aSkipRevid
+      mergeDepth: (int64_t)aMergeDepth;
+
+@end
+
+/**
+ * Returns the depth of the ancestor pointed by the skip pointer of a revision
+ * at the given depth.
+ *
+ * Used to build the ancestry index in the backing store.
+ */
+extern int64_t COSkipDepthForDepth(int64_t depth);
+/**
+ * Returns whether an ancestor walk from the given depth should follow the
+ * skip pointer rather than the parent, to reach the target depth.
+ */
+extern BOOL COShouldFollowSkipPointer(int64_t depth, int64_t targetDepth);
@@ -0,0 +1,512 @@
+/*
+    Copyright (C) 2016 Quentin Mathe
+
+    Date:  October 2016
+    License:  MIT  (see COPYING)
+ */
+
+#import "CORevisionGraph.h"
+#import <EtoileFoundation/Macros.h>
+#import "CODateSerialization.h"
+
+/**
+ * Clears the lowest bit set to 1.
+ */
+static inline int64_t clearLowestOne(int64_t n)
+{
+    return n & (n - 1);
+}
+
+/*
+ * The skip pointers follow the scheme used for the block index in Bitcoin
+ * Core: the skip depths are spread so that any ancestor is reached in
+ * O(log n) steps, and consecutive revisions mostly skip to different depths.
+ */
+int64_t COSkipDepthForDepth(int64_t depth)
+{
+    if (depth < 2)
+        return 0;
+
+    return (depth & 1) ? clearLowestOne(clearLowestOne(depth - 1)) + 1 : clearLowestOne(depth);
+}
+
+BOOL COShouldFollowSkipPointer(int64_t depth, int64_t targetDepth)
+{
+    const int64_t skipDepth = COSkipDepthForDepth(depth);
+    const int64_t previousSkipDepth = COSkipDepthForDepth(depth - 1);
+
+    // Only skip past the target when the parent skip pointer doesn't get
+    // closer to the target with a shorter jump
+    return skipDepth == targetDepth
+        || (skipDepth > targetDepth
+            && !(previousSkipDepth < skipDepth - 2 && previousSkipDepth >= targetDepth));
+}
+
+@implementation CORevisionGraph
+
+@synthesize count = _count;
+
+- (instancetype)init
+{
+    SUPERINIT;
+    _revisionUUIDs = [NSMutableArray new];
+    _parentRevids = [NSMutableData new];
+    _mergeParentRevids = [NSMutableData new];
+    _branchIndexes = [NSMutableData new];
+    _persistentRootIndexes = [NSMutableData new];
+    _timestamps = [NSMutableData new];
+    _branchUUIDs = [NSMutableArray new];
+    _persistentRootUUIDs = [NSMutableArray new];
+    _revidForRevisionUUID = [NSMutableDictionary new];
+    _depths = [NSMutableData new];
+    _skipRevids = [NSMutableData new];
+    _mergeDepths = [NSMutableData new];
+    _hasAncestryIndex = YES;
+    return self;
+}
+
+- (NSString *)description
+{
+    return [NSString stringWithFormat: @"<%@ %p - %lld revids, %lu branches>",
+                                       NSStringFromClass([self class]),
+                                       self,
+                                       (long long)_count,
+                                       (unsigned long)_branchUUIDs.count];
+}
+
+#pragma mark Building -
+
+/**
+ * Returns the index of the UUID in the array, and adds it if needed.
+ *
+ * The revisions are usually grouped by branch, so we check the last UUID
+ * before searching the array.
+ */
+static uint32_t indexOfUUIDInArray(ETUUID *aUUID, NSMutableArray *UUIDs, uint32_t lastIndex)
+{
+    if (lastIndex < UUIDs.count && [UUIDs[lastIndex] isEqual: aUUID])
+        return lastIndex;
+
+    NSUInteger index = [UUIDs indexOfObject: aUUID];
+
+    if (index == NSNotFound)
+    {
+        [UUIDs addObject: aUUID];
+        index = UUIDs.count - 1;
+    }
+    return (uint32_t)index;
+}
+
+- (void)addRevid: (int64_t)aRevid
+    revisionUUID: (ETUUID *)aRevisionUUID
+     parentRevid: (int64_t)aParentRevid
+mergeParentRevid: (int64_t)aMergeParentRevid
+      branchUUID: (ETUUID *)aBranchUUID
+persistentRootUUID: (ETUUID *)aPersistentRootUUID
+       timestamp: (int64_t)aTimestamp
+           depth: (int64_t)aDepth
+       skipRevid: (int64_t)aSkipRevid
+      mergeDepth: (int64_t)aMergeDepth
+{
+    NILARG_EXCEPTION_TEST(aRevisionUUID);
+    NILARG_EXCEPTION_TEST(aBranchUUID);
+    NILARG_EXCEPTION_TEST(aPersistentRootUUID);
+    INVALIDARG_EXCEPTION_TEST(aRevid, aRevid >= _count);
+
+    const uint32_t lastBranchIndex =
+        (_count > 0 ? ((uint32_t *)_branchIndexes.mutableBytes)[_count - 1] : 0);
+    const uint32_t lastPersistentRootIndex =
+        (_count > 0 ? ((uint32_t *)_persistentRootIndexes.mutableBytes)[_count - 1] : 0);
+    const int64_t none = -1;
+    const uint32_t zeroIndex = 0;
+    const int64_t zeroTimestamp = 0;
+
+    // Fill the gaps left by deleted revisions
+    while (_count < aRevid)
+    {
+        [_revisionUUIDs addObject: [NSNull null]];
+        [_parentRevids appendBytes: &none length: sizeof(int64_t)];
+        [_mergeParentRevids appendBytes: &none length: sizeof(int64_t)];
+        [_branchIndexes appendBytes: &zeroIndex length: sizeof(uint32_t)];
+        [_persistentRootIndexes appendBytes: &zeroIndex length: sizeof(uint32_t)];
+        [_timestamps appendBytes: &zeroTimestamp length: sizeof(int64_t)];
+        [_depths appendBytes: &none length: sizeof(int64_t)];
+        [_skipRevids appendBytes: &none length: sizeof(int64_t)];
+        [_mergeDepths appendBytes: &none length: sizeof(int64_t)];
+        _count++;
+    }
+
+    const int64_t parentRevid = (aParentRevid >= 0 ? aParentRevid : -1);
+    const int64_t mergeParentRevid = (aMergeParentRevid >= 0 ? aMergeParentRevid : -1);
+    const uint32_t branchIndex = indexOfUUIDInArray(aBranchUUID, _branchUUIDs, lastBranchIndex);
+    const uint32_t persistentRootIndex =
+        indexOfUUIDInArray(aPersistentRootUUID, _persistentRootUUIDs, lastPersistentRootIndex);
+
+    [_revisionUUIDs addObject: aRevisionUUID];
+    [_parentRevids appendBytes: &parentRevid length: sizeof(int64_t)];
+    [_mergeParentRevids appendBytes: &mergeParentRevid length: sizeof(int64_t)];
+    [_branchIndexes appendBytes: &branchIndex length: sizeof(uint32_t)];
+    [_persistentRootIndexes appendBytes: &persistentRootIndex length: sizeof(uint32_t)];
+    [_timestamps appendBytes: &aTimestamp length: sizeof(int64_t)];
+    [_depths appendBytes: &aDepth length: sizeof(int64_t)];
+    [_skipRevids appendBytes: &aSkipRevid length: sizeof(int64_t)];
+    [_mergeDepths appendBytes: &aMergeDepth length: sizeof(int64_t)];
+    _revidForRevisionUUID[aRevisionUUID] = @(aRevid);
+    if (aDepth < 0)
+    {
+        _hasAncestryIndex = NO;
+    }
+    _count++;
+}
+
+#pragma mark Revision Access -
+
+- (BOOL)containsRevid: (int64_t)aRevid
+{
+    return aRevid >= 0 && aRevid < _count && _revisionUUIDs[(NSUInteger)aRevid] != [NSNull null];
+}
+
+- (int64_t)revidForRevisionUUID: (ETUUID *)aRevisionUUID
+{
+    NSNumber *revid = _revidForRevisionUUID[aRevisionUUID];
+    return (revid != nil ? revid.longLongValue : -1);
+}
+
+- (ETUUID *)revisionUUIDForRevid: (int64_t)aRevid
+{
+    if (![self containsRevid: aRevid])
+        return nil;
+
+    return _revisionUUIDs[(NSUInteger)aRevid];
+}
+
+- (int64_t)parentRevidForRevid: (int64_t)aRevid
+{
+    NSParameterAssert([self containsRevid: aRevid]);
+    return ((const int64_t *)_parentRevids.bytes)[aRevid];
+}
+
+- (int64_t)mergeParentRevidForRevid: (int64_t)aRevid
+{
+    NSParameterAssert([self containsRevid: aRevid]);
+    return ((const int64_t *)_mergeParentRevids.bytes)[aRevid];
+}
+
+- (ETUUID *)branchUUIDForRevid: (int64_t)aRevid
+{
+    NSParameterAssert([self containsRevid: aRevid]);
+    return _branchUUIDs[((const uint32_t *)_branchIndexes.bytes)[aRevid]];
+}
+
+- (ETUUID *)persistentRootUUIDForRevid: (int64_t)aRevid
+{
+    NSParameterAssert([self containsRevid: aRevid]);
+    return _persistentRootUUIDs[((const uint32_t *)_persistentRootIndexes.bytes)[aRevid]];
+}
+
+- (NSDate *)dateForRevid: (int64_t)aRevid
+{
+    NSParameterAssert([self containsRevid: aRevid]);
+    return CODateFromJavaTimestamp(@(((const int64_t *)_timestamps.bytes)[aRevid]));
+}
+
+#pragma mark Ancestry -
+
+- (int64_t)depthForRevid: (int64_t)aRevid
+{
+    NSParameterAssert([self containsRevid: aRevid]);
+
+    if (!_hasAncestryIndex)
+    {
+        const int64_t *parents = _parentRevids.bytes;
+        int64_t depth = 0;
+        int64_t revid = aRevid;
+
+        for (; [self containsRevid: parents[revid]]; revid = parents[revid])
+        {
+            depth++;
+        }
+        return (parents[revid] == -1 ? depth : -1);
+    }
+    return ((const int64_t *)_depths.bytes)[aRevid];
+}
+
+/**
+ * Walks the parents when the ancestry index is not available.
+ */
+- (int64_t)ancestorRevidForRevidWithoutIndex: (int64_t)aRevid atDepth: (int64_t)aDepth
+{
+    const int64_t *parents = _parentRevids.bytes;
+    NSMutableData *chain = [NSMutableData new];
+
+    for (int64_t revid = aRevid; [self containsRevid: revid]; revid = parents[revid])
+    {
+        [chain appendBytes: &revid length: sizeof(int64_t)];
+    }
+
+    const int64_t *revids = chain.bytes;
+    const int64_t chainLength = chain.length / sizeof(int64_t);
+
+    // The chain is complete only if the first revision has no parent
+    if (chainLength == 0 || parents[revids[chainLength - 1]] != -1)
+        return -1;
+    if (aDepth < 0 || aDepth >= chainLength)
+        return -1;
+
+    return revids[chainLength - 1 - aDepth];
+}
+
+- (int64_t)ancestorRevidForRevid: (int64_t)aRevid atDepth: (int64_t)aDepth
+{
+    if (![self containsRevid: aRevid])
+        return -1;
+    if (!_hasAncestryIndex)
+        return [self ancestorRevidForRevidWithoutIndex: aRevid atDepth: aDepth];
+
+    const int64_t *parents = _parentRevids.bytes;
+    const int64_t *depths = _depths.bytes;
+    const int64_t *skipRevids = _skipRevids.bytes;
+    int64_t revid = aRevid;
+    int64_t depth = depths[revid];
+
+    if (aDepth < 0 || aDepth > depth)
+        return -1;
+
+    while (depth > aDepth)
+    {
+        const int64_t skipRevid = skipRevids[revid];
+
+        if ([self containsRevid: skipRevid] && COShouldFollowSkipPointer(depth, aDepth))
+        {
+            revid = skipRevid;
+            depth = COSkipDepthForDepth(depth);
+        }
+        else
+        {
+            revid = parents[revid];
+            depth--;
+
+            // Deleted by a history compaction
+            if (![self containsRevid: revid])
+                return -1;
+        }
+    }
+    return revid;
+}
+
+- (BOOL)isRevid: (int64_t)aRevid equalToOrParentOfRevid: (int64_t)anotherRevid
+{
+    if (![self containsRevid: aRevid] || ![self containsRevid: anotherRevid])
+        return NO;
+
+    if (!_hasAncestryIndex)
+    {
+        const int64_t *parents = _parentRevids.bytes;
+
+        for (int64_t revid = anotherRevid; [self containsRevid: revid]; revid = parents[revid])
+        {
+            if (revid == aRevid)
+                return YES;
+        }
+        return NO;
+    }
+
+    return [self ancestorRevidForRevid: anotherRevid
+                               atDepth: [self depthForRevid: aRevid]] == aRevid;
+}
+
+/**
+ * Returns the common ancestor on the parent chains (ignoring merge parents),
+ * or -1 if it cannot be found with the ancestry index.
+ *
+ * Since the parent chains form a tree, the ancestors at a given depth are
+ * equal for all depths up to the common ancestor one, and we can do a binary
+ * search on the depth.
+ */
+- (int64_t)parentChainCommonAncestorForRevid: (int64_t)aRevid andRevid: (int64_t)anotherRevid
+{
+    int64_t low = 0;
+    int64_t high = MIN([self depthForRevid: aRevid], [self depthForRevid: anotherRevid]);
+    const int64_t ancestor = [self ancestorRevidForRevid: aRevid atDepth: high];
+    const int64_t otherAncestor = [self ancestorRevidForRevid: anotherRevid atDepth: high];
+
+    if (ancestor == -1 || otherAncestor == -1)
+        return -1;
+    if (ancestor == otherAncestor)
+        return ancestor;
+
+    const int64_t root = [self ancestorRevidForRevid: ancestor atDepth: 0];
+
+    if (root == -1 || root != [self ancestorRevidForRevid: otherAncestor atDepth: 0])
+        return -1;
+
+    // Invariant: the ancestors are equal at the low depth, and differ at the
+    // high depth
+    while (high - low > 1)
+    {
+        const int64_t depth = low + (high - low) / 2;
+        const int64_t revid = [self ancestorRevidForRevid: ancestor atDepth: depth];
+        const int64_t otherRevid = [self ancestorRevidForRevid: otherAncestor atDepth: depth];
+
+        if (revid == -1 || otherRevid == -1)
+            return -1;
+
+        if (revid == otherRevid)
+        {
+            low = depth;
+        }
+        else
+        {
+            high = depth;
+        }
+    }
+    return [self ancestorRevidForRevid: ancestor atDepth: low];
+}
+
+typedef NS_OPTIONS(uint8_t, COAncestorWalkFlags)
+{
+    COAncestorOfFirstRevid = 1 << 0,
+    COAncestorOfSecondRevid = 1 << 1,
+    COAncestorVisited = 1 << 2
+};
+
+/**
+ * A max-heap of revids.
+ */
+typedef struct
+{
+    int64_t *revids;
+    size_t count;
+    size_t capacity;
+} CORevidHeap;
+
+static void CORevidHeapPush(CORevidHeap *heap, int64_t revid)
+{
+    if (heap->count == heap->capacity)
+    {
+        heap->capacity = MAX(16, heap->capacity * 2);
+        heap->revids = realloc(heap->revids, heap->capacity * sizeof(int64_t));
+    }
+
+    size_t i = heap->count++;
+
+    while (i > 0 && heap->revids[(i - 1) / 2] < revid)
+    {
+        heap->revids[i] = heap->revids[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap->revids[i] = revid;
+}
+
+static int64_t CORevidHeapPop(CORevidHeap *heap)
+{
+    const int64_t result = heap->revids[0];
+    const int64_t last = heap->revids[--heap->count];
+    size_t i = 0;
+
+    while (2 * i + 1 < heap->count)
+    {
+        size_t child = 2 * i + 1;
+
+        if (child + 1 < heap->count && heap->revids[child + 1] > heap->revids[child])
+        {
+            child++;
+        }
+        if (heap->revids[child] <= last)
+            break;
+
+        heap->revids[i] = heap->revids[child];
+        i = child;
+    }
+    if (heap->count > 0)
+    {
+        heap->revids[i] = last;
+    }
+    return result;
+}
+
+/**
+ * Paints the ancestors of both revisions in decreasing revid order, and
+ * returns the first one painted by both.
+ *
+ * A parent revid is always lower than its child one, so when a revision is
+ * popped, all its descendants reachable from the two revisions have been
+ * visited, and the revision is a common ancestor that is not an ancestor of
+ * another common ancestor.
+ */
+- (int64_t)walkedCommonAncestorForRevid: (int64_t)aRevid andRevid: (int64_t)anotherRevid
+{
+    const int64_t *parents = _parentRevids.bytes;
+    const int64_t *mergeParents = _mergeParentRevids.bytes;
+    uint8_t *flags = calloc((size_t)MAX(aRevid, anotherRevid) + 1, sizeof(uint8_t));
+    CORevidHeap heap = { NULL, 0, 0 };
+    int64_t result = -1;
+
+    flags[aRevid] |= COAncestorOfFirstRevid;
+    flags[anotherRevid] |= COAncestorOfSecondRevid;
+    CORevidHeapPush(&heap, aRevid);
+    CORevidHeapPush(&heap, anotherRevid);
+
+    while (heap.count > 0)
+    {
+        const int64_t revid = CORevidHeapPop(&heap);
+
+        if (flags[revid] & COAncestorVisited)
+            continue;
+
+        flags[revid] |= COAncestorVisited;
+
+        const COAncestorWalkFlags paint = flags[revid] & (COAncestorOfFirstRevid | COAncestorOfSecondRevid);
+
+        if (paint == (COAncestorOfFirstRevid | COAncestorOfSecondRevid))
+        {
+            result = revid;
+            break;
+        }
+
+        const int64_t parentRevids[2] = { parents[revid], mergeParents[revid] };
+
+        for (int i = 0; i < 2; i++)
+        {
+            const int64_t parentRevid = parentRevids[i];
+
+            if (![self containsRevid: parentRevid] || (flags[parentRevid] & paint) == paint)
+                continue;
+
+            flags[parentRevid] |= paint;
+            CORevidHeapPush(&heap, parentRevid);
+        }
+    }
+
+    free(heap.revids);
+    free(flags);
+    return result;
+}
+
+- (int64_t)commonAncestorForRevid: (int64_t)aRevid andRevid: (int64_t)anotherRevid
+{
+    if (![self containsRevid: aRevid] || ![self containsRevid: anotherRevid])
+        return -1;
+    if (aRevid == anotherRevid)
+        return aRevid;
+
+    if (_hasAncestryIndex)
+    {
+        const int64_t *mergeDepths = _mergeDepths.bytes;
+        const int64_t ancestor = [self parentChainCommonAncestorForRevid: aRevid
+                                                                andRevid: anotherRevid];
+
+        // Without merges after the parent chain common ancestor, the
+        // ancestors of both revisions are their parent chains down to this
+        // ancestor, plus the ancestors of this ancestor.
+        if (ancestor != -1
+            && mergeDepths[aRevid] <= [self depthForRevid: ancestor]
+            && mergeDepths[anotherRevid] <= [self depthForRevid: ancestor])
+        {
+            return ancestor;
+        }
+    }
+    return [self walkedCommonAncestorForRevid: aRevid andRevid: anotherRevid];
+}
+
+@end
@@ -8,7 +8,7 @@
 #import "COSQLiteStore.h"
 #import "FMDatabase.h"
 
-@class COSQLiteStorePersistentRootBackingStore;
+@class COSQLiteStorePersistentRootBackingStore, COSQLiteStoreReader, COSQLiteStoreBackingStoreStatistics;
 
 /**
  * Private methods which are exposed so tests can look at the store internals.
@@ -16,6 +16,12 @@
 @interface COSQLiteStore ()
 
 @property (nonatomic, readonly, strong) FMDatabase *database;
+/**
+ * The maximum number of commits in a delta run, for 
+ * COSQLiteStoreSnapshotPolicyCommitCount and COSQLiteStoreSnapshotPolicyAdaptive.
+ *
+ * By default, 50.
+ */
 @property (nonatomic, readwrite, assign) NSUInteger maxNumberOfDeltaCommits;
 
 - (BOOL)writeRevisionWithModifiedItems: (COItemGraph *)anItemTree
@@ -28,5 +34,39 @@
 - (COSQLiteStorePersistentRootBackingStore *)backingStoreForPersistentRootUUID: (ETUUID *)aUUID
                                                             createIfNotPresent: (BOOL)createIfNotPresent;
 - (void)testingRunBlockInStoreQueue: (void (^)())aBlock;
+/**
+ * Executes the transactions in a single group commit, in the given order, and 
+ * returns whether each one succeeded (as NSNumber booleans).
+ *
+ * Doesn't post commit notifications.
+ */
+- (NSArray *)testingCommitStoreTransactionsInGroup: (NSArray *)transactions;
+/**
+ * Suspends or resumes the index queue, so the search index journal is only 
+ * applied by -waitUntilSearchIndexesAreUpdated or another store instance.
+ *
+ * Each suspension must be balanced by a resumption before the store is 
+ * deallocated.
+ */
+- (void)testingSetSearchIndexUpdatesSuspended: (BOOL)suspended;
+/**
+ * Returns the read and write statistics shared by the store connection and the 
+ * readers for the given backing store. Can be called from any thread.
+ */
+- (COSQLiteStoreBackingStoreStatistics *)statisticsForBackingStoreUUID: (ETUUID *)aUUID;
+/**
+ * Runs the block with a read-only connection from the reader pool, inside a 
+ * read transaction.
+ *
+ * Waits for a connection if they are all in use. Can be called from any 
+ * thread, except the store queue.
+ */
+- (void)performReadUsingBlock: (void (^)(COSQLiteStoreReader *reader))aBlock;
+/**
+ * Discards the revision contents cached by the reader pool. Must be called in 
+ * the store queue, inside the transaction that deletes revisions, since 
+ * revids can be reused.
+ */
+- (void)invalidateReaderCaches;
 
 @end
@@ -10,7 +10,7 @@
 
 @protocol COItemGraph;
 @class ETUUID;
-@class COItem, CORevisionInfo, COItemGraph, COBranchInfo, COPersistentRootInfo;
+@class COItem, CORevisionInfo, CORevisionGraph, COItemGraph, COBranchInfo, COPersistentRootInfo, COSearchResult;
 @class FMDatabase, COStoreTransaction;
 
 #define BACKING_STORES_SHARE_SAME_SQLITE_DB 1
@@ -46,6 +46,64 @@ typedef NS_OPTIONS(NSUInteger, COBranchRevisionReadingOptions)
     COBranchRevisionReadingDivergentRevisions = 4
 };
 
+/**
+ * Controls when a commit is stored as a full snapshot of the persistent root 
+ * state, rather than as a delta against its parent.
+ *
+ * Reading a revision requires parsing all the deltas back to the last 
+ * snapshot, while writing a snapshot requires loading and writing the whole 
+ * state. See -[COSQLiteStore snapshotPolicy].
+ */
+typedef NS_ENUM(NSUInteger, COSQLiteStoreSnapshotPolicy)
+{
+    /**
+     * Write a snapshot every -maxNumberOfDeltaCommits commits.
+     */
+    COSQLiteStoreSnapshotPolicyCommitCount,
+    /**
+     * Write a snapshot when the deltas since the last snapshot would exceed 
+     * -maxNumberOfBytesInDeltaRun.
+     */
+    COSQLiteStoreSnapshotPolicyByteCount,
+    /**
+     * Write a snapshot when the estimated time to parse the deltas since the 
+     * last snapshot, to reconstruct the new revision, would exceed 
+     * -maxReconstructionTime.
+     *
+     * The estimate is based on the reconstruction times measured for the 
+     * persistent root, and falls back on COSQLiteStoreSnapshotPolicyByteCount 
+     * until a measurement is available.
+     */
+    COSQLiteStoreSnapshotPolicyReconstructionCost,
+    /**
+     * Like COSQLiteStoreSnapshotPolicyByteCount, but the byte and commit 
+     * limits are scaled for each persistent root, based on the ratio between 
+     * the revisions read and written.
+     *
+     * Persistent roots mostly read (e.g. open documents being navigated) get 
+     * shorter delta runs, and persistent roots mostly written (e.g. logs) get 
+     * longer ones (up to 16 times the limits).
+     */
+    COSQLiteStoreSnapshotPolicyAdaptive
+};
+
+/**
+ * Compression applied to the commit contents written to the store. 
+ *
+ * See -[COSQLiteStore commitCompression].
+ */
+typedef NS_ENUM(NSUInteger, COSQLiteStoreCompression)
+{
+    /**
+     * Commit contents are stored uncompressed.
+     */
+    COSQLiteStoreCompressionNone,
+    /**
+     * Commit contents are compressed with zlib.
+     */
+    COSQLiteStoreCompressionZlib
+};
+
 /**
  * Semi-private notification name posted by COSQLiteStore. Only intended for
  * use by COEditingContext or clients using COSQLiteStore directly.
@@ -304,6 +362,10 @@ extern NSString *const COPersistentRootAttributeUsedSize;
  * One idea was to add a fromVersion: paramater to -setCurrentVersion:forBranch:...,  and within the transaction, 
  * fail if the current state is not the fromVersion.
  *
+ * Within a process, all the writes go through a single writer connection and a serial queue, while reads use a 
+ * pool of read-only connections (see -maxNumberOfReaders). Each read runs in its own read transaction, so it sees 
+ * a consistent snapshot of the store, and neither waits for the commits in progress nor blocks them.
+ *
  * Footnotes
  * ---------
  *
@@ -349,10 +411,37 @@ extern NSString *const COPersistentRootAttributeUsedSize;
 
     dispatch_queue_t queue_;
     NSUInteger _maxNumberOfDeltaCommits;
+    NSUInteger _maxItemGraphCacheSize;
+    COSQLiteStoreSnapshotPolicy _snapshotPolicy;
+    NSUInteger _maxNumberOfBytesInDeltaRun;
+    NSTimeInterval _maxReconstructionTime;
+    COSQLiteStoreCompression _commitCompression;
+    BOOL _usesCompressionDictionaries;
+
+    dispatch_queue_t _readQueue;
+    NSCondition *_readerPoolCondition;
+    NSMutableArray *_idleReaders; // COSQLiteStoreReader
+    NSUInteger _numberOfReaders;
+    NSUInteger _maxNumberOfReaders;
+    NSMutableArray *_pendingReads; // blocks waiting for a reader
+    NSMutableDictionary *_backingStoreStatistics; // ETUUID (backing store UUID) => COSQLiteStoreBackingStoreStatistics
+    BOOL _groupsCommits;
+    NSMutableArray *_pendingCommits; // COSQLiteStorePendingCommit
+    NSMutableDictionary *_indexedPropertyNamesByEntityName; // NSString => NSMutableSet
+    int64_t _indexedPropertyNamesDataVersion;
+    BOOL _updatesSearchIndexesInBackground;
+    dispatch_queue_t _indexQueue;
+    BOOL _hasSearchIndexJournal;
+    BOOL _searchIndexUpdateScheduled;
+    NSMutableDictionary *_unindexedItemGraphs; // ETUUID (revision UUID) => COItemGraph (bounded)
 }
 
 /**
  * Opens an exisiting, or creates a new CoreObject store at the given file:// URL.
+ *
+ * When opening a store created by an older CoreObject version, the indexes on 
+ * current revisions can be rebuilt once, which reads the current item graph of 
+ * every persistent root in a single transaction.
  */
 - (instancetype)initWithURL: (NSURL *)aURL NS_DESIGNATED_INITIALIZER;
 
@@ -384,6 +473,45 @@ extern NSString *const COPersistentRootAttributeUsedSize;
  */
 - (NSArray *)revisionInfosForBranchUUID: (ETUUID *)aBranchUUID
                                 options: (COBranchRevisionReadingOptions)options;
+/**
+ * Returns the revision DAG of the backing store where the given persistent
+ * root is stored (without the revision metadata), or nil if the persistent
+ * root doesn't exist.
+ *
+ * The whole DAG is loaded with a single query, so this is much faster than
+ * calling -revisionInfoForRevisionUUID:persistentRootUUID: for each revision
+ * when walking the history.
+ */
+- (CORevisionGraph *)revisionGraphForPersistentRootUUID: (ETUUID *)aPersistentRoot;
+/**
+ * Adds the revisions committed since the given revision graph was loaded with 
+ * -revisionGraphForPersistentRootUUID:, and returns YES.
+ *
+ * Only the new revisions are read, so this is much faster than reloading the 
+ * graph after each commit.
+ *
+ * Returns NO, and leaves the graph untouched, if the persistent root doesn't 
+ * exist, or if a history compaction deleted the last revision in the graph 
+ * (the graph must then be reloaded).
+ *
+ * The graph must not be accessed by other threads during the update.
+ */
+- (BOOL)updateRevisionGraph: (CORevisionGraph *)aGraph
+      forPersistentRootUUID: (ETUUID *)aPersistentRoot;
+/**
+ * Returns the given revisions and all their ancestors (following the merge
+ * parents too), minus the excluded revisions and their ancestors.
+ *
+ * The excluded revisions can be nil. The revisions that don't exist in the
+ * persistent root are ignored.
+ *
+ * The ancestors are computed in the store without creating any object per
+ * revision, and the walk uses a bounded amount of memory, so this is suited
+ * to compute which revisions to send when synchronizing.
+ */
+- (NSSet<ETUUID *> *)revisionUUIDsOfAncestorsOfRevisionUUIDs: (NSSet<ETUUID *> *)revisionUUIDs
+                           excludingAncestorsOfRevisionUUIDs: (NSSet<ETUUID *> *)excludedRevisionUUIDs
+                                          persistentRootUUID: (ETUUID *)aPersistentRoot;
 /**
  * Returns all revision infos of the backing store where the given persistent
  * root is stored
@@ -412,6 +540,59 @@ extern NSString *const COPersistentRootAttributeUsedSize;
  * Returns the UUID of the root object of the given persistent root.
  */
 - (ETUUID *)rootObjectUUIDForPersistentRoot: (ETUUID *)aPersistentRoot;
+/**
+ * The approximate number of bytes of reconstructed revision contents that each 
+ * backing store keeps in memory, to speed up loading revisions close to a 
+ * recently loaded one (e.g. when navigating the history).
+ *
+ * The read-only connections (see -maxNumberOfReaders) split this size between 
+ * them, rather than each caching that much.
+ *
+ * By default, 4 MB. 0 disables the cache.
+ */
+@property (nonatomic, readwrite, assign) NSUInteger maxItemGraphCacheSize;
+/**
+ * The policy used to decide when a commit is written as a full snapshot.
+ *
+ * By default, COSQLiteStoreSnapshotPolicyCommitCount.
+ *
+ * The policy can be changed at any time, and only affects future commits.
+ */
+@property (atomic, readwrite, assign) COSQLiteStoreSnapshotPolicy snapshotPolicy;
+/**
+ * The maximum size of the deltas since the last snapshot, for 
+ * COSQLiteStoreSnapshotPolicyByteCount and COSQLiteStoreSnapshotPolicyAdaptive.
+ *
+ * By default, 64 KB.
+ */
+@property (atomic, readwrite, assign) NSUInteger maxNumberOfBytesInDeltaRun;
+/**
+ * The maximum estimated time to parse the deltas on top of the last snapshot 
+ * when reconstructing a revision, for 
+ * COSQLiteStoreSnapshotPolicyReconstructionCost.
+ *
+ * By default, 5 ms.
+ */
+@property (atomic, readwrite, assign) NSTimeInterval maxReconstructionTime;
+/**
+ * The compression applied to the commit contents written from now on.
+ *
+ * Commit contents are read back whatever compression they were written with, 
+ * so the compression can be changed at any time.
+ *
+ * By default, COSQLiteStoreCompressionNone.
+ */
+@property (atomic, readwrite, assign) COSQLiteStoreCompression commitCompression;
+/**
+ * Whether each persistent root compresses its commits with a dictionary 
+ * trained on its first snapshot written with compression enabled.
+ *
+ * Since persistent roots repeat the same attribute names and values in many 
+ * commits, a dictionary improves the compression of small commits a lot.
+ *
+ * The dictionary is kept in the persistent root metadata. By default, YES.
+ */
+@property (atomic, readwrite, assign) BOOL usesCompressionDictionaries;
 
 
 /** @taskunit Persistent Root Reading */
@@ -428,20 +609,172 @@ extern NSString *const COPersistentRootAttributeUsedSize;
  *          the persistent root does not exist.
  */
 - (COPersistentRootInfo *)persistentRootInfoForUUID: (ETUUID *)aUUID;
+/**
+ * Returns snapshots of the given persistent roots, in the same order, and 
+ * omits the persistent roots that don't exist.
+ *
+ * All the persistent roots and their branches are read together with a few 
+ * queries, which is much faster than calling -persistentRootInfoForUUID: for 
+ * each one.
+ */
+- (NSArray<COPersistentRootInfo *> *)persistentRootInfosForUUIDs: (NSArray<ETUUID *> *)UUIDs;
+/**
+ * Returns snapshots of all the non-deleted persistent roots.
+ *
+ * See -persistentRootUUIDs and -persistentRootInfosForUUIDs:.
+ */
+@property (nonatomic, readonly) NSArray<COPersistentRootInfo *> *persistentRootInfos;
+/**
+ * Returns snapshots of all the deleted persistent roots.
+ *
+ * See -deletedPersistentRootUUIDs and -persistentRootInfosForUUIDs:.
+ */
+@property (nonatomic, readonly) NSArray<COPersistentRootInfo *> *deletedPersistentRootInfos;
 - (ETUUID *)persistentRootUUIDForBranchUUID: (ETUUID *)aBranchUUID;
 
 
+/** @taskunit Asynchronous Reading */
+
+
+/**
+ * The maximum number of read-only database connections used to run reads 
+ * concurrently.
+ *
+ * The synchronous and asynchronous reads below use these connections, so 
+ * they don't wait for the commits in progress, and only wait for each other 
+ * when all the connections are in use. In this case, the asynchronous reads 
+ * are queued until a connection is available, rather than blocking a 
+ * background thread.
+ *
+ * By default, 4.
+ */
+@property (atomic, readwrite, assign) NSUInteger maxNumberOfReaders;
+/**
+ * Reads the state of a persistent root in the background, then passes it (or 
+ * nil if the persistent root doesn't exist) to the handler.
+ *
+ * The handler is called on a background queue, and never on the calling 
+ * thread.
+ *
+ * See -persistentRootInfoForUUID:.
+ */
+- (void)persistentRootInfoForUUID: (ETUUID *)aUUID
+                completionHandler: (void (^)(COPersistentRootInfo *info))handler;
+/**
+ * Reads the revisions of a branch in the background, then passes them (or nil 
+ * if the persistent root of the branch doesn't exist) to the handler.
+ *
+ * The handler is called on a background queue, and never on the calling 
+ * thread.
+ *
+ * See -revisionInfosForBranchUUID:options:.
+ */
+- (void)revisionInfosForBranchUUID: (ETUUID *)aBranchUUID
+                           options: (COBranchRevisionReadingOptions)options
+                 completionHandler: (void (^)(NSArray *revisionInfos))handler;
+/**
+ * Reconstructs the state of the inner object graph at a given revision in the 
+ * background, then passes it (or nil if the revision doesn't exist) to the 
+ * handler.
+ *
+ * The handler is called on a background queue, and never on the calling 
+ * thread.
+ *
+ * See -itemGraphForRevisionUUID:persistentRoot:.
+ */
+- (void)itemGraphForRevisionUUID: (ETUUID *)aRevisionUUID
+                  persistentRoot: (ETUUID *)aPersistentRoot
+               completionHandler: (void (^)(COItemGraph *itemGraph))handler;
+
+
 /** @taskunit Search. API not final. */
 
 
 /**
- * @returns an array of COSearchResult
+ * Returns the revisions whose written items match the FTS query, as
+ * COSearchResult objects (without inner object UUIDs).
+ *
+ * All the revisions are searched, including the ones that are not current
+ * anymore, and each revision is matched as a whole (e.g. two words can match
+ * in distinct inner objects).
+ *
+ * Waits until the revisions committed so far are indexed, see
+ * -searchResultsForQuery:allowsStaleResults:.
+ *
+ * See also -currentSearchResultsForQuery:.
  */
 - (NSArray *)searchResultsForQuery: (NSString *)aQuery;
 /**
- * @returns an array of COSearchResult
+ * Returns the revisions whose written items match the FTS query, as
+ * COSearchResult objects (without inner object UUIDs).
+ *
+ * If allowsStale is YES and the revision indexes are updated in the
+ * background, the results don't include the revisions that remain to be
+ * indexed, otherwise the method waits until they are indexed.
+ *
+ * See -updatesSearchIndexesInBackground.
+ */
+- (NSArray *)searchResultsForQuery: (NSString *)aQuery
+                allowsStaleResults: (BOOL)allowsStale;
+/**
+ * Returns the inner objects that match the FTS query, in the current revisions
+ * of the current branches, as COSearchResult objects.
+ *
+ * Deleted persistent roots are ignored.
+ *
+ * Unlike -searchResultsForQuery:, each inner object is matched on its own, and
+ * on commit, only the inner objects written in the new revision are reindexed.
+ */
+- (NSArray<COSearchResult *> *)currentSearchResultsForQuery: (NSString *)aQuery;
+/**
+ * Whether the revision indexes (full-text, persistent root and attachment
+ * references, and property values in all revisions) are updated in the
+ * background rather than in the commit transaction.
+ *
+ * In this mode, each written revision is recorded in a journal as part of the
+ * commit, then the journal is applied on a background queue, in transactions
+ * that index several revisions together. The journal is persistent, so the
+ * revisions not indexed when the store is closed are indexed once it is opened
+ * again.
+ *
+ * The methods that read the revision indexes wait until the journal is
+ * applied, except -searchResultsForQuery:allowsStaleResults:. The indexes on
+ * the current revisions (e.g. -currentReferencesToPersistentRoot:) are always
+ * updated in the commit transaction.
+ *
+ * By default, NO.
+ */
+@property (atomic, readwrite, assign) BOOL updatesSearchIndexesInBackground;
+/**
+ * Blocks until the revisions committed so far are indexed.
+ *
+ * See -updatesSearchIndexesInBackground.
+ */
+- (void)waitUntilSearchIndexesAreUpdated;
+/**
+ * Returns the references to the given persistent root in all the revisions, 
+ * as COSearchResult objects (with the backing store UUID as persistent root).
+ *
+ * See also -currentReferencesToPersistentRoot:.
  */
 - (NSArray *)referencesToPersistentRoot: (ETUUID *)aUUID;
+/**
+ * Returns the references to the given persistent root in the current revisions 
+ * of the current branches, as COSearchResult objects.
+ *
+ * Deleted persistent roots are ignored.
+ *
+ * This can be used to answer derived properties accross persistent roots 
+ * (e.g. the tags of a document), without loading every persistent root.
+ */
+- (NSArray<COSearchResult *> *)currentReferencesToPersistentRoot: (ETUUID *)aUUID;
+/**
+ * Returns the non-deleted persistent roots whose current revision of the 
+ * current branch references the given persistent root.
+ *
+ * See -currentReferencesToPersistentRoot:.
+ */
+- (NSArray<ETUUID *> *)persistentRootUUIDsReferencingPersistentRoot: (ETUUID *)aUUID;
 /**
  * Finalizes the deletion of any unreachable commits (whether due to -setInitialRevision:... moving the initial pointer,
  * or branches being deleted), any deleted branches, or the persistent root itself, as well as all unreachable
@@ -486,10 +819,134 @@ extern NSString *const COPersistentRootAttributeUsedSize;
 @property (nonatomic, readonly) NSDictionary *pageStatistics;
 
 
+/** @taskunit Property Indexes. API not final. */
+
+
+/**
+ * Sets the properties whose values are indexed in the store, for the items
+ * whose entity name is the given one.
+ *
+ * Only attributes whose primitive type is kCOTypeInt64, kCOTypeDouble,
+ * kCOTypeString or kCOTypeBlob can be indexed. For multivalued attributes,
+ * each element is indexed.
+ *
+ * The index spec is persistent, so it is used by every editing context and
+ * process committing to the store. Usually you don't call this method
+ * directly, the editing context registers the properties marked with
+ * -[ETPropertyDescription indexedInStore] in its metamodel.
+ *
+ * When the spec changes, the index on current revisions is rebuilt for the 
+ * items of this entity, but the index on all revisions only covers the 
+ * revisions written afterwards. When the spec is unchanged, the store is not 
+ * locked.
+ *
+ * The rebuild reads the current item graph of every persistent root, so its 
+ * cost grows with the store size. It runs in several transactions, so 
+ * commits can run in between, and until it is done, the search on current 
+ * revisions can return results based on the old spec.
+ *
+ * Passing an empty set unregisters the entity.
+ */
+- (void)setIndexedPropertyNames: (NSSet<NSString *> *)propertyNames
+                  forEntityName: (NSString *)anEntityName;
+/**
+ * Returns the entity names that have indexed properties in the store.
+ */
+- (NSSet<NSString *> *)indexedEntityNames;
+/**
+ * Returns the properties indexed in the store for the given entity name.
+ */
+- (NSSet<NSString *> *)indexedPropertyNamesForEntityName: (NSString *)anEntityName;
+/**
+ * Returns the inner objects whose given property is equal to the value, in the
+ * current revisions of the current branches, as COSearchResult objects.
+ *
+ * Deleted persistent roots are ignored.
+ *
+ * For example, this can be used to find all the bookmarks with a given URL,
+ * without loading every bookmark library.
+ */
+- (NSArray<COSearchResult *> *)searchResultsForProperty: (NSString *)aProperty
+                                                  value: (id)aValue;
+/**
+ * Returns the inner objects whose given property is in the range
+ * [minValue, maxValue], in the current revisions of the current branches, as
+ * COSearchResult objects.
+ *
+ * A nil bound means the range is unbounded on this side. The values are
+ * compared with the SQLite rules, so both bounds should have the same type
+ * than the indexed values (integers and doubles can be mixed though).
+ *
+ * Deleted persistent roots are ignored.
+ *
+ * The property is matched for all the entities that index it, see 
+ * -searchResultsForProperty:entityName:minimumValue:maximumValue:.
+ */
+- (NSArray<COSearchResult *> *)searchResultsForProperty: (NSString *)aProperty
+                                           minimumValue: (id)minValue
+                                           maximumValue: (id)maxValue;
+/**
+ * Returns the inner objects of the given entity whose given property is in the
+ * range [minValue, maxValue], in the current revisions of the current 
+ * branches, as COSearchResult objects.
+ *
+ * The entity name must be the exact entity of the inner objects (subentities 
+ * are not matched). A nil entity name matches all the entities, see 
+ * -searchResultsForProperty:minimumValue:maximumValue:.
+ */
+- (NSArray<COSearchResult *> *)searchResultsForProperty: (NSString *)aProperty
+                                             entityName: (NSString *)anEntityName
+                                           minimumValue: (id)minValue
+                                           maximumValue: (id)maxValue;
+/**
+ * Returns the inner objects whose given property is in the range
+ * [minValue, maxValue], in the revisions where the inner objects were written,
+ * as COSearchResult objects.
+ *
+ * Unlike -searchResultsForProperty:minimumValue:maximumValue:, the revisions
+ * are not restricted to the current ones, and can belong to deleted persistent
+ * roots. A result is reported for each persistent root sharing the backing
+ * store (e.g. cheap copies).
+ */
+- (NSArray<COSearchResult *> *)revisionSearchResultsForProperty: (NSString *)aProperty
+                                                   minimumValue: (id)minValue
+                                                   maximumValue: (id)maxValue;
+
+
 /** @taskunit Transactions */
 
 
+/**
+ * Commits the transaction atomically, and posts 
+ * COStorePersistentRootsDidChangeNotification if it succeeds.
+ *
+ * Returns NO if the transaction IDs don't match the persistent root ones in 
+ * the store, or if one action fails. In this case, no changes are committed.
+ *
+ * See also -groupsCommits.
+ */
 - (BOOL)commitStoreTransaction: (COStoreTransaction *)aTransaction;
+/**
+ * Whether the transactions submitted concurrently to -commitStoreTransaction: 
+ * from multiple threads are committed together, in a single SQLite 
+ * transaction (with a single sync to disk).
+ *
+ * Each transaction is still checked and rolled back independently, so one 
+ * failing doesn't prevent the others from being committed, and posts its own 
+ * commit notification. However, -commitStoreTransaction: only returns once the 
+ * whole group is committed.
+ *
+ * In this mode, -commitStoreTransaction: can be called from any thread, and 
+ * the commit notifications are posted synchronously on the main thread (so 
+ * the main thread must not block waiting on a committing thread).
+ *
+ * Throughput increases with the number of committing threads, rather than 
+ * being limited by the disk sync latency. With a single committing thread, 
+ * this makes no difference.
+ *
+ * By default, NO.
+ */
+@property (atomic, readwrite, assign) BOOL groupsCommits;
 - (void)clearStore;
 
 
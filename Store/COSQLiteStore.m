@@ -8,6 +8,7 @@
 #import "COSQLiteStore.h"
 #import "COSQLiteStore+Private.h"
 #import "COSQLiteStorePersistentRootBackingStore.h"
+#import "COSQLiteStoreReader.h"
 #import "CORevisionInfo.h"
 #import <EtoileFoundation/Macros.h>
 
@@ -39,6 +40,22 @@ NSString *const kCOStoreURL = @"COStoreURL";
 NSString *const COPersistentRootAttributeExportSize = @"COPersistentRootAttributeExportSize";
 NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeUsedSize";
 
+/**
+ * The maximum number of journaled revisions indexed in a single transaction,
+ * so commits can run in between.
+ */
+static const NSUInteger COSearchIndexJournalBatchSize = 64;
+/**
+ * The maximum number of journaled item graphs kept in memory until they are
+ * indexed. Beyond that, the items are read back from the backing store.
+ */
+static const NSUInteger COMaxUnindexedItemGraphCount = 256;
+/**
+ * The maximum number of persistent roots whose current property values are 
+ * reindexed in a single transaction, when the index spec changes.
+ */
+static const NSUInteger COPropertyReindexBatchSize = 16;
+
 
 @interface COSQLiteStore (AttachmentsPrivate)
 
@@ -48,9 +65,55 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
 @end
 
 
+/**
+ * A store transaction submitted to -commitStoreTransaction: and waiting to be 
+ * executed with the other ones in the same group commit.
+ */
+@interface COSQLiteStorePendingCommit : NSObject
+{
+@public
+    COStoreTransaction *transaction;
+    NSMutableDictionary *txnIDForPersistentRoot;
+    NSMutableArray *insertedUUIDs;
+    NSMutableArray *deletedUUIDs;
+    BOOL succeeded;
+}
+
+- (instancetype)initWithTransaction: (COStoreTransaction *)aTransaction NS_DESIGNATED_INITIALIZER;
+
+@end
+
+
+@implementation COSQLiteStorePendingCommit
+
+- (instancetype)initWithTransaction: (COStoreTransaction *)aTransaction
+{
+    NILARG_EXCEPTION_TEST(aTransaction);
+    SUPERINIT;
+    transaction = aTransaction;
+    txnIDForPersistentRoot = [NSMutableDictionary new];
+    insertedUUIDs = [NSMutableArray new];
+    deletedUUIDs = [NSMutableArray new];
+    return self;
+}
+
+- (instancetype)init
+{
+    return [self initWithTransaction: nil];
+}
+
+@end
+
+
 @implementation COSQLiteStore
 
 @synthesize maxNumberOfDeltaCommits = _maxNumberOfDeltaCommits;
+@synthesize snapshotPolicy = _snapshotPolicy;
+@synthesize maxNumberOfBytesInDeltaRun = _maxNumberOfBytesInDeltaRun;
+@synthesize maxReconstructionTime = _maxReconstructionTime;
+@synthesize commitCompression = _commitCompression;
+@synthesize usesCompressionDictionaries = _usesCompressionDictionaries;
+@synthesize updatesSearchIndexesInBackground = _updatesSearchIndexesInBackground;
 
 - (instancetype)initWithURL: (NSURL *)aURL
 {
@@ -64,6 +127,25 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
     backingStores_ = [[NSMutableDictionary alloc] init];
     backingStoreUUIDForPersistentRootUUID_ = [[NSMutableDictionary alloc] init];
     _maxNumberOfDeltaCommits = 50;
+    _maxItemGraphCacheSize = 4 * 1024 * 1024;
+    _snapshotPolicy = COSQLiteStoreSnapshotPolicyCommitCount;
+    _maxNumberOfBytesInDeltaRun = 64 * 1024;
+    _maxReconstructionTime = 0.005;
+    _commitCompression = COSQLiteStoreCompressionNone;
+    _usesCompressionDictionaries = YES;
+    _maxNumberOfReaders = 4;
+    _pendingCommits = [NSMutableArray new];
+    _indexedPropertyNamesByEntityName = [NSMutableDictionary new];
+    _readerPoolCondition = [NSCondition new];
+    _idleReaders = [NSMutableArray new];
+    _pendingReads = [NSMutableArray new];
+    _backingStoreStatistics = [NSMutableDictionary new];
+    _readQueue = dispatch_queue_create([[NSString stringWithFormat: @"COSQLiteStore-reads-%p",
+                                                                    self] UTF8String],
+                                       DISPATCH_QUEUE_CONCURRENT);
+    _indexQueue = dispatch_queue_create([[NSString stringWithFormat: @"COSQLiteStore-indexing-%p",
+                                                                     self] UTF8String], NULL);
+    _unindexedItemGraphs = [NSMutableDictionary new];
 
     __block BOOL ok = YES;
 
@@ -97,6 +179,12 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
         // Set up schema
 
         ok = [self setupSchema];
+
+        // Index the revisions journaled before the store was closed
+        if (ok)
+        {
+            [self scheduleSearchIndexUpdateIfNeeded];
+        }
     });
 
     if (!ok)
@@ -120,13 +208,64 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
         db_ = nil;
     });
 
+    for (COSQLiteStoreReader *reader in _idleReaders)
+    {
+        [reader close];
+    }
+
 #ifdef GNUSTEP
     // For GNUstep, ARC doesn't manage libdispatch objects since libobjc2 doesn't support it 
     // currently (we compile CoreObject with -DOS_OBJECT_USE_OBJC=0).
     dispatch_release(queue_);
+    dispatch_release(_readQueue);
+    dispatch_release(_indexQueue);
 #endif
 }
 
+/**
+ * Loads the index spec, that can be changed by other store instances for the 
+ * same URL (possibly in other processes).
+ */
+- (void)loadIndexedPropertyNames
+{
+    dispatch_assert_queue(queue_);
+
+    [_indexedPropertyNamesByEntityName removeAllObjects];
+    _indexedPropertyNamesDataVersion = [db_ int64ForQuery: @"PRAGMA data_version"];
+
+    FMResultSet *rs = [db_ executeQuery: @"SELECT entityname, property FROM indexed_properties"];
+    while ([rs next])
+    {
+        NSString *entityName = [rs stringForColumnIndex: 0];
+        NSMutableSet *propertyNames = _indexedPropertyNamesByEntityName[entityName];
+
+        if (propertyNames == nil)
+        {
+            propertyNames = [NSMutableSet new];
+            _indexedPropertyNamesByEntityName[entityName] = propertyNames;
+        }
+        [propertyNames addObject: [rs stringForColumnIndex: 1]];
+    }
+    [rs close];
+}
+
+/**
+ * Reloads the index spec if another connection committed since it was loaded.
+ *
+ * PRAGMA data_version doesn't read the database, so unlike loading the spec, 
+ * this can be done on every commit. It doesn't change on the commits of this 
+ * store instance, so the spec is only reloaded in multi-process use.
+ */
+- (void)loadIndexedPropertyNamesIfNeeded
+{
+    dispatch_assert_queue(queue_);
+
+    if ([db_ int64ForQuery: @"PRAGMA data_version"] != _indexedPropertyNamesDataVersion)
+    {
+        [self loadIndexedPropertyNames];
+    }
+}
+
 - (BOOL)setupSchema
 {
     dispatch_assert_queue(queue_);
@@ -174,7 +313,68 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
      * In inner_object_uuid in revid of backing store root_id, there was a reference to dest_root_id
      */
     [db_ executeUpdate: @"CREATE TABLE IF NOT EXISTS proot_refs (root_id BLOB, revid BOLB, inner_object_uuid BLOB, dest_root_id BLOB)"];
+    [db_ executeUpdate: @"CREATE INDEX IF NOT EXISTS proot_refs_by_dest_root_id ON proot_refs(dest_root_id)"];
+    [db_ executeUpdate: @"CREATE INDEX IF NOT EXISTS proot_refs_by_revid ON proot_refs(root_id, revid)"];
+
     [db_ executeUpdate: @"CREATE TABLE IF NOT EXISTS attachment_refs (root_id BLOB, revid BLOB, attachment_hash BLOB)"];
+    [db_ executeUpdate: @"CREATE INDEX IF NOT EXISTS attachment_refs_by_revid ON attachment_refs(root_id, revid)"];
+
+    /**
+     * The properties indexed for the items whose entity name is entityname.
+     */
+    [db_ executeUpdate: @"CREATE TABLE IF NOT EXISTS indexed_properties ("
+                         "entityname TEXT NOT NULL, property TEXT NOT NULL, PRIMARY KEY(entityname, property))"];
+    /**
+     * In revid of backing store backingstore, the indexed property of the 
+     * written inner object item (whose entity is entityname) was equal to value.
+     */
+    [db_ executeUpdate: @"CREATE TABLE IF NOT EXISTS property_values ("
+                         "property TEXT NOT NULL, value, backingstore BLOB NOT NULL, revid BLOB NOT NULL, item BLOB NOT NULL, entityname TEXT)"];
+    [db_ executeUpdate: @"CREATE INDEX IF NOT EXISTS property_values_by_value ON property_values(property, value)"];
+    [db_ executeUpdate: @"CREATE INDEX IF NOT EXISTS property_values_by_revid ON property_values(backingstore, revid)"];
+    /**
+     * In inner_object_uuid (whose entity is entityname) in the current revision 
+     * of the current branch of persistent root root_id, the indexed property is 
+     * equal to value.
+     *
+     * Maintained along proot_current_refs (see proot_current_revisions).
+     */
+    [db_ executeUpdate: @"CREATE TABLE IF NOT EXISTS property_current_values ("
+                         "property TEXT NOT NULL, value, root_id BLOB NOT NULL, inner_object_uuid BLOB NOT NULL, entityname TEXT)"];
+    [db_ executeUpdate: @"CREATE INDEX IF NOT EXISTS property_current_values_by_value ON property_current_values(property, value)"];
+    [db_ executeUpdate: @"CREATE INDEX IF NOT EXISTS property_current_values_by_inner_object ON property_current_values(root_id, inner_object_uuid)"];
+
+    // For stores created before the entity names were indexed (the revisions
+    // written before remain indexed without entity name)
+    const BOOL needsCurrentEntityNames = ![db_ columnExists: @"property_current_values" columnName: @"entityname"];
+
+    if (needsCurrentEntityNames)
+    {
+        [db_ executeUpdate: @"ALTER TABLE property_values ADD COLUMN entityname TEXT"];
+        [db_ executeUpdate: @"ALTER TABLE property_current_values ADD COLUMN entityname TEXT"];
+    }
+
+    [self loadIndexedPropertyNames];
+
+    /**
+     * In inner_object_uuid in the current revision of the current branch of 
+     * persistent root root_id, there is a reference to dest_root_id.
+     *
+     * Unlike proot_refs, root_id is a persistent root UUID (cheap copies share 
+     * a backing store, but not their current revision).
+     */
+    const BOOL needsCurrentReferences = ![db_ tableExists: @"proot_current_revisions"];
+    const BOOL needsCurrentText = ![db_ tableExists: @"fts_current_items"];
+
+    [db_ executeUpdate: @"CREATE TABLE IF NOT EXISTS proot_current_refs ("
+                         "root_id BLOB NOT NULL, inner_object_uuid BLOB NOT NULL, dest_root_id BLOB NOT NULL)"];
+    [db_ executeUpdate: @"CREATE INDEX IF NOT EXISTS proot_current_refs_by_dest_root_id ON proot_current_refs(dest_root_id)"];
+    [db_ executeUpdate: @"CREATE INDEX IF NOT EXISTS proot_current_refs_by_inner_object ON proot_current_refs(root_id, inner_object_uuid)"];
+    /**
+     * The revision indexed in proot_current_refs for persistent root root_id.
+     */
+    [db_ executeUpdate: @"CREATE TABLE IF NOT EXISTS proot_current_revisions ("
+                         "root_id BLOB PRIMARY KEY NOT NULL, revid BLOB NOT NULL)"];
 
     // FIXME: This is a bit ugly. Verify that usage is consistent across fts3/4
     if (sqlite3_libversion_number() >= 3007011)
@@ -189,8 +389,66 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
         }
     }
 
+    /**
+     * The text of the items written in revid of backing store backingstore,
+     * indexed in fts with docid.
+     */
     [db_ executeUpdate: @"CREATE TABLE IF NOT EXISTS fts_docid_to_revisionid ("
                          "docid INTEGER PRIMARY KEY, backingstore BLOB, revid BLOB)"];
+    [db_ executeUpdate: @"CREATE INDEX IF NOT EXISTS fts_docid_to_revisionid_by_revid ON fts_docid_to_revisionid(backingstore, revid)"];
+
+    // Unlike fts, fts_current must support deletions, so it can't be contentless
+    if (sqlite3_libversion_number() >= 3007011)
+    {
+        [db_ executeUpdate: @"CREATE VIRTUAL TABLE IF NOT EXISTS fts_current USING fts4(text)"]; // implicit column docid
+    }
+    else
+    {
+        if (nil == [db_ stringForQuery: @"SELECT name FROM sqlite_master WHERE type = 'table' and name = 'fts_current'"])
+        {
+            [db_ executeUpdate: @"CREATE VIRTUAL TABLE fts_current USING fts3(text)"]; // implicit column docid
+        }
+    }
+
+    /**
+     * The text of inner_object_uuid in the current revision of the current
+     * branch of persistent root root_id, indexed in fts_current with docid.
+     *
+     * Maintained along proot_current_refs (see proot_current_revisions).
+     */
+    [db_ executeUpdate: @"CREATE TABLE IF NOT EXISTS fts_current_items ("
+                         "docid INTEGER PRIMARY KEY, root_id BLOB NOT NULL, inner_object_uuid BLOB NOT NULL)"];
+    [db_ executeUpdate: @"CREATE UNIQUE INDEX IF NOT EXISTS fts_current_items_by_inner_object ON fts_current_items(root_id, inner_object_uuid)"];
+
+    /**
+     * Incremented in the transactions that delete revisions, so the readers 
+     * discard the revision contents they cached by revid (revids can be reused).
+     */
+    [db_ executeUpdate: @"CREATE TABLE IF NOT EXISTS reader_generation (generation INTEGER NOT NULL)"];
+    if (![db_ boolForQuery: @"SELECT COUNT(*) > 0 FROM reader_generation"])
+    {
+        [db_ executeUpdate: @"INSERT INTO reader_generation VALUES(0)"];
+    }
+
+    /**
+     * The revid of persistent root root_id remains to be written in the
+     * revision indexes (see -updatesSearchIndexesInBackground).
+     */
+    [db_ executeUpdate: @"CREATE TABLE IF NOT EXISTS search_index_journal ("
+                         "id INTEGER PRIMARY KEY, root_id BLOB NOT NULL, revid BLOB NOT NULL)"];
+    _hasSearchIndexJournal = [db_ boolForQuery: @"SELECT COUNT(*) > 0 FROM search_index_journal"];
+
+    // For stores created before proot_current_refs, fts_current_items or the 
+    // indexed entity names were introduced
+    if (needsCurrentReferences || needsCurrentText || needsCurrentEntityNames)
+    {
+        [db_ executeUpdate: @"DELETE FROM proot_current_revisions"];
+
+        for (NSData *prootData in [db_ arrayForQuery: @"SELECT uuid FROM persistentroots"])
+        {
+            [self updateCurrentReferencesForPersistentRoot: [ETUUID UUIDWithData: prootData]];
+        }
+    }
 
     [db_ commit];
 
@@ -214,114 +472,168 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
 #pragma mark Transactions -
 
 
-- (BOOL)commitStoreTransaction: (COStoreTransaction *)aTransaction
+/**
+ * Executes the transaction actions, once the transaction IDs have been 
+ * checked, and gathers what the commit notification reports.
+ *
+ * Must be called in the store queue, inside a SQLite transaction or savepoint 
+ * which is rolled back if NO is returned.
+ */
+- (BOOL)executeStoreTransaction: (COStoreTransaction *)aTransaction
+         transactionIDForPersistentRoot: (NSMutableDictionary *)txnIDForPersistentRoot
+                insertedPersistentRoots: (NSMutableArray *)insertedUUIDs
+                 deletedPersistentRoots: (NSMutableArray *)deletedUUIDs
 {
-    __block BOOL ok = YES;
-
-    dispatch_assert_queue_not(queue_);
+    dispatch_assert_queue(queue_);
 
-    NSMutableDictionary *txnIDForPersistentRoot = [[NSMutableDictionary alloc] init];
-    NSMutableArray *insertedUUIDs = [[NSMutableArray alloc] init];
-    NSMutableArray *deletedUUIDs = [[NSMutableArray alloc] init];
+    BOOL ok = YES;
 
-    dispatch_sync(queue_, ^()
-    {
-        [db_ beginTransaction];
+    [self loadIndexedPropertyNamesIfNeeded];
 
-        // update the last transaction field before we commit.
+    // update the last transaction field before we commit.
 
-        // setup
+    // setup
 
-        for (ETUUID *modifiedUUID in aTransaction.persistentRootUUIDs)
+    for (ETUUID *modifiedUUID in aTransaction.persistentRootUUIDs)
+    {
+        const BOOL isPresent = [db_ boolForQuery: @"SELECT COUNT(*) > 0 FROM persistentroots WHERE uuid = ?",
+                                                  [modifiedUUID dataValue]];
+        const BOOL modifiesMutableState = [aTransaction touchesMutableStateForPersistentRootUUID: modifiedUUID];
+        int64_t currentValue = [db_ int64ForQuery: @"SELECT transactionid FROM persistentroots WHERE uuid = ?",
+                                                   [modifiedUUID dataValue]];
+        int64_t clientValue = [aTransaction oldTransactionIDForPersistentRoot: modifiedUUID];
+        const BOOL wasLoaded = [aTransaction hasOldTransactionIDForPersistentRoot: modifiedUUID];
+
+        if (!modifiesMutableState)
+            continue;
+
+        // Sort of a hack: we allow committing without providing a transaction ID. (if wasLoaded is NO)
+        if (!wasLoaded)
         {
-            const BOOL isPresent = [db_ boolForQuery: @"SELECT COUNT(*) > 0 FROM persistentroots WHERE uuid = ?",
-                                                      [modifiedUUID dataValue]];
-            const BOOL modifiesMutableState = [aTransaction touchesMutableStateForPersistentRootUUID: modifiedUUID];
-            int64_t currentValue = [db_ int64ForQuery: @"SELECT transactionid FROM persistentroots WHERE uuid = ?",
-                                                       [modifiedUUID dataValue]];
-            int64_t clientValue = [aTransaction oldTransactionIDForPersistentRoot: modifiedUUID];
-            const BOOL wasLoaded = [aTransaction hasOldTransactionIDForPersistentRoot: modifiedUUID];
-
-            if (!modifiesMutableState)
-                continue;
-
-            // Sort of a hack: we allow committing without providing a transaction ID. (if wasLoaded is NO)
-            if (!wasLoaded)
-            {
-                clientValue = currentValue;
-            }
+            clientValue = currentValue;
+        }
 
-            if (clientValue != currentValue && isPresent)
-            {
-                ok = NO;
-                NSLog(@"Transaction id mismatch for %@. DB had %d, transaction had %d",
-                      modifiedUUID, (int)currentValue, (int)clientValue);
-                [db_ rollback];
-                return;
-            }
+        if (clientValue != currentValue && isPresent)
+        {
+            NSLog(@"Transaction id mismatch for %@. DB had %d, transaction had %d",
+                  modifiedUUID, (int)currentValue, (int)clientValue);
+            return NO;
+        }
 
-            if (!isPresent)
-                [insertedUUIDs addObject: modifiedUUID];
+        if (!isPresent)
+            [insertedUUIDs addObject: modifiedUUID];
 
-            const int64_t newValue = clientValue + 1;
+        const int64_t newValue = clientValue + 1;
 
-            [db_ executeUpdate: @"UPDATE persistentroots SET transactionid = ? WHERE uuid = ?",
-                                @(newValue), [modifiedUUID dataValue]];
+        [db_ executeUpdate: @"UPDATE persistentroots SET transactionid = ? WHERE uuid = ?",
+                            @(newValue), [modifiedUUID dataValue]];
 
-            txnIDForPersistentRoot[modifiedUUID] = @(newValue);
-        }
+        txnIDForPersistentRoot[modifiedUUID] = @(newValue);
+    }
 
-        // perform actions
+    // perform actions
 
-        for (id <COStoreAction> op in aTransaction.operations)
+    for (id <COStoreAction> op in aTransaction.operations)
+    {
+        BOOL opOk = [op execute: self inTransaction: aTransaction];
+        if (!opOk)
         {
-            BOOL opOk = [op execute: self inTransaction: aTransaction];
-            if (!opOk)
-            {
-                NSLog(@"store action failed: %@", op);
-                ok = NO;
-                break;
-            }
-            ok = ok && opOk;
+            NSLog(@"store action failed: %@", op);
+            ok = NO;
+            break;
         }
+        ok = ok && opOk;
+    }
 
-        // gather deleted persistent root UUIDs
+    // update the references in the current revisions
 
-        /* Since we don't allow committing to a deleted persistent root, this 
-           means these deleted UUIDs won't include persistent roots deleted in 
-           a previous commit. */
+    if (ok)
+    {
         for (ETUUID *modifiedUUID in aTransaction.persistentRootUUIDs)
         {
-            const BOOL isPresent = [db_ boolForQuery: @"SELECT COUNT(*) > 0 FROM persistentroots WHERE uuid = ? AND deleted = 1",
-                                                      [modifiedUUID dataValue]];
-
-            if (isPresent)
-                [deletedUUIDs addObject: modifiedUUID];
+            [self updateCurrentReferencesForPersistentRoot: modifiedUUID];
         }
+    }
+
+    // gather deleted persistent root UUIDs
 
-        // TODO: Turn on if we decide to write history compaction changes with
-        // this method.
+    /* Since we don't allow committing to a deleted persistent root, this 
+       means these deleted UUIDs won't include persistent roots deleted in 
+       a previous commit. */
+    for (ETUUID *modifiedUUID in aTransaction.persistentRootUUIDs)
+    {
+        const BOOL isPresent = [db_ boolForQuery: @"SELECT COUNT(*) > 0 FROM persistentroots WHERE uuid = ? AND deleted = 1",
+                                                  [modifiedUUID dataValue]];
+
+        if (isPresent)
+            [deletedUUIDs addObject: modifiedUUID];
+    }
+
+    // TODO: Turn on if we decide to write history compaction changes with
+    // this method.
 #if 0
-        // gather finalized persistent root UUIDs
+    // gather finalized persistent root UUIDs
 
-        for (ETUUID *modifiedUUID in aTransaction.persistentRootUUIDs)
-        {
-            const BOOL isPresent = [db_ boolForQuery: @"SELECT COUNT(*) > 0 FROM persistentroots WHERE uuid = ?", [modifiedUUID dataValue]];
-            
-            if (!isPresent)
-                [finalizedUUIDs addObject: modifiedUUID];
-        }
+    for (ETUUID *modifiedUUID in aTransaction.persistentRootUUIDs)
+    {
+        const BOOL isPresent = [db_ boolForQuery: @"SELECT COUNT(*) > 0 FROM persistentroots WHERE uuid = ?", [modifiedUUID dataValue]];
+        
+        if (!isPresent)
+            [finalizedUUIDs addObject: modifiedUUID];
+    }
 #endif
 
+    return ok;
+}
+
+/**
+ * Discards the backing stores, since their in-memory state (e.g. root UUID or 
+ * compression dictionary) can refer to changes that were just rolled back.
+ */
+- (void)discardBackingStoresAfterRollback
+{
+    dispatch_assert_queue(queue_);
+
+    [backingStores_ removeAllObjects];
+    [backingStoreUUIDForPersistentRootUUID_ removeAllObjects];
+    // The journaled revisions can have been rolled back too (the remaining
+    // ones are read back from the backing stores when indexed)
+    [_unindexedItemGraphs removeAllObjects];
+}
+
+- (BOOL)commitStoreTransaction: (COStoreTransaction *)aTransaction
+{
+    dispatch_assert_queue_not(queue_);
+
+    if (self.groupsCommits)
+    {
+        return [self commitStoreTransactionInGroup: aTransaction];
+    }
+
+    __block BOOL ok = YES;
+    NSMutableDictionary *txnIDForPersistentRoot = [[NSMutableDictionary alloc] init];
+    NSMutableArray *insertedUUIDs = [[NSMutableArray alloc] init];
+    NSMutableArray *deletedUUIDs = [[NSMutableArray alloc] init];
+
+    dispatch_sync(queue_, ^()
+    {
+        [db_ beginTransaction];
+
+        ok = [self executeStoreTransaction: aTransaction
+            transactionIDForPersistentRoot: txnIDForPersistentRoot
+                   insertedPersistentRoots: insertedUUIDs
+                    deletedPersistentRoots: deletedUUIDs];
+
         if (!ok)
         {
             [db_ rollback];
-            ok = NO;
+            [self discardBackingStoresAfterRollback];
         }
         else
         {
             ok = [db_ commit];
         }
+        [self scheduleSearchIndexUpdateIfNeeded];
     });
 
     if (ok)
@@ -340,103 +652,201 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
     return ok;
 }
 
-- (NSArray *)allBackingUUIDs
-{
-    NSMutableArray *result = [NSMutableArray array];
-
-    dispatch_assert_queue_not(queue_);
+#pragma mark Group Commit -
 
-    dispatch_sync(queue_, ^()
+- (BOOL)groupsCommits
+{
+    @synchronized (_pendingCommits)
     {
-        FMResultSet *rs = [db_ executeQuery: @"SELECT DISTINCT backingstore FROM persistentroot_backingstores"];
-        sqlite3_stmt *statement = [[rs statement] statement];
-
-        while ([rs next])
-        {
-            const void *data = sqlite3_column_blob(statement, 0);
-            const int dataSize = sqlite3_column_bytes(statement, 0);
-
-            assert(dataSize == 16);
-
-            ETUUID *uuid = [[ETUUID alloc] initWithUUID: data];
-            [result addObject: uuid];
-        }
-        [rs close];
-    });
+        return _groupsCommits;
+    }
+}
 
-    return result;
+- (void)setGroupsCommits: (BOOL)flag
+{
+    @synchronized (_pendingCommits)
+    {
+        _groupsCommits = flag;
+    }
 }
 
-- (ETUUID *)headRevisionUUIDForBranchUUID: (ETUUID *)aBranchUUID
+/**
+ * Executes all the pending commits in a single SQLite transaction.
+ *
+ * Each store transaction runs in its own savepoint, so a failing one is 
+ * rolled back without affecting the others, then its result is set. 
+ */
+- (void)executePendingCommits
 {
-    NILARG_EXCEPTION_TEST(aBranchUUID);
+    dispatch_assert_queue(queue_);
 
-    __block ETUUID *revUUID = nil;
+    NSArray *pendingCommits = nil;
 
-    dispatch_assert_queue_not(queue_);
+    @synchronized (_pendingCommits)
+    {
+        pendingCommits = [_pendingCommits copy];
+        [_pendingCommits removeAllObjects];
+    }
 
-    dispatch_sync(queue_, ^()
+    // Already executed as part of a previous group
+    if (pendingCommits.count == 0)
+        return;
+
+    [db_ beginTransaction];
+
+    for (COSQLiteStorePendingCommit *commit in pendingCommits)
     {
-        FMResultSet *rs = [db_ executeQuery: @"SELECT head_revid FROM branches WHERE uuid = ?",
-                                             [aBranchUUID dataValue]];
+        [db_ savepoint: @"storeTransaction"];
+
+        commit->succeeded = [self executeStoreTransaction: commit->transaction
+                           transactionIDForPersistentRoot: commit->txnIDForPersistentRoot
+                                  insertedPersistentRoots: commit->insertedUUIDs
+                                   deletedPersistentRoots: commit->deletedUUIDs];
 
-        if ([rs next])
+        if (!commit->succeeded)
         {
-            revUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]];
-            ETAssert(![rs next]);
+            [db_ rollbackToSavepoint: @"storeTransaction"];
+            // Before the next store transaction reuses the backing stores
+            [self discardBackingStoresAfterRollback];
         }
+        [db_ releaseSavepoint: @"storeTransaction"];
+    }
 
-        [rs close];
-    });
+    // The single fsync shared by the group
+    if (![db_ commit])
+    {
+        [db_ rollback];
+        [self discardBackingStoresAfterRollback];
 
-    return revUUID;
+        for (COSQLiteStorePendingCommit *commit in pendingCommits)
+        {
+            commit->succeeded = NO;
+        }
+    }
+    [self scheduleSearchIndexUpdateIfNeeded];
 }
 
-- (NSArray *)revisionInfosForBranchUUID: (ETUUID *)aBranchUUID
-                                options: (COBranchRevisionReadingOptions)options
+- (BOOL)commitStoreTransactionInGroup: (COStoreTransaction *)aTransaction
 {
-    ETUUID *prootUUID = [self persistentRootUUIDForBranchUUID: aBranchUUID];
-    if (prootUUID == nil)
+    COSQLiteStorePendingCommit *commit = [[COSQLiteStorePendingCommit alloc] initWithTransaction: aTransaction];
+
+    @synchronized (_pendingCommits)
     {
-        [NSException raise: NSInternalInconsistencyException
-                    format: @"For branch %@, the persistent root doesn't exist "
-                             "in the store. This usually means the persistent "
-                             "root has been finalized and this branch doesn't "
-                             "exist anymore.", aBranchUUID];
+        [_pendingCommits addObject: commit];
     }
-    ETUUID *headRevUUID = [self headRevisionUUIDForBranchUUID: aBranchUUID];
-
-    __block NSArray *result = nil;
-
-    dispatch_assert_queue_not(queue_);
 
+    /* The first block to run in the store queue executes all the commits 
+       submitted until then, including the ones whose blocks are waiting 
+       behind it. These blocks then find nothing left to execute. */
     dispatch_sync(queue_, ^()
     {
-        COSQLiteStorePersistentRootBackingStore *backingStore =
-            [self backingStoreForPersistentRootUUID: prootUUID createIfNotPresent: YES];
-
-        result = [backingStore revisionInfosForBranchUUID: aBranchUUID
-                                         headRevisionUUID: headRevUUID
-                                                  options: options];
+        [self executePendingCommits];
     });
 
-    return result;
+    if (commit->succeeded)
+    {
+        // Committing threads are usually not the main thread in this mode
+        dispatch_sync_now(dispatch_get_main_queue(), ^()
+        {
+            [self postCommitNotificationsWithTransactionIDForPersistentRootUUID: commit->txnIDForPersistentRoot
+                                                        insertedPersistentRoots: commit->insertedUUIDs
+                                                         deletedPersistentRoots: commit->deletedUUIDs
+                                                       compactedPersistentRoots: @[]
+                                                       finalizedPersistentRoots: @[]];
+        });
+    }
+    else
+    {
+        NSLog(@"Commit failed");
+    }
+
+    return commit->succeeded;
 }
 
-- (NSArray *)revisionInfosForBackingStoreOfPersistentRootUUID: (ETUUID *)aPersistentRoot
+- (NSArray *)testingCommitStoreTransactionsInGroup: (NSArray *)transactions
 {
-    __block NSArray *result = nil;
-
     dispatch_assert_queue_not(queue_);
 
-    dispatch_sync(queue_, ^()
+    NSMutableArray *commits = [NSMutableArray new];
+
+    for (COStoreTransaction *transaction in transactions)
     {
-        COSQLiteStorePersistentRootBackingStore *backingStore =
-            [self backingStoreForPersistentRootUUID: aPersistentRoot createIfNotPresent: YES];
+        [commits addObject: [[COSQLiteStorePendingCommit alloc] initWithTransaction: transaction]];
+    }
 
-        result = backingStore.revisionInfos;
+    dispatch_sync(queue_, ^()
+    {
+        @synchronized (_pendingCommits)
+        {
+            [_pendingCommits addObjectsFromArray: commits];
+        }
+        [self executePendingCommits];
     });
 
+    NSMutableArray *results = [NSMutableArray new];
+
+    for (COSQLiteStorePendingCommit *commit in commits)
+    {
+        [results addObject: @(commit->succeeded)];
+    }
+    return results;
+}
+
+- (NSArray *)allBackingUUIDs
+{
+    __block NSArray *result = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader allBackingUUIDs];
+    }];
+    return result;
+}
+
+- (ETUUID *)headRevisionUUIDForBranchUUID: (ETUUID *)aBranchUUID
+{
+    NILARG_EXCEPTION_TEST(aBranchUUID);
+
+    __block ETUUID *revUUID = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        revUUID = [reader headRevisionUUIDForBranchUUID: aBranchUUID];
+    }];
+    return revUUID;
+}
+
+- (NSArray *)revisionInfosForBranchUUID: (ETUUID *)aBranchUUID
+                                options: (COBranchRevisionReadingOptions)options
+{
+    NILARG_EXCEPTION_TEST(aBranchUUID);
+
+    __block NSArray *result = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader revisionInfosForBranchUUID: aBranchUUID options: options];
+    }];
+
+    if (result == nil)
+    {
+        [NSException raise: NSInternalInconsistencyException
+                    format: @"For branch %@, the persistent root doesn't exist "
+                             "in the store. This usually means the persistent "
+                             "root has been finalized and this branch doesn't "
+                             "exist anymore.", aBranchUUID];
+    }
+    return result;
+}
+
+- (NSArray *)revisionInfosForBackingStoreOfPersistentRootUUID: (ETUUID *)aPersistentRoot
+{
+    __block NSArray *result = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader revisionInfosForBackingStoreOfPersistentRootUUID: aPersistentRoot];
+    }];
     return result;
 }
 
@@ -502,12 +912,28 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
         {
             return nil;
         }
+        result.maxItemGraphCacheSize = _maxItemGraphCacheSize;
 
         backingStores_[aUUID] = result;
     }
     return result;
 }
 
+- (COSQLiteStoreBackingStoreStatistics *)statisticsForBackingStoreUUID: (ETUUID *)aUUID
+{
+    @synchronized (_backingStoreStatistics)
+    {
+        COSQLiteStoreBackingStoreStatistics *statistics = _backingStoreStatistics[aUUID];
+
+        if (statistics == nil)
+        {
+            statistics = [COSQLiteStoreBackingStoreStatistics new];
+            _backingStoreStatistics[aUUID] = statistics;
+        }
+        return statistics;
+    }
+}
+
 - (NSString *)backingStorePathForUUID: (ETUUID *)aUUID
 {
     return [self.URL.path stringByAppendingPathComponent: [NSString stringWithFormat: @"%@.sqlite",
@@ -519,6 +945,8 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
 #if BACKING_STORES_SHARE_SAME_SQLITE_DB == 1
     [db_ executeUpdate: [NSString stringWithFormat: @"DROP TABLE IF EXISTS `commits-%@`", aUUID]];
     [db_ executeUpdate: [NSString stringWithFormat: @"DROP TABLE IF EXISTS `metadata-%@`", aUUID]];
+    [db_ executeUpdate: [NSString stringWithFormat: @"DROP TABLE IF EXISTS `items-%@`", aUUID]];
+    [db_ executeUpdate: [NSString stringWithFormat: @"DROP TABLE IF EXISTS `ancestry-%@`", aUUID]];
 #else
 
     // FIXME: Test this
@@ -535,6 +963,11 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
     assert([[NSFileManager defaultManager] removeItemAtPath:
             [self backingStorePathForUUID: aUUID] error: NULL]);
 #endif
+
+    @synchronized (_backingStoreStatistics)
+    {
+        [_backingStoreStatistics removeObjectForKey: aUUID];
+    }
 }
 
 #pragma mark Reading States -
@@ -547,15 +980,56 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
 
     __block CORevisionInfo *result = nil;
 
-    dispatch_assert_queue_not(queue_);
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader revisionInfoForRevisionUUID: aRevision persistentRootUUID: aPersistentRoot];
+    }];
+    return result;
+}
 
-    dispatch_sync(queue_, ^()
+- (CORevisionGraph *)revisionGraphForPersistentRootUUID: (ETUUID *)aPersistentRoot
+{
+    NILARG_EXCEPTION_TEST(aPersistentRoot);
+
+    __block CORevisionGraph *result = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
     {
-        COSQLiteStorePersistentRootBackingStore *backing = [self backingStoreForPersistentRootUUID: aPersistentRoot
-                                                                                createIfNotPresent: YES];
-        result = [backing revisionInfoForRevisionUUID: aRevision];
-    });
+        result = [reader revisionGraphForPersistentRootUUID: aPersistentRoot];
+    }];
+    return result;
+}
+
+- (BOOL)updateRevisionGraph: (CORevisionGraph *)aGraph
+      forPersistentRootUUID: (ETUUID *)aPersistentRoot
+{
+    NILARG_EXCEPTION_TEST(aGraph);
+    NILARG_EXCEPTION_TEST(aPersistentRoot);
+
+    __block BOOL result = NO;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader updateRevisionGraph: aGraph forPersistentRootUUID: aPersistentRoot];
+    }];
+    return result;
+}
+
+- (NSSet *)revisionUUIDsOfAncestorsOfRevisionUUIDs: (NSSet *)revisionUUIDs
+                  excludingAncestorsOfRevisionUUIDs: (NSSet *)excludedRevisionUUIDs
+                                 persistentRootUUID: (ETUUID *)aPersistentRoot
+{
+    NILARG_EXCEPTION_TEST(revisionUUIDs);
+    NILARG_EXCEPTION_TEST(aPersistentRoot);
 
+    __block NSSet *result = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader revisionUUIDsOfAncestorsOfRevisionUUIDs: revisionUUIDs
+                               excludingAncestorsOfRevisionUUIDs: excludedRevisionUUIDs
+                                              persistentRootUUID: aPersistentRoot];
+    }];
     return result;
 }
 
@@ -569,17 +1043,12 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
 
     __block COItemGraph *result = nil;
 
-    dispatch_assert_queue_not(queue_);
-
-    dispatch_sync(queue_, ^()
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
     {
-        COSQLiteStorePersistentRootBackingStore *backing = [self backingStoreForPersistentRootUUID: aPersistentRoot
-                                                                                createIfNotPresent: YES];
-
-        result = [backing partialItemGraphFromRevid: [backing revidForUUID: baseRevid]
-                                            toRevid: [backing revidForUUID: finalRevid]];
-    });
-
+        result = [reader partialItemGraphFromRevisionUUID: baseRevid
+                                           toRevisionUUID: finalRevid
+                                           persistentRoot: aPersistentRoot];
+    }];
     return result;
 }
 
@@ -591,14 +1060,10 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
 
     __block COItemGraph *result = nil;
 
-    dispatch_assert_queue_not(queue_);
-
-    dispatch_sync(queue_, ^()
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
     {
-        COSQLiteStorePersistentRootBackingStore *backing = [self backingStoreForPersistentRootUUID: aPersistentRoot
-                                                                                createIfNotPresent: YES];
-        result = [backing itemGraphForRevid: [backing revidForUUID: aRevisionUUID]];
-    });
+        result = [reader itemGraphForRevisionUUID: aRevisionUUID persistentRoot: aPersistentRoot];
+    }];
     return result;
 }
 
@@ -608,20 +1073,76 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
 
     __block ETUUID *result = nil;
 
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader rootObjectUUIDForPersistentRoot: aPersistentRoot];
+    }];
+    return result;
+}
+
+- (NSUInteger)maxItemGraphCacheSize
+{
+    return _maxItemGraphCacheSize;
+}
+
+- (void)setMaxItemGraphCacheSize: (NSUInteger)aSize
+{
     dispatch_assert_queue_not(queue_);
 
     dispatch_sync(queue_, ^()
     {
-        COSQLiteStorePersistentRootBackingStore *backing = [self backingStoreForPersistentRootUUID: aPersistentRoot
-                                                                                createIfNotPresent: YES];
-        result = backing.rootUUID;
-    });
+        _maxItemGraphCacheSize = aSize;
 
-    return result;
+        for (COSQLiteStorePersistentRootBackingStore *backing in backingStores_.objectEnumerator)
+        {
+            backing.maxItemGraphCacheSize = aSize;
+        }
+        // Readers pick up the new size when checked out
+    });
 }
 
 #pragma mark writing states -
 
+/**
+ * Calls the block for each value of the indexed properties of the given item.
+ *
+ * For multivalued properties, the block is called for each element. Null 
+ * values and non-indexable types (e.g. references) are skipped.
+ */
+- (void)enumerateIndexedPropertyValuesOfItem: (COItem *)anItem
+                                  usingBlock: (void (^)(NSString *property, id value))aBlock
+{
+    dispatch_assert_queue(queue_);
+
+    if (anItem.entityName == nil)
+        return;
+
+    NSSet *propertyNames = _indexedPropertyNamesByEntityName[anItem.entityName];
+
+    for (NSString *property in propertyNames)
+    {
+        const COType type = [anItem typeForAttribute: property];
+        const COType primitiveType = COTypePrimitivePart(type);
+
+        if (primitiveType != kCOTypeInt64 && primitiveType != kCOTypeDouble
+            && primitiveType != kCOTypeString && primitiveType != kCOTypeBlob)
+        {
+            continue;
+        }
+
+        id value = [anItem valueForAttribute: property];
+        id <NSFastEnumeration> values = (COTypeIsMultivalued(type) ? value : @[value]);
+
+        for (id element in values)
+        {
+            if (element != [NSNull null])
+            {
+                aBlock(property, element);
+            }
+        }
+    }
+}
+
 /**
  * Updates SQL indexes so given a search query containing contents of
  * the items mentioned by modifiedItems, we can get back aRevision.
@@ -669,6 +1190,18 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
                                     attachment.dataValue];
             }
         }
+
+        [self enumerateIndexedPropertyValuesOfItem: itemToIndex
+                                        usingBlock: ^(NSString *property, id value)
+        {
+            [db_ executeUpdate: @"INSERT INTO property_values(property, value, backingstore, revid, item, entityname) VALUES(?,?,?,?,?,?)",
+                                property,
+                                value,
+                                backingUUIDData,
+                                [aRevision dataValue],
+                                [uuid dataValue],
+                                itemToIndex.entityName];
+        }];
     }
     NSString *allItemsFtsContent = [ftsContent componentsJoinedByString: @" "];
 
@@ -687,242 +1220,498 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
     assert(![db_ hadError]);
 }
 
-- (NSArray *)searchResultsForQuery: (NSString *)aQuery
+#pragma mark Search Index Journal -
+
+/**
+ * Records a revision to be indexed on the index queue, see
+ * -updatesSearchIndexesInBackground.
+ */
+- (void)journalSearchIndexUpdateForItemTree: (COItemGraph *)anItemTree
+                     revisionIDBeingWritten: (ETUUID *)aRevision
+                 persistentRootBeingWritten: (ETUUID *)aPersistentRoot
 {
-    NSMutableArray *result = [NSMutableArray array];
+    dispatch_assert_queue(queue_);
 
-    dispatch_assert_queue_not(queue_);
+    [db_ executeUpdate: @"INSERT INTO search_index_journal(root_id, revid) VALUES(?,?)",
+                        [aPersistentRoot dataValue],
+                        [aRevision dataValue]];
 
-    dispatch_sync(queue_, ^()
+    // Spares reading back the items from the backing store, unless the index
+    // queue lags too much behind (e.g. during an import)
+    if (_unindexedItemGraphs.count < COMaxUnindexedItemGraphCount)
     {
-        FMResultSet *rs = [db_ executeQuery: @"SELECT uuid, revid FROM "
-                                              "(SELECT backingstore, revid FROM fts_docid_to_revisionid WHERE docid IN (SELECT docid FROM fts WHERE text MATCH ?)) "
-                                              "INNER JOIN persistentroot_backingstores USING(backingstore)",
-                                             aQuery];
+        _unindexedItemGraphs[aRevision] = anItemTree;
+    }
+    _hasSearchIndexJournal = YES;
+}
 
-        while ([rs next])
-        {
-            COSearchResult *searchResult = [[COSearchResult alloc] init];
-            searchResult.innerObjectUUID = nil;
-            searchResult.revision = [ETUUID UUIDWithData: [rs dataForColumnIndex: 1]];
-            searchResult.persistentRoot = [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]];
-            [result addObject: searchResult];
-        }
-        [rs close];
-    });
+/**
+ * Returns the items written in the given revision, or nil if the revision
+ * doesn't exist anymore.
+ */
+- (COItemGraph *)itemTreeWrittenInRevision: (ETUUID *)aRevision
+                            persistentRoot: (ETUUID *)aPersistentRoot
+{
+    dispatch_assert_queue(queue_);
 
-    return result;
+    COSQLiteStorePersistentRootBackingStore *backing = [self backingStoreForPersistentRootUUID: aPersistentRoot
+                                                                            createIfNotPresent: NO];
+    const int64_t revid = [backing revidForUUID: aRevision];
+
+    if (backing == nil || revid == -1)
+        return nil;
+
+    ETUUID *parentRevision = [backing revisionInfoForRevisionUUID: aRevision].parentRevisionUUID;
+    const int64_t parentRevid = (parentRevision != nil ? [backing revidForUUID: parentRevision] : -1);
+
+    if (parentRevid == -1)
+    {
+        return [backing itemGraphForRevid: revid];
+    }
+    return [backing partialItemGraphFromRevid: parentRevid toRevid: revid];
 }
 
-// Actual implementation used by action
-- (BOOL)writeRevisionWithModifiedItems: (COItemGraph *)anItemTree
-                          revisionUUID: (ETUUID *)aRevisionUUID
-                              metadata: (NSDictionary *)metadata
-                      parentRevisionID: (ETUUID *)aParent
-                 mergeParentRevisionID: (ETUUID *)aMergeParent
-                    persistentRootUUID: (ETUUID *)aUUID
-                            branchUUID: (ETUUID *)branch
+/**
+ * Indexes the oldest journaled revisions in a transaction, and returns whether
+ * journaled revisions remain to be indexed.
+ *
+ * Must not be called inside a transaction.
+ */
+- (BOOL)applySearchIndexJournalWithBatchSize: (NSUInteger)aBatchSize
 {
     dispatch_assert_queue(queue_);
 
-    COSQLiteStorePersistentRootBackingStore *backing = [self backingStoreForPersistentRootUUID: aUUID
-                                                                            createIfNotPresent: YES];
-    if (backing == nil)
-    {
+    if (!_hasSearchIndexJournal)
         return NO;
-    }
 
-    const int64_t parentRevid = [backing revidForUUID: aParent];
-    const int64_t mergeParentRevid = [backing revidForUUID: aMergeParent];
+    NSMutableArray *entryIDs = [NSMutableArray array];
+    NSMutableArray *persistentRoots = [NSMutableArray array];
+    NSMutableArray *revisions = [NSMutableArray array];
 
-    if (aParent != nil && parentRevid == -1)
+    [db_ beginTransaction];
+
+    [self loadIndexedPropertyNamesIfNeeded];
+
+    FMResultSet *rs = [db_ executeQuery: @"SELECT id, root_id, revid FROM search_index_journal ORDER BY id LIMIT ?",
+                                         @(aBatchSize)];
+    while ([rs next])
     {
-        NSLog(@"Parent revision not found: %@", aParent);
-        // FIXME: If we're going to support writing revisions with missing parents
-        // we should probably preserve the parent UUID?
+        [entryIDs addObject: @([rs longLongIntForColumnIndex: 0])];
+        [persistentRoots addObject: [ETUUID UUIDWithData: [rs dataForColumnIndex: 1]]];
+        [revisions addObject: [ETUUID UUIDWithData: [rs dataForColumnIndex: 2]]];
     }
-    if (aMergeParent != nil && mergeParentRevid == -1)
+    [rs close];
+
+    for (NSUInteger i = 0; i < entryIDs.count; i++)
     {
-        NSLog(@"Merge parent revision not found: %@", aMergeParent);
-    }
+        ETUUID *persistentRoot = persistentRoots[i];
+        ETUUID *revision = revisions[i];
+        COItemGraph *itemTree = _unindexedItemGraphs[revision];
 
-    const BOOL ok = [backing writeItemGraph: anItemTree
-                               revisionUUID: aRevisionUUID
-                               withMetadata: metadata
-                                 withParent: parentRevid
-                            withMergeParent: mergeParentRevid
-                                 branchUUID: branch
-                         persistentrootUUID: aUUID
-                                      error: NULL];
+        // Don't index the persistent roots finalized in the meantime
+        if ([self backingStoreForPersistentRootUUID: persistentRoot createIfNotPresent: NO] == nil)
+        {
+            itemTree = nil;
+        }
+        else if (itemTree == nil)
+        {
+            itemTree = [self itemTreeWrittenInRevision: revision persistentRoot: persistentRoot];
+        }
 
-    if (!ok)
+        if (itemTree != nil)
+        {
+            [self updateSearchIndexesForItemTree: itemTree
+                          revisionIDBeingWritten: revision
+                      persistentRootBeingWritten: persistentRoot];
+        }
+        [_unindexedItemGraphs removeObjectForKey: revision];
+        [db_ executeUpdate: @"DELETE FROM search_index_journal WHERE id = ?", entryIDs[i]];
+    }
+
+    if (![db_ commit])
     {
-        NSLog(@"Error creating revision");
-        return NO;
+        [db_ rollback];
     }
 
-    [self updateSearchIndexesForItemTree: anItemTree
-                  revisionIDBeingWritten: aRevisionUUID
-              persistentRootBeingWritten: aUUID];
+    _hasSearchIndexJournal = [db_ boolForQuery: @"SELECT COUNT(*) > 0 FROM search_index_journal"];
 
-    return YES;
+    // Drops the item graphs indexed by other store instances
+    if (!_hasSearchIndexJournal)
+    {
+        [_unindexedItemGraphs removeAllObjects];
+    }
+    return _hasSearchIndexJournal;
 }
 
-#pragma mark Persistent Roots -
-
-- (NSArray *)persistentRootUUIDs
+/**
+ * Indexes all the journaled revisions.
+ *
+ * Must not be called inside a transaction.
+ */
+- (void)applySearchIndexJournal
 {
-    NSMutableArray *result = [NSMutableArray array];
-    dispatch_assert_queue_not(queue_);
+    dispatch_assert_queue(queue_);
 
-    dispatch_sync(queue_, ^()
+    while ([self applySearchIndexJournalWithBatchSize: COSearchIndexJournalBatchSize])
     {
-        FMResultSet *rs = [db_ executeQuery: @"SELECT uuid FROM persistentroots WHERE deleted = 0"];
-        while ([rs next])
-        {
-            [result addObject: [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]]];
-        }
-        [rs close];
-    });
-    return result;
+        // Continue
+    }
 }
 
-- (NSArray *)deletedPersistentRootUUIDs
+/**
+ * Applies the journal on the index queue, one batch at a time so the store
+ * queue is not blocked between batches.
+ */
+- (void)scheduleSearchIndexUpdateIfNeeded
 {
-    NSMutableArray *result = [NSMutableArray array];
+    dispatch_assert_queue(queue_);
 
-    dispatch_assert_queue_not(queue_);
+    if (!_hasSearchIndexJournal || _searchIndexUpdateScheduled)
+        return;
 
-    dispatch_sync(queue_, ^()
+    _searchIndexUpdateScheduled = YES;
+
+    dispatch_async(_indexQueue, ^()
     {
-        FMResultSet *rs = [db_ executeQuery: @"SELECT uuid FROM persistentroots WHERE deleted = 1"];
-        while ([rs next])
+        __block BOOL hasJournal = YES;
+
+        while (hasJournal)
         {
-            [result addObject: [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]]];
+            dispatch_sync(queue_, ^()
+            {
+                hasJournal = [self applySearchIndexJournalWithBatchSize: COSearchIndexJournalBatchSize];
+                _searchIndexUpdateScheduled = hasJournal;
+            });
         }
-        [rs close];
     });
-    return result;
 }
 
-- (COPersistentRootInfo *)persistentRootInfoForUUID: (ETUUID *)aUUID
+- (void)waitUntilSearchIndexesAreUpdated
 {
-    if (aUUID == nil)
-    {
-        return nil;
-    }
-
-    __block COPersistentRootInfo *result = nil;
-
     dispatch_assert_queue_not(queue_);
 
     dispatch_sync(queue_, ^()
     {
-        ETUUID *currBranch = nil;
-        BOOL deleted = NO;
-        int64_t transactionID = -1;
-        NSMutableDictionary *branchDict = [NSMutableDictionary dictionary];
-        id persistentRootMetadata = nil;
+        [self applySearchIndexJournal];
+    });
+}
 
-        [db_ savepoint: @"persistentRootInfoForUUID"]; // N.B. The transaction is so the two SELECTs see the same DB. Needed?
+- (void)deleteCurrentReferencesForPersistentRoot: (ETUUID *)aPersistentRoot
+{
+    dispatch_assert_queue(queue_);
 
-        {
-            FMResultSet *rs = [db_ executeQuery: @"SELECT currentbranch, deleted, transactionid, metadata FROM persistentroots WHERE uuid = ?",
-                                                 [aUUID dataValue]];
-            if ([rs next])
-            {
-                currBranch = [rs dataForColumnIndex: 0] != nil
-                    ? [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]]
-                    : nil;
-                deleted = [rs boolForColumnIndex: 1];
-                transactionID = [rs int64ForColumnIndex: 2];
-                persistentRootMetadata = [self readMetadata: [rs dataForColumnIndex: 3]];
-            }
-            else
-            {
-                [rs close];
-                [db_ releaseSavepoint: @"persistentRootInfoForUUID"];
+    [db_ executeUpdate: @"DELETE FROM proot_current_refs WHERE root_id = ?", [aPersistentRoot dataValue]];
+    [db_ executeUpdate: @"DELETE FROM property_current_values WHERE root_id = ?", [aPersistentRoot dataValue]];
+    [self deleteCurrentTextForPersistentRoot: [aPersistentRoot dataValue]];
+    [db_ executeUpdate: @"DELETE FROM proot_current_revisions WHERE root_id = ?", [aPersistentRoot dataValue]];
+}
 
-                return;
-            }
-            [rs close];
+- (void)deleteCurrentTextForPersistentRoot: (NSData *)prootData
+{
+    [db_ executeUpdate: @"DELETE FROM fts_current WHERE docid IN "
+                         "(SELECT docid FROM fts_current_items WHERE root_id = ?)", prootData];
+    [db_ executeUpdate: @"DELETE FROM fts_current_items WHERE root_id = ?", prootData];
+}
+
+- (void)deleteCurrentTextForPersistentRoot: (NSData *)prootData
+                               innerObject: (NSData *)itemData
+{
+    [db_ executeUpdate: @"DELETE FROM fts_current WHERE docid IN "
+                         "(SELECT docid FROM fts_current_items WHERE root_id = ? AND inner_object_uuid = ?)",
+                        prootData, itemData];
+    [db_ executeUpdate: @"DELETE FROM fts_current_items WHERE root_id = ? AND inner_object_uuid = ?",
+                        prootData, itemData];
+}
+
+/**
+ * Updates proot_current_refs, property_current_values and fts_current to match
+ * the current revision of the current branch.
+ *
+ * When the current revision is a child of the indexed one (e.g. on commit), we 
+ * only reindex the items written in the current revision, otherwise (e.g. on 
+ * revert or branch switch) we reindex the whole item graph.
+ */
+- (void)updateCurrentReferencesForPersistentRoot: (ETUUID *)aPersistentRoot
+{
+    dispatch_assert_queue(queue_);
+
+    NSData *prootData = [aPersistentRoot dataValue];
+    NSData *currentRevisionData = [db_ dataForQuery: @"SELECT branches.current_revid FROM persistentroots "
+                                                      "INNER JOIN branches ON persistentroots.currentbranch = branches.uuid "
+                                                      "WHERE persistentroots.uuid = ?",
+                                                     prootData];
+    NSData *indexedRevisionData = [db_ dataForQuery: @"SELECT revid FROM proot_current_revisions WHERE root_id = ?",
+                                                     prootData];
+
+    if (currentRevisionData == nil)
+    {
+        [self deleteCurrentReferencesForPersistentRoot: aPersistentRoot];
+        return;
+    }
+    if ([currentRevisionData isEqual: indexedRevisionData])
+        return;
+
+    COSQLiteStorePersistentRootBackingStore *backing = [self backingStoreForPersistentRootUUID: aPersistentRoot
+                                                                            createIfNotPresent: NO];
+    ETUUID *currentRevision = [ETUUID UUIDWithData: currentRevisionData];
+    ETUUID *indexedRevision = (indexedRevisionData != nil ? [ETUUID UUIDWithData: indexedRevisionData] : nil);
+    const int64_t currentRevid = [backing revidForUUID: currentRevision];
+    ETUUID *parentRevision = [backing revisionInfoForRevisionUUID: currentRevision].parentRevisionUUID;
+    COItemGraph *itemGraph = nil;
+
+    if (indexedRevision != nil && [parentRevision isEqual: indexedRevision])
+    {
+        itemGraph = [backing partialItemGraphFromRevid: [backing revidForUUID: indexedRevision]
+                                               toRevid: currentRevid];
+
+        for (ETUUID *uuid in itemGraph.itemUUIDs)
+        {
+            [db_ executeUpdate: @"DELETE FROM proot_current_refs WHERE root_id = ? AND inner_object_uuid = ?",
+                                prootData, [uuid dataValue]];
+            [db_ executeUpdate: @"DELETE FROM property_current_values WHERE root_id = ? AND inner_object_uuid = ?",
+                                prootData, [uuid dataValue]];
+            [self deleteCurrentTextForPersistentRoot: prootData innerObject: [uuid dataValue]];
         }
+    }
+    else
+    {
+        itemGraph = [backing itemGraphForRevid: currentRevid];
 
+        [db_ executeUpdate: @"DELETE FROM proot_current_refs WHERE root_id = ?", prootData];
+        [db_ executeUpdate: @"DELETE FROM property_current_values WHERE root_id = ?", prootData];
+        [self deleteCurrentTextForPersistentRoot: prootData];
+    }
+    ETAssert(itemGraph != nil);
+
+    for (ETUUID *uuid in itemGraph.itemUUIDs)
+    {
+        COItem *item = [itemGraph itemForUUID: uuid];
+
+        for (ETUUID *referenced in item.allReferencedPersistentRootUUIDs)
         {
-            FMResultSet *rs = [db_ executeQuery: @"SELECT uuid, current_revid, head_revid, metadata, deleted, parentbranch FROM branches WHERE proot = ?",
-                                                 [aUUID dataValue]];
-            while ([rs next])
-            {
-                ETUUID *branch = [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]];
-                ETUUID *currentRevid = [ETUUID UUIDWithData: [rs dataForColumnIndex: 1]];
-                ETUUID *headRevid = [ETUUID UUIDWithData: [rs dataForColumnIndex: 2]];
-                id branchMeta = [self readMetadata: [rs dataForColumnIndex: 3]];
-
-                COBranchInfo *state = [[COBranchInfo alloc] init];
-                state.UUID = branch;
-                state.persistentRootUUID = aUUID;
-                state.currentRevisionUUID = currentRevid;
-                state.headRevisionUUID = headRevid;
-                state.metadata = branchMeta;
-                state.deleted = [rs boolForColumnIndex: 4];
-                state.parentBranchUUID = [rs dataForColumnIndex: 5] != nil
-                    ? [ETUUID UUIDWithData: [rs dataForColumnIndex: 5]]
-                    : nil;
-
-                branchDict[branch] = state;
-            }
-            [rs close];
+            [db_ executeUpdate: @"INSERT INTO proot_current_refs(root_id, inner_object_uuid, dest_root_id) VALUES(?,?,?)",
+                                prootData,
+                                [uuid dataValue],
+                                [referenced dataValue]];
         }
 
-        [db_ releaseSavepoint: @"persistentRootInfoForUUID"];
+        [self enumerateIndexedPropertyValuesOfItem: item
+                                        usingBlock: ^(NSString *property, id value)
+        {
+            [db_ executeUpdate: @"INSERT INTO property_current_values(property, value, root_id, inner_object_uuid, entityname) VALUES(?,?,?,?,?)",
+                                property,
+                                value,
+                                prootData,
+                                [uuid dataValue],
+                                item.entityName];
+        }];
 
-        result = [[COPersistentRootInfo alloc] init];
-        result.UUID = aUUID;
-        result.branchForUUID = branchDict;
-        result.currentBranchUUID = currBranch;
-        result.deleted = deleted;
-        result.transactionID = transactionID;
-        result.metadata = persistentRootMetadata;
-    });
+        NSString *text = item.fullTextSearchContent;
+
+        if (text.length > 0)
+        {
+            [db_ executeUpdate: @"INSERT INTO fts_current_items(root_id, inner_object_uuid) VALUES(?,?)",
+                                prootData,
+                                [uuid dataValue]];
+            [db_ executeUpdate: @"INSERT INTO fts_current(docid, text) VALUES(?,?)",
+                                @([db_ lastInsertRowId]),
+                                text];
+        }
+    }
+
+    [db_ executeUpdate: @"INSERT OR REPLACE INTO proot_current_revisions(root_id, revid) VALUES(?,?)",
+                        prootData, currentRevisionData];
+}
 
+- (NSArray *)searchResultsForQuery: (NSString *)aQuery
+{
+    return [self searchResultsForQuery: aQuery allowsStaleResults: NO];
+}
+
+- (NSArray *)searchResultsForQuery: (NSString *)aQuery
+                allowsStaleResults: (BOOL)allowsStale
+{
+    if (!allowsStale)
+    {
+        [self waitUntilSearchIndexesAreUpdated];
+    }
+
+    __block NSArray *result = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader searchResultsForQuery: aQuery];
+    }];
     return result;
 }
 
-- (ETUUID *)persistentRootUUIDForBranchUUID: (ETUUID *)aBranchUUID
+- (NSArray *)currentSearchResultsForQuery: (NSString *)aQuery
 {
-    NILARG_EXCEPTION_TEST(aBranchUUID);
+    NILARG_EXCEPTION_TEST(aQuery);
 
-    __block ETUUID *prootUUID = nil;
-    dispatch_assert_queue_not(queue_);
+    __block NSArray *result = nil;
 
-    dispatch_sync(queue_, ^()
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
     {
-        FMResultSet *rs = [db_ executeQuery: @"SELECT proot FROM branches WHERE uuid = ?",
-                                             [aBranchUUID dataValue]];
+        result = [reader currentSearchResultsForQuery: aQuery];
+    }];
+    return result;
+}
 
-        if ([rs next])
-        {
-            prootUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]];
-            ETAssert(![rs next]);
-        }
+// Actual implementation used by action
+- (BOOL)writeRevisionWithModifiedItems: (COItemGraph *)anItemTree
+                          revisionUUID: (ETUUID *)aRevisionUUID
+                              metadata: (NSDictionary *)metadata
+                      parentRevisionID: (ETUUID *)aParent
+                 mergeParentRevisionID: (ETUUID *)aMergeParent
+                    persistentRootUUID: (ETUUID *)aUUID
+                            branchUUID: (ETUUID *)branch
+{
+    dispatch_assert_queue(queue_);
 
-        [rs close];
-    });
+    COSQLiteStorePersistentRootBackingStore *backing = [self backingStoreForPersistentRootUUID: aUUID
+                                                                            createIfNotPresent: YES];
+    if (backing == nil)
+    {
+        return NO;
+    }
 
-    return prootUUID;
+    const int64_t parentRevid = [backing revidForUUID: aParent];
+    const int64_t mergeParentRevid = [backing revidForUUID: aMergeParent];
+
+    if (aParent != nil && parentRevid == -1)
+    {
+        NSLog(@"Parent revision not found: %@", aParent);
+        // FIXME: If we're going to support writing revisions with missing parents
+        // we should probably preserve the parent UUID?
+    }
+    if (aMergeParent != nil && mergeParentRevid == -1)
+    {
+        NSLog(@"Merge parent revision not found: %@", aMergeParent);
+    }
+
+    const BOOL ok = [backing writeItemGraph: anItemTree
+                               revisionUUID: aRevisionUUID
+                               withMetadata: metadata
+                                 withParent: parentRevid
+                            withMergeParent: mergeParentRevid
+                                 branchUUID: branch
+                         persistentrootUUID: aUUID
+                                      error: NULL];
+
+    if (!ok)
+    {
+        NSLog(@"Error creating revision");
+        return NO;
+    }
+
+    if (self.updatesSearchIndexesInBackground)
+    {
+        [self journalSearchIndexUpdateForItemTree: anItemTree
+                           revisionIDBeingWritten: aRevisionUUID
+                       persistentRootBeingWritten: aUUID];
+    }
+    else
+    {
+        [self updateSearchIndexesForItemTree: anItemTree
+                      revisionIDBeingWritten: aRevisionUUID
+                  persistentRootBeingWritten: aUUID];
+    }
+
+    return YES;
 }
 
-#pragma mark Writing persistent roots -
+#pragma mark Persistent Roots -
 
-- (NSDictionary *)readMetadata: (NSData *)data
+- (NSArray *)persistentRootUUIDs
 {
-    if (data != nil)
+    __block NSArray *result = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
     {
-        return COJSONObjectWithData(data, NULL);
+        result = [reader persistentRootUUIDsDeleted: NO];
+    }];
+    return result;
+}
+
+- (NSArray *)deletedPersistentRootUUIDs
+{
+    __block NSArray *result = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader persistentRootUUIDsDeleted: YES];
+    }];
+    return result;
+}
+
+- (COPersistentRootInfo *)persistentRootInfoForUUID: (ETUUID *)aUUID
+{
+    if (aUUID == nil)
+    {
+        return nil;
     }
-    return nil;
+
+    __block COPersistentRootInfo *result = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        // N.B. The read transaction ensures the two SELECTs see the same DB
+        result = [reader persistentRootInfoForUUID: aUUID];
+    }];
+    return result;
+}
+
+- (NSArray *)persistentRootInfosForUUIDs: (NSArray *)UUIDs
+{
+    NILARG_EXCEPTION_TEST(UUIDs);
+
+    __block NSArray *result = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader persistentRootInfosForUUIDs: UUIDs];
+    }];
+    return result;
+}
+
+- (NSArray *)persistentRootInfos
+{
+    __block NSArray *result = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader persistentRootInfosDeleted: NO];
+    }];
+    return result;
+}
+
+- (NSArray *)deletedPersistentRootInfos
+{
+    __block NSArray *result = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader persistentRootInfosDeleted: YES];
+    }];
+    return result;
+}
+
+- (ETUUID *)persistentRootUUIDForBranchUUID: (ETUUID *)aBranchUUID
+{
+    NILARG_EXCEPTION_TEST(aBranchUUID);
+
+    __block ETUUID *prootUUID = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        prootUUID = [reader persistentRootUUIDForBranchUUID: aBranchUUID];
+    }];
+    return prootUUID;
 }
 
+#pragma mark Writing persistent roots -
+
 - (BOOL)finalizeGarbageAttachments
 {
     dispatch_assert_queue(queue_);
@@ -967,35 +1756,46 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
                                                error: error];
 }
 
+- (NSArray *)currentReferencesToPersistentRoot: (ETUUID *)aUUID
+{
+    NILARG_EXCEPTION_TEST(aUUID);
+
+    __block NSArray *result = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader currentReferencesToPersistentRoot: aUUID];
+    }];
+    return result;
+}
+
+- (NSArray *)persistentRootUUIDsReferencingPersistentRoot: (ETUUID *)aUUID
+{
+    NILARG_EXCEPTION_TEST(aUUID);
+
+    __block NSArray *result = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader persistentRootUUIDsReferencingPersistentRoot: aUUID];
+    }];
+    return result;
+}
+
 /**
  * @returns an array of COSearchResult
  */
 - (NSArray *)referencesToPersistentRoot: (ETUUID *)aUUID
 {
-    NSMutableArray *results = [NSMutableArray array];
+    [self waitUntilSearchIndexesAreUpdated];
 
-    dispatch_assert_queue_not(queue_);
+    __block NSArray *result = nil;
 
-    dispatch_sync(queue_, ^()
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
     {
-        FMResultSet *rs = [db_ executeQuery: @"SELECT root_id, revid, inner_object_uuid FROM proot_refs WHERE dest_root_id = ?",
-                                             [aUUID dataValue]];
-        while ([rs next])
-        {
-            ETUUID *root = [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]];
-            ETUUID *revUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 1]];
-            ETUUID *inner_object_uuid = [ETUUID UUIDWithData: [rs dataForColumnIndex: 2]];
-
-            COSearchResult *searchResult = [[COSearchResult alloc] init];
-            searchResult.innerObjectUUID = inner_object_uuid;
-            searchResult.revision = revUUID;
-            searchResult.persistentRoot = root;
-            [results addObject: searchResult];
-        }
-        [rs close];
-    });
-
-    return results;
+        result = [reader referencesToPersistentRoot: aUUID];
+    }];
+    return result;
 }
 
 - (BOOL)vacuum
@@ -1013,15 +1813,209 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
 
 - (NSDictionary *)pageStatistics
 {
-    dispatch_assert_queue_not(queue_);
     __block NSDictionary *statistics = nil;
 
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        statistics = reader.pageStatistics;
+    }];
+    return statistics;
+}
+
+#pragma mark Property Indexes -
+
+- (void)setIndexedPropertyNames: (NSSet *)propertyNames
+                  forEntityName: (NSString *)anEntityName
+{
+    NILARG_EXCEPTION_TEST(propertyNames);
+    NILARG_EXCEPTION_TEST(anEntityName);
+    dispatch_assert_queue_not(queue_);
+
+    // Most editing contexts register an unchanged spec, so we compare it
+    // first on a reader to avoid taking the exclusive lock on every opening
+    if ([propertyNames isEqual: [self indexedPropertyNamesForEntityName: anEntityName]])
+        return;
+
     dispatch_sync(queue_, ^()
     {
-        statistics = pageStatisticsForDatabase(db_);
+        [db_ beginTransaction];
+
+        [self loadIndexedPropertyNamesIfNeeded];
+
+        NSSet *oldPropertyNames = _indexedPropertyNamesByEntityName[anEntityName];
+
+        if ([propertyNames isEqual: (oldPropertyNames != nil ? oldPropertyNames : [NSSet set])])
+        {
+            [db_ commit];
+            return;
+        }
+
+        [db_ executeUpdate: @"DELETE FROM indexed_properties WHERE entityname = ?", anEntityName];
+
+        for (NSString *property in propertyNames)
+        {
+            [db_ executeUpdate: @"INSERT INTO indexed_properties(entityname, property) VALUES(?,?)",
+                                anEntityName, property];
+        }
+        [self loadIndexedPropertyNames];
+
+        [db_ commit];
+
+        // The commits from now on index the written items with the new spec
+        [self reindexCurrentPropertyValuesForEntityName: anEntityName];
     });
+}
 
-    return statistics;
+/**
+ * Reindexes the current property values of the items whose entity name is 
+ * the given one, in batches of COPropertyReindexBatchSize persistent roots.
+ *
+ * Must not be called inside a transaction.
+ */
+- (void)reindexCurrentPropertyValuesForEntityName: (NSString *)anEntityName
+{
+    dispatch_assert_queue(queue_);
+
+    NSArray *prootDatas = [db_ arrayForQuery: @"SELECT root_id FROM proot_current_revisions"];
+
+    for (NSUInteger i = 0; i < prootDatas.count; i += COPropertyReindexBatchSize)
+    {
+        [db_ beginTransaction];
+
+        const NSUInteger end = MIN(i + COPropertyReindexBatchSize, prootDatas.count);
+
+        for (NSUInteger j = i; j < end; j++)
+        {
+            [self reindexCurrentPropertyValuesForEntityName: anEntityName
+                                          persistentRootData: prootDatas[j]];
+        }
+
+        if (![db_ commit])
+        {
+            [db_ rollback];
+        }
+    }
+}
+
+- (void)reindexCurrentPropertyValuesForEntityName: (NSString *)anEntityName
+                               persistentRootData: (NSData *)prootData
+{
+    dispatch_assert_queue(queue_);
+
+    // The revision whose items are in the current revision indexes, which a 
+    // commit between two batches can have changed
+    NSData *revisionData = [db_ dataForQuery: @"SELECT revid FROM proot_current_revisions WHERE root_id = ?",
+                                              prootData];
+    ETUUID *persistentRoot = [ETUUID UUIDWithData: prootData];
+    COSQLiteStorePersistentRootBackingStore *backing = [self backingStoreForPersistentRootUUID: persistentRoot
+                                                                            createIfNotPresent: NO];
+
+    if (revisionData == nil || backing == nil)
+        return;
+
+    COItemGraph *itemGraph = [backing itemGraphForRevid: [backing revidForUUID: [ETUUID UUIDWithData: revisionData]]];
+
+    [db_ executeUpdate: @"DELETE FROM property_current_values WHERE root_id = ? AND entityname = ?",
+                        prootData, anEntityName];
+
+    for (ETUUID *uuid in itemGraph.itemUUIDs)
+    {
+        COItem *item = [itemGraph itemForUUID: uuid];
+
+        if (![item.entityName isEqualToString: anEntityName])
+            continue;
+
+        [self enumerateIndexedPropertyValuesOfItem: item
+                                        usingBlock: ^(NSString *property, id value)
+        {
+            [db_ executeUpdate: @"INSERT INTO property_current_values(property, value, root_id, inner_object_uuid, entityname) VALUES(?,?,?,?,?)",
+                                property,
+                                value,
+                                prootData,
+                                [uuid dataValue],
+                                anEntityName];
+        }];
+    }
+}
+
+- (NSSet *)indexedEntityNames
+{
+    __block NSSet *entityNames = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        entityNames = [reader indexedEntityNames];
+    }];
+    return entityNames;
+}
+
+- (NSSet *)indexedPropertyNamesForEntityName: (NSString *)anEntityName
+{
+    NILARG_EXCEPTION_TEST(anEntityName);
+
+    __block NSSet *propertyNames = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        propertyNames = [reader indexedPropertyNamesForEntityName: anEntityName];
+    }];
+    return propertyNames;
+}
+
+- (NSArray *)searchResultsForProperty: (NSString *)aProperty
+                                value: (id)aValue
+{
+    NILARG_EXCEPTION_TEST(aValue);
+    return [self searchResultsForProperty: aProperty
+                             minimumValue: aValue
+                             maximumValue: aValue];
+}
+
+- (NSArray *)searchResultsForProperty: (NSString *)aProperty
+                         minimumValue: (id)minValue
+                         maximumValue: (id)maxValue
+{
+    return [self searchResultsForProperty: aProperty
+                               entityName: nil
+                             minimumValue: minValue
+                             maximumValue: maxValue];
+}
+
+- (NSArray *)searchResultsForProperty: (NSString *)aProperty
+                           entityName: (NSString *)anEntityName
+                         minimumValue: (id)minValue
+                         maximumValue: (id)maxValue
+{
+    NILARG_EXCEPTION_TEST(aProperty);
+
+    __block NSArray *result = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader searchResultsForProperty: aProperty
+                                       entityName: anEntityName
+                                     minimumValue: minValue
+                                     maximumValue: maxValue];
+    }];
+    return result;
+}
+
+- (NSArray *)revisionSearchResultsForProperty: (NSString *)aProperty
+                                 minimumValue: (id)minValue
+                                 maximumValue: (id)maxValue
+{
+    NILARG_EXCEPTION_TEST(aProperty);
+    [self waitUntilSearchIndexesAreUpdated];
+
+    __block NSArray *result = nil;
+
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader revisionSearchResultsForProperty: aProperty
+                                             minimumValue: minValue
+                                             maximumValue: maxValue];
+    }];
+    return result;
 }
 
 /**
@@ -1167,14 +2161,27 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
         [db_ executeUpdate: @"DELETE FROM persistentroot_backingstores"];
         [db_ executeUpdate: @"DELETE FROM branches"];
         [db_ executeUpdate: @"DELETE FROM proot_refs"];
+        [db_ executeUpdate: @"DELETE FROM proot_current_refs"];
+        [db_ executeUpdate: @"DELETE FROM proot_current_revisions"];
+        [db_ executeUpdate: @"DELETE FROM property_values"];
+        [db_ executeUpdate: @"DELETE FROM property_current_values"];
         [db_ executeUpdate: @"DELETE FROM attachment_refs"];
         [db_ executeUpdate: @"DELETE FROM fts_docid_to_revisionid"];
         [db_ executeUpdate: @"DROP TABLE IF EXISTS fts"];
+        [db_ executeUpdate: @"DELETE FROM fts_current_items"];
+        [db_ executeUpdate: @"DROP TABLE IF EXISTS fts_current"];
+        [db_ executeUpdate: @"DELETE FROM search_index_journal"];
         [db_ executeUpdate: @"DROP TABLE IF EXISTS storeMetadata"];
+        [self invalidateReaderCaches];
         [db_ commit];
 
         [backingStores_ removeAllObjects];
         [backingStoreUUIDForPersistentRootUUID_ removeAllObjects];
+        [_unindexedItemGraphs removeAllObjects];
+        @synchronized (_backingStoreStatistics)
+        {
+            [_backingStoreStatistics removeAllObjects];
+        }
 
         [self setupSchema];
     });
@@ -1186,28 +2193,271 @@ NSString *const COPersistentRootAttributeUsedSize = @"COPersistentRootAttributeU
 {
     __block NSDictionary *result = nil;
 
-    dispatch_assert_queue_not(queue_);
+    [self performReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader attributesForPersistentRootWithUUID: aUUID];
+    }];
+    return result;
+}
 
-    dispatch_sync(queue_, ^()
+- (void)testingRunBlockInStoreQueue: (void (^)())aBlock
+{
+    dispatch_sync(queue_, aBlock);
+}
+
+- (void)testingSetSearchIndexUpdatesSuspended: (BOOL)suspended
+{
+    if (suspended)
     {
-        COSQLiteStorePersistentRootBackingStore *bs = [self backingStoreForPersistentRootUUID: aUUID
-                                                                           createIfNotPresent: NO];
+        dispatch_suspend(_indexQueue);
+    }
+    else
+    {
+        dispatch_resume(_indexQueue);
+    }
+}
 
-        if (bs == nil)
-            return;
+#pragma mark Asynchronous Reading -
 
-        const uint64_t exportsize = bs.fileSize;
-        const uint64_t usedsize = [bs.UUID isEqual: aUUID] ? exportsize : 0;
+- (NSUInteger)maxNumberOfReaders
+{
+    [_readerPoolCondition lock];
+    const NSUInteger max = _maxNumberOfReaders;
+    [_readerPoolCondition unlock];
+    return max;
+}
+
+- (void)setMaxNumberOfReaders: (NSUInteger)aMax
+{
+    INVALIDARG_EXCEPTION_TEST(aMax, aMax > 0);
 
-        result = @{COPersistentRootAttributeExportSize: @(exportsize),
-                   COPersistentRootAttributeUsedSize: @(usedsize)};
+    [_readerPoolCondition lock];
+    _maxNumberOfReaders = aMax;
+    [_readerPoolCondition broadcast];
+    [_readerPoolCondition unlock];
+}
+
+- (void)invalidateReaderCaches
+{
+    dispatch_assert_queue(queue_);
+
+    // Committed along with the deletions, so the generation read in a snapshot
+    // always matches the revisions it contains
+    [db_ executeUpdate: @"UPDATE reader_generation SET generation = generation + 1"];
+}
+
+/**
+ * Each reader caches revision contents on its own, so the readers split 
+ * -maxItemGraphCacheSize rather than each using it.
+ */
+- (NSUInteger)maxItemGraphCacheSizePerReader
+{
+    return _maxItemGraphCacheSize / MAX(self.maxNumberOfReaders, 1);
+}
+
+/**
+ * Returns an idle reader, or opens a new one if the pool is not full.
+ *
+ * Otherwise, if aPendingRead is nil, waits until a reader is checked in. If it
+ * isn't nil, returns nil instead, and -checkInReader: passes the next reader 
+ * checked in to aPendingRead on the read queue.
+ */
+- (COSQLiteStoreReader *)checkOutReaderOrEnqueueRead: (void (^)(COSQLiteStoreReader *reader))aPendingRead
+{
+    COSQLiteStoreReader *reader = nil;
+
+    [_readerPoolCondition lock];
+    while (_idleReaders.count == 0 && _numberOfReaders >= _maxNumberOfReaders)
+    {
+        if (aPendingRead != nil)
+        {
+            [_pendingReads addObject: aPendingRead];
+            [_readerPoolCondition unlock];
+            return nil;
+        }
+        [_readerPoolCondition wait];
+    }
+    if (_idleReaders.count > 0)
+    {
+        reader = _idleReaders.lastObject;
+        [_idleReaders removeLastObject];
+    }
+    else
+    {
+        _numberOfReaders++;
+    }
+    [_readerPoolCondition unlock];
+
+    if (reader == nil)
+    {
+        reader = [[COSQLiteStoreReader alloc] initWithStore: self];
+
+        if (reader == nil)
+        {
+            [_readerPoolCondition lock];
+            _numberOfReaders--;
+            [_readerPoolCondition signal];
+            [_readerPoolCondition unlock];
+
+            [NSException raise: NSInternalInconsistencyException
+                        format: @"Failed to open a read connection to %@", url_];
+        }
+    }
+    return reader;
+}
+
+- (COSQLiteStoreReader *)checkOutReader
+{
+    return [self checkOutReaderOrEnqueueRead: nil];
+}
+
+- (void)checkInReader: (COSQLiteStoreReader *)aReader
+{
+    BOOL closesReader = NO;
+    void (^pendingRead)(COSQLiteStoreReader *reader) = nil;
+
+    [_readerPoolCondition lock];
+    if (_numberOfReaders > _maxNumberOfReaders)
+    {
+        _numberOfReaders--;
+        closesReader = YES;
+    }
+    else if (_pendingReads.count > 0)
+    {
+        pendingRead = _pendingReads[0];
+        [_pendingReads removeObjectAtIndex: 0];
+    }
+    else
+    {
+        [_idleReaders addObject: aReader];
+    }
+    [_readerPoolCondition signal];
+    [_readerPoolCondition unlock];
+
+    if (closesReader)
+    {
+        [aReader close];
+    }
+    else if (pendingRead != nil)
+    {
+        dispatch_async(_readQueue, ^()
+        {
+            pendingRead(aReader);
+        });
+    }
+}
+
+/**
+ * Runs the block inside a read transaction, then checks in the reader.
+ */
+- (void)performReadUsingBlock: (void (^)(COSQLiteStoreReader *reader))aBlock
+                   withReader: (COSQLiteStoreReader *)aReader
+{
+    @try
+    {
+        aReader.maxItemGraphCacheSize = [self maxItemGraphCacheSizePerReader];
+        // Discards the caches invalidated by the compactions committed before
+        // the snapshot
+        [aReader beginReadTransaction];
+
+        aBlock(aReader);
+    }
+    @finally
+    {
+        [aReader endReadTransaction];
+        [self checkInReader: aReader];
+    }
+}
+
+- (void)performReadUsingBlock: (void (^)(COSQLiteStoreReader *reader))aBlock
+{
+    dispatch_assert_queue_not(queue_);
+
+    [self performReadUsingBlock: aBlock withReader: [self checkOutReader]];
+}
+
+/**
+ * Runs the block with a reader on the read queue, then the handler.
+ *
+ * Unlike -performReadUsingBlock:, never blocks a read queue thread while all
+ * the readers are in use, but waits in the pending reads instead.
+ */
+- (void)performAsynchronousReadUsingBlock: (void (^)(COSQLiteStoreReader *reader))aBlock
+                        completionHandler: (void (^)())handler
+{
+    void (^read)(COSQLiteStoreReader *reader) = ^(COSQLiteStoreReader *reader)
+    {
+        [self performReadUsingBlock: aBlock withReader: reader];
+        handler();
+    };
+    COSQLiteStoreReader *reader = [self checkOutReaderOrEnqueueRead: read];
+
+    if (reader == nil)
+        return;
+
+    dispatch_async(_readQueue, ^()
+    {
+        read(reader);
     });
-    return result;
 }
 
-- (void)testingRunBlockInStoreQueue: (void (^)())aBlock
+- (void)persistentRootInfoForUUID: (ETUUID *)aUUID
+                completionHandler: (void (^)(COPersistentRootInfo *info))handler
 {
-    dispatch_sync(queue_, aBlock);
+    NILARG_EXCEPTION_TEST(handler);
+
+    __block COPersistentRootInfo *result = nil;
+
+    [self performAsynchronousReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        if (aUUID != nil)
+        {
+            result = [reader persistentRootInfoForUUID: aUUID];
+        }
+    }
+                          completionHandler: ^()
+    {
+        handler(result);
+    }];
+}
+
+- (void)revisionInfosForBranchUUID: (ETUUID *)aBranchUUID
+                           options: (COBranchRevisionReadingOptions)options
+                 completionHandler: (void (^)(NSArray *revisionInfos))handler
+{
+    NILARG_EXCEPTION_TEST(aBranchUUID);
+    NILARG_EXCEPTION_TEST(handler);
+
+    __block NSArray *result = nil;
+
+    [self performAsynchronousReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader revisionInfosForBranchUUID: aBranchUUID options: options];
+    }
+                          completionHandler: ^()
+    {
+        handler(result);
+    }];
+}
+
+- (void)itemGraphForRevisionUUID: (ETUUID *)aRevisionUUID
+                  persistentRoot: (ETUUID *)aPersistentRoot
+               completionHandler: (void (^)(COItemGraph *itemGraph))handler
+{
+    NILARG_EXCEPTION_TEST(aRevisionUUID);
+    NILARG_EXCEPTION_TEST(aPersistentRoot);
+    NILARG_EXCEPTION_TEST(handler);
+
+    __block COItemGraph *result = nil;
+
+    [self performAsynchronousReadUsingBlock: ^(COSQLiteStoreReader *reader)
+    {
+        result = [reader itemGraphForRevisionUUID: aRevisionUUID persistentRoot: aPersistentRoot];
+    }
+                          completionHandler: ^()
+    {
+        handler(result);
+    }];
 }
 
 @end
@@ -11,7 +11,47 @@
 
 @class FMDatabase;
 @class COItemGraph;
-@class CORevisionInfo;
+@class CORevisionInfo, CORevisionGraph;
+@class COItemDataCacheEntry, COAncestryRows;
+
+/**
+ * The recent revision reads and writes of a backing store, used by the 
+ * snapshot policies.
+ *
+ * Shared by the backing store instances opened for the same backing store 
+ * (by the store connection and each reader), so the writes account for the 
+ * reads done through the reader pool. Thread-safe.
+ */
+@interface COSQLiteStoreBackingStoreStatistics : NSObject
+{
+    /**
+     * Recent revision reads and writes, used by 
+     * COSQLiteStoreSnapshotPolicyAdaptive
+     */
+    double _readCount;
+    double _writeCount;
+    /**
+     * Moving average of the time to reconstruct a revision per byte of 
+     * commit data parsed, used by COSQLiteStoreSnapshotPolicyReconstructionCost
+     */
+    double _reconstructionTimePerByte;
+}
+
+- (void)recordRevisionRead;
+- (void)recordRevisionWrite;
+- (void)recordReconstructionTime: (NSTimeInterval)aTime bytesParsed: (int64_t)bytesParsed;
+/**
+ * Returns how much longer delta runs can be than the store limits, for the 
+ * adaptive policy. Less than 1 when the revisions are read more often than 
+ * written.
+ */
+@property (nonatomic, readonly) double adaptiveSnapshotScale;
+/**
+ * 0 until a revision has been reconstructed.
+ */
+@property (nonatomic, readonly) double reconstructionTimePerByte;
+
+@end
 
 /**
  * Database connection for manipulating a persistent root backing store.
@@ -29,6 +69,37 @@
      * Can be cached after being read for the first time, since it can never change
      */
     ETUUID *_rootObjectUUID;
+
+    /**
+     * Reconstructed revision contents (revid => COItemDataCacheEntry, whose 
+     * dictionary maps item UUID => item data), see -maxItemGraphCacheSize.
+     */
+    NSMutableDictionary *_itemDataCache;
+    /**
+     * The ends of the cache entry list, ordered from least recently used to 
+     * most recently used
+     */
+    COItemDataCacheEntry *_leastRecentlyUsedItemData;
+    COItemDataCacheEntry *_mostRecentlyUsedItemData;
+    NSUInteger _itemDataCacheSize;
+    NSUInteger _maxItemGraphCacheSize;
+    /**
+     * The ancestry index rows, loaded on the first write, see 
+     * -ancestryRowsBeforeRevid:.
+     */
+    COAncestryRows *_ancestryRows;
+
+    /**
+     * See -[COSQLiteStore statisticsForBackingStoreUUID:]
+     */
+    COSQLiteStoreBackingStoreStatistics *_statistics;
+
+    /**
+     * Can be cached after being read for the first time, since it never 
+     * changes once set (see -[COSQLiteStore usesCompressionDictionaries])
+     */
+    NSData *_compressionDictionary;
+    BOOL _compressionDictionaryLoaded;
 }
 
 /**
@@ -40,9 +111,31 @@
                                      store: (COSQLiteStore *)store
                                 useStoreDB: (BOOL)share
                                      error: (NSError **)error NS_DESIGNATED_INITIALIZER;
+/**
+ * Opens a backing store, whose tables must already exist in the store 
+ * database, for reading through a read-only connection.
+ *
+ * Only supported when BACKING_STORES_SHARE_SAME_SQLITE_DB is 1.
+ */
+- (instancetype)initWithPersistentRootUUID: (ETUUID *)aUUID
+                                     store: (COSQLiteStore *)store
+                          readOnlyDatabase: (FMDatabase *)aDatabase NS_DESIGNATED_INITIALIZER;
 
 @property (nonatomic, readonly) BOOL close;
 
+/**
+ * The approximate number of bytes of reconstructed revision contents kept in 
+ * memory.
+ *
+ * Reconstructing a revision requires reading and parsing every commit back to 
+ * the last full snapshot. When a cached ancestor is found while walking back, 
+ * the reconstruction stops there, so loading a revision close to a recently 
+ * loaded one only costs the deltas in between.
+ *
+ * The least recently used revisions are evicted first. 0 disables the cache.
+ */
+@property (nonatomic, readwrite, assign) NSUInteger maxItemGraphCacheSize;
+
 - (CORevisionInfo *)revisionInfoForRevisionUUID: (ETUUID *)aToken;
 
 @property (nonatomic, readonly, strong) ETUUID *UUID;
@@ -68,6 +161,13 @@
     persistentrootUUID: (ETUUID *)aPersistentRootUUID
                  error: (NSError **)error;
 - (NSIndexSet *)revidsFromRevid: (int64_t)baseRevid toRevid: (int64_t)finalRevid;
+/**
+ * Returns the revids of the commits that contain a new state for one of the 
+ * given items (for a full snapshot, all the items present in the revision).
+ *
+ * Answered by the item directory, without parsing the commit contents.
+ */
+- (NSIndexSet *)revidsTouchingItemUUIDs: (NSSet *)itemUUIDs;
 /**
  * Unconditionally deletes the specified revisions
  */
@@ -84,11 +184,31 @@
 - (int64_t)revidForUUID: (ETUUID *)aUUID;
 - (NSIndexSet *)revidsForUUIDs: (NSArray *)UUIDs;
 - (ETUUID *)revisionUUIDForRevid: (int64_t)aRevid;
+- (NSArray *)revisionUUIDsForRevids: (NSIndexSet *)revids;
+/**
+ * Returns the given revids and the revids of all their ancestors (following 
+ * the merge parents too), minus the excluded revids and their ancestors.
+ *
+ * The walk is iterative, and only keeps the parent revids and two bitsets 
+ * sized from -revidsUsedRange in memory.
+ */
+- (NSIndexSet *)ancestorRevidsOfRevids: (NSIndexSet *)revids
+            excludingAncestorsOfRevids: (NSIndexSet *)excludedRevids;
 - (NSArray *)revisionInfosForBranchUUID: (ETUUID *)aBranchUUID
                        headRevisionUUID: (ETUUID *)aHeadRevUUID
                                 options: (COBranchRevisionReadingOptions)options;
 
 @property (nonatomic, readonly) NSArray *revisionInfos;
+/**
+ * Returns the revision DAG, loaded with a single query.
+ */
+@property (nonatomic, readonly) CORevisionGraph *revisionGraph;
+/**
+ * Adds the revisions committed since the revision graph was loaded, and 
+ * returns YES, or returns NO if the last revision in the graph was deleted or 
+ * replaced (the graph must be reloaded then).
+ */
+- (BOOL)appendRevisionsToRevisionGraph: (CORevisionGraph *)aGraph;
 @property (nonatomic, readonly) uint64_t fileSize;
 
 - (void)clearBackingStore;
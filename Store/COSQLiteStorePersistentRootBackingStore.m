@@ -16,6 +16,7 @@
 #import "COSQLiteStorePersistentRootBackingStoreBinaryFormats.h"
 #import "COItem+Binary.h"
 #import "CORevisionInfo.h"
+#import "CORevisionGraph.h"
 #import "COSQLiteStore+Private.h"
 #import "CODateSerialization.h"
 #import "COJSONSerialization.h"
@@ -45,6 +46,138 @@
 @end
 
 
+/**
+ * A node in the item data cache list, ordered from least recently used to most 
+ * recently used, which lets the backing store reorder and evict cached 
+ * revisions in constant time.
+ */
+@interface COItemDataCacheEntry : NSObject
+{
+@public
+    int64_t revid;
+    NSUInteger size;
+    NSDictionary *dataForUUID;
+    __unsafe_unretained COItemDataCacheEntry *previous;
+    COItemDataCacheEntry *next;
+}
+@end
+
+@implementation COItemDataCacheEntry
+@end
+
+
+typedef struct
+{
+    BOOL present;
+    int64_t parentRevid;
+    int64_t depth;
+    int64_t skipRevid;
+    int64_t mergeDepth;
+} COAncestryRow;
+
+/**
+ * The ancestry index rows of a backing store and the parent revids, indexed 
+ * by revid, see -[COSQLiteStorePersistentRootBackingStore ancestryRowsBeforeRevid:].
+ */
+@interface COAncestryRows : NSObject
+{
+@public
+    NSMutableData *rows; // COAncestryRow, not present for the missing revids
+    int64_t lastRevid;
+    NSData *lastRevisionUUIDData;
+}
+@end
+
+@implementation COAncestryRows
+
+- (instancetype)init
+{
+    SUPERINIT;
+    rows = [NSMutableData new];
+    lastRevid = -1;
+    return self;
+}
+
+@end
+
+
+@implementation COSQLiteStoreBackingStoreStatistics
+
+/**
+ * The adaptive policy can make delta runs up to this factor shorter or longer
+ */
+static const double COAdaptiveSnapshotMaxScale = 16;
+
+- (void)decayReadWriteCounts
+{
+    // Halve the counts regularly, so the policy follows the recent usage
+    if (_readCount + _writeCount > 256)
+    {
+        _readCount /= 2;
+        _writeCount /= 2;
+    }
+}
+
+- (void)recordRevisionRead
+{
+    @synchronized (self)
+    {
+        _readCount++;
+        [self decayReadWriteCounts];
+    }
+}
+
+- (void)recordRevisionWrite
+{
+    @synchronized (self)
+    {
+        _writeCount++;
+        [self decayReadWriteCounts];
+    }
+}
+
+- (void)recordReconstructionTime: (NSTimeInterval)aTime bytesParsed: (int64_t)bytesParsed
+{
+    if (bytesParsed == 0)
+        return;
+
+    const double timePerByte = aTime / bytesParsed;
+
+    @synchronized (self)
+    {
+        if (_reconstructionTimePerByte == 0)
+        {
+            _reconstructionTimePerByte = timePerByte;
+        }
+        else
+        {
+            _reconstructionTimePerByte = 0.8 * _reconstructionTimePerByte + 0.2 * timePerByte;
+        }
+    }
+}
+
+- (double)adaptiveSnapshotScale
+{
+    double ratio;
+
+    @synchronized (self)
+    {
+        ratio = (_writeCount + 1) / (_readCount + 1);
+    }
+    return MIN(MAX(ratio, 1 / COAdaptiveSnapshotMaxScale), COAdaptiveSnapshotMaxScale);
+}
+
+- (double)reconstructionTimePerByte
+{
+    @synchronized (self)
+    {
+        return _reconstructionTimePerByte;
+    }
+}
+
+@end
+
+
 @implementation COSQLiteStorePersistentRootBackingStore
 
 - (NSString *)tableName
@@ -71,6 +204,38 @@
     }
 }
 
+/**
+ * The item directory lists the items written in each commit, so we know which 
+ * revisions touch a given item without parsing the commit contents.
+ */
+- (NSString *)itemsTableName
+{
+    if (_shareDB)
+    {
+        return [NSString stringWithFormat: @"`items-%@`", _uuid];
+    }
+    else
+    {
+        return @"items";
+    }
+}
+
+/**
+ * The ancestry index stores the depth, skip pointer and last merge depth of
+ * each revision, see CORevisionGraph.
+ */
+- (NSString *)ancestryTableName
+{
+    if (_shareDB)
+    {
+        return [NSString stringWithFormat: @"`ancestry-%@`", _uuid];
+    }
+    else
+    {
+        return @"ancestry";
+    }
+}
+
 - (instancetype)initWithPersistentRootUUID: (ETUUID *)aUUID
                                      store: (COSQLiteStore *)store
                                 useStoreDB: (BOOL)share
@@ -83,6 +248,8 @@
     _shareDB = share;
     _store = store;
     _uuid = aUUID;
+    _itemDataCache = [NSMutableDictionary new];
+    _statistics = [store statisticsForBackingStoreUUID: aUUID];
 
     if (_shareDB)
     {
@@ -126,194 +293,960 @@
 
     // This table always contains exactly one row
     [db_ executeUpdate: [NSString stringWithFormat:
-        @"CREATE TABLE IF NOT EXISTS %@ (root BLOB NOT NULL CHECK (length(root) = 16))",
+        @"CREATE TABLE IF NOT EXISTS %@ (root BLOB NOT NULL CHECK (length(root) = 16), "
+            "compressiondictionary BLOB)",
         [self metadataTableName]]];
+    [self addCompressionDictionaryColumnIfNeeded];
+
+    // N.B. The primary key gives us an index to look up the revids by item UUID
+    [db_ executeUpdate: [NSString stringWithFormat:
+        @"CREATE TABLE IF NOT EXISTS %@ (itemuuid BLOB NOT NULL, revid INTEGER NOT NULL, "
+            "PRIMARY KEY (itemuuid, revid))",
+        [self itemsTableName]]];
+
+    [self populateItemsTableIfNeeded];
+
+    [db_ executeUpdate: [NSString stringWithFormat:
+        @"CREATE TABLE IF NOT EXISTS %@ (revid INTEGER PRIMARY KEY, depth INTEGER NOT NULL, "
+            "skip INTEGER NOT NULL, mergedepth INTEGER NOT NULL)",
+        [self ancestryTableName]]];
+
+    [self populateAncestryTableIfNeeded];
 
     [self commit];
 
     // FIXME: -hadError only looks at the success of the last statement.
     if ([db_ hadError])
     {
-        NSLog(@"Error %d: %@", [db_ lastErrorCode], [db_ lastErrorMessage]);
-        return nil;
+        NSLog(@"Error %d: %@", [db_ lastErrorCode], [db_ lastErrorMessage]);
+        return nil;
+    }
+
+    return self;
+}
+
+- (instancetype)initWithPersistentRootUUID: (ETUUID *)aUUID
+                                     store: (COSQLiteStore *)store
+                          readOnlyDatabase: (FMDatabase *)aDatabase
+{
+    NILARG_EXCEPTION_TEST(aUUID);
+    NILARG_EXCEPTION_TEST(store);
+    NILARG_EXCEPTION_TEST(aDatabase);
+    SUPERINIT;
+
+    // The tables are created by the store connection, see the other initializer
+    _shareDB = YES;
+    _store = store;
+    _uuid = aUUID;
+    _itemDataCache = [NSMutableDictionary new];
+    _statistics = [store statisticsForBackingStoreUUID: aUUID];
+    db_ = aDatabase;
+
+    return self;
+}
+
+- (instancetype)init
+{
+    return [self initWithPersistentRootUUID: nil store: nil useStoreDB: NO error: NULL];
+}
+
+- (void)clearBackingStore
+{
+    [self removeAllCachedItemData];
+    _ancestryRows = nil;
+    _compressionDictionary = nil;
+    _compressionDictionaryLoaded = NO;
+
+    [self beginTransaction];
+    [db_ executeUpdate: [NSString stringWithFormat: @"DELETE FROM %@", [self tableName]]];
+    [db_ executeUpdate: [NSString stringWithFormat: @"DELETE FROM %@", [self metadataTableName]]];
+    [db_ executeUpdate: [NSString stringWithFormat: @"DELETE FROM %@", [self itemsTableName]]];
+    [db_ executeUpdate: [NSString stringWithFormat: @"DELETE FROM %@", [self ancestryTableName]]];
+    ETAssert([self commit]);
+}
+
+- (ETUUID *)UUID
+{
+    return _uuid;
+}
+
+- (BOOL)close
+{
+    if (!_shareDB)
+    {
+        return [db_ close];
+    }
+    else
+    {
+        return YES;
+    }
+}
+
+
+- (BOOL)beginTransaction
+{
+    return [db_ savepoint: @"backingStore"];
+}
+
+- (BOOL)commit
+{
+    return [db_ releaseSavepoint: @"backingStore"];
+}
+
+- (BOOL)rollback
+{
+    return [db_ rollbackToSavepoint: @"backingStore"];
+}
+
+
+#pragma mark DB Setup -
+
+
+/*
+ 
+ commits
+ =======
+ 
+ revid INTEGER PRIMARY KEY | contents BLOB | metadata BLOB | parent INTEGER | root BLOB | deltabase INTEGER
+ --------------------------+---------------+---------------+----------------+-----------+------------------
+ 0                         | ???           | ???           | null           | xxxxxxxxx | 0
+ 1                         | ???           | ???           | 0              | xxxxxxxxx | 0
+ 2                         | ???           | ???           | 1              | xxxxxxxxx | 2
+ 3                         | ???           | ???           | 2              | xxxxxxxxx | 2
+ 4                         | ???           | ???           | 3              | xxxxxxxxx | 2
+ 5                         | ???           | ???           | 2              | xxxxxxxxx | 2
+ 6                         | ???           | ???           | 0              | xxxxxxxxx | 6
+ 
+ 
+ 
+ suppose we want to reconstruct the delta revision 500000:
+ 
+ SELECT * FROM test WHERE revid <= 500000 AND revid >= (SELECT MAX(revid) FROM test WHERE delta = 0 AND revid < 500000);
+
+ */
+
+- (ETUUID *)revisionUUIDForRevid: (int64_t)aRevid
+{
+    NSData *revUUID = [db_ dataForQuery:
+        [NSString stringWithFormat: @"SELECT uuid FROM %@ WHERE revid = ?", [self tableName]],
+        @(aRevid)];
+
+    if (revUUID != nil)
+    {
+        return [ETUUID UUIDWithData: revUUID];
+    }
+    else
+    {
+        return nil;
+    }
+}
+
+- (CORevisionInfo *)revisionInfoForRevisionUUID: (ETUUID *)aRevisionUUID
+{
+    CORevisionInfo *result = nil;
+    // The parent and merge parent UUIDs are looked up with self joins
+    FMResultSet *rs = [db_ executeQuery:
+        [NSString stringWithFormat: @"SELECT parentrevs.uuid, mergeparentrevs.uuid, revs.branchuuid, "
+                                      "revs.persistentrootuuid, revs.metadata, revs.timestamp FROM %@ AS revs "
+                                      "LEFT OUTER JOIN %@ AS parentrevs ON parentrevs.revid = revs.parent "
+                                      "LEFT OUTER JOIN %@ AS mergeparentrevs ON mergeparentrevs.revid = revs.mergeparent "
+                                      "WHERE revs.uuid = ?",
+                                    [self tableName], [self tableName], [self tableName]],
+        [aRevisionUUID dataValue]];
+    if ([rs next])
+    {
+        NSData *parentData = [rs dataForColumnIndex: 0];
+        NSData *mergeParentData = [rs dataForColumnIndex: 1];
+
+        result = [[CORevisionInfo alloc] init];
+        result.revisionUUID = aRevisionUUID;
+        result.parentRevisionUUID = (parentData != nil ? [ETUUID UUIDWithData: parentData] : nil);
+        result.mergeParentRevisionUUID = (mergeParentData != nil ? [ETUUID UUIDWithData: mergeParentData] : nil);
+        result.branchUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 2]];
+        result.persistentRootUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 3]];
+        NSData *data = [rs dataForColumnIndex: 4];
+        if (data != nil)
+        {
+            result.metadata = COJSONObjectWithData(data, NULL);
+        }
+        result.date = CODateFromJavaTimestamp([rs numberForColumnIndex: 5]);
+    }
+    [rs close];
+
+    return result;
+}
+
+- (int64_t)revidForUUID: (ETUUID *)aUUID
+{
+    NSNumber *revid = [db_ numberForQuery:
+        [NSString stringWithFormat: @"SELECT revid FROM %@ WHERE uuid = ?", [self tableName]],
+        [aUUID dataValue]];
+    if (revid == nil)
+    {
+        return -1;
+    }
+    return revid.longLongValue;
+}
+
+- (NSIndexSet *)revidsForUUIDs: (NSArray *)UUIDs
+{
+    NSSet *UUIDDataValues = (id)[[[NSSet setWithArray: UUIDs] mappedCollection] dataValue];
+    NSMutableIndexSet *revids = [NSMutableIndexSet new];
+    FMResultSet *rs = [db_ executeQuery: [NSString stringWithFormat:
+        @"SELECT revid, uuid FROM %@", [self tableName]]];
+
+    while ([rs next])
+    {
+        if ([UUIDDataValues containsObject: [rs dataForColumnIndex: 1]])
+        {
+            [revids addIndex: [rs int64ForColumnIndex: 0]];
+        }
+    }
+    [rs close];
+
+    return revids;
+}
+
+- (NSArray *)revisionUUIDsForRevids: (NSIndexSet *)revids
+{
+    NSMutableArray *UUIDs = [NSMutableArray new];
+    FMResultSet *rs = [db_ executeQuery: [NSString stringWithFormat:
+        @"SELECT revid, uuid FROM %@", [self tableName]]];
+
+    while ([rs next])
+    {
+        if ([revids containsIndex: [rs int64ForColumnIndex: 0]])
+        {
+            [UUIDs addObject: [ETUUID UUIDWithData: [rs dataForColumnIndex: 1]]];
+        }
+    }
+    [rs close];
+
+    return UUIDs;
+}
+
+static inline BOOL COBitsetContainsIndex(const uint64_t *bitset, int64_t index)
+{
+    return (bitset[index / 64] >> (index % 64)) & 1;
+}
+
+static inline void COBitsetAddIndex(uint64_t *bitset, int64_t index)
+{
+    bitset[index / 64] |= (uint64_t)1 << (index % 64);
+}
+
+/**
+ * Marks the revisions and their ancestors in the bitset, without walking past
+ * the revisions marked in the stop bitset.
+ *
+ * The parents array contains the parent and merge parent of each revision 
+ * (indexed by revid minus the first revid), or -2 for a missing revision.
+ */
+static void COMarkAncestors(const int64_t *parents,
+                            int64_t firstRevid,
+                            int64_t count,
+                            NSIndexSet *revids,
+                            uint64_t *marked,
+                            const uint64_t *stopMarked)
+{
+    // Each revision is marked when pushed, so it is pushed at most once
+    int64_t *stack = malloc(count * sizeof(int64_t));
+    int64_t stackCount = 0;
+    BOOL (^shouldMark)(int64_t) = ^(int64_t revid)
+    {
+        const int64_t i = revid - firstRevid;
+
+        return (BOOL)(i >= 0 && i < count && parents[2 * i] != -2
+            && !COBitsetContainsIndex(marked, i)
+            && (stopMarked == NULL || !COBitsetContainsIndex(stopMarked, i)));
+    };
+
+    for (NSUInteger revid = revids.firstIndex; revid != NSNotFound; revid = [revids indexGreaterThanIndex: revid])
+    {
+        if (shouldMark(revid))
+        {
+            COBitsetAddIndex(marked, revid - firstRevid);
+            stack[stackCount++] = revid - firstRevid;
+        }
+    }
+
+    while (stackCount > 0)
+    {
+        const int64_t i = stack[--stackCount];
+
+        for (int j = 0; j < 2; j++)
+        {
+            const int64_t parent = parents[2 * i + j];
+
+            if (shouldMark(parent))
+            {
+                COBitsetAddIndex(marked, parent - firstRevid);
+                stack[stackCount++] = parent - firstRevid;
+            }
+        }
+    }
+    free(stack);
+}
+
+- (NSIndexSet *)ancestorRevidsOfRevids: (NSIndexSet *)revids
+            excludingAncestorsOfRevids: (NSIndexSet *)excludedRevids
+{
+    NILARG_EXCEPTION_TEST(revids);
+    NSIndexSet *usedRange = self.revidsUsedRange;
+    NSMutableIndexSet *result = [NSMutableIndexSet indexSet];
+
+    if (usedRange.count == 0)
+        return result;
+
+    const int64_t firstRevid = usedRange.firstIndex;
+    const int64_t count = usedRange.count;
+    int64_t *parents = malloc(2 * count * sizeof(int64_t));
+    uint64_t *excluded = calloc((count + 63) / 64, sizeof(uint64_t));
+    uint64_t *included = calloc((count + 63) / 64, sizeof(uint64_t));
+
+    for (int64_t i = 0; i < 2 * count; i++)
+    {
+        parents[i] = -2;
+    }
+
+    FMResultSet *rs = [db_ executeQuery: [NSString stringWithFormat:
+        @"SELECT revid, parent, mergeparent FROM %@", [self tableName]]];
+
+    while ([rs next])
+    {
+        const int64_t i = [rs int64ForColumnIndex: 0] - firstRevid;
+
+        // N.B.: Watch for null being returned as 0
+        parents[2 * i] = ([rs columnIndexIsNull: 1] ? -1 : [rs int64ForColumnIndex: 1]);
+        parents[2 * i + 1] = ([rs columnIndexIsNull: 2] ? -1 : [rs int64ForColumnIndex: 2]);
+    }
+    [rs close];
+
+    if (excludedRevids != nil)
+    {
+        COMarkAncestors(parents, firstRevid, count, excludedRevids, excluded, NULL);
+    }
+    COMarkAncestors(parents, firstRevid, count, revids, included, excluded);
+
+    // Add the marked revids as ranges
+    int64_t rangeStart = -1;
+
+    for (int64_t i = 0; i <= count; i++)
+    {
+        const BOOL isMarked = (i < count && COBitsetContainsIndex(included, i));
+
+        if (isMarked && rangeStart == -1)
+        {
+            rangeStart = i;
+        }
+        else if (!isMarked && rangeStart != -1)
+        {
+            [result addIndexesInRange: NSMakeRange(firstRevid + rangeStart, i - rangeStart)];
+            rangeStart = -1;
+        }
+    }
+
+    free(included);
+    free(excluded);
+    free(parents);
+    return result;
+}
+
+- (ETUUID *)rootUUID
+{
+    if (_rootObjectUUID == nil)
+    {
+        FMResultSet *rs = [db_ executeQuery: [NSString stringWithFormat: @"SELECT root FROM %@",
+                                                                         [self metadataTableName]]];
+        if ([rs next])
+        {
+            _rootObjectUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]];
+        }
+        [rs close];
+    }
+    return _rootObjectUUID;
+}
+
+
+#pragma mark Commit Compression -
+
+/**
+ * Upgrades metadata tables created before commit compression was supported.
+ */
+- (void)addCompressionDictionaryColumnIfNeeded
+{
+    FMResultSet *rs = [db_ executeQuery: [NSString stringWithFormat: @"PRAGMA table_info(%@)",
+                                                                     [self metadataTableName]]];
+    BOOL hasColumn = NO;
+
+    while ([rs next])
+    {
+        if ([[rs stringForColumn: @"name"] isEqualToString: @"compressiondictionary"])
+        {
+            hasColumn = YES;
+        }
+    }
+    [rs close];
+
+    if (!hasColumn)
+    {
+        [db_ executeUpdate: [NSString stringWithFormat: @"ALTER TABLE %@ ADD COLUMN compressiondictionary BLOB",
+                                                        [self metadataTableName]]];
+    }
+}
+
+- (NSData *)compressionDictionary
+{
+    if (!_compressionDictionaryLoaded)
+    {
+        _compressionDictionary = [db_ dataForQuery: [NSString stringWithFormat: @"SELECT compressiondictionary FROM %@",
+                                                                                [self metadataTableName]]];
+        // Another connection can train the dictionary later
+        _compressionDictionaryLoaded = (_compressionDictionary != nil);
+    }
+    return _compressionDictionary;
+}
+
+/**
+ * Returns the commit contents to store in the database, compressed or not 
+ * depending on -[COSQLiteStore commitCompression].
+ */
+- (NSData *)storedDataForContents: (NSData *)contentsBlob dictionary: (NSData *)dictionary
+{
+    if (_store.commitCompression == COSQLiteStoreCompressionNone)
+        return contentsBlob;
+
+    return CompressedCommitData(contentsBlob, dictionary);
+}
+
+- (NSData *)contentsForStoredData: (NSData *)storedData
+{
+    if (!IsCompressedCommitData(storedData))
+        return storedData;
+
+    return UncompressedCommitData(storedData, self.compressionDictionary);
+}
+
+/**
+ * Returns a new compression dictionary trained on the given snapshot, or nil 
+ * if the receiver already has one or doesn't need one.
+ */
+- (NSData *)trainedCompressionDictionaryForSnapshot: (NSData *)contentsBlob
+{
+    COSQLiteStore *store = _store;
+
+    if (store.commitCompression == COSQLiteStoreCompressionNone
+        || !store.usesCompressionDictionaries
+        || self.compressionDictionary != nil)
+    {
+        return nil;
+    }
+
+    NSMutableDictionary *dataForUUID = [NSMutableDictionary dictionary];
+    ParseCombinedCommitDataInToUUIDToItemDataDictionary(dataForUUID, contentsBlob, NO, nil);
+
+    // zlib can only reference the last 32 KB of the dictionary
+    return CompressionDictionaryWithItemData(dataForUUID.allValues, 32 * 1024);
+}
+
+- (BOOL)hasRevid: (int64_t)revid
+{
+    return [db_ boolForQuery: [NSString stringWithFormat: @"SELECT 1 FROM %@ WHERE revid = ?",
+                                                          [self tableName]],
+                              @(revid)];
+}
+
+#pragma mark Item Directory -
+
+- (BOOL)addItemUUIDs: (NSArray *)itemUUIDs toItemsTableForRevid: (int64_t)revid
+{
+    NSString *sql = [NSString stringWithFormat: @"INSERT INTO %@ (itemuuid, revid) VALUES (?, ?)",
+                                                [self itemsTableName]];
+    NSNumber *revidObj = @(revid);
+    BOOL ok = YES;
+
+    for (ETUUID *uuid in itemUUIDs)
+    {
+        ok = ok && [db_ executeUpdate: sql, [uuid dataValue], revidObj];
+    }
+    return ok;
+}
+
+/**
+ * For backing stores created before the item directory was introduced, 
+ * populates it by parsing every commit once.
+ */
+- (void)populateItemsTableIfNeeded
+{
+    // Stops at the first row, unlike COUNT(*) which scans the whole table
+    const BOOL hasItems = [db_ boolForQuery: [NSString stringWithFormat: @"SELECT EXISTS (SELECT 1 FROM %@ LIMIT 1)",
+                                                                         [self itemsTableName]]];
+    if (hasItems)
+        return;
+
+    FMResultSet *rs = [db_ executeQuery: [NSString stringWithFormat: @"SELECT revid, contents FROM %@",
+                                                                     [self tableName]]];
+    NSMutableDictionary *itemUUIDsForRevid = [NSMutableDictionary dictionary];
+
+    while ([rs next])
+    {
+        NSMutableDictionary *dataForUUID = [NSMutableDictionary dictionary];
+
+        ParseCombinedCommitDataInToUUIDToItemDataDictionary(dataForUUID,
+                                                            [self contentsForStoredData: [rs dataForColumnIndex: 1]],
+                                                            NO,
+                                                            nil);
+        itemUUIDsForRevid[@([rs longLongIntForColumnIndex: 0])] = dataForUUID.allKeys;
+    }
+    [rs close];
+
+    for (NSNumber *revid in itemUUIDsForRevid)
+    {
+        [self addItemUUIDs: itemUUIDsForRevid[revid] toItemsTableForRevid: revid.longLongValue];
+    }
+}
+
+/**
+ * Returns the ancestry row of the revid, or NULL if the revision is not in the 
+ * ancestry rows (e.g. deleted by a history compaction).
+ */
+static const COAncestryRow *COAncestryRowForRevid(COAncestryRows *rows, int64_t revid)
+{
+    if (revid < 0 || revid >= (int64_t)(rows->rows.length / sizeof(COAncestryRow)))
+        return NULL;
+
+    const COAncestryRow *row = (const COAncestryRow *)rows->rows.bytes + revid;
+    return (row->present ? row : NULL);
+}
+
+static void COAncestryRowsSetRow(COAncestryRows *rows, int64_t revid, COAncestryRow row, NSData *revisionUUIDData)
+{
+    const NSUInteger length = (NSUInteger)(revid + 1) * sizeof(COAncestryRow);
+
+    // The gaps are zeroed, so they are not present
+    if (rows->rows.length < length)
+    {
+        [rows->rows setLength: length];
+    }
+    ((COAncestryRow *)rows->rows.mutableBytes)[revid] = row;
+
+    if (revid > rows->lastRevid)
+    {
+        rows->lastRevid = revid;
+        rows->lastRevisionUUIDData = revisionUUIDData;
+    }
+}
+
+/**
+ * Same as -[CORevisionGraph ancestorRevidForRevid:atDepth:], but for the 
+ * ancestry rows.
+ */
+static int64_t COAncestorRevidForRevid(COAncestryRows *rows, int64_t aRevid, int64_t aDepth)
+{
+    const COAncestryRow *row = COAncestryRowForRevid(rows, aRevid);
+    int64_t revid = aRevid;
+
+    if (row == NULL || aDepth < 0 || aDepth > row->depth)
+        return -1;
+
+    while (row->depth > aDepth)
+    {
+        const COAncestryRow *skipRow = COAncestryRowForRevid(rows, row->skipRevid);
+
+        if (skipRow != NULL && COShouldFollowSkipPointer(row->depth, aDepth))
+        {
+            revid = row->skipRevid;
+            row = skipRow;
+        }
+        else
+        {
+            revid = row->parentRevid;
+            row = COAncestryRowForRevid(rows, revid);
+
+            // Deleted by a history compaction
+            if (row == NULL)
+                return -1;
+        }
+    }
+    return revid;
+}
+
+/**
+ * Adds the ancestry index rows of the revisions after the last revid in the 
+ * ancestry rows, and before the given revid.
+ */
+- (void)addAncestryRowsBeforeRevid: (int64_t)aRevid toAncestryRows: (COAncestryRows *)rows
+{
+    FMResultSet *rs = [db_ executeQuery: [NSString stringWithFormat:
+        @"SELECT a.revid, c.uuid, c.parent, a.depth, a.skip, a.mergedepth FROM %@ AS a "
+            "INNER JOIN %@ AS c ON (c.revid = a.revid) WHERE a.revid > ? AND a.revid < ? ORDER BY a.revid ASC",
+        [self ancestryTableName], [self tableName]], @(rows->lastRevid), @(aRevid)];
+
+    while ([rs next])
+    {
+        // N.B.: Watch for null being returned as 0
+        const COAncestryRow row = {
+            YES,
+            ([rs columnIndexIsNull: 2] ? -1 : [rs longLongIntForColumnIndex: 2]),
+            [rs longLongIntForColumnIndex: 3],
+            [rs longLongIntForColumnIndex: 4],
+            [rs longLongIntForColumnIndex: 5]
+        };
+
+        COAncestryRowsSetRow(rows, [rs longLongIntForColumnIndex: 0], row, [rs dataForColumnIndex: 1]);
+    }
+    [rs close];
+}
+
+/**
+ * Returns the ancestry index rows of the revisions before the given revid, 
+ * kept in memory so the skip pointer of a new revision can be computed 
+ * without a query per step.
+ *
+ * Other store instances can write to the backing store too, so we check the 
+ * last revision we know about still exists, then only load the rows added 
+ * after it. Revids are only reused once the last revisions are deleted, so 
+ * otherwise the rows are reloaded.
+ */
+- (COAncestryRows *)ancestryRowsBeforeRevid: (int64_t)aRevid
+{
+    if (_ancestryRows != nil && _ancestryRows->lastRevid != -1)
+    {
+        NSData *lastRevisionUUIDData = [db_ dataForQuery: [NSString stringWithFormat:
+            @"SELECT uuid FROM %@ WHERE revid = ?", [self tableName]], @(_ancestryRows->lastRevid)];
+
+        if (![lastRevisionUUIDData isEqual: _ancestryRows->lastRevisionUUIDData])
+        {
+            _ancestryRows = nil;
+        }
+    }
+    if (_ancestryRows == nil)
+    {
+        _ancestryRows = [COAncestryRows new];
+    }
+
+    [self addAncestryRowsBeforeRevid: aRevid toAncestryRows: _ancestryRows];
+    return _ancestryRows;
+}
+
+/**
+ * Adds the ancestry index row of a revision, once the ancestry index rows of
+ * its parents have been added to the given rows.
+ *
+ * If the parent is missing (deleted by a history compaction before the 
+ * revision was indexed) or not indexed, the depth is unknown, so we store -1, 
+ * and the ancestry queries walk the parents instead (see CORevisionGraph).
+ */
+- (BOOL)addAncestryForRevid: (int64_t)revid
+           revisionUUIDData: (NSData *)revisionUUIDData
+                parentRevid: (int64_t)aParent
+           mergeParentRevid: (int64_t)aMergeParent
+             toAncestryRows: (COAncestryRows *)rows
+{
+    COAncestryRow row = { YES, aParent, 0, -1, -1 };
+
+    if (aParent != -1)
+    {
+        const COAncestryRow *parentRow = COAncestryRowForRevid(rows, aParent);
+
+        if (parentRow != NULL && parentRow->depth >= 0)
+        {
+            row.depth = parentRow->depth + 1;
+            row.skipRevid = COAncestorRevidForRevid(rows, aParent, COSkipDepthForDepth(row.depth));
+            row.mergeDepth = parentRow->mergeDepth;
+        }
+        else
+        {
+            row.depth = -1;
+        }
+    }
+    if (aMergeParent != -1 && row.depth != -1)
+    {
+        row.mergeDepth = row.depth;
     }
 
-    return self;
-}
+    COAncestryRowsSetRow(rows, revid, row, revisionUUIDData);
 
-- (instancetype)init
-{
-    return [self initWithPersistentRootUUID: nil store: nil useStoreDB: NO error: NULL];
+    return [db_ executeUpdate: [NSString stringWithFormat: @"INSERT OR REPLACE INTO %@ (revid, depth, skip, mergedepth) "
+                                                               "VALUES (?, ?, ?, ?)",
+                                                           [self ancestryTableName]],
+                               @(revid), @(row.depth), @(row.skipRevid), @(row.mergeDepth)];
 }
 
-- (void)clearBackingStore
+/**
+ * For backing stores created before the ancestry index was introduced, 
+ * populates it in revid order (parents are always written before children).
+ *
+ * Since each revision is indexed when written, and the backfill runs in the 
+ * transaction that creates the tables, the index is complete when it contains 
+ * the last revid. We check this first, so opening a backing store doesn't 
+ * scan the whole history.
+ */
+- (void)populateAncestryTableIfNeeded
 {
-    [self beginTransaction];
-    [db_ executeUpdate: [NSString stringWithFormat: @"DELETE FROM %@", [self tableName]]];
-    [db_ executeUpdate: [NSString stringWithFormat: @"DELETE FROM %@", [self metadataTableName]]];
-    ETAssert([self commit]);
-}
+    const int64_t lastRevid = [db_ int64ForQuery: [NSString stringWithFormat:
+        @"SELECT IFNULL(MAX(revid), -1) FROM %@", [self tableName]]];
+    const int64_t lastIndexedRevid = [db_ int64ForQuery: [NSString stringWithFormat:
+        @"SELECT IFNULL(MAX(revid), -1) FROM %@", [self ancestryTableName]]];
 
-- (ETUUID *)UUID
-{
-    return _uuid;
+    if (lastRevid <= lastIndexedRevid)
+        return;
+
+    // Loads the rows already indexed
+    COAncestryRows *ancestryRows = [self ancestryRowsBeforeRevid: INT64_MAX];
+    FMResultSet *rs = [db_ executeQuery: [NSString stringWithFormat:
+        @"SELECT c.revid, c.uuid, c.parent, c.mergeparent FROM %@ AS c "
+            "LEFT OUTER JOIN %@ AS a ON (a.revid = c.revid) "
+            "WHERE a.revid IS NULL ORDER BY c.revid ASC",
+        [self tableName], [self ancestryTableName]]];
+
+    while ([rs next])
+    {
+        // N.B.: Watch for null being returned as 0
+        [self addAncestryForRevid: [rs longLongIntForColumnIndex: 0]
+                 revisionUUIDData: [rs dataForColumnIndex: 1]
+                      parentRevid: ([rs columnIndexIsNull: 2] ? -1 : [rs longLongIntForColumnIndex: 2])
+                 mergeParentRevid: ([rs columnIndexIsNull: 3] ? -1 : [rs longLongIntForColumnIndex: 3])
+                   toAncestryRows: ancestryRows];
+    }
+    [rs close];
 }
 
-- (BOOL)close
+- (NSIndexSet *)revidsTouchingItemUUIDs: (NSSet *)itemUUIDs
+                              fromRevid: (int64_t)baseRevid
+                                toRevid: (int64_t)finalRevid
 {
-    if (!_shareDB)
+    NSMutableIndexSet *result = [NSMutableIndexSet indexSet];
+
+    if (itemUUIDs.count == 0)
+        return result;
+
+    NSMutableArray *placeholders = [NSMutableArray arrayWithCapacity: itemUUIDs.count];
+    NSMutableArray *args = [NSMutableArray arrayWithCapacity: itemUUIDs.count + 2];
+
+    for (ETUUID *uuid in itemUUIDs)
     {
-        return [db_ close];
+        [placeholders addObject: @"?"];
+        [args addObject: [uuid dataValue]];
     }
-    else
+    [args addObject: @(baseRevid)];
+    [args addObject: @(finalRevid)];
+
+    FMResultSet *rs = [db_ executeQuery: [NSString stringWithFormat:
+        @"SELECT DISTINCT revid FROM %@ WHERE itemuuid IN (%@) AND revid BETWEEN ? AND ?",
+        [self itemsTableName], [placeholders componentsJoinedByString: @", "]]
+                   withArgumentsInArray: args];
+
+    while ([rs next])
     {
-        return YES;
+        [result addIndex: [rs longLongIntForColumnIndex: 0]];
     }
-}
+    [rs close];
 
+    return result;
+}
 
-- (BOOL)beginTransaction
+- (NSIndexSet *)revidsTouchingItemUUIDs: (NSSet *)itemUUIDs
 {
-    return [db_ savepoint: @"backingStore"];
+    return [self revidsTouchingItemUUIDs: itemUUIDs fromRevid: 0 toRevid: INT64_MAX];
 }
 
-- (BOOL)commit
+#pragma mark Item Data Cache -
+
+- (NSUInteger)maxItemGraphCacheSize
 {
-    return [db_ releaseSavepoint: @"backingStore"];
+    return _maxItemGraphCacheSize;
 }
 
-- (BOOL)rollback
+- (void)setMaxItemGraphCacheSize: (NSUInteger)aSize
 {
-    return [db_ rollbackToSavepoint: @"backingStore"];
+    _maxItemGraphCacheSize = aSize;
+    [self evictCachedItemDataToFitSize: aSize];
 }
 
+/**
+ * Item data parsed from commit data retain the whole commit data, so each 
+ * commit data is counted once rather than the item data ranges.
+ */
+static NSUInteger ItemDataDictionarySize(NSDictionary *dataForUUID)
+{
+    NSHashTable *commitDatas = [NSHashTable hashTableWithOptions: NSHashTableObjectPointerPersonality];
+    NSUInteger size = 0;
 
-#pragma mark DB Setup -
+    for (NSData *data in dataForUUID.objectEnumerator)
+    {
+        NSData *commitData = CommitDataForItemData(data);
 
+        // Count the UUID key and some per-entry overhead too
+        size += 32;
 
-/*
- 
- commits
- =======
- 
- revid INTEGER PRIMARY KEY | contents BLOB | metadata BLOB | parent INTEGER | root BLOB | deltabase INTEGER
- --------------------------+---------------+---------------+----------------+-----------+------------------
- 0                         | ???           | ???           | null           | xxxxxxxxx | 0
- 1                         | ???           | ???           | 0              | xxxxxxxxx | 0
- 2                         | ???           | ???           | 1              | xxxxxxxxx | 2
- 3                         | ???           | ???           | 2              | xxxxxxxxx | 2
- 4                         | ???           | ???           | 3              | xxxxxxxxx | 2
- 5                         | ???           | ???           | 2              | xxxxxxxxx | 2
- 6                         | ???           | ???           | 0              | xxxxxxxxx | 6
- 
- 
- 
- suppose we want to reconstruct the delta revision 500000:
- 
- SELECT * FROM test WHERE revid <= 500000 AND revid >= (SELECT MAX(revid) FROM test WHERE delta = 0 AND revid < 500000);
+        if (commitData == nil)
+        {
+            size += data.length;
+        }
+        else if (![commitDatas containsObject: commitData])
+        {
+            [commitDatas addObject: commitData];
+            size += commitData.length;
+        }
+    }
+    return size;
+}
 
+/**
+ * Inserts the entry as the most recently used one.
  */
-
-- (ETUUID *)revisionUUIDForRevid: (int64_t)aRevid
+- (void)appendItemDataCacheEntry: (COItemDataCacheEntry *)entry
 {
-    NSData *revUUID = [db_ dataForQuery:
-        [NSString stringWithFormat: @"SELECT uuid FROM %@ WHERE revid = ?", [self tableName]],
-        @(aRevid)];
+    entry->previous = _mostRecentlyUsedItemData;
+    entry->next = nil;
 
-    if (revUUID != nil)
+    if (_mostRecentlyUsedItemData != nil)
     {
-        return [ETUUID UUIDWithData: revUUID];
+        _mostRecentlyUsedItemData->next = entry;
     }
     else
     {
-        return nil;
+        _leastRecentlyUsedItemData = entry;
     }
+    _mostRecentlyUsedItemData = entry;
 }
 
-- (CORevisionInfo *)revisionInfoForRevisionUUID: (ETUUID *)aRevisionUUID
+- (void)unlinkItemDataCacheEntry: (COItemDataCacheEntry *)entry
 {
-    CORevisionInfo *result = nil;
-    FMResultSet *rs = [db_ executeQuery:
-        [NSString stringWithFormat: @"SELECT parent, mergeparent, branchuuid, persistentrootuuid, metadata, timestamp FROM %@ WHERE uuid = ?",
-                                    [self tableName]],
-        [aRevisionUUID dataValue]];
-    if ([rs next])
+    if (entry->previous != nil)
     {
-        // N.B.: Watch for null being returned as 0
-        int64_t parent = [rs longLongIntForColumnIndex: 0];
-        int64_t mergeparent = [rs longLongIntForColumnIndex: 1];
+        entry->previous->next = entry->next;
+    }
+    else
+    {
+        _leastRecentlyUsedItemData = entry->next;
+    }
 
-        result = [[CORevisionInfo alloc] init];
-        result.revisionUUID = aRevisionUUID;
-        result.parentRevisionUUID = [self revisionUUIDForRevid: parent];
-        result.mergeParentRevisionUUID = [self revisionUUIDForRevid: mergeparent];
-        result.branchUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 2]];
-        result.persistentRootUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 3]];
-        NSData *data = [rs dataForColumnIndex: 4];
-        if (data != nil)
-        {
-            result.metadata = COJSONObjectWithData(data, NULL);
-        }
-        result.date = CODateFromJavaTimestamp([rs numberForColumnIndex: 5]);
+    if (entry->next != nil)
+    {
+        entry->next->previous = entry->previous;
     }
-    [rs close];
+    else
+    {
+        _mostRecentlyUsedItemData = entry->previous;
+    }
+    entry->previous = nil;
+    entry->next = nil;
+}
 
-    return result;
+- (void)removeCachedItemDataForRevid: (int64_t)revid
+{
+    NSNumber *revidObj = @(revid);
+    COItemDataCacheEntry *entry = _itemDataCache[revidObj];
+
+    if (entry == nil)
+        return;
+
+    _itemDataCacheSize -= entry->size;
+    [self unlinkItemDataCacheEntry: entry];
+    [_itemDataCache removeObjectForKey: revidObj];
 }
 
-- (int64_t)revidForUUID: (ETUUID *)aUUID
+- (void)removeAllCachedItemData
 {
-    NSNumber *revid = [db_ numberForQuery:
-        [NSString stringWithFormat: @"SELECT revid FROM %@ WHERE uuid = ?", [self tableName]],
-        [aUUID dataValue]];
-    if (revid == nil)
+    // Break the links, so the entries are not released recursively
+    while (_leastRecentlyUsedItemData != nil)
     {
-        return -1;
+        [self unlinkItemDataCacheEntry: _leastRecentlyUsedItemData];
     }
-    return revid.longLongValue;
+    [_itemDataCache removeAllObjects];
+    _itemDataCacheSize = 0;
 }
 
-- (NSIndexSet *)revidsForUUIDs: (NSArray *)UUIDs
+- (void)evictCachedItemDataToFitSize: (NSUInteger)aSize
 {
-    NSSet *UUIDDataValues = (id)[[[NSSet setWithArray: UUIDs] mappedCollection] dataValue];
-    NSMutableIndexSet *revids = [NSMutableIndexSet new];
-    FMResultSet *rs = [db_ executeQuery: [NSString stringWithFormat:
-        @"SELECT revid, uuid FROM %@", [self tableName]]];
+    while (_itemDataCacheSize > aSize && _leastRecentlyUsedItemData != nil)
+    {
+        [self removeCachedItemDataForRevid: _leastRecentlyUsedItemData->revid];
+    }
+}
 
-    while ([rs next])
+/**
+ * Returns the cached UUID => item data dictionary for the given revid and marks 
+ * it as the most recently used, or nil if the revision is not cached.
+ */
+- (NSDictionary *)cachedItemDataForRevid: (int64_t)revid
+{
+    COItemDataCacheEntry *entry = _itemDataCache[@(revid)];
+
+    if (entry != nil && entry != _mostRecentlyUsedItemData)
     {
-        if ([UUIDDataValues containsObject: [rs dataForColumnIndex: 1]])
-        {
-            [revids addIndex: [rs int64ForColumnIndex: 0]];
-        }
+        [self unlinkItemDataCacheEntry: entry];
+        [self appendItemDataCacheEntry: entry];
     }
-    [rs close];
+    return entry != nil ? entry->dataForUUID : nil;
+}
 
-    return revids;
+- (void)cacheItemData: (NSDictionary *)dataForUUID forRevid: (int64_t)revid
+{
+    const NSUInteger size = ItemDataDictionarySize(dataForUUID);
+
+    [self removeCachedItemDataForRevid: revid];
+
+    if (size > _maxItemGraphCacheSize)
+        return;
+
+    [self evictCachedItemDataToFitSize: _maxItemGraphCacheSize - size];
+
+    COItemDataCacheEntry *entry = [COItemDataCacheEntry new];
+
+    entry->revid = revid;
+    entry->size = size;
+    entry->dataForUUID = [dataForUUID copy];
+
+    _itemDataCache[@(revid)] = entry;
+    [self appendItemDataCacheEntry: entry];
+    _itemDataCacheSize += size;
 }
 
-- (ETUUID *)rootUUID
+#pragma mark Snapshot Policy -
+
+/**
+ * Returns whether a new commit should be written as a delta, given the 
+ * commits in its delta run and the bytes of the deltas to parse on top of 
+ * the snapshot to reconstruct it (both including the new commit).
+ */
+- (BOOL)shouldWriteDeltaWithNumberOfDeltaCommits: (int64_t)numberOfDeltaCommits
+                                      deltaBytes: (int64_t)deltaBytes
 {
-    if (_rootObjectUUID == nil)
+    COSQLiteStore *store = _store;
+    const double maxBytes = store.maxNumberOfBytesInDeltaRun;
+
+    switch (store.snapshotPolicy)
     {
-        FMResultSet *rs = [db_ executeQuery: [NSString stringWithFormat: @"SELECT root FROM %@",
-                                                                         [self metadataTableName]]];
-        if ([rs next])
+        case COSQLiteStoreSnapshotPolicyCommitCount:
+            return numberOfDeltaCommits < store.maxNumberOfDeltaCommits;
+        case COSQLiteStoreSnapshotPolicyByteCount:
+            return deltaBytes <= maxBytes;
+        case COSQLiteStoreSnapshotPolicyReconstructionCost:
         {
-            _rootObjectUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]];
+            const double timePerByte = _statistics.reconstructionTimePerByte;
+
+            if (timePerByte == 0)
+            {
+                return deltaBytes <= maxBytes;
+            }
+            return deltaBytes * timePerByte <= store.maxReconstructionTime;
+        }
+        case COSQLiteStoreSnapshotPolicyAdaptive:
+        {
+            const double scale = _statistics.adaptiveSnapshotScale;
+
+            return numberOfDeltaCommits < MAX(1, store.maxNumberOfDeltaCommits * scale)
+                && deltaBytes <= maxBytes * scale;
         }
-        [rs close];
     }
-    return _rootObjectUUID;
+    return NO;
 }
 
+#pragma mark Reading Revisions -
 
-- (BOOL)hasRevid: (int64_t)revid
-{
-    return [db_ boolForQuery: [NSString stringWithFormat: @"SELECT 1 FROM %@ WHERE revid = ?",
-                                                          [self tableName]],
-                              @(revid)];
-}
 
 /**
  * Returns the item tree 
@@ -322,10 +1255,26 @@
                                    toRevid: (int64_t)revid
                        restrictToItemUUIDs: (NSSet *)itemSet
 {
+    const NSTimeInterval startTime = [NSDate timeIntervalSinceReferenceDate];
+    int64_t bytesParsed = 0;
     NSNumber *revidObj = @(revid);
+    /* Cached states are complete, so they can only be used when reconstructing 
+       the full state (the caller doesn't have the state of baseRevid) */
+    const BOOL isFullReconstruction = (baseRevid == -1);
 
     NSMutableDictionary *dataForUUID = [NSMutableDictionary dictionary];
 
+    /* For a restricted load, the item directory tells us which commits we 
+       need to parse, and we can stop as soon as we have all the items. */
+    NSIndexSet *touchingRevids = nil;
+
+    if (itemSet != nil)
+    {
+        touchingRevids = [self revidsTouchingItemUUIDs: itemSet
+                                             fromRevid: MAX(baseRevid, 0)
+                                               toRevid: revid];
+    }
+
     FMResultSet *rs = [db_ executeQuery: [NSString stringWithFormat:
         @"SELECT revid, contents, hash, parent, deltabase "
             "FROM %@ "
@@ -334,6 +1283,11 @@
                                          revidObj, revidObj];
 
     int64_t nextRevId = -1;
+    /* For an unrestricted load, the commits are parsed together after the walk, 
+       from the most recent to the oldest */
+    NSMutableArray *commitDataRun = (itemSet == nil) ? [NSMutableArray array] : nil;
+    NSDictionary *cachedDataForUUID = nil;
+    int64_t cachedRevid = -1;
 
     BOOL wasEmpty = YES;
     while ([rs next])
@@ -341,22 +1295,51 @@
         wasEmpty = NO;
 
         const int64_t revid = [rs longLongIntForColumnIndex: 0];
-        NSData *contentsData = [rs dataForColumnIndex: 1];
-        NSData *hashData = [rs dataForColumnIndex: 2];
         const int64_t parent = [rs longLongIntForColumnIndex: 3];
-        const int64_t deltabase = [rs boolForColumnIndex: 4];
+        const int64_t deltabase = [rs longLongIntForColumnIndex: 4];
 
         if (revid == nextRevId || nextRevId == -1)
         {
-            NSData *actualHash = Sha1Data(contentsData);
-            ETAssert([hashData isEqual: actualHash]);
+            if (isFullReconstruction)
+            {
+                cachedDataForUUID = [self cachedItemDataForRevid: revid];
+
+                if (cachedDataForUUID != nil)
+                {
+                    // The cached state already includes all the older commits
+                    cachedRevid = revid;
+                    break;
+                }
+            }
 
-            ParseCombinedCommitDataInToUUIDToItemDataDictionary(dataForUUID,
-                                                                contentsData,
-                                                                NO,
-                                                                itemSet);
+            // N.B.: Only read the blobs for the commits we are interested in
+            if (touchingRevids == nil || [touchingRevids containsIndex: revid])
+            {
+                NSData *storedData = [rs dataForColumnIndex: 1];
+                NSData *hashData = [rs dataForColumnIndex: 2];
+                NSData *actualHash = Sha1Data(storedData);
+                ETAssert([hashData isEqual: actualHash]);
+                NSData *contentsData = [self contentsForStoredData: storedData];
+                bytesParsed += contentsData.length;
+
+                if (commitDataRun != nil)
+                {
+                    [commitDataRun addObject: contentsData];
+                }
+                else
+                {
+                    ParseCombinedCommitDataInToUUIDToItemDataDictionary(dataForUUID,
+                                                                        contentsData,
+                                                                        NO,
+                                                                        itemSet);
+                }
+            }
 
-            // TODO: If we are filtering to a known set of items, we can break out once we have all of them.
+            if (itemSet != nil && dataForUUID.count == itemSet.count)
+            {
+                // We found the most recent state of all the requested items
+                break;
+            }
 
             if (parent == baseRevid)
             {
@@ -384,31 +1367,60 @@
         return nil;
     }
 
+    if (commitDataRun != nil)
+    {
+        ParseCombinedCommitDataRunInToUUIDToItemDataDictionary(dataForUUID, commitDataRun);
+    }
+
+    for (ETUUID *uuid in cachedDataForUUID)
+    {
+        if (dataForUUID[uuid] == nil
+            && (itemSet == nil || [itemSet containsObject: uuid]))
+        {
+            dataForUUID[uuid] = cachedDataForUUID[uuid];
+        }
+    }
+
+    // When the requested revision itself was cached, it is already the most 
+    // recently used entry and there is nothing new to cache
+    if (isFullReconstruction && itemSet == nil && cachedRevid != revid)
+    {
+        [self cacheItemData: dataForUUID forRevid: revid];
+    }
+
     ETUUID *root = self.rootUUID;
 
-    // Convert dataForUUID to a UUID -> COItem mapping.
-    // TODO: Eliminate this by giving COItem to be created with a serialized NSData of itself,
-    // and lazily deserializing itself.
-    NSMutableDictionary *resultDict = [NSMutableDictionary dictionary];
+    // Convert dataForUUID to a UUID -> COItem mapping. The items are decoded 
+    // lazily from the commit blobs, when their attributes are accessed.
+    NSMutableDictionary *resultDict = [NSMutableDictionary dictionaryWithCapacity: dataForUUID.count];
     for (ETUUID *uuid in dataForUUID)
     {
         NSData *data = dataForUUID[uuid];
-        COItem *item = [[COItem alloc] initWithData: data];
+        COItem *item = [[COLazyItem alloc] initWithUUID: uuid data: data];
         resultDict[uuid] = item;
     }
 
     COItemGraph *result = [[COItemGraph alloc] initWithItemForUUID: resultDict
                                                       rootItemUUID: root];
+
+    if (itemSet == nil)
+    {
+        [_statistics recordReconstructionTime: [NSDate timeIntervalSinceReferenceDate] - startTime
+                                  bytesParsed: bytesParsed];
+    }
     return result;
 }
 
 - (COItemGraph *)partialItemGraphFromRevid: (int64_t)baseRevid toRevid: (int64_t)revid
 {
+    [_statistics recordRevisionRead];
     return [self partialItemGraphFromRevid: baseRevid toRevid: revid restrictToItemUUIDs: nil];
 }
 
 - (COItemGraph *)itemGraphForRevid: (int64_t)revid
 {
+    [_statistics recordRevisionRead];
+
     COItemGraph *result = [self partialItemGraphFromRevid: -1
                                                   toRevid: revid
                                       restrictToItemUUIDs: nil];
@@ -425,13 +1437,12 @@
 
 - (COItemGraph *)itemGraphForRevid: (int64_t)revid restrictToItemUUIDs: (NSSet *)itemSet
 {
+    [_statistics recordRevisionRead];
     return [self partialItemGraphFromRevid: -1 toRevid: revid restrictToItemUUIDs: itemSet];
 }
 
 NSData *contentsBLOBWithItemTree(id <COItemGraph> itemGraph)
 {
-    NSMutableData *result = [NSMutableData dataWithCapacity: 64536];
-
     NSArray *sortedUUIDs = [itemGraph.itemUUIDs sortedArrayUsingComparator: ^(id obj1, id obj2)
     {
         ETUUID *uuid1 = (ETUUID *)obj1;
@@ -444,15 +1455,14 @@ NSData *contentsBLOBWithItemTree(id <COItemGraph> itemGraph)
                 : NSOrderedDescending);
     }];
 
+    NSMutableArray *sortedItems = [NSMutableArray arrayWithCapacity: sortedUUIDs.count];
+
     for (ETUUID *uuid in sortedUUIDs)
     {
-        COItem *item = [itemGraph itemForUUID: uuid];
-        NSData *itemData = item.dataValue;
-
-        AddCommitUUIDAndDataToCombinedCommitData(result, uuid, itemData);
+        [sortedItems addObject: [itemGraph itemForUUID: uuid]];
     }
 
-    return result;
+    return CombinedCommitDataWithItems(sortedItems);
 }
 
 - (int64_t)nextRowid
@@ -548,20 +1558,35 @@ static NSData *Sha1Data(NSData *data)
 
     const int64_t parent_deltabase = [self deltabaseForRowid: aParent];
     const int64_t rowid = [self nextRowid];
-    const int64_t lastBytesInDeltaRun = [self bytesInDeltaRunForRowid: rowid - 1];
+
+    // Revids can be reused after deleting the last revisions
+    [self removeCachedItemDataForRevid: rowid];
+
+    // The commits parsed to reconstruct the new revision are the parent's ones
+    const int64_t lastBytesInDeltaRun = [self bytesInDeltaRunForRowid: aParent];
     int64_t deltabase;
-    NSData *contentsBlob;
+    NSData *contentsBlob = nil;
+    NSArray *writtenItemUUIDs;
     int64_t bytesInDeltaRun;
+    NSData *trainedDictionary = nil;
+    BOOL delta = NO;
+
+    [_statistics recordRevisionWrite];
+
+    if (parent_deltabase != -1)
+    {
+        const int64_t snapshotBytes = [self bytesInDeltaRunForRowid: parent_deltabase];
 
-    // Limit delta runs to 50 commits
-    const BOOL delta = (parent_deltabase != -1 && rowid - parent_deltabase < _store.maxNumberOfDeltaCommits);
+        contentsBlob = contentsBLOBWithItemTree(anItemTree);
+        delta = [self shouldWriteDeltaWithNumberOfDeltaCommits: rowid - parent_deltabase
+                                                    deltaBytes: lastBytesInDeltaRun - snapshotBytes
+                                                                + contentsBlob.length];
+    }
 
-    // Limit delta runs to 4k
-    //const BOOL delta = (parent_deltabase != -1 && lastBytesInDeltaRun < 4096);
     if (delta)
     {
         deltabase = parent_deltabase;
-        contentsBlob = contentsBLOBWithItemTree(anItemTree);
+        writtenItemUUIDs = anItemTree.itemUUIDs;
         bytesInDeltaRun = lastBytesInDeltaRun + contentsBlob.length;
     }
     else
@@ -573,7 +1598,9 @@ static NSData *Sha1Data(NSData *data)
         // Previous iterations of COSQLiteStore required the caller to always
         // provide the full item tree, and so we didn't need to do this
 
-        COItemGraph *parentGraph = [self itemGraphForRevid: aParent];
+        COItemGraph *parentGraph = [self partialItemGraphFromRevid: -1
+                                                           toRevid: aParent
+                                               restrictToItemUUIDs: nil];
         COItemGraph *combinedGraph;
 
         if (parentGraph != nil)
@@ -590,9 +1617,16 @@ static NSData *Sha1Data(NSData *data)
         [combinedGraph removeUnreachableItems];
 
         contentsBlob = contentsBLOBWithItemTree(combinedGraph);
+        writtenItemUUIDs = combinedGraph.itemUUIDs;
         bytesInDeltaRun = contentsBlob.length;
+        trainedDictionary = [self trainedCompressionDictionaryForSnapshot: contentsBlob];
     }
 
+    NSData *storedBlob = [self storedDataForContents: contentsBlob
+                                          dictionary: (trainedDictionary != nil
+                                                       ? trainedDictionary
+                                                       : self.compressionDictionary)];
+
     NSData *metadataBlob = nil;
     if (metadata != nil)
     {
@@ -604,8 +1638,8 @@ static NSData *Sha1Data(NSData *data)
                                                                   "bytesInDeltaRun, garbage, uuid) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, 0, ?)",
                                                               [self tableName]],
                                   @(rowid),
-                                  contentsBlob,
-                                  Sha1Data(contentsBlob),
+                                  storedBlob,
+                                  Sha1Data(storedBlob),
                                   metadataBlob,
                                   CODateToJavaTimestamp([NSDate date]),
                                   @(aParent),
@@ -616,6 +1650,12 @@ static NSData *Sha1Data(NSData *data)
                                   @(bytesInDeltaRun),
                                   [aRevisionUUID dataValue]];
 
+    ok = ok && [self addItemUUIDs: writtenItemUUIDs toItemsTableForRevid: rowid];
+    ok = ok && [self addAncestryForRevid: rowid
+                        revisionUUIDData: [aRevisionUUID dataValue]
+                             parentRevid: aParent
+                        mergeParentRevid: aMergeParent
+                          toAncestryRows: [self ancestryRowsBeforeRevid: rowid]];
 
     // Update the root object UUID
     ETUUID *currentRoot = self.rootUUID;
@@ -632,8 +1672,21 @@ static NSData *Sha1Data(NSData *data)
         return NO;
     }
 
+    if (trainedDictionary != nil)
+    {
+        ok = ok && [db_ executeUpdate: [NSString stringWithFormat: @"UPDATE %@ SET compressiondictionary = ?",
+                                                                   [self metadataTableName]],
+                                       trainedDictionary];
+    }
+
     [self commit];
 
+    if (ok && trainedDictionary != nil)
+    {
+        _compressionDictionary = trainedDictionary;
+        _compressionDictionaryLoaded = YES;
+    }
+
     return ok;
 }
 
@@ -744,23 +1797,33 @@ static NSData *Sha1Data(NSData *data)
     // Rebuild each revision that needs it
     [rebuildRevids enumerateIndexesUsingBlock: ^(NSUInteger revid, BOOL *stop)
     {
-        COItemGraph *graph = [self itemGraphForRevid: revid];
+        COItemGraph *graph = [self partialItemGraphFromRevid: -1
+                                                     toRevid: revid
+                                         restrictToItemUUIDs: nil];
 
         // GC unreachable items in graph
         [graph removeUnreachableItems];
 
         NSData *contentsBlob = contentsBLOBWithItemTree(graph);
+        NSData *storedBlob = [self storedDataForContents: contentsBlob
+                                              dictionary: self.compressionDictionary];
         NSNumber *deltabase = @(revid);
         NSNumber *bytesInDeltaRun = @(contentsBlob.length);
 
         BOOL ok = [db_ executeUpdate: [NSString stringWithFormat: @"UPDATE %@ SET contents = ?, hash = ?, deltabase = ?, bytesInDeltaRun = ? WHERE revid = ?",
                                                                   [self tableName]],
-                                      contentsBlob,
-                                      Sha1Data(contentsBlob),
+                                      storedBlob,
+                                      Sha1Data(storedBlob),
                                       deltabase,
                                       bytesInDeltaRun,
                                       @(revid)];
 
+        // The revision is now a full snapshot
+        ok = ok && [db_ executeUpdate: [NSString stringWithFormat: @"DELETE FROM %@ WHERE revid = ?",
+                                                                   [self itemsTableName]],
+                                       @(revid)];
+        ok = ok && [self addItemUUIDs: graph.itemUUIDs toItemsTableForRevid: revid];
+
         if (!ok)
         {
             [db_ rollback];
@@ -769,11 +1832,20 @@ static NSData *Sha1Data(NSData *data)
     }];
 
     // Delete _all_ revisions marked as garbage.
+    [db_ executeUpdate: [NSString stringWithFormat: @"DELETE FROM %@ WHERE revid IN (SELECT revid FROM %@ WHERE garbage = 1)",
+                                                    [self itemsTableName], [self tableName]]];
+    [db_ executeUpdate: [NSString stringWithFormat: @"DELETE FROM %@ WHERE revid IN (SELECT revid FROM %@ WHERE garbage = 1)",
+                                                    [self ancestryTableName], [self tableName]]];
     [db_ executeUpdate: [NSString stringWithFormat: @"DELETE FROM %@ WHERE garbage = 1",
                                                     [self tableName]]];
 
     [self commit];
 
+    // Rebuilt revisions don't contain unreachable items anymore
+    [self removeAllCachedItemData];
+    // Deleted revids can be reused
+    _ancestryRows = nil;
+
     return ![db_ hadError];
 }
 
@@ -935,6 +2007,63 @@ static NSData *Sha1Data(NSData *data)
     return revInfos;
 }
 
+- (CORevisionGraph *)revisionGraph
+{
+    CORevisionGraph *graph = [CORevisionGraph new];
+
+    [self addRevisionsFromRevid: 0 toRevisionGraph: graph];
+    return graph;
+}
+
+- (BOOL)appendRevisionsToRevisionGraph: (CORevisionGraph *)aGraph
+{
+    NILARG_EXCEPTION_TEST(aGraph);
+
+    const int64_t lastRevid = aGraph.count - 1;
+
+    // A history compaction or a revid reuse can invalidate the graph
+    if (lastRevid >= 0)
+    {
+        NSData *lastRevisionData = [db_ dataForQuery: [NSString stringWithFormat: @"SELECT uuid FROM %@ WHERE revid = ?",
+                                                                                  [self tableName]], @(lastRevid)];
+
+        if (![[aGraph revisionUUIDForRevid: lastRevid].dataValue isEqual: lastRevisionData])
+            return NO;
+    }
+
+    [self addRevisionsFromRevid: aGraph.count toRevisionGraph: aGraph];
+    return YES;
+}
+
+- (void)addRevisionsFromRevid: (int64_t)aRevid toRevisionGraph: (CORevisionGraph *)aGraph
+{
+    FMResultSet *rs = [db_ executeQuery: [NSString stringWithFormat:
+        @"SELECT c.revid, c.uuid, c.parent, c.mergeparent, c.branchuuid, c.persistentrootuuid, c.timestamp, "
+            "a.depth, a.skip, a.mergedepth "
+            "FROM %@ AS c LEFT OUTER JOIN %@ AS a ON (a.revid = c.revid) WHERE c.revid >= ? ORDER BY c.revid ASC",
+        [self tableName], [self ancestryTableName]], @(aRevid)];
+
+    while ([rs next])
+    {
+        // N.B.: Watch for null being returned as 0
+        const int64_t parent = ([rs columnIndexIsNull: 2] ? -1 : [rs longLongIntForColumnIndex: 2]);
+        const int64_t mergeParent = ([rs columnIndexIsNull: 3] ? -1 : [rs longLongIntForColumnIndex: 3]);
+        const BOOL isIndexed = ![rs columnIndexIsNull: 7];
+
+        [aGraph addRevid: [rs longLongIntForColumnIndex: 0]
+            revisionUUID: [ETUUID UUIDWithData: [rs dataForColumnIndex: 1]]
+             parentRevid: parent
+        mergeParentRevid: mergeParent
+              branchUUID: [ETUUID UUIDWithData: [rs dataForColumnIndex: 4]]
+      persistentRootUUID: [ETUUID UUIDWithData: [rs dataForColumnIndex: 5]]
+               timestamp: [rs longLongIntForColumnIndex: 6]
+                   depth: (isIndexed ? [rs longLongIntForColumnIndex: 7] : -1)
+               skipRevid: (isIndexed ? [rs longLongIntForColumnIndex: 8] : -1)
+              mergeDepth: (isIndexed ? [rs longLongIntForColumnIndex: 9] : -1)];
+    }
+    [rs close];
+}
+
 - (uint64_t)fileSize
 {
     NSDictionary *attrs = [[NSFileManager defaultManager] attributesOfItemAtPath: [db_ databasePath]
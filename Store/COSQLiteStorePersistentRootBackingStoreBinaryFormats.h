@@ -12,15 +12,108 @@
 /**
  * Given an NSData produced by AddCommitUUIDAndDataToCombinedCommitData,
  * extracts the UUID : NSData pairs within it and adds them to dest
+ *
+ * The item data objects reference commitData bytes without copying them, so 
+ * commitData must be immutable. For commit data with a string table, the item 
+ * data must be decoded with the table (see StringTableForItemData()).
  */
 void ParseCombinedCommitDataInToUUIDToItemDataDictionary(NSMutableDictionary *dest,
                                                          NSData *commitData,
                                                          BOOL replaceExisting,
                                                          NSSet *restrictToItemUUIDs);
 
+/**
+ * Given an array of NSData produced by CombinedCommitDataWithUUIDsAndItemData()
+ * or AddCommitUUIDAndDataToCombinedCommitData(), ordered from the most recent 
+ * commit to the oldest, adds the most recent UUID : NSData pairs to dest 
+ * (existing pairs are not replaced).
+ *
+ * When all the commits use the directory format, the sorted directories are 
+ * merged, instead of parsing each commit in turn.
+ */
+void ParseCombinedCommitDataRunInToUUIDToItemDataDictionary(NSMutableDictionary *dest,
+                                                            NSArray *commitDataRun);
+
+/**
+ * Returns the combined commit data for the given items, in the directory 
+ * format, which begins with a UUID : item data offset table sorted by UUID.
+ *
+ * sortedUUIDs must be sorted by UUID bytes, and itemDataArray contains the 
+ * item data in the same order.
+ */
+NSData *CombinedCommitDataWithUUIDsAndItemData(NSArray *sortedUUIDs, NSArray *itemDataArray);
+
+/**
+ * Returns the combined commit data for the given items, in the directory 
+ * format with a string table.
+ *
+ * The attribute names, and the entity and package names, are written once in 
+ * the string table, and the item data reference them (see 
+ * -[COItem dataValueWithStringTable:]).
+ *
+ * The items are appended to a single buffer (see 
+ * -[COItem appendDataValueWithStringTable:toBuffer:]), so no NSData is 
+ * allocated per item.
+ *
+ * sortedItems must be sorted by UUID bytes.
+ */
+NSData *CombinedCommitDataWithItems(NSArray *sortedItems);
+
+/**
+ * Returns the commit data from which the item data was parsed, and whose 
+ * bytes it references, or nil if the item data owns its bytes.
+ *
+ * See ParseCombinedCommitDataInToUUIDToItemDataDictionary().
+ */
+NSData *CommitDataForItemData(NSData *itemData);
+
+/**
+ * Returns the string table of the commit data from which the item data was 
+ * parsed, or nil if the item data contains no string references.
+ *
+ * See ParseCombinedCommitDataInToUUIDToItemDataDictionary().
+ */
+NSArray *StringTableForItemData(NSData *itemData);
+
 /**
  * Adds a COUUID : NSData pair to combinedCommitData
+ *
+ * Produces the length-prefixed format used before the directory format was 
+ * introduced, which is still supported for reading.
  */
 void AddCommitUUIDAndDataToCombinedCommitData(NSMutableData *combinedCommitData,
                                               ETUUID *uuidToAdd,
                                               NSData *dataToAdd);
+
+/**
+ * Returns whether storedData was produced by CompressedCommitData().
+ */
+BOOL IsCompressedCommitData(NSData *storedData);
+
+/**
+ * Returns commitData compressed with zlib, behind a header that lets 
+ * UncompressedCommitData() tell it apart from uncompressed commit data.
+ *
+ * If dictionary is not nil, it is used as the zlib preset dictionary, and 
+ * must be passed to UncompressedCommitData() too.
+ */
+NSData *CompressedCommitData(NSData *commitData, NSData *dictionary);
+
+/**
+ * Returns the commit data contained in storedData, which is returned as is 
+ * when it is not compressed.
+ *
+ * Raises an NSInternalInconsistencyException if the data is corrupted, or if
+ * it was compressed with a dictionary and dictionary is nil.
+ */
+NSData *UncompressedCommitData(NSData *storedData, NSData *dictionary);
+
+/**
+ * Returns a zlib preset dictionary of at most maxLength bytes, built from 
+ * samples of the given item data (e.g. the items of a snapshot), or nil if 
+ * there is nothing to sample.
+ *
+ * Items of the same entity share their attribute names and types, and often 
+ * some values, so a few items are enough to train a dictionary.
+ */
+NSData *CompressionDictionaryWithItemData(NSArray *itemDataArray, NSUInteger maxLength);
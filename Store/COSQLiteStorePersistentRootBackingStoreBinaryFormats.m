@@ -6,14 +6,321 @@
  */
 
 #import "COSQLiteStorePersistentRootBackingStoreBinaryFormats.h"
+#import "COItem+Binary.h"
+#import "COBinaryWriter.h"
+#import "COBinaryReader.h"
 #import <EtoileFoundation/ETUUID.h>
+#import <EtoileFoundation/Macros.h>
+#include <dispatch/dispatch.h>
+#include <zlib.h>
 
-void ParseCombinedCommitDataInToUUIDToItemDataDictionary(NSMutableDictionary *dest,
-                                                         NSData *commitData,
-                                                         BOOL replaceExisting,
-                                                         NSSet *restrictToItemUUIDs)
+/**
+ * Immutable data referencing a range of another immutable data without 
+ * copying it (the other data is retained).
+ */
+@interface COSubdata : NSData
+{
+@public
+    NSData *_parent;
+    const void *_bytes;
+    NSUInteger _length;
+    /** The string table of the parent commit data, or nil */
+    NSArray *_stringTable;
+}
+
+- (instancetype)initWithData: (NSData *)aData
+                       range: (NSRange)aRange
+                 stringTable: (NSArray *)aStringTable;
+
+@end
+
+@implementation COSubdata
+
+- (instancetype)initWithData: (NSData *)aData
+                       range: (NSRange)aRange
+                 stringTable: (NSArray *)aStringTable
+{
+    NSParameterAssert(NSMaxRange(aRange) <= aData.length);
+
+    SUPERINIT;
+    _parent = aData;
+    _bytes = (const unsigned char *)aData.bytes + aRange.location;
+    _length = aRange.length;
+    _stringTable = aStringTable;
+    return self;
+}
+
+- (instancetype)initWithData: (NSData *)aData range: (NSRange)aRange
+{
+    return [self initWithData: aData range: aRange stringTable: nil];
+}
+
+- (const void *)bytes
+{
+    return _bytes;
+}
+
+- (NSUInteger)length
+{
+    return _length;
+}
+
+@end
+
+
+/*
+ * Version 2 (directory) format:
+ *
+ * |--------|---------|---------|-----------|-----------------------------------|-----------..
+ * | 'COCD' | uint_8  | 3 bytes | uint_32   | directory entries                 | item data..
+ * | magic  | version | padding | LE count  | (16-byte UUID, uint_32 LE offset, |
+ * |        | (2)     | (zero)  |           |  uint_32 LE length) * count       |
+ * |--------|---------|---------|-----------|-----------------------------------|-----------..
+ *
+ * The directory entries are sorted by UUID bytes, and the item data offsets 
+ * are relative to the start of the commit data.
+ *
+ * In the version 1 format, the fifth byte is always '#' (the first byte of the 
+ * first item data), so it can't be mistaken for the version 2 header.
+ *
+ * Version 3 (string table) format:
+ *
+ * |--------|---------|---------|-----------|-------------------|--------------------------------|-----------..
+ * | 'COCD' | uint_8  | 3 bytes | uint_32   | directory entries | uint_32 LE     | (varint      | item data..
+ * | magic  | version | padding | LE count  | (same as v2)      | string count   |  length,     |
+ * |        | (3)     | (zero)  |           |                   |                |  UTF-8) * n  |
+ * |--------|---------|---------|-----------|-------------------|--------------------------------|-----------..
+ *
+ * The item data references the strings of the table by index ('r' tokens, 
+ * see COItemStringTable), and can contain varint and zigzag integer tokens 
+ * ('v' and 'z', see CO_BUFFER_FORMAT_VERSION_VARINT_INTEGERS).
+ *
+ * The commit data version implies the item data format version: version 3 
+ * implies CO_BUFFER_FORMAT_VERSION_VARINT_INTEGERS, so a reader that supports 
+ * version 3 must read varints. The item data of the older versions only 
+ * contain fixed-width integers (CO_BUFFER_FORMAT_VERSION_FIXED_INTEGERS).
+ */
+
+#define CO_DIRECTORY_FORMAT_MAGIC "COCD"
+#define CO_DIRECTORY_FORMAT_VERSION 2
+#define CO_STRING_TABLE_FORMAT_VERSION 3
+#define CO_DIRECTORY_HEADER_LENGTH 12
+#define CO_DIRECTORY_ENTRY_LENGTH 24
+
+static inline uint32_t readLittleUint32(const unsigned char *bytes)
+{
+    uint32_t value;
+    memcpy(&value, bytes, 4);
+    return NSSwapLittleIntToHost(value);
+}
+
+static inline void writeLittleUint32(unsigned char *bytes, uint32_t value)
+{
+    const uint32_t swapped = NSSwapHostIntToLittle(value);
+    memcpy(bytes, &swapped, 4);
+}
+
+/**
+ * Compares two 16-byte UUIDs like memcmp(), as two 64-bit words.
+ */
+static inline int compareUUIDBytes(const unsigned char *uuidA, const unsigned char *uuidB)
 {
-    // format:
+    uint64_t a[2], b[2];
+
+    memcpy(a, uuidA, 16);
+    memcpy(b, uuidB, 16);
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (a[i] != b[i])
+        {
+            return NSSwapBigLongLongToHost(a[i]) < NSSwapBigLongLongToHost(b[i]) ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+static BOOL isDirectoryFormat(const unsigned char *bytes, NSUInteger len)
+{
+    return len >= CO_DIRECTORY_HEADER_LENGTH
+        && memcmp(bytes, CO_DIRECTORY_FORMAT_MAGIC, 4) == 0
+        && (bytes[4] == CO_DIRECTORY_FORMAT_VERSION
+            || bytes[4] == CO_STRING_TABLE_FORMAT_VERSION);
+}
+
+static inline const unsigned char *directoryEntry(const unsigned char *bytes, uint32_t i)
+{
+    return bytes + CO_DIRECTORY_HEADER_LENGTH + (size_t)i * CO_DIRECTORY_ENTRY_LENGTH;
+}
+
+static inline NSRange itemDataRangeForDirectoryEntry(const unsigned char *entry)
+{
+    return NSMakeRange(readLittleUint32(entry + 16), readLittleUint32(entry + 20));
+}
+
+/**
+ * Returns a shared instance for the string, so the items parsed from distinct
+ * commits share their attribute and entity names.
+ *
+ * The interned strings are not retained.
+ */
+static NSString *internedString(const unsigned char *bytes, size_t length)
+{
+    static NSHashTable *internedStrings = nil;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^()
+    {
+        internedStrings = [NSHashTable weakObjectsHashTable];
+    });
+
+    NSString *string = [[NSString alloc] initWithBytes: bytes
+                                                length: length
+                                              encoding: NSUTF8StringEncoding];
+    @synchronized(internedStrings)
+    {
+        NSString *internedString = [internedStrings member: string];
+
+        if (internedString != nil)
+            return internedString;
+
+        [internedStrings addObject: string];
+        return string;
+    }
+}
+
+/**
+ * Returns the string table that follows the directory in the version 3 
+ * format, or nil for other formats.
+ */
+static NSArray *stringTableForCommitData(NSData *commitData)
+{
+    const unsigned char *bytes = commitData.bytes;
+
+    if (!isDirectoryFormat(bytes, commitData.length)
+        || bytes[4] != CO_STRING_TABLE_FORMAT_VERSION)
+    {
+        return nil;
+    }
+
+    size_t pos = (size_t)directoryEntry(bytes, readLittleUint32(bytes + 8)) - (size_t)bytes;
+    const uint32_t count = readLittleUint32(bytes + pos);
+    NSMutableArray *strings = [NSMutableArray arrayWithCapacity: count];
+
+    pos += 4;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        size_t varintLength;
+        const uint64_t length = co_reader_read_varint(bytes + pos, &varintLength);
+
+        pos += varintLength;
+        if (pos + length > commitData.length)
+        {
+            [NSException raise: NSInternalInconsistencyException
+                        format: @"Commit data string table is corrupted"];
+        }
+        [strings addObject: internedString(bytes + pos, (size_t)length)];
+        pos += length;
+    }
+    return strings;
+}
+
+NSData *CommitDataForItemData(NSData *itemData)
+{
+    if (![itemData isKindOfClass: [COSubdata class]])
+        return nil;
+
+    return ((COSubdata *)itemData)->_parent;
+}
+
+NSArray *StringTableForItemData(NSData *itemData)
+{
+    if (![itemData isKindOfClass: [COSubdata class]])
+        return nil;
+
+    return ((COSubdata *)itemData)->_stringTable;
+}
+
+/**
+ * Returns the directory entry for the given UUID, or NULL if the commit 
+ * doesn't contain it.
+ */
+static const unsigned char *findDirectoryEntry(const unsigned char *bytes, const unsigned char *uuid)
+{
+    uint32_t low = 0;
+    uint32_t high = readLittleUint32(bytes + 8);
+
+    while (low < high)
+    {
+        const uint32_t mid = low + (high - low) / 2;
+        const unsigned char *entry = directoryEntry(bytes, mid);
+        const int result = compareUUIDBytes(entry, uuid);
+
+        if (result == 0)
+        {
+            return entry;
+        }
+        else if (result < 0)
+        {
+            low = mid + 1;
+        }
+        else
+        {
+            high = mid;
+        }
+    }
+    return NULL;
+}
+
+static void parseCombinedCommitDataWithDirectory(NSMutableDictionary *dest,
+                                                 NSData *commitData,
+                                                 BOOL replaceExisting,
+                                                 NSSet *restrictToItemUUIDs)
+{
+    const unsigned char *bytes = commitData.bytes;
+    NSArray *stringTable = stringTableForCommitData(commitData);
+
+    if (restrictToItemUUIDs != nil)
+    {
+        for (ETUUID *uuid in restrictToItemUUIDs)
+        {
+            if (!replaceExisting && dest[uuid] != nil)
+                continue;
+
+            const unsigned char *entry = findDirectoryEntry(bytes, [uuid UUIDValue]);
+
+            if (entry != NULL)
+            {
+                dest[uuid] = [[COSubdata alloc] initWithData: commitData
+                                                       range: itemDataRangeForDirectoryEntry(entry)
+                                                 stringTable: stringTable];
+            }
+        }
+        return;
+    }
+
+    const uint32_t count = readLittleUint32(bytes + 8);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const unsigned char *entry = directoryEntry(bytes, i);
+        ETUUID *uuid = [[ETUUID alloc] initWithUUID: entry];
+
+        if (replaceExisting || dest[uuid] == nil)
+        {
+            dest[uuid] = [[COSubdata alloc] initWithData: commitData
+                                                   range: itemDataRangeForDirectoryEntry(entry)
+                                             stringTable: stringTable];
+        }
+    }
+}
+
+static void parseLengthPrefixedCombinedCommitData(NSMutableDictionary *dest,
+                                                  NSData *commitData,
+                                                  BOOL replaceExisting,
+                                                  NSSet *restrictToItemUUIDs)
+{
+    // Version 1 format:
     //
     // |-----------------------|---------------------------------------------------| |---..
     // | uint_32 little-endian | item data (first byte is '#', then 16-byte  UUID) | | next length..
@@ -40,13 +347,272 @@ void ParseCombinedCommitDataInToUUIDToItemDataDictionary(NSMutableDictionary *de
                 || [restrictToItemUUIDs containsObject: uuid]))
         {
 
-            NSData *data = [commitData subdataWithRange: NSMakeRange(offset, length)];
+            NSData *data = [[COSubdata alloc] initWithData: commitData
+                                                     range: NSMakeRange(offset, length)];
             dest[uuid] = data;
         }
         offset += length;
     }
 }
 
+void ParseCombinedCommitDataInToUUIDToItemDataDictionary(NSMutableDictionary *dest,
+                                                         NSData *commitData,
+                                                         BOOL replaceExisting,
+                                                         NSSet *restrictToItemUUIDs)
+{
+    if (isDirectoryFormat(commitData.bytes, commitData.length))
+    {
+        parseCombinedCommitDataWithDirectory(dest, commitData, replaceExisting, restrictToItemUUIDs);
+    }
+    else
+    {
+        parseLengthPrefixedCombinedCommitData(dest, commitData, replaceExisting, restrictToItemUUIDs);
+    }
+}
+
+typedef struct
+{
+    const unsigned char *uuid;
+    uint32_t commitIndex;
+    uint32_t offset;
+    uint32_t length;
+} COItemDataLocation;
+
+static int compareItemDataLocations(const void *ptrA, const void *ptrB)
+{
+    const COItemDataLocation *a = ptrA;
+    const COItemDataLocation *b = ptrB;
+    const int result = compareUUIDBytes(a->uuid, b->uuid);
+
+    if (result != 0)
+        return result;
+
+    return (a->commitIndex < b->commitIndex) ? -1 : (a->commitIndex > b->commitIndex);
+}
+
+void ParseCombinedCommitDataRunInToUUIDToItemDataDictionary(NSMutableDictionary *dest,
+                                                            NSArray *commitDataRun)
+{
+    size_t count = 0;
+
+    for (NSData *commitData in commitDataRun)
+    {
+        if (!isDirectoryFormat(commitData.bytes, commitData.length))
+        {
+            // Commits written before the directory format was introduced
+            for (NSData *runCommitData in commitDataRun)
+            {
+                ParseCombinedCommitDataInToUUIDToItemDataDictionary(dest, runCommitData, NO, nil);
+            }
+            return;
+        }
+        count += readLittleUint32((const unsigned char *)commitData.bytes + 8);
+    }
+
+    /* Merge the sorted directories, keeping only the most recent location for 
+       each UUID, so we allocate an ETUUID per item in the reconstructed state 
+       rather than per item in each commit. */
+
+    COItemDataLocation *locations = malloc(sizeof(COItemDataLocation) * MAX(count, 1));
+    NSMutableArray *stringTables = [NSMutableArray arrayWithCapacity: commitDataRun.count];
+    size_t i = 0;
+
+    for (uint32_t commitIndex = 0; commitIndex < commitDataRun.count; commitIndex++)
+    {
+        const unsigned char *bytes = [commitDataRun[commitIndex] bytes];
+        NSArray *stringTable = stringTableForCommitData(commitDataRun[commitIndex]);
+
+        [stringTables addObject: (stringTable != nil ? stringTable : [NSNull null])];
+        const uint32_t entryCount = readLittleUint32(bytes + 8);
+
+        for (uint32_t j = 0; j < entryCount; j++)
+        {
+            const unsigned char *entry = directoryEntry(bytes, j);
+
+            locations[i].uuid = entry;
+            locations[i].commitIndex = commitIndex;
+            locations[i].offset = readLittleUint32(entry + 16);
+            locations[i].length = readLittleUint32(entry + 20);
+            i++;
+        }
+    }
+
+    qsort(locations, count, sizeof(COItemDataLocation), compareItemDataLocations);
+
+    for (i = 0; i < count; i++)
+    {
+        if (i > 0 && compareUUIDBytes(locations[i - 1].uuid, locations[i].uuid) == 0)
+            continue;
+
+        ETUUID *uuid = [[ETUUID alloc] initWithUUID: locations[i].uuid];
+
+        if (dest[uuid] == nil)
+        {
+            NSArray *stringTable = stringTables[locations[i].commitIndex];
+
+            dest[uuid] = [[COSubdata alloc] initWithData: commitDataRun[locations[i].commitIndex]
+                                                   range: NSMakeRange(locations[i].offset,
+                                                                      locations[i].length)
+                                             stringTable: (stringTable != (id)[NSNull null] ? stringTable : nil)];
+        }
+    }
+
+    free(locations);
+}
+
+/**
+ * Returns the directory format commit data header, with a zeroed directory for 
+ * count items, followed by the string table (version 3) if strings is not nil.
+ *
+ * The returned data has enough capacity for the item data to be appended.
+ */
+static NSMutableData *commitDataHeader(NSUInteger count, NSArray *strings, NSUInteger itemDataLength)
+{
+    const NSUInteger directoryLength = CO_DIRECTORY_HEADER_LENGTH + count * CO_DIRECTORY_ENTRY_LENGTH;
+    co_buffer_t stringTable;
+
+    co_buffer_init_from_arena(&stringTable, CO_BUFFER_FORMAT_VERSION_FIXED_INTEGERS);
+
+    if (strings != nil)
+    {
+        unsigned char stringCount[4];
+
+        writeLittleUint32(stringCount, (uint32_t)strings.count);
+        co_buffer_write(&stringTable, stringCount, 4);
+
+        for (NSString *string in strings)
+        {
+            const char *utf8 = string.UTF8String;
+            const size_t length = strlen(utf8);
+
+            co_buffer_store_varint(&stringTable, length);
+            co_buffer_write(&stringTable, (const unsigned char *)utf8, length);
+        }
+    }
+
+    const NSUInteger totalLength = directoryLength + co_buffer_get_length(&stringTable) + itemDataLength;
+
+    if (totalLength > UINT32_MAX)
+    {
+        co_buffer_return_to_arena(&stringTable);
+        [NSException raise: NSInvalidArgumentException
+                    format: @"Can't write commit data larger than 2^32-1 bytes"];
+    }
+
+    NSMutableData *result = [NSMutableData dataWithCapacity: totalLength];
+    result.length = directoryLength;
+    unsigned char *header = result.mutableBytes;
+
+    memcpy(header, CO_DIRECTORY_FORMAT_MAGIC, 4);
+    header[4] = (strings != nil) ? CO_STRING_TABLE_FORMAT_VERSION : CO_DIRECTORY_FORMAT_VERSION;
+    writeLittleUint32(header + 8, (uint32_t)count);
+
+    [result appendBytes: co_buffer_get_data(&stringTable)
+                 length: co_buffer_get_length(&stringTable)];
+    co_buffer_return_to_arena(&stringTable);
+
+    return result;
+}
+
+/**
+ * Writes the directory entry at index i, for item data at the given offset in 
+ * the commit data.
+ */
+static void writeDirectoryEntry(NSMutableData *commitData,
+                                NSArray *sortedUUIDs,
+                                NSUInteger i,
+                                const unsigned char *itemBytes,
+                                NSUInteger offset,
+                                NSUInteger length)
+{
+    ETUUID *uuid = sortedUUIDs[i];
+    unsigned char *entry = (unsigned char *)directoryEntry(commitData.mutableBytes, (uint32_t)i);
+
+    assert(i == 0 || compareUUIDBytes([sortedUUIDs[i - 1] UUIDValue], [uuid UUIDValue]) < 0);
+    assert('#' == itemBytes[0]);
+    assert(0 == memcmp([uuid UUIDValue], itemBytes + 1, 16));
+
+    memcpy(entry, [uuid UUIDValue], 16);
+    writeLittleUint32(entry + 16, (uint32_t)offset);
+    writeLittleUint32(entry + 20, (uint32_t)length);
+}
+
+NSData *CombinedCommitDataWithUUIDsAndItemData(NSArray *sortedUUIDs, NSArray *itemDataArray)
+{
+    NSCParameterAssert(sortedUUIDs.count == itemDataArray.count);
+
+    const NSUInteger count = sortedUUIDs.count;
+    NSUInteger itemDataLength = 0;
+
+    for (NSData *itemData in itemDataArray)
+    {
+        itemDataLength += itemData.length;
+    }
+
+    NSMutableData *result = commitDataHeader(count, nil, itemDataLength);
+
+    for (NSUInteger i = 0; i < count; i++)
+    {
+        NSData *itemData = itemDataArray[i];
+
+        writeDirectoryEntry(result, sortedUUIDs, i, itemData.bytes, result.length, itemData.length);
+        [result appendData: itemData];
+    }
+
+    return result;
+}
+
+NSData *CombinedCommitDataWithItems(NSArray *sortedItems)
+{
+    const NSUInteger count = sortedItems.count;
+    COItemStringTable *stringTable = [[COItemStringTable alloc] init];
+    NSMutableArray *sortedUUIDs = [NSMutableArray arrayWithCapacity: count];
+    NSRange *itemRanges = malloc(MAX(count, 1) * sizeof(NSRange));
+
+    // The item data are appended to a single buffer, and the directory and 
+    // string table are written in front once all the items have been written
+    co_buffer_t itemBuffer;
+    co_buffer_init_from_arena(&itemBuffer, CO_BUFFER_FORMAT_VERSION_VARINT_INTEGERS);
+    NSMutableData *result = nil;
+
+    @try
+    {
+        for (NSUInteger i = 0; i < count; i++)
+        {
+            COItem *item = sortedItems[i];
+            const NSUInteger start = co_buffer_get_length(&itemBuffer);
+
+            [sortedUUIDs addObject: item.UUID];
+            [item appendDataValueWithStringTable: stringTable toBuffer: &itemBuffer];
+            itemRanges[i] = NSMakeRange(start, co_buffer_get_length(&itemBuffer) - start);
+        }
+
+        const unsigned char *itemBytes = co_buffer_get_data(&itemBuffer);
+
+        result = commitDataHeader(count, stringTable.strings, co_buffer_get_length(&itemBuffer));
+
+        const NSUInteger itemDataOffset = result.length;
+
+        for (NSUInteger i = 0; i < count; i++)
+        {
+            writeDirectoryEntry(result,
+                                sortedUUIDs,
+                                i,
+                                itemBytes + itemRanges[i].location,
+                                itemDataOffset + itemRanges[i].location,
+                                itemRanges[i].length);
+        }
+        [result appendBytes: itemBytes length: co_buffer_get_length(&itemBuffer)];
+    }
+    @finally
+    {
+        free(itemRanges);
+        co_buffer_return_to_arena(&itemBuffer);
+    }
+
+    return result;
+}
+
 void AddCommitUUIDAndDataToCombinedCommitData(NSMutableData *combinedCommitData,
                                               ETUUID *uuidToAdd,
                                               NSData *dataToAdd)
@@ -67,3 +633,170 @@ void AddCommitUUIDAndDataToCombinedCommitData(NSMutableData *combinedCommitData,
     assert('#' == ((const unsigned char *)[dataToAdd bytes])[0]);
     assert(0 == memcmp([uuidToAdd UUIDValue], ((const unsigned char *)[dataToAdd bytes]) + 1, 16));
 }
+
+
+/*
+ * Compressed format:
+ *
+ * |--------|---------|---------|--------------------|-------------------..
+ * | 'COCZ' | uint_8  | 3 bytes | uint_32 LE         | zlib stream..
+ * | magic  | method  | padding | uncompressed       |
+ * |        |         | (zero)  | length             |
+ * |--------|---------|---------|--------------------|-------------------..
+ *
+ * Like the directory format, the fifth byte can't be '#', so the compressed 
+ * data can't be mistaken for the version 1 format.
+ */
+
+#define CO_COMPRESSED_FORMAT_MAGIC "COCZ"
+#define CO_COMPRESSED_HEADER_LENGTH 12
+
+enum
+{
+    COCompressionMethodZlib = 1,
+    COCompressionMethodZlibWithDictionary = 2
+};
+
+BOOL IsCompressedCommitData(NSData *storedData)
+{
+    const unsigned char *bytes = storedData.bytes;
+
+    return storedData.length >= CO_COMPRESSED_HEADER_LENGTH
+        && memcmp(bytes, CO_COMPRESSED_FORMAT_MAGIC, 4) == 0
+        && (bytes[4] == COCompressionMethodZlib
+            || bytes[4] == COCompressionMethodZlibWithDictionary);
+}
+
+NSData *CompressedCommitData(NSData *commitData, NSData *dictionary)
+{
+    if (commitData.length > UINT32_MAX)
+    {
+        [NSException raise: NSInvalidArgumentException
+                    format: @"Can't compress commit data larger than 2^32-1 bytes"];
+    }
+
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    if (deflateInit(&stream, Z_DEFAULT_COMPRESSION) != Z_OK)
+    {
+        [NSException raise: NSInternalInconsistencyException
+                    format: @"zlib initialization failed"];
+    }
+    if (dictionary != nil)
+    {
+        const int status = deflateSetDictionary(&stream, dictionary.bytes, (uInt)dictionary.length);
+
+        if (status != Z_OK)
+        {
+            deflateEnd(&stream);
+            [NSException raise: NSInternalInconsistencyException
+                        format: @"zlib compression dictionary could not be set (%d)", status];
+        }
+    }
+
+    const uLong bound = deflateBound(&stream, commitData.length);
+    NSMutableData *result = [NSMutableData dataWithLength: CO_COMPRESSED_HEADER_LENGTH + bound];
+    unsigned char *header = result.mutableBytes;
+
+    memcpy(header, CO_COMPRESSED_FORMAT_MAGIC, 4);
+    header[4] = (dictionary != nil) ? COCompressionMethodZlibWithDictionary : COCompressionMethodZlib;
+    writeLittleUint32(header + 8, (uint32_t)commitData.length);
+
+    stream.next_in = (Bytef *)commitData.bytes;
+    stream.avail_in = (uInt)commitData.length;
+    stream.next_out = header + CO_COMPRESSED_HEADER_LENGTH;
+    stream.avail_out = (uInt)bound;
+
+    const int status = deflate(&stream, Z_FINISH);
+    deflateEnd(&stream);
+
+    if (status != Z_STREAM_END)
+    {
+        [NSException raise: NSInternalInconsistencyException
+                    format: @"zlib compression failed (%d)", status];
+    }
+
+    result.length = CO_COMPRESSED_HEADER_LENGTH + stream.total_out;
+    return result;
+}
+
+NSData *UncompressedCommitData(NSData *storedData, NSData *dictionary)
+{
+    if (!IsCompressedCommitData(storedData))
+        return storedData;
+
+    const unsigned char *bytes = storedData.bytes;
+    const uint32_t length = readLittleUint32(bytes + 8);
+
+    if (bytes[4] == COCompressionMethodZlibWithDictionary && dictionary == nil)
+    {
+        [NSException raise: NSInternalInconsistencyException
+                    format: @"Commit data was compressed with a dictionary that is missing"];
+    }
+
+    NSMutableData *result = [NSMutableData dataWithLength: length];
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+
+    if (inflateInit(&stream) != Z_OK)
+    {
+        [NSException raise: NSInternalInconsistencyException
+                    format: @"zlib initialization failed"];
+    }
+
+    stream.next_in = (Bytef *)bytes + CO_COMPRESSED_HEADER_LENGTH;
+    stream.avail_in = (uInt)(storedData.length - CO_COMPRESSED_HEADER_LENGTH);
+    stream.next_out = result.mutableBytes;
+    stream.avail_out = length;
+
+    int status = inflate(&stream, Z_FINISH);
+
+    if (status == Z_NEED_DICT && dictionary != nil)
+    {
+        // Fails with Z_DATA_ERROR if the dictionary is not the one used to 
+        // compress the data (its Adler-32 checksum doesn't match)
+        status = inflateSetDictionary(&stream, dictionary.bytes, (uInt)dictionary.length);
+
+        if (status != Z_OK)
+        {
+            inflateEnd(&stream);
+            [NSException raise: NSInternalInconsistencyException
+                        format: @"zlib decompression dictionary could not be set (%d)", status];
+        }
+        status = inflate(&stream, Z_FINISH);
+    }
+    inflateEnd(&stream);
+
+    if (status != Z_STREAM_END || stream.total_out != length)
+    {
+        [NSException raise: NSInternalInconsistencyException
+                    format: @"zlib decompression failed (%d)", status];
+    }
+    return result;
+}
+
+NSData *CompressionDictionaryWithItemData(NSArray *itemDataArray, NSUInteger maxLength)
+{
+    NSMutableData *result = [NSMutableData data];
+    NSMutableSet *samples = [NSMutableSet set];
+
+    for (NSData *itemData in itemDataArray)
+    {
+        // Skip the item UUID token, which is never repeated
+        if (itemData.length <= 17)
+            continue;
+
+        NSData *sample = [itemData subdataWithRange: NSMakeRange(17, itemData.length - 17)];
+
+        if ([samples containsObject: sample])
+            continue;
+
+        if (result.length + sample.length > maxLength)
+            break;
+
+        [samples addObject: sample];
+        [result appendData: sample];
+    }
+    return (result.length > 0) ? result : nil;
+}
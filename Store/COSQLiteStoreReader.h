@@ -0,0 +1,186 @@
+/**
+    Copyright (C) 2016 Quentin Mathe
+
+    Date:  October 2016
+    License:  MIT  (see COPYING)
+ */
+
+#import <Foundation/Foundation.h>
+#import <CoreObject/COSQLiteStore.h>
+
+@class FMDatabase;
+@class COSQLiteStorePersistentRootBackingStore;
+
+/**
+ * A read-only connection to the store database.
+ *
+ * The store keeps a pool of readers, so reads run concurrently with each
+ * other, and with the commits which use the store connection (in WAL mode,
+ * readers don't block the writer and the writer doesn't block readers).
+ *
+ * Not a public class, only intended to be used by COSQLiteStore. A reader must
+ * only be used by one thread at a time, see -[COSQLiteStore
+ * performReadUsingBlock:].
+ */
+@interface COSQLiteStoreReader : NSObject
+{
+    COSQLiteStore *__weak _store; // weak reference
+    FMDatabase *_database;
+    NSMutableDictionary *_backingStores; // COUUID (backing store UUID => COSQLiteStorePersistentRootBackingStore)
+    int64_t _generation;
+    NSUInteger _maxItemGraphCacheSize;
+}
+
+
+/** @taskunit Initialization */
+
+
+/**
+ * Opens a read-only connection to the database of the given store, or returns
+ * nil if the database can't be opened.
+ */
+- (instancetype)initWithStore: (COSQLiteStore *)aStore NS_DESIGNATED_INITIALIZER;
+/**
+ * Closes the connection. The receiver must not be used afterwards.
+ */
+- (void)close;
+
+
+/** @taskunit Read Transactions */
+
+
+/**
+ * The store generation the receiver caches belong to.
+ *
+ * The transactions that delete revisions increment the store generation 
+ * (since revids can be reused), see -beginReadTransaction.
+ */
+@property (nonatomic, readonly) int64_t generation;
+/**
+ * The approximate number of bytes of revision contents cached by each backing 
+ * store of the receiver.
+ *
+ * See -[COSQLiteStore maxItemGraphCacheSize].
+ */
+@property (nonatomic, readwrite, assign) NSUInteger maxItemGraphCacheSize;
+/**
+ * Begins a read transaction. All the reads until -endReadTransaction see the
+ * same database snapshot.
+ *
+ * Takes the snapshot by reading the store generation, then discards the 
+ * backing stores (including their cached revision contents) if the generation
+ * is not the receiver one.
+ */
+- (void)beginReadTransaction;
+- (void)endReadTransaction;
+
+
+/** @taskunit Reading */
+
+
+/**
+ * Returns the backing store for the given persistent root, or nil if the
+ * persistent root doesn't exist.
+ */
+- (COSQLiteStorePersistentRootBackingStore *)backingStoreForPersistentRootUUID: (ETUUID *)aUUID;
+/**
+ * Returns the deleted persistent root UUIDs if deleted is YES, otherwise the 
+ * other ones.
+ */
+- (NSArray *)persistentRootUUIDsDeleted: (BOOL)deleted;
+- (COPersistentRootInfo *)persistentRootInfoForUUID: (ETUUID *)aUUID;
+/**
+ * Returns the infos of the given persistent roots that exist, in the same 
+ * order, with two queries per 500 persistent roots.
+ */
+- (NSArray *)persistentRootInfosForUUIDs: (NSArray *)UUIDs;
+/**
+ * Returns the infos of the deleted persistent roots if deleted is YES, 
+ * otherwise of the other ones, with two queries.
+ */
+- (NSArray *)persistentRootInfosDeleted: (BOOL)deleted;
+- (ETUUID *)persistentRootUUIDForBranchUUID: (ETUUID *)aBranchUUID;
+/**
+ * See -[COSQLiteStore persistentRootUUIDsReferencingPersistentRoot:].
+ */
+- (NSArray *)persistentRootUUIDsReferencingPersistentRoot: (ETUUID *)aUUID;
+/**
+ * See -[COSQLiteStore currentReferencesToPersistentRoot:].
+ */
+- (NSArray *)currentReferencesToPersistentRoot: (ETUUID *)aUUID;
+/**
+ * See -[COSQLiteStore currentSearchResultsForQuery:].
+ */
+- (NSArray *)currentSearchResultsForQuery: (NSString *)aQuery;
+/**
+ * See -[COSQLiteStore searchResultsForQuery:allowsStaleResults:].
+ */
+- (NSArray *)searchResultsForQuery: (NSString *)aQuery;
+/**
+ * See -[COSQLiteStore referencesToPersistentRoot:].
+ */
+- (NSArray *)referencesToPersistentRoot: (ETUUID *)aUUID;
+- (NSSet *)indexedPropertyNamesForEntityName: (NSString *)anEntityName;
+/**
+ * See -[COSQLiteStore indexedEntityNames].
+ */
+- (NSSet *)indexedEntityNames;
+/**
+ * See -[COSQLiteStore searchResultsForProperty:entityName:minimumValue:maximumValue:].
+ */
+- (NSArray *)searchResultsForProperty: (NSString *)aProperty
+                           entityName: (NSString *)anEntityName
+                         minimumValue: (id)minValue
+                         maximumValue: (id)maxValue;
+/**
+ * See -[COSQLiteStore revisionSearchResultsForProperty:minimumValue:maximumValue:].
+ */
+- (NSArray *)revisionSearchResultsForProperty: (NSString *)aProperty
+                                 minimumValue: (id)minValue
+                                 maximumValue: (id)maxValue;
+- (NSArray *)allBackingUUIDs;
+/**
+ * Returns an empty array if the persistent root doesn't exist.
+ */
+- (NSArray *)revisionInfosForBackingStoreOfPersistentRootUUID: (ETUUID *)aPersistentRoot;
+/**
+ * See -[COSQLiteStore attributesForPersistentRootWithUUID:].
+ */
+- (NSDictionary *)attributesForPersistentRootWithUUID: (ETUUID *)aUUID;
+/**
+ * See -[COSQLiteStore pageStatistics].
+ */
+@property (nonatomic, readonly) NSDictionary *pageStatistics;
+- (ETUUID *)headRevisionUUIDForBranchUUID: (ETUUID *)aBranchUUID;
+/**
+ * Returns nil if the persistent root of the branch doesn't exist.
+ *
+ * See -[COSQLiteStore revisionInfosForBranchUUID:options:].
+ */
+- (NSArray *)revisionInfosForBranchUUID: (ETUUID *)aBranchUUID
+                                options: (COBranchRevisionReadingOptions)options;
+- (CORevisionInfo *)revisionInfoForRevisionUUID: (ETUUID *)aRevision
+                             persistentRootUUID: (ETUUID *)aPersistentRoot;
+/**
+ * See -[COSQLiteStore revisionGraphForPersistentRootUUID:].
+ */
+- (CORevisionGraph *)revisionGraphForPersistentRootUUID: (ETUUID *)aPersistentRoot;
+/**
+ * See -[COSQLiteStore updateRevisionGraph:forPersistentRootUUID:].
+ */
+- (BOOL)updateRevisionGraph: (CORevisionGraph *)aGraph
+      forPersistentRootUUID: (ETUUID *)aPersistentRoot;
+/**
+ * See -[COSQLiteStore revisionUUIDsOfAncestorsOfRevisionUUIDs:excludingAncestorsOfRevisionUUIDs:persistentRootUUID:].
+ */
+- (NSSet *)revisionUUIDsOfAncestorsOfRevisionUUIDs: (NSSet *)revisionUUIDs
+                 excludingAncestorsOfRevisionUUIDs: (NSSet *)excludedRevisionUUIDs
+                                persistentRootUUID: (ETUUID *)aPersistentRoot;
+- (COItemGraph *)partialItemGraphFromRevisionUUID: (ETUUID *)baseRevid
+                                   toRevisionUUID: (ETUUID *)finalRevid
+                                   persistentRoot: (ETUUID *)aPersistentRoot;
+- (COItemGraph *)itemGraphForRevisionUUID: (ETUUID *)aRevisionUUID
+                           persistentRoot: (ETUUID *)aPersistentRoot;
+- (ETUUID *)rootObjectUUIDForPersistentRoot: (ETUUID *)aPersistentRoot;
+
+@end
@@ -0,0 +1,650 @@
+/**
+    Copyright (C) 2016 Quentin Mathe
+
+    Date:  October 2016
+    License:  MIT  (see COPYING)
+ */
+
+#import "COSQLiteStoreReader.h"
+#import "COSQLiteStorePersistentRootBackingStore.h"
+#import "COPersistentRootInfo.h"
+#import "COBranchInfo.h"
+#import "COSearchResult.h"
+#import "COJSONSerialization.h"
+#import "COSQLiteUtilities.h"
+#import "FMDatabase.h"
+#import "FMDatabaseAdditions.h"
+#import <EtoileFoundation/Macros.h>
+#import <EtoileFoundation/ETUUID.h>
+
+/**
+ * Keeps the number of bound parameters well below SQLITE_MAX_VARIABLE_NUMBER 
+ * (999 by default).
+ */
+static const NSUInteger COMaxNumberOfUUIDsPerQuery = 500;
+
+@implementation COSQLiteStoreReader
+
+@synthesize generation = _generation;
+
+- (instancetype)initWithStore: (COSQLiteStore *)aStore
+{
+    NILARG_EXCEPTION_TEST(aStore);
+    SUPERINIT;
+
+    _store = aStore;
+    _generation = -1;
+    _maxItemGraphCacheSize = aStore.maxItemGraphCacheSize;
+    _backingStores = [NSMutableDictionary new];
+    _database = [[FMDatabase alloc] initWithPath: [aStore.URL.path stringByAppendingPathComponent: @"index.sqlite"]];
+
+    [_database setShouldCacheStatements: YES];
+    [_database setCrashOnErrors: NO];
+    [_database setLogsErrors: YES];
+
+    // N.B. The store connection has already enabled WAL mode, which is persistent
+    if (![_database openWithFlags: SQLITE_OPEN_READONLY])
+    {
+        NSLog(@"Error %d: %@", [_database lastErrorCode], [_database lastErrorMessage]);
+        return nil;
+    }
+
+    return self;
+}
+
+- (instancetype)init
+{
+    return [self initWithStore: nil];
+}
+
+- (void)close
+{
+    [_backingStores removeAllObjects];
+    [_database close];
+    _database = nil;
+}
+
+#pragma mark Read Transactions -
+
+- (NSUInteger)maxItemGraphCacheSize
+{
+    return _maxItemGraphCacheSize;
+}
+
+- (void)setMaxItemGraphCacheSize: (NSUInteger)aSize
+{
+    if (aSize == _maxItemGraphCacheSize)
+        return;
+
+    _maxItemGraphCacheSize = aSize;
+
+    for (COSQLiteStorePersistentRootBackingStore *backing in _backingStores.objectEnumerator)
+    {
+        backing.maxItemGraphCacheSize = aSize;
+    }
+}
+
+- (void)beginReadTransaction
+{
+    [_database beginDeferredTransaction];
+
+    // A deferred transaction takes its snapshot on the first SELECT, so the
+    // generation matches the revisions visible until -endReadTransaction
+    const int64_t generation = [_database int64ForQuery: @"SELECT generation FROM reader_generation"];
+
+    if (generation != _generation)
+    {
+        [_backingStores removeAllObjects];
+        _generation = generation;
+    }
+}
+
+- (void)endReadTransaction
+{
+    [_database commit];
+}
+
+#pragma mark Reading -
+
+- (COSQLiteStorePersistentRootBackingStore *)backingStoreForPersistentRootUUID: (ETUUID *)aUUID
+{
+    NSData *data = [_database dataForQuery: @"SELECT backingstore FROM persistentroot_backingstores WHERE uuid = ?",
+                                            [aUUID dataValue]];
+    if (data == nil)
+    {
+        return nil;
+    }
+
+    ETUUID *backingUUID = [ETUUID UUIDWithData: data];
+    COSQLiteStorePersistentRootBackingStore *result = _backingStores[backingUUID];
+
+    if (result == nil)
+    {
+        COSQLiteStore *store = _store;
+
+        result = [[COSQLiteStorePersistentRootBackingStore alloc] initWithPersistentRootUUID: backingUUID
+                                                                                       store: store
+                                                                            readOnlyDatabase: _database];
+        result.maxItemGraphCacheSize = _maxItemGraphCacheSize;
+
+        _backingStores[backingUUID] = result;
+    }
+    return result;
+}
+
+- (NSDictionary *)readMetadata: (NSData *)data
+{
+    if (data != nil)
+    {
+        return COJSONObjectWithData(data, NULL);
+    }
+    return nil;
+}
+
+- (NSArray *)persistentRootUUIDsDeleted: (BOOL)deleted
+{
+    NSMutableArray *result = [NSMutableArray array];
+    FMResultSet *rs = [_database executeQuery: @"SELECT uuid FROM persistentroots WHERE deleted = ?",
+                                               @(deleted)];
+
+    while ([rs next])
+    {
+        [result addObject: [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]]];
+    }
+    [rs close];
+    return result;
+}
+
+/**
+ * Returns the persistent root infos built from the rows returned by the two 
+ * queries, in the order of the persistent root rows.
+ *
+ * The persistent root query must return the columns: uuid, currentbranch, 
+ * deleted, transactionid, metadata. The branch query must return: uuid, 
+ * current_revid, head_revid, metadata, deleted, parentbranch, proot.
+ */
+- (NSArray *)persistentRootInfosWithQuery: (NSString *)persistentRootSQL
+                              branchQuery: (NSString *)branchSQL
+                                arguments: (NSArray *)args
+{
+    NSMutableArray *result = [NSMutableArray array];
+    NSMutableDictionary *branchDictForUUID = [NSMutableDictionary dictionary];
+
+    {
+        FMResultSet *rs = [_database executeQuery: persistentRootSQL withArgumentsInArray: args];
+
+        while ([rs next])
+        {
+            COPersistentRootInfo *info = [[COPersistentRootInfo alloc] init];
+            info.UUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]];
+            info.currentBranchUUID = [rs dataForColumnIndex: 1] != nil
+                ? [ETUUID UUIDWithData: [rs dataForColumnIndex: 1]]
+                : nil;
+            info.deleted = [rs boolForColumnIndex: 2];
+            info.transactionID = [rs int64ForColumnIndex: 3];
+            info.metadata = [self readMetadata: [rs dataForColumnIndex: 4]];
+
+            [result addObject: info];
+            branchDictForUUID[info.UUID] = [NSMutableDictionary dictionary];
+        }
+        [rs close];
+    }
+
+    if (result.count == 0)
+    {
+        return result;
+    }
+
+    {
+        FMResultSet *rs = [_database executeQuery: branchSQL withArgumentsInArray: args];
+
+        while ([rs next])
+        {
+            ETUUID *branch = [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]];
+            ETUUID *prootUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 6]];
+
+            COBranchInfo *state = [[COBranchInfo alloc] init];
+            state.UUID = branch;
+            state.persistentRootUUID = prootUUID;
+            state.currentRevisionUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 1]];
+            state.headRevisionUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 2]];
+            state.metadata = [self readMetadata: [rs dataForColumnIndex: 3]];
+            state.deleted = [rs boolForColumnIndex: 4];
+            state.parentBranchUUID = [rs dataForColumnIndex: 5] != nil
+                ? [ETUUID UUIDWithData: [rs dataForColumnIndex: 5]]
+                : nil;
+
+            branchDictForUUID[prootUUID][branch] = state;
+        }
+        [rs close];
+    }
+
+    for (COPersistentRootInfo *info in result)
+    {
+        info.branchForUUID = branchDictForUUID[info.UUID];
+    }
+    return result;
+}
+
+- (COPersistentRootInfo *)persistentRootInfoForUUID: (ETUUID *)aUUID
+{
+    NSArray *infos = [self persistentRootInfosWithQuery: @"SELECT uuid, currentbranch, deleted, transactionid, metadata "
+                                                          "FROM persistentroots WHERE uuid = ?"
+                                            branchQuery: @"SELECT uuid, current_revid, head_revid, metadata, deleted, parentbranch, proot "
+                                                          "FROM branches WHERE proot = ?"
+                                              arguments: @[[aUUID dataValue]]];
+    return infos.firstObject;
+}
+
+- (NSArray *)persistentRootInfosForUUIDs: (NSArray *)UUIDs
+{
+    NSMutableDictionary *infoForUUID = [NSMutableDictionary dictionaryWithCapacity: UUIDs.count];
+
+    for (NSUInteger start = 0; start < UUIDs.count; start += COMaxNumberOfUUIDsPerQuery)
+    {
+        const NSUInteger length = MIN(COMaxNumberOfUUIDsPerQuery, UUIDs.count - start);
+        NSMutableArray *args = [NSMutableArray arrayWithCapacity: length];
+        NSMutableArray *placeholders = [NSMutableArray arrayWithCapacity: length];
+
+        for (ETUUID *uuid in [UUIDs subarrayWithRange: NSMakeRange(start, length)])
+        {
+            [args addObject: [uuid dataValue]];
+            [placeholders addObject: @"?"];
+        }
+
+        NSString *list = [placeholders componentsJoinedByString: @", "];
+        NSArray *infos =
+            [self persistentRootInfosWithQuery: [NSString stringWithFormat: @"SELECT uuid, currentbranch, deleted, transactionid, metadata "
+                                                                             "FROM persistentroots WHERE uuid IN (%@)", list]
+                                   branchQuery: [NSString stringWithFormat: @"SELECT uuid, current_revid, head_revid, metadata, deleted, parentbranch, proot "
+                                                                             "FROM branches WHERE proot IN (%@)", list]
+                                     arguments: args];
+
+        for (COPersistentRootInfo *info in infos)
+        {
+            infoForUUID[info.UUID] = info;
+        }
+    }
+
+    NSMutableArray *result = [NSMutableArray arrayWithCapacity: infoForUUID.count];
+
+    for (ETUUID *uuid in UUIDs)
+    {
+        COPersistentRootInfo *info = infoForUUID[uuid];
+
+        if (info != nil)
+        {
+            [result addObject: info];
+        }
+    }
+    return result;
+}
+
+- (NSArray *)persistentRootInfosDeleted: (BOOL)deleted
+{
+    return [self persistentRootInfosWithQuery: @"SELECT uuid, currentbranch, deleted, transactionid, metadata "
+                                                "FROM persistentroots WHERE deleted = ?"
+                                  branchQuery: @"SELECT uuid, current_revid, head_revid, metadata, deleted, parentbranch, proot "
+                                                "FROM branches WHERE proot IN (SELECT uuid FROM persistentroots WHERE deleted = ?)"
+                                    arguments: @[@(deleted)]];
+}
+
+- (ETUUID *)persistentRootUUIDForBranchUUID: (ETUUID *)aBranchUUID
+{
+    NSData *data = [_database dataForQuery: @"SELECT proot FROM branches WHERE uuid = ?",
+                                            [aBranchUUID dataValue]];
+    return (data != nil) ? [ETUUID UUIDWithData: data] : nil;
+}
+
+- (NSArray *)persistentRootUUIDsReferencingPersistentRoot: (ETUUID *)aUUID
+{
+    NSMutableArray *result = [NSMutableArray array];
+    FMResultSet *rs = [_database executeQuery: @"SELECT DISTINCT proot_current_refs.root_id FROM proot_current_refs "
+                                                "INNER JOIN persistentroots ON persistentroots.uuid = proot_current_refs.root_id "
+                                                "WHERE proot_current_refs.dest_root_id = ? AND persistentroots.deleted = 0",
+                                               [aUUID dataValue]];
+    while ([rs next])
+    {
+        [result addObject: [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]]];
+    }
+    [rs close];
+    return result;
+}
+
+- (NSArray *)currentReferencesToPersistentRoot: (ETUUID *)aUUID
+{
+    NSMutableArray *results = [NSMutableArray array];
+    FMResultSet *rs = [_database executeQuery: @"SELECT proot_current_refs.root_id, proot_current_revisions.revid, "
+                                                "proot_current_refs.inner_object_uuid FROM proot_current_refs "
+                                                "INNER JOIN proot_current_revisions USING(root_id) "
+                                                "INNER JOIN persistentroots ON persistentroots.uuid = proot_current_refs.root_id "
+                                                "WHERE proot_current_refs.dest_root_id = ? AND persistentroots.deleted = 0",
+                                               [aUUID dataValue]];
+    while ([rs next])
+    {
+        COSearchResult *searchResult = [[COSearchResult alloc] init];
+
+        searchResult.persistentRoot = [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]];
+        searchResult.revision = [ETUUID UUIDWithData: [rs dataForColumnIndex: 1]];
+        searchResult.innerObjectUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 2]];
+        [results addObject: searchResult];
+    }
+    [rs close];
+    return results;
+}
+
+/**
+ * Returns a SQL condition on the value column for the given inclusive bounds, 
+ * and adds the bounds to the arguments.
+ */
+static NSString *rangeConditionForBounds(id minValue, id maxValue, NSMutableArray *arguments)
+{
+    NSMutableString *condition = [NSMutableString string];
+
+    if (minValue != nil)
+    {
+        [condition appendString: @" AND value >= ?"];
+        [arguments addObject: minValue];
+    }
+    if (maxValue != nil)
+    {
+        [condition appendString: @" AND value <= ?"];
+        [arguments addObject: maxValue];
+    }
+    return condition;
+}
+
+- (NSArray *)currentSearchResultsForQuery: (NSString *)aQuery
+{
+    NSMutableArray *results = [NSMutableArray array];
+    FMResultSet *rs = [_database executeQuery: @"SELECT fts_current_items.root_id, proot_current_revisions.revid, "
+                                                "fts_current_items.inner_object_uuid FROM fts_current_items "
+                                                "INNER JOIN proot_current_revisions USING(root_id) "
+                                                "INNER JOIN persistentroots ON persistentroots.uuid = fts_current_items.root_id "
+                                                "WHERE fts_current_items.docid IN (SELECT docid FROM fts_current WHERE text MATCH ?) "
+                                                "AND persistentroots.deleted = 0",
+                                               aQuery];
+
+    while ([rs next])
+    {
+        COSearchResult *searchResult = [[COSearchResult alloc] init];
+
+        searchResult.persistentRoot = [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]];
+        searchResult.revision = [ETUUID UUIDWithData: [rs dataForColumnIndex: 1]];
+        searchResult.innerObjectUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 2]];
+        [results addObject: searchResult];
+    }
+    [rs close];
+    return results;
+}
+
+- (NSArray *)searchResultsForQuery: (NSString *)aQuery
+{
+    NSMutableArray *results = [NSMutableArray array];
+    FMResultSet *rs = [_database executeQuery: @"SELECT uuid, revid FROM "
+                                                "(SELECT backingstore, revid FROM fts_docid_to_revisionid WHERE docid IN (SELECT docid FROM fts WHERE text MATCH ?)) "
+                                                "INNER JOIN persistentroot_backingstores USING(backingstore)",
+                                               aQuery];
+
+    while ([rs next])
+    {
+        COSearchResult *searchResult = [[COSearchResult alloc] init];
+
+        searchResult.innerObjectUUID = nil;
+        searchResult.revision = [ETUUID UUIDWithData: [rs dataForColumnIndex: 1]];
+        searchResult.persistentRoot = [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]];
+        [results addObject: searchResult];
+    }
+    [rs close];
+    return results;
+}
+
+- (NSArray *)referencesToPersistentRoot: (ETUUID *)aUUID
+{
+    NSMutableArray *results = [NSMutableArray array];
+    FMResultSet *rs = [_database executeQuery: @"SELECT root_id, revid, inner_object_uuid FROM proot_refs WHERE dest_root_id = ?",
+                                               [aUUID dataValue]];
+
+    while ([rs next])
+    {
+        COSearchResult *searchResult = [[COSearchResult alloc] init];
+
+        searchResult.persistentRoot = [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]];
+        searchResult.revision = [ETUUID UUIDWithData: [rs dataForColumnIndex: 1]];
+        searchResult.innerObjectUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 2]];
+        [results addObject: searchResult];
+    }
+    [rs close];
+    return results;
+}
+
+- (NSSet *)indexedPropertyNamesForEntityName: (NSString *)anEntityName
+{
+    NSArray *propertyNames = [_database arrayForQuery: @"SELECT property FROM indexed_properties WHERE entityname = ?",
+                                                       anEntityName];
+
+    return [NSSet setWithArray: propertyNames];
+}
+
+- (NSSet *)indexedEntityNames
+{
+    return [NSSet setWithArray: [_database arrayForQuery: @"SELECT DISTINCT entityname FROM indexed_properties"]];
+}
+
+- (NSArray *)searchResultsForProperty: (NSString *)aProperty
+                           entityName: (NSString *)anEntityName
+                         minimumValue: (id)minValue
+                         maximumValue: (id)maxValue
+{
+    NSMutableArray *results = [NSMutableArray array];
+    NSMutableArray *arguments = [NSMutableArray arrayWithObject: aProperty];
+    NSString *condition = rangeConditionForBounds(minValue, maxValue, arguments);
+
+    if (anEntityName != nil)
+    {
+        condition = [condition stringByAppendingString: @" AND property_current_values.entityname = ?"];
+        [arguments addObject: anEntityName];
+    }
+
+    NSString *query = [NSString stringWithFormat: @"SELECT DISTINCT property_current_values.root_id, proot_current_revisions.revid, "
+                                                   "property_current_values.inner_object_uuid FROM property_current_values "
+                                                   "INNER JOIN proot_current_revisions USING(root_id) "
+                                                   "INNER JOIN persistentroots ON persistentroots.uuid = property_current_values.root_id "
+                                                   "WHERE property = ?%@ AND persistentroots.deleted = 0",
+                                                  condition];
+    FMResultSet *rs = [_database executeQuery: query withArgumentsInArray: arguments];
+
+    while ([rs next])
+    {
+        COSearchResult *searchResult = [[COSearchResult alloc] init];
+
+        searchResult.persistentRoot = [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]];
+        searchResult.revision = [ETUUID UUIDWithData: [rs dataForColumnIndex: 1]];
+        searchResult.innerObjectUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 2]];
+        [results addObject: searchResult];
+    }
+    [rs close];
+    return results;
+}
+
+- (NSArray *)revisionSearchResultsForProperty: (NSString *)aProperty
+                                 minimumValue: (id)minValue
+                                 maximumValue: (id)maxValue
+{
+    NSMutableArray *results = [NSMutableArray array];
+    NSMutableArray *arguments = [NSMutableArray arrayWithObject: aProperty];
+    NSString *condition = rangeConditionForBounds(minValue, maxValue, arguments);
+    NSString *query = [NSString stringWithFormat: @"SELECT DISTINCT uuid, revid, item FROM "
+                                                   "(SELECT backingstore, revid, item FROM property_values WHERE property = ?%@) "
+                                                   "INNER JOIN persistentroot_backingstores USING(backingstore)",
+                                                  condition];
+    FMResultSet *rs = [_database executeQuery: query withArgumentsInArray: arguments];
+
+    while ([rs next])
+    {
+        COSearchResult *searchResult = [[COSearchResult alloc] init];
+
+        searchResult.persistentRoot = [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]];
+        searchResult.revision = [ETUUID UUIDWithData: [rs dataForColumnIndex: 1]];
+        searchResult.innerObjectUUID = [ETUUID UUIDWithData: [rs dataForColumnIndex: 2]];
+        [results addObject: searchResult];
+    }
+    [rs close];
+    return results;
+}
+
+- (NSArray *)allBackingUUIDs
+{
+    NSMutableArray *result = [NSMutableArray array];
+    FMResultSet *rs = [_database executeQuery: @"SELECT DISTINCT backingstore FROM persistentroot_backingstores"];
+
+    while ([rs next])
+    {
+        [result addObject: [ETUUID UUIDWithData: [rs dataForColumnIndex: 0]]];
+    }
+    [rs close];
+    return result;
+}
+
+- (NSArray *)revisionInfosForBackingStoreOfPersistentRootUUID: (ETUUID *)aPersistentRoot
+{
+    COSQLiteStorePersistentRootBackingStore *backingStore =
+        [self backingStoreForPersistentRootUUID: aPersistentRoot];
+
+    return (backingStore != nil ? backingStore.revisionInfos : @[]);
+}
+
+- (NSDictionary *)attributesForPersistentRootWithUUID: (ETUUID *)aUUID
+{
+    COSQLiteStorePersistentRootBackingStore *backingStore = [self backingStoreForPersistentRootUUID: aUUID];
+
+    if (backingStore == nil)
+        return nil;
+
+    const uint64_t exportsize = backingStore.fileSize;
+    const uint64_t usedsize = [backingStore.UUID isEqual: aUUID] ? exportsize : 0;
+
+    return @{COPersistentRootAttributeExportSize: @(exportsize),
+             COPersistentRootAttributeUsedSize: @(usedsize)};
+}
+
+- (NSDictionary *)pageStatistics
+{
+    return pageStatisticsForDatabase(_database);
+}
+
+- (ETUUID *)headRevisionUUIDForBranchUUID: (ETUUID *)aBranchUUID
+{
+    NSData *data = [_database dataForQuery: @"SELECT head_revid FROM branches WHERE uuid = ?",
+                                            [aBranchUUID dataValue]];
+    return (data != nil) ? [ETUUID UUIDWithData: data] : nil;
+}
+
+- (NSArray *)revisionInfosForBranchUUID: (ETUUID *)aBranchUUID
+                                options: (COBranchRevisionReadingOptions)options
+{
+    ETUUID *prootUUID = [self persistentRootUUIDForBranchUUID: aBranchUUID];
+    COSQLiteStorePersistentRootBackingStore *backingStore =
+        (prootUUID != nil) ? [self backingStoreForPersistentRootUUID: prootUUID] : nil;
+
+    if (backingStore == nil)
+    {
+        return nil;
+    }
+
+    return [backingStore revisionInfosForBranchUUID: aBranchUUID
+                                   headRevisionUUID: [self headRevisionUUIDForBranchUUID: aBranchUUID]
+                                            options: options];
+}
+
+- (CORevisionInfo *)revisionInfoForRevisionUUID: (ETUUID *)aRevision
+                             persistentRootUUID: (ETUUID *)aPersistentRoot
+{
+    return [[self backingStoreForPersistentRootUUID: aPersistentRoot] revisionInfoForRevisionUUID: aRevision];
+}
+
+- (CORevisionGraph *)revisionGraphForPersistentRootUUID: (ETUUID *)aPersistentRoot
+{
+    return [self backingStoreForPersistentRootUUID: aPersistentRoot].revisionGraph;
+}
+
+- (BOOL)updateRevisionGraph: (CORevisionGraph *)aGraph
+      forPersistentRootUUID: (ETUUID *)aPersistentRoot
+{
+    return [[self backingStoreForPersistentRootUUID: aPersistentRoot] appendRevisionsToRevisionGraph: aGraph];
+}
+
+- (NSIndexSet *)revidsForRevisionUUIDs: (NSSet *)revisionUUIDs
+                          backingStore: (COSQLiteStorePersistentRootBackingStore *)backingStore
+{
+    NSMutableIndexSet *revids = [NSMutableIndexSet indexSet];
+
+    for (ETUUID *revisionUUID in revisionUUIDs)
+    {
+        const int64_t revid = [backingStore revidForUUID: revisionUUID];
+
+        if (revid != -1)
+        {
+            [revids addIndex: revid];
+        }
+    }
+    return revids;
+}
+
+- (NSSet *)revisionUUIDsOfAncestorsOfRevisionUUIDs: (NSSet *)revisionUUIDs
+                 excludingAncestorsOfRevisionUUIDs: (NSSet *)excludedRevisionUUIDs
+                                persistentRootUUID: (ETUUID *)aPersistentRoot
+{
+    COSQLiteStorePersistentRootBackingStore *backing = [self backingStoreForPersistentRootUUID: aPersistentRoot];
+
+    if (backing == nil)
+        return [NSSet set];
+
+    NSIndexSet *revids = [backing ancestorRevidsOfRevids: [self revidsForRevisionUUIDs: revisionUUIDs
+                                                                          backingStore: backing]
+                              excludingAncestorsOfRevids: [self revidsForRevisionUUIDs: excludedRevisionUUIDs
+                                                                          backingStore: backing]];
+
+    return [NSSet setWithArray: [backing revisionUUIDsForRevids: revids]];
+}
+
+- (COItemGraph *)partialItemGraphFromRevisionUUID: (ETUUID *)baseRevid
+                                   toRevisionUUID: (ETUUID *)finalRevid
+                                   persistentRoot: (ETUUID *)aPersistentRoot
+{
+    COSQLiteStorePersistentRootBackingStore *backing = [self backingStoreForPersistentRootUUID: aPersistentRoot];
+
+    if (backing == nil)
+    {
+        return nil;
+    }
+
+    return [backing partialItemGraphFromRevid: [backing revidForUUID: baseRevid]
+                                      toRevid: [backing revidForUUID: finalRevid]];
+}
+
+- (ETUUID *)rootObjectUUIDForPersistentRoot: (ETUUID *)aPersistentRoot
+{
+    return [self backingStoreForPersistentRootUUID: aPersistentRoot].rootUUID;
+}
+
+- (COItemGraph *)itemGraphForRevisionUUID: (ETUUID *)aRevisionUUID
+                           persistentRoot: (ETUUID *)aPersistentRoot
+{
+    COSQLiteStorePersistentRootBackingStore *backing = [self backingStoreForPersistentRootUUID: aPersistentRoot];
+
+    if (backing == nil)
+    {
+        return nil;
+    }
+
+    const int64_t revid = [backing revidForUUID: aRevisionUUID];
+
+    if (revid == -1)
+    {
+        return nil;
+    }
+    return [backing itemGraphForRevid: revid];
+}
+
+@end
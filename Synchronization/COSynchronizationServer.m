@@ -9,39 +9,6 @@
 
 @implementation COSynchronizationServer
 
-static void FindAllParents(NSMutableSet *resultSet,
-                           ETUUID *rev,
-                           ETUUID *persistentRootUUID,
-                           COSQLiteStore *store,
-                           NSSet *stopSet)
-{
-    if ([resultSet containsObject: rev])
-        return;
-
-    if (stopSet != nil && [stopSet containsObject: rev])
-        return;
-
-    [resultSet addObject: rev];
-
-    // Recursively search the parent(s)
-
-    CORevisionInfo *revision = [store revisionInfoForRevisionUUID: rev
-                                               persistentRootUUID: persistentRootUUID];
-
-    if (revision.parentRevisionUUID != nil)
-    {
-        FindAllParents(resultSet, revision.parentRevisionUUID, persistentRootUUID, store, stopSet);
-    }
-    if (revision.mergeParentRevisionUUID != nil)
-    {
-        FindAllParents(resultSet,
-                       revision.mergeParentRevisionUUID,
-                       persistentRootUUID,
-                       store,
-                       stopSet);
-    }
-}
-
 - (BOOL)shouldSendBranch: (COBranchInfo *)branch
 {
     if (branch.metadata[@"source"] != nil)
@@ -71,28 +38,25 @@ For now we do.
     ETUUID *persistentRoot = [ETUUID UUIDWithString: aRequest[@"persistentRoot"]];
     COPersistentRootInfo *serverInfo = [aStore persistentRootInfoForUUID: persistentRoot];
 
-    // 1. Calculate the set of revision ETUUID the client has
+    // 1. Collect the revisions the client reports as being their latest ones
     NSMutableSet *revisionsClientHas = [NSMutableSet set];
     for (NSString *revisionUUIDString in [aRequest[@"clientNewestRevisionIDForBranchUUID"] allValues])
     {
-        ETUUID *revid = [ETUUID UUIDWithString: revisionUUIDString];
-
-        FindAllParents(revisionsClientHas, revid, persistentRoot, aStore, nil);
+        [revisionsClientHas addObject: [ETUUID UUIDWithString: revisionUUIDString]];
     }
 
     // 2. Calculate the set of CORevisionID that the client lacks
-    NSMutableSet *revisionsClientLacks = [NSMutableSet set];
+    NSMutableSet *currentRevisions = [NSMutableSet set];
     for (COBranchInfo *branch in serverInfo.branches)
     {
         if ([self shouldSendBranch: branch])
         {
-            FindAllParents(revisionsClientLacks,
-                           branch.currentRevisionUUID,
-                           persistentRoot,
-                           aStore,
-                           revisionsClientHas);
+            [currentRevisions addObject: branch.currentRevisionUUID];
         }
     }
+    NSSet *revisionsClientLacks = [aStore revisionUUIDsOfAncestorsOfRevisionUUIDs: currentRevisions
+                                                excludingAncestorsOfRevisionUUIDs: revisionsClientHas
+                                                               persistentRootUUID: persistentRoot];
 
     // Now prepare the property list output
 
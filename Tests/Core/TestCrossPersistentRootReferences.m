@@ -96,6 +96,65 @@
        }];
 }
 
+- (void)testPersistentRootFaulting
+{
+    COPersistentRoot *photo1 = [ctx insertNewPersistentRootWithEntityName: @"OutlineItem"];
+    [photo1.rootObject setLabel: @"photo1"];
+
+    COPersistentRoot *library = [ctx insertNewPersistentRootWithEntityName: @"Tag"];
+    [library.rootObject addObject: photo1.rootObject];
+
+    [ctx commit];
+
+    COEditingContext *ctx2 = [COEditingContext contextWithURL: store.URL];
+    COPersistentRoot *library2 = [ctx2 persistentRootForUUID: library.UUID];
+
+    UKNil(library2.objectGraphContextWithoutUnfaulting);
+    UKNil([ctx2 loadedPersistentRootForUUID: photo1.UUID]);
+
+    // Unfaults the library, but not photo1
+    UKObjectsEqual(library.rootObject.UUID, [library2.rootObject UUID]);
+    UKNotNil(library2.objectGraphContextWithoutUnfaulting);
+    UKNil([ctx2 loadedPersistentRootForUUID: photo1.UUID]);
+
+    // Loads and unfaults photo1
+    COObject *photo1root2 = [[library2.rootObject contents] anyObject];
+    COPersistentRoot *photo1ctx2 = [ctx2 loadedPersistentRootForUUID: photo1.UUID];
+
+    UKObjectsSame(photo1ctx2, photo1root2.persistentRoot);
+    UKNotNil(photo1ctx2.objectGraphContextWithoutUnfaulting);
+    UKObjectsEqual(@"photo1", [photo1root2 label]);
+}
+
+- (void)testIncomingRelationshipLoadsReferringPersistentRoots
+{
+    COPersistentRoot *photo1 = [ctx insertNewPersistentRootWithEntityName: @"OutlineItem"];
+    COPersistentRoot *library = [ctx insertNewPersistentRootWithEntityName: @"Tag"];
+    COPersistentRoot *otherLibrary = [ctx insertNewPersistentRootWithEntityName: @"Tag"];
+
+    [library.rootObject addObject: photo1.rootObject];
+    [otherLibrary.rootObject addObject: photo1.rootObject];
+
+    COPersistentRoot *unrelatedLibrary = [ctx insertNewPersistentRootWithEntityName: @"Tag"];
+
+    [ctx commit];
+
+    COEditingContext *ctx2 = [COEditingContext contextWithURL: store.URL];
+    COPersistentRoot *photo1ctx2 = [ctx2 persistentRootForUUID: photo1.UUID];
+
+    UKNil([ctx2 loadedPersistentRootForUUID: library.UUID]);
+    UKNil([ctx2 loadedPersistentRootForUUID: otherLibrary.UUID]);
+
+    NSMutableSet *parentUUIDs = [NSMutableSet new];
+
+    for (COObject *tag in [photo1ctx2.rootObject parentCollections])
+    {
+        [parentUUIDs addObject: tag.persistentRoot.UUID];
+    }
+    UKObjectsEqual(S(library.UUID, otherLibrary.UUID), parentUUIDs);
+    UKNil([ctx2 loadedPersistentRootForUUID: unrelatedLibrary.UUID]);
+}
+
 - (void)testSpecificAndCurrentBranchReferenceInSet
 {
     COPersistentRoot *photo1 = [ctx insertNewPersistentRootWithEntityName: @"OutlineItem"];
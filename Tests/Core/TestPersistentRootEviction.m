@@ -0,0 +1,175 @@
+/*
+    Copyright (C) 2016 Quentin Mathe
+
+    Date:  October 2016
+    License:  MIT  (see COPYING)
+ */
+
+#import <UnitKit/UnitKit.h>
+#import "TestCommon.h"
+
+@interface TestPersistentRootEviction : EditingContextTestCase <UKTest>
+{
+    COPersistentRootEvictionPolicy *policy;
+    COPersistentRoot *persistentRoot1;
+    COPersistentRoot *persistentRoot2;
+    COPersistentRoot *persistentRoot3;
+}
+
+@end
+
+
+@implementation TestPersistentRootEviction
+
+- (instancetype)init
+{
+    SUPERINIT;
+
+    policy = ctx.evictionPolicy;
+
+    persistentRoot1 = [ctx insertNewPersistentRootWithEntityName: @"OutlineItem"];
+    persistentRoot2 = [ctx insertNewPersistentRootWithEntityName: @"OutlineItem"];
+    persistentRoot3 = [ctx insertNewPersistentRootWithEntityName: @"OutlineItem"];
+
+    [persistentRoot1.rootObject setLabel: @"1"];
+    [persistentRoot2.rootObject setLabel: @"2"];
+    [persistentRoot3.rootObject setLabel: @"3"];
+
+    [ctx commit];
+
+    // Access order (from the least to the most recent)
+    [persistentRoot1 rootObject];
+    [persistentRoot2 rootObject];
+    [persistentRoot3 rootObject];
+
+    return self;
+}
+
+- (NSSet *)loadedPersistentRootUUIDs
+{
+    return [NSSet setWithArray: (id)[[ctx.loadedPersistentRoots.allObjects mappedCollection] UUID]];
+}
+
+/**
+ * Sets a budget that requires to evict a single persistent root.
+ */
+- (void)exceedMemoryBudget
+{
+    policy.maxMemoryFootprint = policy.currentMemoryFootprint - 1;
+}
+
+- (void)testNoEvictionByDefault
+{
+    UKIntsEqual(0, policy.maxMemoryFootprint);
+    UKTrue(policy.currentMemoryFootprint > 0);
+
+    UKIntsEqual(0, [policy evictPersistentRootsIfNeeded]);
+    UKObjectsEqual(S(persistentRoot1.UUID, persistentRoot2.UUID, persistentRoot3.UUID),
+                   [self loadedPersistentRootUUIDs]);
+    UKIntsEqual(0, policy.numberOfEvictionPasses);
+}
+
+- (void)testLeastRecentlyAccessedEvictedFirst
+{
+    unsigned long long footprint = policy.currentMemoryFootprint;
+
+    [self exceedMemoryBudget];
+
+    UKIntsEqual(1, [policy evictPersistentRootsIfNeeded]);
+    UKObjectsEqual(S(persistentRoot2.UUID, persistentRoot3.UUID), [self loadedPersistentRootUUIDs]);
+    UKTrue(policy.currentMemoryFootprint <= policy.maxMemoryFootprint);
+
+    UKIntsEqual(1, policy.numberOfEvictionPasses);
+    UKIntsEqual(1, policy.numberOfEvictedPersistentRoots);
+    UKTrue(policy.evictedMemoryFootprint == footprint - policy.currentMemoryFootprint);
+    UKTrue(policy.peakMemoryFootprint >= footprint);
+
+    [policy resetStatistics];
+
+    UKIntsEqual(0, policy.numberOfEvictionPasses);
+    UKIntsEqual(0, policy.numberOfEvictedPersistentRoots);
+    UKIntsEqual(0, policy.evictedMemoryFootprint);
+}
+
+- (void)testPinnedPersistentRootsAreNotEvicted
+{
+    [policy pinPersistentRootUUID: persistentRoot1.UUID];
+    UKTrue([policy isPersistentRootUUIDPinned: persistentRoot1.UUID]);
+
+    policy.maxMemoryFootprint = 1;
+
+    UKIntsEqual(2, [policy evictPersistentRootsIfNeeded]);
+    UKObjectsEqual(S(persistentRoot1.UUID), [self loadedPersistentRootUUIDs]);
+    UKTrue(policy.currentMemoryFootprint > policy.maxMemoryFootprint);
+
+    [policy unpinPersistentRootUUID: persistentRoot1.UUID];
+
+    UKIntsEqual(1, [policy evictPersistentRootsIfNeeded]);
+    UKTrue([[self loadedPersistentRootUUIDs] isEmpty]);
+    UKIntsEqual(3, policy.numberOfEvictedPersistentRoots);
+}
+
+- (void)testLowPriorityEvictedFirst
+{
+    [policy setPriority: COPersistentRootEvictionPriorityHigh forPersistentRootUUID: persistentRoot1.UUID];
+    [policy setPriority: COPersistentRootEvictionPriorityLow forPersistentRootUUID: persistentRoot3.UUID];
+
+    UKIntsEqual(COPersistentRootEvictionPriorityNormal, [policy priorityForPersistentRootUUID: persistentRoot2.UUID]);
+
+    [self exceedMemoryBudget];
+
+    UKIntsEqual(1, [policy evictPersistentRootsIfNeeded]);
+    UKObjectsEqual(S(persistentRoot1.UUID, persistentRoot2.UUID), [self loadedPersistentRootUUIDs]);
+
+    [self exceedMemoryBudget];
+
+    UKIntsEqual(1, [policy evictPersistentRootsIfNeeded]);
+    UKObjectsEqual(S(persistentRoot1.UUID), [self loadedPersistentRootUUIDs]);
+}
+
+- (void)testPersistentRootsWithChangesAreEvictedAfterCommit
+{
+    [persistentRoot1.rootObject setLabel: @"changed"];
+
+    policy.maxMemoryFootprint = 1;
+
+    UKIntsEqual(2, [policy evictPersistentRootsIfNeeded]);
+    UKObjectsEqual(S(persistentRoot1.UUID), [self loadedPersistentRootUUIDs]);
+
+    [ctx commit];
+
+    UKTrue([[self loadedPersistentRootUUIDs] isEmpty]);
+    UKIntsEqual(0, policy.currentMemoryFootprint);
+}
+
+- (void)testDiscardedPersistentRootsAreNotTracked
+{
+    const unsigned long long footprint = policy.currentMemoryFootprint;
+    COPersistentRoot *insertedPersistentRoot = [ctx insertNewPersistentRootWithEntityName: @"OutlineItem"];
+
+    [insertedPersistentRoot.rootObject setLabel: @"4"];
+    [ctx discardAllChanges];
+
+    UKObjectsEqual(S(persistentRoot1.UUID, persistentRoot2.UUID, persistentRoot3.UUID),
+                   [self loadedPersistentRootUUIDs]);
+    UKIntsEqual(footprint, policy.currentMemoryFootprint);
+
+    policy.maxMemoryFootprint = 1;
+
+    UKIntsEqual(3, [policy evictPersistentRootsIfNeeded]);
+    UKIntsEqual(0, policy.currentMemoryFootprint);
+}
+
+- (void)testEvictedPersistentRootsAreReloaded
+{
+    policy.maxMemoryFootprint = 1;
+    [policy evictPersistentRootsIfNeeded];
+
+    UKTrue([[self loadedPersistentRootUUIDs] isEmpty]);
+
+    UKIntsEqual(3, ctx.persistentRoots.count);
+    UKObjectsEqual(@"2", [[ctx persistentRootForUUID: persistentRoot2.UUID].rootObject label]);
+    UKTrue(policy.currentMemoryFootprint > 0);
+}
+
+@end
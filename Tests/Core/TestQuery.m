@@ -0,0 +1,296 @@
+/*
+    Copyright (C) 2016 Quentin Mathe
+
+    Date:  October 2016
+    License:  MIT  (see COPYING)
+ */
+
+#import <UnitKit/UnitKit.h>
+#import "TestCommon.h"
+
+@interface TestQuery : EditingContextTestCase <UKTest>
+{
+    COPersistentRoot *apple;
+    COPersistentRoot *banana;
+    COPersistentRoot *cherry;
+    OutlineItem *applePie;
+}
+
+@end
+
+
+@implementation TestQuery
+
+/**
+ * Flags 'label' as indexed for all the entities that declare it, otherwise
+ * COQuery doesn't use the store index for this property.
+ */
+- (void)setLabelIndexedInStore: (BOOL)indexed
+{
+    for (ETEntityDescription *entity in ctx.modelDescriptionRepository.entityDescriptions)
+    {
+        [entity propertyDescriptionForName: @"label"].indexedInStore = indexed;
+    }
+}
+
+- (instancetype)init
+{
+    SUPERINIT;
+
+    [self setLabelIndexedInStore: YES];
+    // Register the indexed properties in the store
+    UKNotNil([[COEditingContext alloc] initWithStore: store]);
+
+    apple = [ctx insertNewPersistentRootWithEntityName: @"OutlineItem"];
+    banana = [ctx insertNewPersistentRootWithEntityName: @"OutlineItem"];
+    cherry = [ctx insertNewPersistentRootWithEntityName: @"OutlineItem"];
+
+    [apple.rootObject setLabel: @"apple"];
+    [banana.rootObject setLabel: @"banana"];
+    [cherry.rootObject setLabel: @"cherry"];
+
+    applePie = [apple.objectGraphContext insertObjectWithEntityName: @"OutlineItem"];
+    applePie.label = @"apple pie";
+    [apple.rootObject addObject: applePie];
+
+    [ctx commit];
+
+    return self;
+}
+
+- (void)dealloc
+{
+    [self setLabelIndexedInStore: NO];
+}
+
+- (NSUInteger)numberOfLoadedPersistentRootsInEditingContext: (COEditingContext *)aContext
+{
+    NSUInteger count = 0;
+
+    for (COPersistentRoot *persistentRoot in aContext.loadedPersistentRoots)
+    {
+        if (persistentRoot.objectGraphContextWithoutUnfaulting != nil)
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
+- (NSSet *)labelsInResults: (NSArray *)results
+{
+    return SA((id)[[results mappedCollection] label]);
+}
+
+- (void)testIndexedPropertiesUnregisteredWhenRemovedFromMetamodel
+{
+    UKObjectsEqual(S(@"label"), [store indexedPropertyNamesForEntityName: @"OutlineItem"]);
+    UKTrue([[store indexedEntityNames] containsObject: @"OutlineItem"]);
+
+    [self setLabelIndexedInStore: NO];
+    UKNotNil([[COEditingContext alloc] initWithStore: store]);
+
+    UKTrue([[store indexedPropertyNamesForEntityName: @"OutlineItem"] isEmpty]);
+    UKFalse([[store indexedEntityNames] containsObject: @"OutlineItem"]);
+}
+
+- (void)testInvalidArguments
+{
+    UKRaisesException([COQuery queryWithProperty: nil value: @"apple"]);
+    UKRaisesException([COQuery queryWithProperty: @"label" value: nil]);
+    UKRaisesException([COQuery queryWithText: nil]);
+    UKRaisesException([COQuery queryWithPredicate: nil]);
+    UKRaisesException([COQuery queryMatchingAllOfQueries: @[]]);
+    UKRaisesException([COQuery queryMatchingAnyOfQueries: nil]);
+}
+
+- (void)testEvaluateInMemory
+{
+    COQuery *equality = [COQuery queryWithProperty: @"label" value: @"apple"];
+    COQuery *range = [COQuery queryWithProperty: @"label" minimumValue: @"b" maximumValue: nil];
+    COQuery *text = [COQuery queryWithText: @"PIE"];
+    COQuery *predicate = [COQuery queryWithPredicate: [NSPredicate predicateWithFormat: @"label CONTAINS 'an'"]];
+
+    UKTrue([equality evaluateWithObject: apple.rootObject]);
+    UKFalse([equality evaluateWithObject: applePie]);
+    UKFalse([range evaluateWithObject: apple.rootObject]);
+    UKTrue([range evaluateWithObject: cherry.rootObject]);
+    UKTrue([text evaluateWithObject: applePie]);
+    UKFalse([text evaluateWithObject: apple.rootObject]);
+    UKTrue([predicate evaluateWithObject: banana.rootObject]);
+    UKFalse([predicate evaluateWithObject: cherry.rootObject]);
+}
+
+- (void)testCompoundQueries
+{
+    COQuery *all = [COQuery queryMatchingAllOfQueries:
+        @[[COQuery queryWithProperty: @"label" minimumValue: @"a" maximumValue: @"b"],
+          [COQuery queryWithText: @"pie"]]];
+    COQuery *any = [COQuery queryMatchingAnyOfQueries:
+        @[[COQuery queryWithProperty: @"label" value: @"apple"],
+          [COQuery queryWithProperty: @"label" value: @"cherry"]]];
+
+    UKObjectsEqual(S(@"apple pie"), [self labelsInResults: [all resultsInEditingContext: ctx]]);
+    UKObjectsEqual(S(@"apple", @"cherry"), [self labelsInResults: [any resultsInEditingContext: ctx]]);
+}
+
+- (void)testMemoryEvaluationPreferredWhenPersistentRootsAreLoaded
+{
+    COQuery *query = [COQuery queryWithProperty: @"label" value: @"banana"];
+
+    UKFalse([query prefersStoreEvaluationInEditingContext: ctx]);
+    UKObjectsEqual(A(banana.rootObject), [query resultsInEditingContext: ctx]);
+}
+
+- (void)testMemoryEvaluationForPropertyNotIndexed
+{
+    COEditingContext *ctx2 = [COEditingContext contextWithURL: store.URL];
+    COQuery *query = [COQuery queryWithPredicate: [NSPredicate predicateWithFormat: @"label != nil"]];
+
+    UKFalse([query prefersStoreEvaluationInEditingContext: ctx2]);
+    UKIntsEqual(4, [query resultsInEditingContext: ctx2].count);
+    UKIntsEqual(3, [self numberOfLoadedPersistentRootsInEditingContext: ctx2]);
+}
+
+- (void)testPropertyQueryLoadsMatchingPersistentRootsOnly
+{
+    COEditingContext *ctx2 = [COEditingContext contextWithURL: store.URL];
+    COQuery *equality = [COQuery queryWithProperty: @"label" value: @"banana"];
+    COQuery *range = [COQuery queryWithProperty: @"label" minimumValue: @"b" maximumValue: @"c"];
+
+    UKTrue([equality prefersStoreEvaluationInEditingContext: ctx2]);
+    UKTrue([range prefersStoreEvaluationInEditingContext: ctx2]);
+
+    UKObjectsEqual(S(@"banana"), [self labelsInResults: [equality resultsInEditingContext: ctx2]]);
+    UKObjectsEqual(S(@"banana"), [self labelsInResults: [range resultsInEditingContext: ctx2]]);
+    UKIntsEqual(1, [self numberOfLoadedPersistentRootsInEditingContext: ctx2]);
+}
+
+- (void)testTextQueryLoadsMatchingPersistentRootsOnly
+{
+    COEditingContext *ctx2 = [COEditingContext contextWithURL: store.URL];
+    COQuery *query = [COQuery queryWithText: @"pie"];
+
+    UKTrue([query prefersStoreEvaluationInEditingContext: ctx2]);
+    UKObjectsEqual(S(@"apple pie"), [self labelsInResults: [query resultsInEditingContext: ctx2]]);
+    UKIntsEqual(1, [self numberOfLoadedPersistentRootsInEditingContext: ctx2]);
+}
+
+- (void)testTextQueryMatchesStoreTokenizerForNonASCIIAndPunctuatedText
+{
+    COPersistentRoot *dessert = [ctx insertNewPersistentRootWithEntityName: @"OutlineItem"];
+
+    [dessert.rootObject setLabel: @"Crème brûlée, l'été—enfin"];
+    [ctx commit];
+
+    COEditingContext *ctx2 = [COEditingContext contextWithURL: store.URL];
+    NSArray *queries = @[[COQuery queryWithText: @"CRÈME"],
+                         [COQuery queryWithText: @"brûlée!"],
+                         [COQuery queryWithText: @"l'ÉTÉ"],
+                         [COQuery queryWithText: @"été—enfin"],
+                         [COQuery queryWithText: @"enfin"]];
+    // The simple tokenizer only lowercases ASCII letters and splits on ASCII
+    // punctuation, so the em dash belongs to the word
+    NSArray *expectedMatches = @[@YES, @YES, @NO, @YES, @NO];
+
+    for (NSUInteger i = 0; i < queries.count; i++)
+    {
+        COQuery *query = queries[i];
+        BOOL expectedMatch = [expectedMatches[i] boolValue];
+
+        UKIntsEqual(expectedMatch, [query evaluateWithObject: dessert.rootObject]);
+        UKIntsEqual(expectedMatch ? 1 : 0, [query resultsInEditingContext: ctx2].count);
+    }
+}
+
+- (void)testPredicateQueryWithNilConstantIsEvaluatedInMemory
+{
+    COEditingContext *ctx2 = [COEditingContext contextWithURL: store.URL];
+    COQuery *nilConstant = [COQuery queryWithPredicate:
+        [NSPredicate predicateWithFormat: @"label == nil"]];
+    COQuery *nilInAggregate = [COQuery queryWithPredicate:
+        [NSPredicate predicateWithFormat: @"label BETWEEN {nil, 'b'}"]];
+
+    UKFalse([nilConstant prefersStoreEvaluationInEditingContext: ctx2]);
+    UKFalse([nilInAggregate prefersStoreEvaluationInEditingContext: ctx2]);
+
+    UKTrue([[nilConstant resultsInEditingContext: ctx2] isEmpty]);
+}
+
+- (void)testPredicateQueryUsesStoreIndexesForComparisons
+{
+    COEditingContext *ctx2 = [COEditingContext contextWithURL: store.URL];
+    COQuery *indexed = [COQuery queryWithPredicate:
+        [NSPredicate predicateWithFormat: @"label == 'cherry' OR label == 'banana'"]];
+    COQuery *notIndexed = [COQuery queryWithPredicate:
+        [NSPredicate predicateWithFormat: @"label CONTAINS 'err'"]];
+
+    UKTrue([indexed prefersStoreEvaluationInEditingContext: ctx2]);
+    UKFalse([notIndexed prefersStoreEvaluationInEditingContext: ctx2]);
+
+    UKObjectsEqual(S(@"banana", @"cherry"), [self labelsInResults: [indexed resultsInEditingContext: ctx2]]);
+    UKIntsEqual(2, [self numberOfLoadedPersistentRootsInEditingContext: ctx2]);
+    UKObjectsEqual(S(@"cherry"), [self labelsInResults: [notIndexed resultsInEditingContext: ctx2]]);
+}
+
+- (void)testUncommittedChangesAreSearched
+{
+    COEditingContext *ctx2 = [COEditingContext contextWithURL: store.URL];
+    COPersistentRoot *cherry2 = [ctx2 persistentRootForUUID: cherry.UUID];
+    COPersistentRoot *date = [ctx2 insertNewPersistentRootWithEntityName: @"OutlineItem"];
+    COQuery *query = [COQuery queryWithProperty: @"label" value: @"banana"];
+
+    [cherry2.rootObject setLabel: @"banana"];
+    [date.rootObject setLabel: @"banana"];
+
+    UKTrue([query prefersStoreEvaluationInEditingContext: ctx2]);
+    NSArray *persistentRoots = (id)[[[query resultsInEditingContext: ctx2] mappedCollection] persistentRoot];
+
+    UKObjectsEqual(S(banana.UUID, cherry.UUID, date.UUID),
+                   SA((id)[[persistentRoots mappedCollection] UUID]));
+}
+
+- (void)testDeletedPersistentRootsAreExcluded
+{
+    COQuery *query = [COQuery queryWithProperty: @"label" value: @"banana"];
+
+    banana.deleted = YES;
+    [ctx commit];
+
+    COEditingContext *ctx2 = [COEditingContext contextWithURL: store.URL];
+
+    UKObjectsEqual(@[], [query resultsInEditingContext: ctx]);
+    UKObjectsEqual(@[], [query resultsInEditingContext: ctx2]);
+}
+
+- (void)testEnumerationStopsLoadingPersistentRoots
+{
+    COEditingContext *ctx2 = [COEditingContext contextWithURL: store.URL];
+    COQuery *query = [COQuery queryWithPredicate: [NSPredicate predicateWithFormat: @"label != nil"]];
+    __block NSUInteger count = 0;
+
+    [query enumerateResultsInEditingContext: ctx2
+                                 usingBlock: ^(COObject *object, BOOL *stop)
+    {
+        count++;
+        *stop = YES;
+    }];
+
+    UKIntsEqual(1, count);
+    UKIntsEqual(1, [self numberOfLoadedPersistentRootsInEditingContext: ctx2]);
+}
+
+- (void)testSmartGroupQuery
+{
+    COSmartGroup *group = [ctx insertNewPersistentRootWithEntityName: @"COSmartGroup"].rootObject;
+
+    group.query = [COQuery queryWithProperty: @"label" minimumValue: @"b" maximumValue: nil];
+
+    UKObjectsEqual(S(@"banana", @"cherry"), [self labelsInResults: group.content]);
+
+    group.targetCollection = @[apple.rootObject, banana.rootObject];
+
+    UKObjectsEqual(A(banana.rootObject), group.content);
+}
+
+@end
@@ -74,6 +74,15 @@
     UKObjectsEqual(ctx.bookmarkLibrary, [ctx libraryForContentType: bookmarkType]);
 }
 
+- (void)testBookmarkURLIndexedInStore
+{
+    ETEntityDescription *bookmarkType = [ctx.modelDescriptionRepository descriptionForName: @"COBookmark"];
+
+    UKTrue([bookmarkType propertyDescriptionForName: @"URL"].indexedInStore);
+    UKFalse([bookmarkType propertyDescriptionForName: @"lastVisitedDate"].indexedInStore);
+    UKObjectsEqual(S(@"URL"), [ctx.store indexedPropertyNamesForEntityName: @"COBookmark"]);
+}
+
 - (void)testBookmarkLibrary
 {
     COLibrary *library = ctx.bookmarkLibrary;
@@ -8,6 +8,7 @@
 #import "TestCommon.h"
 #import "COItem+Binary.h"
 #import "COItem+JSON.h"
+#import "COItemShape.h"
 
 @interface TestItem : NSObject <UKTest>
 {
@@ -31,6 +32,10 @@
     NSData *data = item.dataValue;
     COItem *roundTrip = [[COItem alloc] initWithData: data];
     UKObjectsEqual(item, roundTrip);
+
+    COItem *lazyRoundTrip = [[COLazyItem alloc] initWithUUID: item.UUID data: data];
+    UKObjectsEqual(item, lazyRoundTrip);
+    UKObjectsEqual(lazyRoundTrip, item);
 }
 
 - (void)validateRoundTrips: (COItem *)item
@@ -235,6 +240,80 @@
     [self validateRoundTrips: item];
 }
 
+- (void)testLazyItemAttributeAccess
+{
+    COMutableItem *item = [COMutableItem item];
+    [item setValue: @"my name" forAttribute: @"name" type: kCOTypeString];
+    [item setValue: @[@1, @2] forAttribute: @"numbers" type: kCOTypeArray | kCOTypeInt64];
+    [item setValue: S(@"a", @"b") forAttribute: @"letters" type: kCOTypeSet | kCOTypeString];
+    [item setValue: [NSNull null] forAttribute: @"null" type: kCOTypeDouble];
+    item.entityName = @"Anonymous.Test";
+
+    COLazyItem *lazyItem = [[COLazyItem alloc] initWithUUID: item.UUID data: item.dataValue];
+
+    UKObjectsEqual(S(@"name", @"numbers", @"letters", @"null", kCOItemEntityNameProperty),
+                   SA(lazyItem.attributeNames));
+    UKObjectsEqual(@"Anonymous.Test", lazyItem.entityName);
+    UKIntsEqual(kCOTypeSet | kCOTypeString, [lazyItem typeForAttribute: @"letters"]);
+    UKObjectsEqual(S(@"a", @"b"), [lazyItem valueForAttribute: @"letters"]);
+    UKObjectsEqual([NSNull null], [lazyItem valueForAttribute: @"null"]);
+    UKIntsEqual(kCOTypeDouble, [lazyItem typeForAttribute: @"null"]);
+    UKNil([lazyItem valueForAttribute: @"missing"]);
+    UKIntsEqual(0, [lazyItem typeForAttribute: @"missing"]);
+    UKObjectsEqual(item.dataValue, lazyItem.dataValue);
+
+    COMutableItem *mutableCopy = [lazyItem mutableCopy];
+    UKObjectsEqual(@[@1, @2], [mutableCopy valueForAttribute: @"numbers"]);
+    UKObjectsEqual(item, mutableCopy);
+}
+
+- (void)testLazyItemConcurrentAccess
+{
+    COMutableItem *item = [COMutableItem item];
+    [item setValue: @"my name" forAttribute: @"name" type: kCOTypeString];
+    [item setValue: @[@1, @2] forAttribute: @"numbers" type: kCOTypeArray | kCOTypeInt64];
+    [item setValue: S(@"a", @"b") forAttribute: @"letters" type: kCOTypeSet | kCOTypeString];
+    item.entityName = @"Anonymous.Test";
+
+    for (int i = 0; i < 100; i++)
+    {
+        COLazyItem *lazyItem = [[COLazyItem alloc] initWithUUID: item.UUID data: item.dataValue];
+        __block BOOL failed = NO;
+
+        // Mix attribute accesses, which decode single attributes, with 
+        // comparisons and copies, which load all the attributes
+        dispatch_apply(8, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^(size_t j)
+        {
+            BOOL succeeded = NO;
+
+            if (j % 4 == 0)
+            {
+                succeeded = [lazyItem isEqual: item];
+            }
+            else if (j % 4 == 1)
+            {
+                succeeded = [[lazyItem mutableCopy] isEqual: item];
+            }
+            else if (j % 4 == 2)
+            {
+                succeeded = [[lazyItem valueForAttribute: @"numbers"] isEqual: @[@1, @2]];
+            }
+            else
+            {
+                succeeded = [lazyItem.dataValue isEqual: item.dataValue];
+            }
+
+            if (!succeeded)
+            {
+                failed = YES;
+            }
+        });
+
+        UKFalse(failed);
+        UKObjectsEqual(item, lazyItem);
+    }
+}
+
 - (COItem *)roundTrip: (COItem *)anItem
 {
     return [[COMutableItem alloc] initWithData: anItem.dataValue];
@@ -290,6 +369,42 @@
     UKObjectsNotEqual(immutable, mutable);
 }
 
+- (void)testShapeTransitions
+{
+    COMutableItem *item1 = [COMutableItem item];
+    COMutableItem *item2 = [COMutableItem item];
+
+    [item1 setValue: @"a" forAttribute: @"name" type: kCOTypeString];
+    [item1 setValue: @1 forAttribute: @"count" type: kCOTypeInt64];
+    [item2 setValue: @2 forAttribute: @"count" type: kCOTypeInt64];
+    [item2 setValue: @"b" forAttribute: @"name" type: kCOTypeString];
+
+    UKObjectsSame(item1.shape, item2.shape);
+    UKObjectsEqual(A(@"count", @"name"), item1.attributeNames);
+    UKObjectsEqual(@"b", [item2 valueForAttribute: @"name"]);
+
+    COItemShape *shape = item1.shape;
+
+    [item1 setValue: @"x" forAttribute: @"label" type: kCOTypeString];
+
+    UKObjectsEqual(A(@"count", @"label", @"name"), item1.attributeNames);
+    UKObjectsEqual(@1, [item1 valueForAttribute: @"count"]);
+    UKObjectsEqual(@"x", [item1 valueForAttribute: @"label"]);
+    UKObjectsEqual(@"a", [item1 valueForAttribute: @"name"]);
+
+    [item1 removeValueForAttribute: @"label"];
+
+    UKObjectsSame(shape, item1.shape);
+    UKObjectsEqual(@"a", [item1 valueForAttribute: @"name"]);
+
+    [item1 setValue: @1.5 forAttribute: @"count" type: kCOTypeDouble];
+
+    UKIntsEqual(kCOTypeDouble, [item1 typeForAttribute: @"count"]);
+    UKObjectsNotSame(shape, item1.shape);
+    UKObjectsSame(item1.shape, [[COItem alloc] initWithData: item1.dataValue].shape);
+    [self validateRoundTrips: item1];
+}
+
 - (void)testEmptySet
 {
     COMutableItem *item1 = [COMutableItem item];
@@ -156,6 +156,133 @@ static void test_read_null(void *ctx)
     co_buffer_free(&buf);
 }
 
+- (void)testVarintIntegers
+{
+    const int64_t integers[] = {
+        0, 127, -128, 32768, -32769, 2000000, INT32_MAX, (int64_t)INT32_MAX + 1,
+        -1476576000000LL, INT64_MAX, INT64_MIN
+    };
+    const char expectedTypes[] = {
+        'B', 'B', 'B', 'v', 'z', 'v', 'I', 'v', 'z', 'L', 'L'
+    };
+    const size_t count = sizeof(integers) / sizeof(int64_t);
+
+    co_buffer_t buf;
+    co_buffer_init_with_format_version(&buf, CO_BUFFER_FORMAT_VERSION_VARINT_INTEGERS);
+    co_buffer_begin_array(&buf);
+
+    NSMutableArray *expected = [NSMutableArray arrayWithObject: beginArray];
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const size_t offset = co_buffer_get_length(&buf);
+
+        co_buffer_store_integer(&buf, integers[i]);
+
+        const unsigned char *token = co_buffer_get_data(&buf) + offset;
+
+        UKIntsEqual(expectedTypes[i], token[0]);
+        UKIntsEqual(co_buffer_get_length(&buf) - offset, co_reader_length_of_token(token));
+        UKTrue(co_reader_read_integer_token(token) == integers[i]);
+
+        [expected addObject: @(integers[i])];
+    }
+
+    // Forced varint and zigzag tokens for the integers stored as fixed-width ones
+    co_buffer_store_varint_integer(&buf, 1);
+    co_buffer_store_varint_integer(&buf, -1);
+    co_buffer_store_varint_integer(&buf, INT64_MAX);
+    co_buffer_store_varint_integer(&buf, INT64_MIN);
+    [expected addObjectsFromArray: @[@(1), @(-1), @(INT64_MAX), @(INT64_MIN)]];
+
+    co_buffer_end_array(&buf);
+    [expected addObject: endArray];
+
+    co_reader_callback_t cb = {
+        test_read_int64,
+        test_read_double,
+        test_read_string,
+        test_read_uuid,
+        test_read_bytes,
+        test_read_begin_object,
+        test_read_end_object,
+        test_read_begin_array,
+        test_read_end_array,
+        test_read_null
+    };
+
+    co_reader_read(co_buffer_get_data(&buf),
+                   co_buffer_get_length(&buf),
+                   (__bridge void *)(self),
+                   cb);
+    UKObjectsEqual(expected, readObjects);
+
+    co_buffer_free(&buf);
+
+    co_buffer_init(&buf);
+    co_buffer_store_integer(&buf, INT32_MAX + 1LL);
+    UKIntsEqual('L', co_buffer_get_data(&buf)[0]);
+    co_buffer_free(&buf);
+}
+
+- (void)testBufferGrowthAndArena
+{
+    // Make room in the arena, in case other tests filled it
+    co_buffer_t other;
+    co_buffer_init_from_arena(&other, CO_BUFFER_FORMAT_VERSION_FIXED_INTEGERS);
+
+    co_buffer_t buf;
+    co_buffer_init_with_format_version(&buf, CO_BUFFER_FORMAT_VERSION_VARINT_INTEGERS);
+
+    int reallocations = 0;
+
+    // Stays below the largest buffer size kept in the arena
+    for (int i = 0; i < 20000; i++)
+    {
+        const size_t allocatedLength = buf.allocated_length;
+
+        co_buffer_store_integer(&buf, i);
+
+        if (buf.allocated_length != allocatedLength)
+        {
+            reallocations++;
+        }
+    }
+    UKTrue(reallocations < 10);
+    UKTrue(buf.allocated_length <= 2 * co_buffer_get_length(&buf));
+
+    const unsigned char *data = co_buffer_get_data(&buf);
+
+    co_buffer_return_to_arena(&buf);
+
+    // The returned memory is reused, and the buffer is reset
+    co_buffer_init_from_arena(&buf, CO_BUFFER_FORMAT_VERSION_FIXED_INTEGERS);
+
+    UKTrue(co_buffer_get_data(&buf) == data);
+    UKIntsEqual(0, co_buffer_get_length(&buf));
+    UKIntsEqual(CO_BUFFER_FORMAT_VERSION_FIXED_INTEGERS, buf.format_version);
+
+    co_buffer_return_to_arena(&buf);
+
+    // A large buffer is freed rather than kept in the arena
+    co_buffer_init_from_arena(&buf, CO_BUFFER_FORMAT_VERSION_FIXED_INTEGERS);
+
+    for (int i = 0; i < 1000000; i++)
+    {
+        co_buffer_store_integer(&buf, i);
+    }
+
+    const size_t largeLength = buf.allocated_length;
+
+    co_buffer_return_to_arena(&buf);
+    co_buffer_init_from_arena(&buf, CO_BUFFER_FORMAT_VERSION_FIXED_INTEGERS);
+
+    UKTrue(buf.allocated_length < largeLength);
+
+    co_buffer_return_to_arena(&buf);
+    co_buffer_return_to_arena(&other);
+}
+
 static volatile char dest[2048];
 
 - (void)testWritePerf
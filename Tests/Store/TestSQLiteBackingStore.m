@@ -7,6 +7,9 @@
 
 #import "TestCommon.h"
 #import "COSQLiteStorePersistentRootBackingStore.h"
+#import "CORevisionGraph.h"
+#import "COSQLiteStorePersistentRootBackingStoreBinaryFormats.h"
+#import "COItem+Binary.h"
 #import "FMDatabaseAdditions.h"
 
 #pragma mark MockStore -
@@ -14,6 +17,11 @@
 @interface MockStore : NSObject
 
 @property (nonatomic, readwrite, assign) NSUInteger maxNumberOfDeltaCommits;
+@property (nonatomic, readwrite, assign) COSQLiteStoreSnapshotPolicy snapshotPolicy;
+@property (nonatomic, readwrite, assign) NSUInteger maxNumberOfBytesInDeltaRun;
+@property (nonatomic, readwrite, assign) NSTimeInterval maxReconstructionTime;
+@property (nonatomic, readwrite, assign) COSQLiteStoreCompression commitCompression;
+@property (nonatomic, readwrite, assign) BOOL usesCompressionDictionaries;
 @property (nonatomic, readwrite, strong) FMDatabase *database;
 
 @end
@@ -21,18 +29,29 @@
 
 @implementation MockStore
 
-@synthesize maxNumberOfDeltaCommits, database;
+@synthesize maxNumberOfDeltaCommits, snapshotPolicy, maxNumberOfBytesInDeltaRun, maxReconstructionTime;
+@synthesize commitCompression, usesCompressionDictionaries, database;
 
 - (instancetype)init
 {
     SUPERINIT;
     self.maxNumberOfDeltaCommits = 4;
+    self.snapshotPolicy = COSQLiteStoreSnapshotPolicyCommitCount;
+    self.maxNumberOfBytesInDeltaRun = 64 * 1024;
+    self.maxReconstructionTime = 0.005;
+    self.commitCompression = COSQLiteStoreCompressionNone;
+    self.usesCompressionDictionaries = YES;
     // Create an in-memory DB. See https://www.sqlite.org/c3ref/open.html
     self.database = [FMDatabase databaseWithPath: @":memory:"];
     ETAssert([self.database open]);
     return self;
 }
 
+- (COSQLiteStoreBackingStoreStatistics *)statisticsForBackingStoreUUID: (ETUUID *)aUUID
+{
+    return [COSQLiteStoreBackingStoreStatistics new];
+}
+
 @end
 
 
@@ -42,6 +61,7 @@
 @interface COSQLiteStorePersistentRootBackingStore (Private)
 
 - (NSString *)tableName;
+- (NSString *)ancestryTableName;
 
 @end
 
@@ -127,13 +147,20 @@
 }
 
 - (void)commitWithGraph: (COItemGraph *)graph parent: (int64_t)parentRevid
+{
+    [self commitWithGraph: graph parent: parentRevid mergeParent: -1];
+}
+
+- (void)commitWithGraph: (COItemGraph *)graph
+                 parent: (int64_t)parentRevid
+            mergeParent: (int64_t)mergeParentRevid
 {
     ETUUID *revUUID = [ETUUID UUID];
     const BOOL ok = [backing writeItemGraph: graph
                                revisionUUID: revUUID
                                withMetadata: @{}
                                  withParent: parentRevid
-                            withMergeParent: -1
+                            withMergeParent: mergeParentRevid
                                  branchUUID: branchUUID
                          persistentrootUUID: prootUUID
                                       error: NULL];
@@ -237,4 +264,610 @@
     UKNil([[backing itemGraphForRevid: 4] itemForUUID: childitemUUID]);
 }
 
+- (void)testByteCountSnapshotPolicy
+{
+    store.snapshotPolicy = COSQLiteStoreSnapshotPolicyByteCount;
+    // Each of the commits below is the same size
+    store.maxNumberOfBytesInDeltaRun = 2 * contentsBLOBWithItemTree([self graphWithParent: @"parent0"]).length;
+
+    for (int i = 0; i < 7; i++)
+    {
+        [self commitWithGraph: [self graphWithParent: [NSString stringWithFormat: @"parent%d", i]]
+                       parent: i - 1];
+    }
+
+    UKIntsEqual(0, [backing deltabaseForRowid: 0]); // full save
+    UKIntsEqual(0, [backing deltabaseForRowid: 1]);
+    UKIntsEqual(0, [backing deltabaseForRowid: 2]);
+    UKIntsEqual(3, [backing deltabaseForRowid: 3]); // full save
+    UKIntsEqual(3, [backing deltabaseForRowid: 4]);
+    UKIntsEqual(3, [backing deltabaseForRowid: 5]);
+    UKIntsEqual(6, [backing deltabaseForRowid: 6]); // full save
+
+    UKObjectsEqual([self graphWithParent: @"parent5"], [backing itemGraphForRevid: 5]);
+}
+
+- (void)testAdaptiveSnapshotPolicy
+{
+    store.snapshotPolicy = COSQLiteStoreSnapshotPolicyAdaptive;
+
+    // Write-only usage allows longer delta runs than maxNumberOfDeltaCommits
+
+    for (int i = 0; i < 10; i++)
+    {
+        [self commitWithGraph: [self graphWithParent: [NSString stringWithFormat: @"parent%d", i]]
+                       parent: i - 1];
+    }
+
+    for (int i = 0; i < 10; i++)
+    {
+        UKIntsEqual(0, [backing deltabaseForRowid: i]);
+    }
+
+    // Read-mostly usage makes delta runs shorter
+
+    for (int i = 0; i < 100; i++)
+    {
+        [backing itemGraphForRevid: 9];
+    }
+    [self commitWithGraph: [self graphWithParent: @"parent10"] parent: 9];
+
+    UKIntsEqual(10, [backing deltabaseForRowid: 10]); // full save
+    UKObjectsEqual([self graphWithParent: @"parent10"], [backing itemGraphForRevid: 10]);
+}
+
+- (void)testCompressedCommits
+{
+    NSArray *graphs = @[[self graphWithParent: @"parent0"],
+                        [self graphWithParent: @"parent1" child: @"child1"],
+                        [self graphWithParent: @"parent2" child: @"child2"], // compressed
+                        [self graphWithParent: @"parent3" child: @"child3"],
+                        [self graphWithParent: @"parent4"], // full save
+                        [self graphWithParent: @"parent5" child: @"child5"]];
+
+    for (int i = 0; i < graphs.count; i++)
+    {
+        if (i == 2)
+        {
+            store.commitCompression = COSQLiteStoreCompressionZlib;
+        }
+        [self commitWithGraph: graphs[i] parent: i - 1];
+    }
+
+    // Uncompressed and compressed commits can be mixed in a delta run
+    for (int i = 0; i < graphs.count; i++)
+    {
+        UKObjectsEqual(graphs[i], [backing itemGraphForRevid: i]);
+    }
+
+    // The dictionary is trained on the first snapshot written with compression
+    UKNotNil([store.database dataForQuery: [NSString stringWithFormat: @"SELECT compressiondictionary FROM `metadata-%@`",
+                                                                       prootUUID]]);
+
+    // Rebuilt snapshots are compressed too
+    [backing deleteRevids: INDEXSET(1)];
+
+    UKObjectsEqual(graphs[2], [backing itemGraphForRevid: 2]);
+    UKObjectsEqual(graphs[3], [backing itemGraphForRevid: 3]);
+    UKObjectsEqual(graphs[5], [backing itemGraphForRevid: 5]);
+}
+
+- (void)testItemDirectory
+{
+    NSArray *graphs = @[[self graphWithParent: @"parent0"],
+                        [self graphWithParent: @"parent1" child: @"child1"],
+                        [self graphWithChild: @"child2"],
+                        [self graphWithParent: @"parent3"],
+                        [self graphWithParent: @"parent4"], // full save
+                        [self graphWithChild: @"child5"]];
+
+    for (int i = 0; i < graphs.count; i++)
+    {
+        [self commitWithGraph: graphs[i] parent: i - 1];
+    }
+
+    // The child is garbage in the full save at revid 4
+    UKObjectsEqual(INDEXSET(1, 2, 5), [backing revidsTouchingItemUUIDs: S(childitemUUID)]);
+    UKObjectsEqual(INDEXSET(0, 1, 3, 4), [backing revidsTouchingItemUUIDs: S(rootitemUUID)]);
+
+    [backing deleteRevids: INDEXSET(4)];
+
+    // revid 5 was rebuilt as a full snapshot (where the child is garbage too)
+    UKObjectsEqual(INDEXSET(1, 2), [backing revidsTouchingItemUUIDs: S(childitemUUID)]);
+    UKObjectsEqual(INDEXSET(0, 1, 3, 5), [backing revidsTouchingItemUUIDs: S(rootitemUUID)]);
+}
+
+#pragma mark Ancestry Index -
+
+
+/**
+ * The sample history looks like this (revids):
+ *
+ *  0 -- ... -- 19 -- 20 -- ... -- 39 ------------ 50 -- 51
+ *              \                                 /
+ *               40 -- ... -- 44 -- 45 -- ... -- 49
+ *                            \
+ *                             52
+ *
+ * 50 merges 49 into 39, 51 follows 50 and 52 branches from 44.
+ */
+- (void)commitSampleHistory
+{
+    COItemGraph *graph = [self graphWithParent: @"parent"];
+
+    for (int64_t revid = 0; revid < 40; revid++)
+    {
+        [self commitWithGraph: graph parent: revid - 1];
+    }
+    for (int64_t revid = 40; revid < 50; revid++)
+    {
+        [self commitWithGraph: graph parent: (revid == 40 ? 19 : revid - 1)];
+    }
+    [self commitWithGraph: graph parent: 39 mergeParent: 49];
+    [self commitWithGraph: graph parent: 50];
+    [self commitWithGraph: graph parent: 44];
+}
+
+- (NSIndexSet *)ancestorsOfRevid: (int64_t)aRevid inGraph: (CORevisionGraph *)graph
+{
+    NSMutableIndexSet *ancestors = [NSMutableIndexSet indexSet];
+    NSMutableArray *revids = [NSMutableArray arrayWithObject: @(aRevid)];
+
+    while (revids.count > 0)
+    {
+        const int64_t revid = [revids.lastObject longLongValue];
+
+        [revids removeLastObject];
+        if (![graph containsRevid: revid] || [ancestors containsIndex: revid])
+            continue;
+
+        [ancestors addIndex: revid];
+        [revids addObject: @([graph parentRevidForRevid: revid])];
+        [revids addObject: @([graph mergeParentRevidForRevid: revid])];
+    }
+    return ancestors;
+}
+
+- (void)checkAncestryInGraph: (CORevisionGraph *)graph
+{
+    UKIntsEqual(53, graph.count);
+    UKIntsEqual(0, [graph depthForRevid: 0]);
+    UKIntsEqual(39, [graph depthForRevid: 39]);
+    UKIntsEqual(20, [graph depthForRevid: 40]);
+    UKIntsEqual(41, [graph depthForRevid: 51]);
+
+    UKIntsEqual(19, [graph ancestorRevidForRevid: 49 atDepth: 19]);
+    UKIntsEqual(42, [graph ancestorRevidForRevid: 52 atDepth: 22]);
+    UKIntsEqual(-1, [graph ancestorRevidForRevid: 10 atDepth: 11]);
+
+    UKTrue([graph isRevid: 3 equalToOrParentOfRevid: 51]);
+    UKTrue([graph isRevid: 51 equalToOrParentOfRevid: 51]);
+    UKFalse([graph isRevid: 45 equalToOrParentOfRevid: 51]);
+    UKFalse([graph isRevid: 51 equalToOrParentOfRevid: 3]);
+
+    NSMutableArray *ancestors = [NSMutableArray array];
+
+    for (int64_t revid = 0; revid < graph.count; revid++)
+    {
+        [ancestors addObject: [self ancestorsOfRevid: revid inGraph: graph]];
+    }
+
+    // The common ancestor is the most recent revision among the ancestors of both
+    for (int64_t revid = 0; revid < graph.count; revid++)
+    {
+        for (int64_t otherRevid = 0; otherRevid < graph.count; otherRevid++)
+        {
+            NSIndexSet *otherAncestors = ancestors[otherRevid];
+            NSUInteger commonAncestor = [ancestors[revid] indexWithOptions: NSEnumerationReverse
+                                                               passingTest: ^(NSUInteger i, BOOL *stop)
+            {
+                return [otherAncestors containsIndex: i];
+            }];
+
+            UKIntsEqual((int64_t)commonAncestor, [graph commonAncestorForRevid: revid andRevid: otherRevid]);
+        }
+    }
+}
+
+- (void)testAncestryIndex
+{
+    [self commitSampleHistory];
+
+    CORevisionGraph *graph = backing.revisionGraph;
+
+    UKIntsEqual(45, [graph commonAncestorForRevid: 45 andRevid: 51]);
+    UKIntsEqual(44, [graph commonAncestorForRevid: 52 andRevid: 51]);
+    UKIntsEqual(19, [graph commonAncestorForRevid: 52 andRevid: 39]);
+
+    [self checkAncestryInGraph: graph];
+}
+
+- (void)testAncestryIndexPopulatedForExistingBackingStore
+{
+    [self commitSampleHistory];
+    UKTrue([store.database executeUpdate: [NSString stringWithFormat: @"DELETE FROM %@",
+                                                                      [backing ancestryTableName]]]);
+
+    // Without the ancestry index, the ancestry queries walk the parents
+    [self checkAncestryInGraph: backing.revisionGraph];
+
+    backing = [[COSQLiteStorePersistentRootBackingStore alloc] initWithPersistentRootUUID: prootUUID
+                                                                                    store: (COSQLiteStore *)store
+                                                                               useStoreDB: YES
+                                                                                    error: NULL];
+
+    UKIntsEqual(53, [store.database intForQuery: [NSString stringWithFormat: @"SELECT COUNT(*) FROM %@",
+                                                                             [backing ancestryTableName]]]);
+    [self checkAncestryInGraph: backing.revisionGraph];
+}
+
+- (void)testAncestryIndexAfterDeletion
+{
+    [self commitSampleHistory];
+    [backing deleteRevids: INDEXSET(2, 3, 41)];
+
+    CORevisionGraph *graph = backing.revisionGraph;
+
+    UKFalse([graph containsRevid: 41]);
+    UKIntsEqual(10, [graph ancestorRevidForRevid: 51 atDepth: 10]);
+    UKIntsEqual(-1, [graph ancestorRevidForRevid: 51 atDepth: 1]);
+    UKTrue([graph isRevid: 39 equalToOrParentOfRevid: 51]);
+    UKFalse([graph isRevid: 1 equalToOrParentOfRevid: 51]);
+    UKIntsEqual(44, [graph commonAncestorForRevid: 52 andRevid: 51]);
+    UKIntsEqual(-1, [graph commonAncestorForRevid: 52 andRevid: 39]);
+}
+
+- (void)testAncestryIndexPopulatedAfterDeletion
+{
+    [self commitSampleHistory];
+    [backing deleteRevids: INDEXSET(2, 3, 41)];
+    UKTrue([store.database executeUpdate: [NSString stringWithFormat: @"DELETE FROM %@",
+                                                                      [backing ancestryTableName]]]);
+
+    backing = [[COSQLiteStorePersistentRootBackingStore alloc] initWithPersistentRootUUID: prootUUID
+                                                                                    store: (COSQLiteStore *)store
+                                                                               useStoreDB: YES
+                                                                                    error: NULL];
+    [self commitWithGraph: [self graphWithParent: @"parent"] parent: 51];
+
+    // The revisions whose parent was deleted are not indexed as roots, but
+    // without a depth, and so are their children
+    NSString *depthQuery = [NSString stringWithFormat: @"SELECT depth FROM %@ WHERE revid = ?",
+                                                      [backing ancestryTableName]];
+
+    UKIntsEqual(0, [store.database int64ForQuery: depthQuery, @(0)]);
+    UKIntsEqual(20, [store.database int64ForQuery: depthQuery, @(40)]);
+    UKIntsEqual(-1, [store.database int64ForQuery: depthQuery, @(4)]);
+    UKIntsEqual(-1, [store.database int64ForQuery: depthQuery, @(42)]);
+    UKIntsEqual(-1, [store.database int64ForQuery: depthQuery, @(53)]);
+
+    // The ancestry queries walk the parents
+    CORevisionGraph *graph = backing.revisionGraph;
+
+    UKIntsEqual(-1, [graph depthForRevid: 4]);
+    UKIntsEqual(-1, [graph ancestorRevidForRevid: 51 atDepth: 0]);
+    UKTrue([graph isRevid: 39 equalToOrParentOfRevid: 53]);
+    UKFalse([graph isRevid: 1 equalToOrParentOfRevid: 51]);
+    UKIntsEqual(44, [graph commonAncestorForRevid: 52 andRevid: 51]);
+    UKIntsEqual(-1, [graph commonAncestorForRevid: 52 andRevid: 39]);
+}
+
+- (void)testAncestorRevids
+{
+    [self commitSampleHistory];
+
+    UKObjectsEqual(INDEXSET(0, 1, 2), [backing ancestorRevidsOfRevids: INDEXSET(2)
+                                           excludingAncestorsOfRevids: nil]);
+    UKIntsEqual(52, [backing ancestorRevidsOfRevids: INDEXSET(51)
+                         excludingAncestorsOfRevids: [NSIndexSet indexSet]].count);
+    UKObjectsEqual(INDEXSET(45, 46, 47, 48, 49, 50, 51),
+                   [backing ancestorRevidsOfRevids: INDEXSET(51)
+                        excludingAncestorsOfRevids: INDEXSET(52, 39)]);
+    UKObjectsEqual(INDEXSET(52), [backing ancestorRevidsOfRevids: INDEXSET(52, 44)
+                                          excludingAncestorsOfRevids: INDEXSET(51)]);
+
+    [backing deleteRevids: INDEXSET(2, 3, 41)];
+
+    // The walk stops at the deleted revisions
+    UKObjectsEqual(INDEXSET(42, 43, 44, 52),
+                   [backing ancestorRevidsOfRevids: INDEXSET(52, 41)
+                        excludingAncestorsOfRevids: INDEXSET(19)]);
+}
+
+- (void)testRestrictedItemGraph
+{
+    NSArray *graphs = @[[self graphWithParent: @"parent0" child: @"child0"],
+                        [self graphWithChild: @"child1"],
+                        [self graphWithParent: @"parent2" child: @"child2"],
+                        [self graphWithChild: @"child3"]];
+
+    for (int i = 0; i < graphs.count; i++)
+    {
+        [self commitWithGraph: graphs[i] parent: i - 1];
+    }
+
+    COItemGraph *childOnly = [backing itemGraphForRevid: 3 restrictToItemUUIDs: S(childitemUUID)];
+    COItemGraph *rootOnly = [backing itemGraphForRevid: 3 restrictToItemUUIDs: S(rootitemUUID)];
+    COItemGraph *rootAtRevid1 = [backing itemGraphForRevid: 1 restrictToItemUUIDs: S(rootitemUUID)];
+
+    UKObjectsEqual(A(childitemUUID), childOnly.itemUUIDs);
+    UKObjectsEqual([graphs[3] itemForUUID: childitemUUID], [childOnly itemForUUID: childitemUUID]);
+    UKObjectsEqual(A(rootitemUUID), rootOnly.itemUUIDs);
+    UKObjectsEqual([graphs[2] itemForUUID: rootitemUUID], [rootOnly itemForUUID: rootitemUUID]);
+    UKObjectsEqual([graphs[0] itemForUUID: rootitemUUID], [rootAtRevid1 itemForUUID: rootitemUUID]);
+}
+
+- (void)testItemGraphCache
+{
+    backing.maxItemGraphCacheSize = 1024 * 1024;
+
+    NSArray *graphs = @[[self graphWithParent: @"parent0"],
+                        [self graphWithParent: @"parent1" child: @"child1"],
+                        [self graphWithParent: @"parent2" child: @"child2"],
+                        [self graphWithParent: @"parent3"]];
+
+    for (int i = 0; i < graphs.count; i++)
+    {
+        [self commitWithGraph: graphs[i] parent: i - 1];
+    }
+
+    // Reconstruct each revision on top of the cached previous one
+    for (int i = 0; i < graphs.count; i++)
+    {
+        UKObjectsEqual(graphs[i], [backing itemGraphForRevid: i]);
+    }
+    // Read back cached revisions
+    for (int i = (int)graphs.count - 1; i >= 0; i--)
+    {
+        UKObjectsEqual(graphs[i], [backing itemGraphForRevid: i]);
+    }
+    UKObjectsEqual([graphs[2] itemForUUID: childitemUUID],
+                   [[backing itemGraphForRevid: 2 restrictToItemUUIDs: S(childitemUUID)] itemForUUID: childitemUUID]);
+    UKNil([[backing itemGraphForRevid: 2 restrictToItemUUIDs: S(childitemUUID)] itemForUUID: rootitemUUID]);
+
+    backing.maxItemGraphCacheSize = 0;
+
+    UKObjectsEqual(graphs[3], [backing itemGraphForRevid: 3]);
+}
+
+- (void)testItemGraphCacheWithReusedRevid
+{
+    backing.maxItemGraphCacheSize = 1024 * 1024;
+
+    COItemGraph *rootgraph = [self graphWithParent: @"parent"];
+    COItemGraph *graph1 = [self graphWithParent: @"parent 1" child: @"child 1"];
+    COItemGraph *graph1Bis = [self graphWithParent: @"parent 1 bis"];
+
+    [self commitWithGraph: rootgraph parent: -1]; // revid 0
+    [self commitWithGraph: graph1 parent: 0];     // revid 1
+
+    UKObjectsEqual(graph1, [backing itemGraphForRevid: 1]);
+
+    [backing deleteRevids: INDEXSET(1)];
+    [self commitWithGraph: graph1Bis parent: 0];  // revid 1 again
+
+    UKObjectsEqual(graph1Bis, [backing itemGraphForRevid: 1]);
+}
+
+
+#pragma mark Combined Commit Data Formats -
+
+
+- (NSArray *)sortedUUIDs: (NSArray *)uuids
+{
+    return [uuids sortedArrayUsingComparator: ^(id obj1, id obj2)
+    {
+        int result = memcmp([obj1 UUIDValue], [obj2 UUIDValue], 16);
+        return (result < 0) ? NSOrderedAscending : ((result == 0) ? NSOrderedSame : NSOrderedDescending);
+    }];
+}
+
+- (NSData *)directoryCommitDataWithItems: (NSArray *)items
+{
+    NSMutableDictionary *itemsByUUID = [NSMutableDictionary dictionary];
+
+    for (COItem *item in items)
+    {
+        itemsByUUID[item.UUID] = item;
+    }
+
+    NSArray *sortedUUIDs = [self sortedUUIDs: itemsByUUID.allKeys];
+    NSMutableArray *itemDataArray = [NSMutableArray array];
+
+    for (ETUUID *uuid in sortedUUIDs)
+    {
+        [itemDataArray addObject: [itemsByUUID[uuid] dataValue]];
+    }
+    return CombinedCommitDataWithUUIDsAndItemData(sortedUUIDs, itemDataArray);
+}
+
+- (NSData *)legacyCommitDataWithItems: (NSArray *)items
+{
+    NSMutableData *result = [NSMutableData data];
+
+    for (COItem *item in items)
+    {
+        AddCommitUUIDAndDataToCombinedCommitData(result, item.UUID, item.dataValue);
+    }
+    return result;
+}
+
+- (void)testParseLegacyCommitData
+{
+    COItem *parent = [self parentItem: @"parent" referenceChildren: YES];
+    COItem *child = [self childItem: @"child"];
+    NSData *commitData = [self legacyCommitDataWithItems: @[parent, child]];
+    NSMutableDictionary *dataForUUID = [NSMutableDictionary dictionary];
+
+    ParseCombinedCommitDataInToUUIDToItemDataDictionary(dataForUUID, commitData, NO, nil);
+
+    UKObjectsEqual(S(rootitemUUID, childitemUUID), SA(dataForUUID.allKeys));
+    UKObjectsEqual(parent.dataValue, dataForUUID[rootitemUUID]);
+    UKObjectsEqual(child.dataValue, dataForUUID[childitemUUID]);
+}
+
+- (void)testParseDirectoryCommitData
+{
+    COItem *parent = [self parentItem: @"parent" referenceChildren: YES];
+    COItem *child = [self childItem: @"child"];
+    NSData *commitData = [self directoryCommitDataWithItems: @[parent, child]];
+    NSMutableDictionary *dataForUUID = [NSMutableDictionary dictionary];
+
+    ParseCombinedCommitDataInToUUIDToItemDataDictionary(dataForUUID, commitData, NO, nil);
+
+    UKObjectsEqual(S(rootitemUUID, childitemUUID), SA(dataForUUID.allKeys));
+    UKObjectsEqual(parent.dataValue, dataForUUID[rootitemUUID]);
+    UKObjectsEqual(child.dataValue, dataForUUID[childitemUUID]);
+}
+
+- (void)testParseDirectoryCommitDataRestrictedToItems
+{
+    NSMutableArray *items = [NSMutableArray array];
+
+    for (int i = 0; i < 20; i++)
+    {
+        COMutableItem *item = [COMutableItem item];
+        [item setValue: @(i) forAttribute: @"number" type: kCOTypeInt64];
+        [items addObject: item];
+    }
+
+    NSData *commitData = [self directoryCommitDataWithItems: items];
+    ETUUID *missingUUID = [ETUUID UUID];
+    NSMutableDictionary *dataForUUID = [NSMutableDictionary dictionary];
+
+    ParseCombinedCommitDataInToUUIDToItemDataDictionary(dataForUUID,
+                                                        commitData,
+                                                        NO,
+                                                        S([items[0] UUID], [items[19] UUID], missingUUID));
+
+    UKObjectsEqual(S([items[0] UUID], [items[19] UUID]), SA(dataForUUID.allKeys));
+    UKObjectsEqual([items[0] dataValue], dataForUUID[[items[0] UUID]]);
+    UKObjectsEqual([items[19] dataValue], dataForUUID[[items[19] UUID]]);
+}
+
+- (NSData *)stringTableCommitDataWithItems: (NSArray *)items
+{
+    NSMutableDictionary *itemsByUUID = [NSMutableDictionary dictionary];
+
+    for (COItem *item in items)
+    {
+        itemsByUUID[item.UUID] = item;
+    }
+    return CombinedCommitDataWithItems([itemsByUUID objectsForKeys: [self sortedUUIDs: itemsByUUID.allKeys]
+                                                     notFoundMarker: [NSNull null]]);
+}
+
+- (void)testParseStringTableCommitData
+{
+    COMutableItem *parent = (COMutableItem *)[self parentItem: @"parent" referenceChildren: YES];
+    COMutableItem *child = (COMutableItem *)[self childItem: @"child"];
+
+    parent.entityName = @"Anonymous.OutlineItem";
+    child.entityName = @"Anonymous.OutlineItem";
+
+    NSData *commitData = [self stringTableCommitDataWithItems: @[parent, child]];
+    NSMutableDictionary *dataForUUID = [NSMutableDictionary dictionary];
+
+    UKTrue(commitData.length < [self directoryCommitDataWithItems: @[parent, child]].length);
+
+    ParseCombinedCommitDataInToUUIDToItemDataDictionary(dataForUUID, commitData, NO, nil);
+
+    UKObjectsEqual(S(rootitemUUID, childitemUUID), SA(dataForUUID.allKeys));
+    UKNotNil(StringTableForItemData(dataForUUID[rootitemUUID]));
+    UKObjectsSame(StringTableForItemData(dataForUUID[rootitemUUID]),
+                  StringTableForItemData(dataForUUID[childitemUUID]));
+
+    COLazyItem *lazyParent = [[COLazyItem alloc] initWithUUID: rootitemUUID data: dataForUUID[rootitemUUID]];
+    COLazyItem *lazyChild = [[COLazyItem alloc] initWithUUID: childitemUUID data: dataForUUID[childitemUUID]];
+    COItem *decodedChild = [[COItem alloc] initWithData: dataForUUID[childitemUUID]];
+
+    UKObjectsEqual(@"Anonymous.OutlineItem", lazyChild.entityName);
+    UKObjectsEqual(parent, lazyParent);
+    UKObjectsEqual(child, lazyChild);
+    UKObjectsEqual(child, decodedChild);
+
+    /* The strings are shared between the items */
+    UKObjectsSame(lazyParent.entityName, lazyChild.entityName);
+    UKObjectsSame(lazyParent.entityName, decodedChild.entityName);
+
+    /* The item data is self-contained once copied out of the commit data */
+    UKObjectsEqual(parent.dataValue, lazyParent.dataValue);
+    UKObjectsEqual(child.dataValue, lazyChild.dataValue);
+
+    /* Rewriting the lazy items with a new string table (e.g. for a snapshot) */
+    NSData *rewrittenCommitData = [self stringTableCommitDataWithItems: @[lazyParent, lazyChild]];
+
+    UKObjectsEqual(commitData, rewrittenCommitData);
+}
+
+- (void)testParseStringTableCommitDataRun
+{
+    COItem *parent1 = [self parentItem: @"parent 1" referenceChildren: YES];
+    COItem *child1 = [self childItem: @"child 1"];
+    COItem *child2 = [self childItem: @"child 2"];
+    NSArray *run = @[[self stringTableCommitDataWithItems: @[child2]],
+                     [self directoryCommitDataWithItems: @[parent1, child1]]];
+    NSMutableDictionary *dataForUUID = [NSMutableDictionary dictionary];
+
+    ParseCombinedCommitDataRunInToUUIDToItemDataDictionary(dataForUUID, run);
+
+    UKObjectsEqual(S(rootitemUUID, childitemUUID), SA(dataForUUID.allKeys));
+    UKNil(StringTableForItemData(dataForUUID[rootitemUUID]));
+    UKNotNil(StringTableForItemData(dataForUUID[childitemUUID]));
+    UKObjectsEqual(parent1, [[COItem alloc] initWithData: dataForUUID[rootitemUUID]]);
+    UKObjectsEqual(child2, [[COItem alloc] initWithData: dataForUUID[childitemUUID]]);
+}
+
+- (void)testCompressedCommitData
+{
+    COItem *parent = [self parentItem: @"parent" referenceChildren: YES];
+    COItem *child = [self childItem: @"child"];
+    NSData *commitData = [self directoryCommitDataWithItems: @[parent, child]];
+    NSData *dictionary = CompressionDictionaryWithItemData(@[parent.dataValue, child.dataValue], 1024);
+
+    UKNotNil(dictionary);
+    UKFalse(IsCompressedCommitData(commitData));
+    UKFalse(IsCompressedCommitData([self legacyCommitDataWithItems: @[parent, child]]));
+    UKObjectsSame(commitData, UncompressedCommitData(commitData, nil));
+
+    NSData *compressed = CompressedCommitData(commitData, nil);
+    NSData *compressedWithDictionary = CompressedCommitData(commitData, dictionary);
+
+    UKTrue(IsCompressedCommitData(compressed));
+    UKTrue(IsCompressedCommitData(compressedWithDictionary));
+    UKTrue(compressedWithDictionary.length < compressed.length);
+    UKObjectsEqual(commitData, UncompressedCommitData(compressed, nil));
+    UKObjectsEqual(commitData, UncompressedCommitData(compressedWithDictionary, dictionary));
+    UKRaisesException(UncompressedCommitData(compressedWithDictionary, nil));
+
+    NSData *otherDictionary = CompressionDictionaryWithItemData(@[[self childItem: @"other"].dataValue], 1024);
+
+    UKRaisesException(UncompressedCommitData(compressedWithDictionary, otherDictionary));
+}
+
+- (void)testParseCommitDataRun
+{
+    COItem *parent1 = [self parentItem: @"parent 1" referenceChildren: YES];
+    COItem *child1 = [self childItem: @"child 1"];
+    COItem *parent2 = [self parentItem: @"parent 2" referenceChildren: YES];
+    COItem *child3 = [self childItem: @"child 3"];
+    NSArray *directoryRun = @[[self directoryCommitDataWithItems: @[child3]],
+                              [self directoryCommitDataWithItems: @[parent2]],
+                              [self directoryCommitDataWithItems: @[parent1, child1]]];
+    NSArray *mixedRun = @[directoryRun[0],
+                          [self legacyCommitDataWithItems: @[parent2]],
+                          directoryRun[2]];
+
+    for (NSArray *run in @[directoryRun, mixedRun])
+    {
+        NSMutableDictionary *dataForUUID = [NSMutableDictionary dictionary];
+
+        ParseCombinedCommitDataRunInToUUIDToItemDataDictionary(dataForUUID, run);
+
+        UKObjectsEqual(S(rootitemUUID, childitemUUID), SA(dataForUUID.allKeys));
+        UKObjectsEqual(parent2.dataValue, dataForUUID[rootitemUUID]);
+        UKObjectsEqual(child3.dataValue, dataForUUID[childitemUUID]);
+    }
+}
+
 @end
@@ -7,6 +7,7 @@
 
 #import "TestCommon.h"
 #import "FMDatabaseAdditions.h"
+#import "COSQLiteStorePersistentRootBackingStore.h"
 
 /**
  * For each execution of a test method, the store is recreated and a persistent root
@@ -689,6 +690,83 @@ static ETUUID *childUUID2;
     UKObjectsEqual(proot.currentBranchUUID, info.branchUUID);
 }
 
+- (void)testRevisionGraph
+{
+    CORevisionGraph *graph = [store revisionGraphForPersistentRootUUID: prootUUID];
+    NSArray *infos = [store revisionInfosForBackingStoreOfPersistentRootUUID: prootUUID];
+
+    UKIntsEqual(1 + 2 * BRANCH_LENGTH, infos.count);
+
+    for (CORevisionInfo *info in infos)
+    {
+        int64_t revid = [graph revidForRevisionUUID: info.revisionUUID];
+
+        UKTrue([graph containsRevid: revid]);
+        UKObjectsEqual(info.revisionUUID, [graph revisionUUIDForRevid: revid]);
+        if (info.parentRevisionUUID == nil)
+        {
+            UKIntsEqual(-1, [graph parentRevidForRevid: revid]);
+        }
+        else
+        {
+            UKObjectsEqual(info.parentRevisionUUID,
+                           [graph revisionUUIDForRevid: [graph parentRevidForRevid: revid]]);
+        }
+        UKIntsEqual(-1, [graph mergeParentRevidForRevid: revid]);
+        UKObjectsEqual(info.branchUUID, [graph branchUUIDForRevid: revid]);
+        UKObjectsEqual(prootUUID, [graph persistentRootUUIDForRevid: revid]);
+        UKObjectsEqual(info.date, [graph dateForRevid: revid]);
+    }
+
+    UKIntsEqual(-1, [graph revidForRevisionUUID: [ETUUID UUID]]);
+    UKNil([store revisionGraphForPersistentRootUUID: [ETUUID UUID]]);
+}
+
+- (void)testUpdateRevisionGraph
+{
+    CORevisionGraph *graph = [store revisionGraphForPersistentRootUUID: prootUUID];
+    const int64_t count = graph.count;
+    ETUUID *lastRevisionUUID = [graph revisionUUIDForRevid: count - 1];
+    ETUUID *revision = [ETUUID UUID];
+
+    COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+    [txn writeRevisionWithModifiedItems: [self itemTreeWithChildNameChange: @"updated"]
+                           revisionUUID: revision
+                               metadata: nil
+                       parentRevisionID: initialRevisionUUID
+                  mergeParentRevisionID: nil
+                     persistentRootUUID: prootUUID
+                             branchUUID: initialBranchUUID];
+    [self updateChangeCountAndCommitTransaction: txn];
+
+    UKTrue([store updateRevisionGraph: graph forPersistentRootUUID: prootUUID]);
+    UKIntsEqual(count + 1, graph.count);
+    UKObjectsEqual(lastRevisionUUID, [graph revisionUUIDForRevid: count - 1]);
+    UKObjectsEqual(revision, [graph revisionUUIDForRevid: count]);
+    UKObjectsEqual(initialRevisionUUID, [graph revisionUUIDForRevid: [graph parentRevidForRevid: count]]);
+
+    // Nothing new
+    UKTrue([store updateRevisionGraph: graph forPersistentRootUUID: prootUUID]);
+    UKIntsEqual(count + 1, graph.count);
+
+    UKFalse([store updateRevisionGraph: graph forPersistentRootUUID: [ETUUID UUID]]);
+}
+
+- (void)testRevisionUUIDsOfAncestors
+{
+    NSSet *ancestors = [store revisionUUIDsOfAncestorsOfRevisionUUIDs: S([self lateBranchA], [ETUUID UUID])
+                                    excludingAncestorsOfRevisionUUIDs: nil
+                                                   persistentRootUUID: prootUUID];
+    NSSet *lateAncestors = [store revisionUUIDsOfAncestorsOfRevisionUUIDs: S([self lateBranchA], [self lateBranchB])
+                                        excludingAncestorsOfRevisionUUIDs: S([self earlyBranchA], [self earlyBranchB])
+                                                       persistentRootUUID: prootUUID];
+
+    UKObjectsEqual(SA([[branchARevisionUUIDs subarrayWithRange: NSMakeRange(0, BRANCH_LATER + 1)]
+                          arrayByAddingObject: initialRevisionUUID]),
+                   ancestors);
+    UKObjectsEqual(S([self lateBranchA], [self lateBranchB]), lateAncestors);
+}
+
 - (void)checkHasTables: (BOOL)flag forUUID: (ETUUID *)aUUID
 {
 #if BACKING_STORES_SHARE_SAME_SQLITE_DB == 1
@@ -697,16 +775,22 @@ static ETUUID *childUUID2;
         {
             const BOOL hasCommitsTable = [store.database tableExists: [NSString stringWithFormat: @"commits-%@", aUUID]];
             const BOOL hasMetadataTable = [store.database tableExists: [NSString stringWithFormat: @"metadata-%@", aUUID]];
+            const BOOL hasItemsTable = [store.database tableExists: [NSString stringWithFormat: @"items-%@", aUUID]];
+            const BOOL hasAncestryTable = [store.database tableExists: [NSString stringWithFormat: @"ancestry-%@", aUUID]];
 
             if (flag)
             {
                 UKTrue(hasCommitsTable);
                 UKTrue(hasMetadataTable);
+                UKTrue(hasItemsTable);
+                UKTrue(hasAncestryTable);
             }
             else
             {
                 UKFalse(hasCommitsTable);
                 UKFalse(hasMetadataTable);
+                UKFalse(hasItemsTable);
+                UKFalse(hasAncestryTable);
             }
         }];
 #endif
@@ -986,6 +1070,91 @@ static ETUUID *childUUID2;
     UKNil([store persistentRootInfoForUUID: nil]);
 }
 
+- (ETUUID *)commitNewPersistentRoot
+{
+    COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+    COPersistentRootInfo *info = [txn createPersistentRootWithInitialItemGraph: [self makeInitialItemTree]
+                                                                          UUID: [ETUUID UUID]
+                                                                    branchUUID: [ETUUID UUID]
+                                                              revisionMetadata: nil];
+    UKTrue([store commitStoreTransaction: txn]);
+    return info.UUID;
+}
+
+- (void)checkPersistentRootInfo: (COPersistentRootInfo *)info
+    equalsPersistentRootInfo: (COPersistentRootInfo *)expectedInfo
+{
+    UKObjectsEqual(expectedInfo.UUID, info.UUID);
+    UKObjectsEqual(expectedInfo.currentBranchUUID, info.currentBranchUUID);
+    UKObjectsEqual(expectedInfo.branchUUIDs, info.branchUUIDs);
+    UKIntsEqual(expectedInfo.deleted, info.deleted);
+    UKIntsEqual(expectedInfo.transactionID, info.transactionID);
+    UKObjectsEqual(expectedInfo.metadata, info.metadata);
+
+    for (ETUUID *branchUUID in expectedInfo.branchUUIDs)
+    {
+        COBranchInfo *branchInfo = [info branchInfoForUUID: branchUUID];
+        COBranchInfo *expectedBranchInfo = [expectedInfo branchInfoForUUID: branchUUID];
+
+        UKObjectsEqual(expectedBranchInfo.persistentRootUUID, branchInfo.persistentRootUUID);
+        UKObjectsEqual(expectedBranchInfo.currentRevisionUUID, branchInfo.currentRevisionUUID);
+        UKObjectsEqual(expectedBranchInfo.headRevisionUUID, branchInfo.headRevisionUUID);
+        UKObjectsEqual(expectedBranchInfo.metadata, branchInfo.metadata);
+    }
+}
+
+- (void)testPersistentRootInfosForUUIDs
+{
+    ETUUID *otherUUID = [self commitNewPersistentRoot];
+    NSArray *infos = [store persistentRootInfosForUUIDs: @[otherUUID, [ETUUID UUID], prootUUID]];
+
+    UKIntsEqual(2, infos.count);
+    [self checkPersistentRootInfo: infos[0]
+         equalsPersistentRootInfo: [store persistentRootInfoForUUID: otherUUID]];
+    [self checkPersistentRootInfo: infos[1]
+         equalsPersistentRootInfo: [store persistentRootInfoForUUID: prootUUID]];
+
+    UKObjectsEqual(@[], [store persistentRootInfosForUUIDs: @[]]);
+}
+
+- (void)testPersistentRootInfosForManyUUIDs
+{
+    NSMutableArray *UUIDs = [NSMutableArray new];
+
+    for (int i = 0; i < 1200; i++)
+    {
+        [UUIDs addObject: (i == 700) ? prootUUID : [ETUUID UUID]];
+    }
+
+    NSArray *infos = [store persistentRootInfosForUUIDs: UUIDs];
+
+    UKIntsEqual(1, infos.count);
+    [self checkPersistentRootInfo: infos.firstObject
+         equalsPersistentRootInfo: [store persistentRootInfoForUUID: prootUUID]];
+}
+
+- (void)testAllPersistentRootInfos
+{
+    ETUUID *deletedUUID = [self commitNewPersistentRoot];
+    {
+        COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+        [txn deletePersistentRoot: deletedUUID];
+        UKTrue([store commitStoreTransaction: txn]);
+    }
+
+    NSArray *infos = store.persistentRootInfos;
+    NSArray *deletedInfos = store.deletedPersistentRootInfos;
+
+    UKIntsEqual(1, infos.count);
+    [self checkPersistentRootInfo: infos.firstObject
+         equalsPersistentRootInfo: [store persistentRootInfoForUUID: prootUUID]];
+
+    UKIntsEqual(1, deletedInfos.count);
+    [self checkPersistentRootInfo: deletedInfos.firstObject
+         equalsPersistentRootInfo: [store persistentRootInfoForUUID: deletedUUID]];
+    UKTrue([deletedInfos.firstObject isDeleted]);
+}
+
 - (void)testDuplicateBranchesDisallowed
 {
     COStoreTransaction *txn = [[COStoreTransaction alloc] init];
@@ -1191,4 +1360,540 @@ static ETUUID *childUUID2;
 
 }
 
+- (void)testAsynchronousPersistentRootInfo
+{
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+    __block COPersistentRootInfo *info = nil;
+    __block BOOL calledOnMainThread = YES;
+
+    [store persistentRootInfoForUUID: prootUUID
+                   completionHandler: ^(COPersistentRootInfo *anInfo)
+    {
+        info = anInfo;
+        calledOnMainThread = [NSThread isMainThread];
+        dispatch_semaphore_signal(done);
+    }];
+    dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+
+    UKFalse(calledOnMainThread);
+    UKObjectsEqual(prootUUID, info.UUID);
+    UKObjectsEqual(initialBranchUUID, info.currentBranchUUID);
+    UKObjectsEqual([store persistentRootInfoForUUID: prootUUID].branchUUIDs, info.branchUUIDs);
+}
+
+- (void)testAsynchronousRevisionInfosAndItemGraph
+{
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+    __block NSArray *revInfos = nil;
+    __block COItemGraph *itemGraph = nil;
+
+    [store revisionInfosForBranchUUID: branchAUUID
+                              options: COBranchRevisionReadingDefault
+                    completionHandler: ^(NSArray *revisionInfos)
+    {
+        revInfos = revisionInfos;
+        dispatch_semaphore_signal(done);
+    }];
+    [store itemGraphForRevisionUUID: [self lateBranchA]
+                     persistentRoot: prootUUID
+                  completionHandler: ^(COItemGraph *anItemGraph)
+    {
+        itemGraph = anItemGraph;
+        dispatch_semaphore_signal(done);
+    }];
+    dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+    dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+
+    UKObjectsEqual([store revisionInfosForBranchUUID: branchAUUID
+                                             options: COBranchRevisionReadingDefault],
+                   revInfos);
+    UKTrue(COItemGraphEqualToItemGraph([self makeBranchAItemTreeAtIndex: BRANCH_LATER], itemGraph));
+}
+
+- (void)testAsynchronousReadsOfMissingPersistentRoot
+{
+    dispatch_semaphore_t done = dispatch_semaphore_create(0);
+    __block id info = @"";
+    __block id revInfos = @"";
+    __block id itemGraph = @"";
+
+    [store persistentRootInfoForUUID: [ETUUID UUID]
+                   completionHandler: ^(COPersistentRootInfo *anInfo)
+    {
+        info = anInfo;
+        dispatch_semaphore_signal(done);
+    }];
+    [store revisionInfosForBranchUUID: [ETUUID UUID]
+                              options: COBranchRevisionReadingDefault
+                    completionHandler: ^(NSArray *revisionInfos)
+    {
+        revInfos = revisionInfos;
+        dispatch_semaphore_signal(done);
+    }];
+    [store itemGraphForRevisionUUID: [ETUUID UUID]
+                     persistentRoot: prootUUID
+                  completionHandler: ^(COItemGraph *anItemGraph)
+    {
+        itemGraph = anItemGraph;
+        dispatch_semaphore_signal(done);
+    }];
+    for (int i = 0; i < 3; i++)
+    {
+        dispatch_semaphore_wait(done, DISPATCH_TIME_FOREVER);
+    }
+
+    UKNil(info);
+    UKNil(revInfos);
+    UKNil(itemGraph);
+}
+
+- (void)testConcurrentReadsWithSingleReader
+{
+    store.maxNumberOfReaders = 1;
+
+    dispatch_group_t group = dispatch_group_create();
+    NSMutableDictionary *itemGraphs = [NSMutableDictionary new];
+
+    for (ETUUID *revUUID in branchARevisionUUIDs)
+    {
+        dispatch_group_enter(group);
+        [store itemGraphForRevisionUUID: revUUID
+                         persistentRoot: prootUUID
+                      completionHandler: ^(COItemGraph *itemGraph)
+        {
+            @synchronized (itemGraphs)
+            {
+                itemGraphs[revUUID] = itemGraph;
+            }
+            dispatch_group_leave(group);
+        }];
+    }
+    dispatch_group_wait(group, DISPATCH_TIME_FOREVER);
+
+    UKIntsEqual(BRANCH_LENGTH, itemGraphs.count);
+    for (int i = 0; i < BRANCH_LENGTH; i++)
+    {
+        UKTrue(COItemGraphEqualToItemGraph([self makeBranchAItemTreeAtIndex: i],
+                                           itemGraphs[branchARevisionUUIDs[i]]));
+    }
+}
+
+- (void)testReadsThroughReadersCountInAdaptiveSnapshotPolicy
+{
+    store.snapshotPolicy = COSQLiteStoreSnapshotPolicyAdaptive;
+    store.maxNumberOfDeltaCommits = 4;
+
+    // Reconstructed by the reader backing stores, not the store one
+    for (int i = 0; i < 100; i++)
+    {
+        [store itemGraphForRevisionUUID: [self lateBranchA] persistentRoot: prootUUID];
+    }
+
+    COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+    ETUUID *revUUID = [ETUUID UUID];
+
+    [txn writeRevisionWithModifiedItems: [self makeBranchAItemTreeAtIndex: BRANCH_LENGTH]
+                           revisionUUID: revUUID
+                               metadata: [self branchAMetadata]
+                       parentRevisionID: branchARevisionUUIDs.lastObject
+                  mergeParentRevisionID: nil
+                     persistentRootUUID: prootUUID
+                             branchUUID: branchAUUID];
+    [self updateChangeCountAndCommitTransaction: txn];
+
+    // Read-mostly usage makes delta runs shorter
+    [store testingRunBlockInStoreQueue: ^()
+    {
+        COSQLiteStorePersistentRootBackingStore *backing =
+            [store backingStoreForPersistentRootUUID: prootUUID createIfNotPresent: NO];
+        const int64_t revid = [backing revidForUUID: revUUID];
+
+        UKIntsEqual(revid, [backing deltabaseForRowid: revid]); // full save
+    }];
+    UKTrue(COItemGraphEqualToItemGraph([self makeBranchAItemTreeAtIndex: BRANCH_LENGTH],
+                                       [store itemGraphForRevisionUUID: revUUID persistentRoot: prootUUID]));
+}
+
+- (void)testGroupCommit
+{
+    const int numberOfThreads = 8;
+    __block int numberOfSucceededCommits = 0;
+    __block BOOL staleCommitSucceeded = YES;
+    NSMutableArray *insertedUUIDs = [NSMutableArray new];
+
+    store.groupsCommits = YES;
+
+    [self checkBlock: ^()
+    {
+        dispatch_queue_t queue = dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0);
+        dispatch_group_t group = dispatch_group_create();
+
+        for (int i = 0; i < numberOfThreads; i++)
+        {
+            dispatch_group_async(group, queue, ^()
+            {
+                COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+                COPersistentRootInfo *info = [txn createPersistentRootWithInitialItemGraph: [self makeInitialItemTree]
+                                                                                      UUID: [ETUUID UUID]
+                                                                                branchUUID: [ETUUID UUID]
+                                                                          revisionMetadata: nil];
+                const BOOL ok = [store commitStoreTransaction: txn];
+
+                @synchronized (insertedUUIDs)
+                {
+                    if (ok)
+                    {
+                        numberOfSucceededCommits++;
+                        [insertedUUIDs addObject: info.UUID];
+                    }
+                }
+            });
+        }
+
+        // Fails due to the transaction ID mismatch, without affecting the other commits
+        dispatch_group_async(group, queue, ^()
+        {
+            COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+            [txn setCurrentBranch: branchAUUID
+                forPersistentRoot: prootUUID];
+            [txn setOldTransactionID: prootChangeCount - 1 forPersistentRoot: prootUUID];
+
+            staleCommitSucceeded = [store commitStoreTransaction: txn];
+        });
+
+        // The commit notifications are posted on the main thread
+        while (dispatch_group_wait(group, DISPATCH_TIME_NOW) != 0)
+        {
+            [[NSRunLoop currentRunLoop] runUntilDate: [NSDate dateWithTimeIntervalSinceNow: 0.01]];
+        }
+    }
+     postsNotification: COStorePersistentRootsDidChangeNotification
+             withCount: numberOfThreads
+            fromObject: store
+          withUserInfo: nil];
+
+    UKIntsEqual(numberOfThreads, numberOfSucceededCommits);
+    UKFalse(staleCommitSucceeded);
+    UKObjectsEqual(initialBranchUUID, [store persistentRootInfoForUUID: prootUUID].currentBranchUUID);
+
+    for (ETUUID *uuid in insertedUUIDs)
+    {
+        UKTrue(COItemGraphEqualToItemGraph([self makeInitialItemTree],
+                                           [self currentItemGraphForPersistentRoot: uuid]));
+    }
+}
+
+- (void)testGroupCommitAfterRolledBackCompressionDictionary
+{
+    ETUUID *newUUID = [ETUUID UUID];
+
+    store.commitCompression = COSQLiteStoreCompressionZlib;
+
+    // Trains a compression dictionary for the new backing store, then fails
+    // since the branch already exists
+    COStoreTransaction *failingTxn = [[COStoreTransaction alloc] init];
+    [failingTxn createPersistentRootWithInitialItemGraph: [self makeInitialItemTree]
+                                                    UUID: newUUID
+                                              branchUUID: [ETUUID UUID]
+                                        revisionMetadata: nil];
+    [failingTxn createBranchWithUUID: branchAUUID
+                        parentBranch: nil
+                     initialRevision: initialRevisionUUID
+                   forPersistentRoot: newUUID];
+
+    // Recreates the same backing store in the same group
+    COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+    COPersistentRootInfo *info = [txn createPersistentRootWithInitialItemGraph: [self makeBranchAItemTreeAtIndex: 0]
+                                                                          UUID: newUUID
+                                                                    branchUUID: [ETUUID UUID]
+                                                              revisionMetadata: nil];
+
+    UKObjectsEqual(@[@NO, @YES], [store testingCommitStoreTransactionsInGroup: @[failingTxn, txn]]);
+
+    __block NSData *dictionary = nil;
+
+    [store testingRunBlockInStoreQueue: ^()
+    {
+        dictionary = [store.database dataForQuery: [NSString stringWithFormat: @"SELECT compressiondictionary FROM `metadata-%@`",
+                                                                               newUUID]];
+    }];
+    UKNotNil(dictionary);
+    UKTrue(COItemGraphEqualToItemGraph([self makeBranchAItemTreeAtIndex: 0],
+                                       [store itemGraphForRevisionUUID: info.currentRevisionUUID
+                                                        persistentRoot: newUUID]));
+}
+
+#pragma mark - Property Indexes
+
+- (ETUUID *)commitIndexedChildName: (NSString *)aName
+                    parentRevision: (ETUUID *)aParentRevision
+{
+    COItemGraph *itemGraph = [self itemTreeWithChildNameChange: aName];
+    ETUUID *revision = [ETUUID UUID];
+
+    ((COMutableItem *)[itemGraph itemForUUID: childUUID1]).entityName = @"Child";
+
+    COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+    [txn writeRevisionWithModifiedItems: itemGraph
+                           revisionUUID: revision
+                               metadata: nil
+                       parentRevisionID: aParentRevision
+                  mergeParentRevisionID: nil
+                     persistentRootUUID: prootUUID
+                             branchUUID: initialBranchUUID];
+    [txn setCurrentRevision: revision
+               headRevision: revision
+                  forBranch: initialBranchUUID
+           ofPersistentRoot: prootUUID];
+    [self updateChangeCountAndCommitTransaction: txn];
+
+    return revision;
+}
+
+- (void)testIndexedPropertyValues
+{
+    [store setIndexedPropertyNames: S(@"name") forEntityName: @"Child"];
+
+    UKObjectsEqual(S(@"name"), [store indexedPropertyNamesForEntityName: @"Child"]);
+    UKTrue([[store indexedPropertyNamesForEntityName: @"Root"] isEmpty]);
+
+    ETUUID *revision = [self commitIndexedChildName: @"b" parentRevision: initialRevisionUUID];
+    NSArray *results = [store searchResultsForProperty: @"name" value: @"b"];
+
+    UKIntsEqual(1, results.count);
+    UKObjectsEqual(prootUUID, [results.firstObject persistentRoot]);
+    UKObjectsEqual(revision, [results.firstObject revision]);
+    UKObjectsEqual(childUUID1, [results.firstObject innerObjectUUID]);
+
+    // The root item has no entity name
+    UKTrue([[store searchResultsForProperty: @"name" value: @"root"] isEmpty]);
+
+    UKIntsEqual(1, [store searchResultsForProperty: @"name" minimumValue: @"a" maximumValue: @"c"].count);
+    UKIntsEqual(1, [store searchResultsForProperty: @"name" minimumValue: @"b" maximumValue: nil].count);
+    UKIntsEqual(1, [store searchResultsForProperty: @"name" minimumValue: nil maximumValue: @"b"].count);
+    UKTrue([[store searchResultsForProperty: @"name" minimumValue: @"c" maximumValue: nil] isEmpty]);
+}
+
+- (void)testIndexedPropertyValuesFilteredByEntityName
+{
+    [store setIndexedPropertyNames: S(@"name") forEntityName: @"Child"];
+    [self commitIndexedChildName: @"b" parentRevision: initialRevisionUUID];
+
+    NSArray *results = [store searchResultsForProperty: @"name"
+                                            entityName: @"Child"
+                                          minimumValue: @"b"
+                                          maximumValue: @"b"];
+
+    UKIntsEqual(1, results.count);
+    UKObjectsEqual(childUUID1, [results.firstObject innerObjectUUID]);
+    UKTrue([[store searchResultsForProperty: @"name"
+                                 entityName: @"Other"
+                               minimumValue: @"b"
+                               maximumValue: @"b"] isEmpty]);
+    UKIntsEqual(1, [store searchResultsForProperty: @"name"
+                                        entityName: nil
+                                      minimumValue: @"b"
+                                      maximumValue: @"b"].count);
+}
+
+- (void)testIndexedPropertyValuesFollowCurrentRevision
+{
+    [store setIndexedPropertyNames: S(@"name") forEntityName: @"Child"];
+
+    ETUUID *revisionB = [self commitIndexedChildName: @"b" parentRevision: initialRevisionUUID];
+    ETUUID *revisionC = [self commitIndexedChildName: @"c" parentRevision: revisionB];
+
+    UKTrue([[store searchResultsForProperty: @"name" value: @"b"] isEmpty]);
+    UKObjectsEqual(revisionC, [[store searchResultsForProperty: @"name" value: @"c"].firstObject revision]);
+
+    NSArray *revisionResults = [store revisionSearchResultsForProperty: @"name"
+                                                          minimumValue: @"b"
+                                                          maximumValue: @"b"];
+
+    UKIntsEqual(1, revisionResults.count);
+    UKObjectsEqual(revisionB, [revisionResults.firstObject revision]);
+
+    COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+    [txn setCurrentRevision: revisionB
+               headRevision: revisionC
+                  forBranch: initialBranchUUID
+           ofPersistentRoot: prootUUID];
+    [self updateChangeCountAndCommitTransaction: txn];
+
+    UKObjectsEqual(revisionB, [[store searchResultsForProperty: @"name" value: @"b"].firstObject revision]);
+    UKTrue([[store searchResultsForProperty: @"name" value: @"c"] isEmpty]);
+}
+
+- (void)testIndexedPropertySpecChangeReindexesCurrentRevisions
+{
+    [self commitIndexedChildName: @"b" parentRevision: initialRevisionUUID];
+
+    UKTrue([[store searchResultsForProperty: @"name" value: @"b"] isEmpty]);
+
+    [store setIndexedPropertyNames: S(@"name") forEntityName: @"Child"];
+
+    UKIntsEqual(1, [store searchResultsForProperty: @"name" value: @"b"].count);
+    // Past revisions are not reindexed
+    UKTrue([[store revisionSearchResultsForProperty: @"name" minimumValue: @"b" maximumValue: @"b"] isEmpty]);
+
+    [store setIndexedPropertyNames: [NSSet set] forEntityName: @"Child"];
+
+    UKTrue([[store searchResultsForProperty: @"name" value: @"b"] isEmpty]);
+}
+
+- (void)testIndexedPropertySpecChangeOnlyReindexesItsEntity
+{
+    [store setIndexedPropertyNames: S(@"name") forEntityName: @"Child"];
+    [self commitIndexedChildName: @"b" parentRevision: initialRevisionUUID];
+
+    [store setIndexedPropertyNames: S(@"name") forEntityName: @"Other"];
+
+    UKIntsEqual(1, [store searchResultsForProperty: @"name"
+                                        entityName: @"Child"
+                                      minimumValue: @"b"
+                                      maximumValue: @"b"].count);
+}
+
+- (void)testIndexedPropertySpecChangedByOtherStoreIsUsedOnCommit
+{
+    // Loads the spec in store
+    [self commitIndexedChildName: @"a" parentRevision: initialRevisionUUID];
+
+    COSQLiteStore *store2 = [[COSQLiteStore alloc] initWithURL: store.URL];
+
+    [store2 setIndexedPropertyNames: S(@"name") forEntityName: @"Child"];
+
+    ETUUID *revision = [self commitIndexedChildName: @"b" parentRevision: initialRevisionUUID];
+
+    UKObjectsEqual(A(revision), (id)[[[store revisionSearchResultsForProperty: @"name"
+                                                                 minimumValue: @"b"
+                                                                 maximumValue: @"b"] mappedCollection] revision]);
+}
+
+- (void)testCurrentSearchResultsFollowCurrentRevision
+{
+    ETUUID *revisionB = [self commitIndexedChildName: @"banana" parentRevision: initialRevisionUUID];
+    ETUUID *revisionC = [self commitIndexedChildName: @"cherry" parentRevision: revisionB];
+    NSArray *results = [store currentSearchResultsForQuery: @"cherry"];
+
+    UKIntsEqual(1, results.count);
+    UKObjectsEqual(prootUUID, [results.firstObject persistentRoot]);
+    UKObjectsEqual(revisionC, [results.firstObject revision]);
+    UKObjectsEqual(childUUID1, [results.firstObject innerObjectUUID]);
+
+    UKTrue([[store currentSearchResultsForQuery: @"banana"] isEmpty]);
+    // The revision index still matches past revisions
+    UKObjectsEqual(A(revisionB), (id)[[[store searchResultsForQuery: @"banana"] mappedCollection] revision]);
+
+    COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+    [txn setCurrentRevision: revisionB
+               headRevision: revisionC
+                  forBranch: initialBranchUUID
+           ofPersistentRoot: prootUUID];
+    [self updateChangeCountAndCommitTransaction: txn];
+
+    UKObjectsEqual(A(revisionB), (id)[[[store currentSearchResultsForQuery: @"banana"] mappedCollection] revision]);
+    UKTrue([[store currentSearchResultsForQuery: @"cherry"] isEmpty]);
+}
+
+- (void)testCurrentSearchResultsMatchInnerObjectsSeparately
+{
+    [self commitIndexedChildName: @"banana" parentRevision: initialRevisionUUID];
+
+    // The root item is named 'root'
+    UKIntsEqual(1, [store currentSearchResultsForQuery: @"banana"].count);
+    UKTrue([[store currentSearchResultsForQuery: @"banana root"] isEmpty]);
+    UKIntsEqual(1, [store searchResultsForQuery: @"banana root"].count);
+}
+
+- (void)testSearchResultsAfterCompactingBranchWithIdenticalText
+{
+    ETUUID *revision = [self commitIndexedChildName: @"banana" parentRevision: initialRevisionUUID];
+    ETUUID *branchARevision = [ETUUID UUID];
+
+    // Write the same text on branch A
+    {
+        COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+        [txn writeRevisionWithModifiedItems: [self itemTreeWithChildNameChange: @"banana"]
+                               revisionUUID: branchARevision
+                                   metadata: nil
+                           parentRevisionID: initialRevisionUUID
+                      mergeParentRevisionID: nil
+                         persistentRootUUID: prootUUID
+                                 branchUUID: branchAUUID];
+        [txn setCurrentRevision: branchARevision
+                   headRevision: branchARevision
+                      forBranch: branchAUUID
+               ofPersistentRoot: prootUUID];
+        [self updateChangeCountAndCommitTransaction: txn];
+    }
+
+    UKObjectsEqual(S(revision, branchARevision),
+                   SA((id)[[[store searchResultsForQuery: @"banana"] mappedCollection] revision]));
+
+    // Delete branch A and its revisions
+    {
+        COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+        [txn deleteBranch: branchAUUID ofPersistentRoot: prootUUID];
+        [self updateChangeCountAndCommitTransaction: txn];
+    }
+    UKTrue([store finalizeDeletionsForPersistentRoot: prootUUID error: NULL]);
+
+    UKNil([store revisionInfoForRevisionUUID: branchARevision persistentRootUUID: prootUUID]);
+    UKObjectsEqual(A(revision), (id)[[[store searchResultsForQuery: @"banana"] mappedCollection] revision]);
+    UKObjectsEqual(A(revision), (id)[[[store currentSearchResultsForQuery: @"banana"] mappedCollection] revision]);
+}
+
+- (void)testSearchIndexesUpdatedInBackground
+{
+    store.updatesSearchIndexesInBackground = YES;
+
+    ETUUID *revision = [self commitIndexedChildName: @"banana" parentRevision: initialRevisionUUID];
+
+    // Waits until the revision is indexed
+    UKObjectsEqual(A(revision), (id)[[[store searchResultsForQuery: @"banana"] mappedCollection] revision]);
+    UKObjectsEqual(A(revision), (id)[[[store searchResultsForQuery: @"banana"
+                                                allowsStaleResults: YES] mappedCollection] revision]);
+    // The current revision indexes are updated on commit
+    UKIntsEqual(1, [store currentSearchResultsForQuery: @"banana"].count);
+}
+
+- (void)testStaleSearchResults
+{
+    store.updatesSearchIndexesInBackground = YES;
+    // Prevents the index queue from indexing the revision
+    [store testingSetSearchIndexUpdatesSuspended: YES];
+
+    ETUUID *revision = [self commitIndexedChildName: @"banana" parentRevision: initialRevisionUUID];
+
+    UKObjectsEqual(@[], [store searchResultsForQuery: @"banana" allowsStaleResults: YES]);
+    UKObjectsEqual(A(initialRevisionUUID), (id)[[[store searchResultsForQuery: @"initial"
+                                                           allowsStaleResults: YES] mappedCollection] revision]);
+
+    [store waitUntilSearchIndexesAreUpdated];
+
+    UKObjectsEqual(A(revision), (id)[[[store searchResultsForQuery: @"banana"
+                                                allowsStaleResults: YES] mappedCollection] revision]);
+
+    [store testingSetSearchIndexUpdatesSuspended: NO];
+}
+
+- (void)testSearchIndexJournalAppliedOnReopening
+{
+    store.updatesSearchIndexesInBackground = YES;
+    // Only the reopened store can apply the journal
+    [store testingSetSearchIndexUpdatesSuspended: YES];
+
+    [self commitIndexedChildName: @"banana" parentRevision: initialRevisionUUID];
+
+    COSQLiteStore *store2 = [[COSQLiteStore alloc] initWithURL: store.URL];
+
+    UKIntsEqual(1, [store2 searchResultsForQuery: @"banana" allowsStaleResults: NO].count);
+
+    [store testingSetSearchIndexUpdatesSuspended: NO];
+
+    // The journal is not applied twice
+    UKIntsEqual(1, [store searchResultsForQuery: @"banana"].count);
+}
+
 @end
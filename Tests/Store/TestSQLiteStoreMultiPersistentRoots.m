@@ -37,7 +37,7 @@ static ETUUID *tagUUID;
 {
     COMutableItem *rootItem = [[COMutableItem alloc] initWithUUID: tagUUID];
     [rootItem setValue: @"favourites" forAttribute: @"name" type: kCOTypeString];
-    [rootItem setValue: S([COPath pathWithPersistentRoot: aUUID])
+    [rootItem setValue: (aUUID != nil ? S([COPath pathWithPersistentRoot: aUUID]) : [NSSet set])
           forAttribute: @"taggedDocuments"
                   type: kCOTypeReference | kCOTypeSet];
 
@@ -84,6 +84,88 @@ static ETUUID *tagUUID;
     UKObjectsEqual(tagUUID, [result innerObjectUUID]);
 }
 
+- (void)commitTagTransaction: (COStoreTransaction *)txn
+{
+    tagProotChangeCount = [txn setOldTransactionID: tagProotChangeCount
+                                 forPersistentRoot: tagProot.UUID];
+    UKTrue([store commitStoreTransaction: txn]);
+}
+
+- (void)testCurrentReferences
+{
+    UKObjectsEqual(@[tagProot.UUID], [store persistentRootUUIDsReferencingPersistentRoot: docProot.UUID]);
+    UKObjectsEqual(@[], [store persistentRootUUIDsReferencingPersistentRoot: tagProot.UUID]);
+
+    NSArray *results = [store currentReferencesToPersistentRoot: docProot.UUID];
+    COSearchResult *result = results.firstObject;
+
+    UKIntsEqual(1, results.count);
+    UKObjectsEqual(tagProot.UUID, result.persistentRoot);
+    UKObjectsEqual(tagProot.currentBranchInfo.currentRevisionUUID, result.revision);
+    UKObjectsEqual(tagUUID, result.innerObjectUUID);
+}
+
+- (void)testCurrentReferencesFollowCurrentRevision
+{
+    ETUUID *initialRevision = tagProot.currentBranchInfo.currentRevisionUUID;
+    ETUUID *untaggedRevision = [ETUUID UUID];
+    COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+
+    [txn writeRevisionWithModifiedItems: [self tagItemTreeWithDocProoUUID: nil]
+                           revisionUUID: untaggedRevision
+                               metadata: nil
+                       parentRevisionID: initialRevision
+                  mergeParentRevisionID: nil
+                     persistentRootUUID: tagProot.UUID
+                             branchUUID: tagProot.currentBranchUUID];
+    [txn setCurrentRevision: untaggedRevision
+               headRevision: untaggedRevision
+                  forBranch: tagProot.currentBranchUUID
+           ofPersistentRoot: tagProot.UUID];
+    [self commitTagTransaction: txn];
+
+    UKObjectsEqual(@[], [store persistentRootUUIDsReferencingPersistentRoot: docProot.UUID]);
+    UKObjectsEqual(@[], [store currentReferencesToPersistentRoot: docProot.UUID]);
+    // The history still contains the reference
+    UKIntsEqual(1, [store referencesToPersistentRoot: docProot.UUID].count);
+
+    // Revert (the initial revision is not a child of the untagged one)
+
+    txn = [[COStoreTransaction alloc] init];
+    [txn setCurrentRevision: initialRevision
+               headRevision: nil
+                  forBranch: tagProot.currentBranchUUID
+           ofPersistentRoot: tagProot.UUID];
+    [self commitTagTransaction: txn];
+
+    UKObjectsEqual(@[tagProot.UUID], [store persistentRootUUIDsReferencingPersistentRoot: docProot.UUID]);
+    UKObjectsEqual(initialRevision, [[store currentReferencesToPersistentRoot: docProot.UUID].firstObject revision]);
+}
+
+- (void)testCurrentReferencesIgnoreDeletedPersistentRoots
+{
+    COStoreTransaction *txn = [[COStoreTransaction alloc] init];
+    [txn deletePersistentRoot: tagProot.UUID];
+    [self commitTagTransaction: txn];
+
+    UKObjectsEqual(@[], [store persistentRootUUIDsReferencingPersistentRoot: docProot.UUID]);
+
+    txn = [[COStoreTransaction alloc] init];
+    [txn undeletePersistentRoot: tagProot.UUID];
+    [self commitTagTransaction: txn];
+
+    UKObjectsEqual(@[tagProot.UUID], [store persistentRootUUIDsReferencingPersistentRoot: docProot.UUID]);
+
+    txn = [[COStoreTransaction alloc] init];
+    [txn deletePersistentRoot: tagProot.UUID];
+    [self commitTagTransaction: txn];
+
+    UKTrue([store finalizeDeletionsForPersistentRoot: tagProot.UUID
+                                               error: NULL]);
+
+    UKObjectsEqual(@[], [store currentReferencesToPersistentRoot: docProot.UUID]);
+}
+
 - (void)testDeletion
 {
     COStoreTransaction *txn = [[COStoreTransaction alloc] init];